@@ -0,0 +1,77 @@
+/**
+ * @brief DVM interpreter benchmark, see the Makefile
+ *
+ * The sim has no sensor board, so this file also provides a photo
+ * sensor that answers GET_DATA at once with a random reading.
+ */
+#include <sos.h>
+#include <sys_module.h>
+#include <sensor.h>
+
+#ifndef SOS_SIM
+#error dvm_bench only runs on the sim platform
+#endif
+
+#define BENCH_SENSOR_PID DFLT_APP_ID1
+#define BENCH_PHOTO_SID  1
+
+static int8_t bench_sensor_control(func_cb_ptr cb, uint8_t cmd, void *data);
+static int8_t bench_sensor_handler(void *state, Message *msg);
+
+static const mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = BENCH_SENSOR_PID,
+	.state_size     = 0,
+	.num_timers     = 0,
+	.num_sub_func   = 0,
+	.num_prov_func  = 1,
+	.platform_type  = HW_TYPE,
+	.processor_type = MCU_TYPE,
+	.code_id        = ehtons(BENCH_SENSOR_PID),
+	.module_handler = bench_sensor_handler,
+	.funct          = {
+		{bench_sensor_control, "cCw2", BENCH_SENSOR_PID, SENSOR_CONTROL_FID},
+	},
+};
+
+static int8_t bench_sensor_control(func_cb_ptr cb, uint8_t cmd, void *data)
+{
+	switch (cmd) {
+		case SENSOR_GET_DATA_CMD:
+			return sys_sensor_data_ready(BENCH_PHOTO_SID, sys_rand() & 0x3ff, 0);
+		case SENSOR_CONFIG_CMD:
+			if (data != NULL) {
+				sys_free(data);
+			}
+			return SOS_OK;
+		case SENSOR_ENABLE_CMD:
+		case SENSOR_DISABLE_CMD:
+			return SOS_OK;
+		default:
+			return -EINVAL;
+	}
+}
+
+static int8_t bench_sensor_handler(void *state, Message *msg)
+{
+	switch (msg->type) {
+		case MSG_INIT:
+			return sys_sensor_register(BENCH_SENSOR_PID, BENCH_PHOTO_SID,
+					SENSOR_CONTROL_FID, NULL);
+		case MSG_FINAL:
+			return sys_sensor_deregister(BENCH_SENSOR_PID, BENCH_PHOTO_SID);
+		default:
+			return -EINVAL;
+	}
+}
+
+mod_header_ptr dvm_get_header();
+mod_header_ptr script_loader_get_header();
+mod_header_ptr loader_get_header();
+
+void sos_start(void)
+{
+	ker_register_module(sos_get_header_address(mod_header));
+	ker_register_module(loader_get_header());
+	ker_register_module(dvm_get_header());
+	ker_register_module(script_loader_get_header());
+}
@@ -0,0 +1,132 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * @brief module dissemination benchmark for the fetcher
+ *
+ * Node 0 writes FETCHBENCH_SIZE bytes of a known pattern into codemem
+ * and serves it.  Node n fetches the image from node n - 1, so on a
+ * chain topology the image is relayed hop by hop.  Each node prints the
+ * virtual time from its request to a verified copy.  Run the nodes with
+ * --vtime so that the numbers do not depend on the host.
+ */
+#include <sos.h>
+#include <sos_module_fetcher.h>
+#include <vtime.h>
+
+#ifndef SOS_SIM
+#error fetchbench only runs on the sim platform
+#endif
+
+#ifndef FETCHBENCH_SIZE
+#define FETCHBENCH_SIZE    4096L
+#endif
+
+enum {
+	FETCHBENCH_START_TID   = 0,
+	FETCHBENCH_START_DELAY = 1024L,   //!< let the other nodes boot
+};
+
+static int8_t bench_msg_handler(void *state, Message *msg);
+
+static const mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = DFLT_APP_ID0,
+	.state_size     = 0,
+	.num_timers     = 1,
+	.num_sub_func   = 0,
+	.num_prov_func  = 0,
+	.platform_type  = HW_TYPE,
+	.processor_type = MCU_TYPE,
+	.code_id        = ehtons(DFLT_APP_ID0),
+	.module_handler = bench_msg_handler,
+};
+
+static fetcher_cam_t cam;
+static vtime_t start;
+
+static uint8_t pattern(uint16_t offset)
+{
+	return (uint8_t)(offset * 7 + (offset >> 8));
+}
+
+static int8_t bench_init(void)
+{
+	uint8_t buf[FETCHER_FRAGMENT_SIZE];
+	uint16_t off;
+	uint8_t i;
+
+	cam.fetchtype = FETCHTYPE_DATA;
+	cam.cm = ker_codemem_alloc(FETCHBENCH_SIZE, CODEMEM_TYPE_EXECUTABLE);
+	if( cam.cm == CODEMEM_INVALID ) {
+		printf("fetchbench: no codemem for %ld bytes\n", FETCHBENCH_SIZE);
+		exit(1);
+	}
+	ker_shm_open(DFLT_APP_ID0, sys_shm_name(DFLT_APP_ID0, 0), &cam);
+
+	if( ker_id() != 0 ) {
+		cam.status = FETCHING_QUEUED;
+		ker_timer_init(DFLT_APP_ID0, FETCHBENCH_START_TID, TIMER_ONE_SHOT);
+		return ker_timer_start(DFLT_APP_ID0, FETCHBENCH_START_TID,
+				FETCHBENCH_START_DELAY);
+	}
+	for( off = 0; off < FETCHBENCH_SIZE; off += sizeof(buf) ) {
+		for( i = 0; i < sizeof(buf); i++ ) {
+			buf[i] = pattern(off + i);
+		}
+		ker_codemem_write(cam.cm, DFLT_APP_ID0, buf, sizeof(buf), off);
+	}
+	ker_codemem_flush(cam.cm, DFLT_APP_ID0);
+	cam.status = FETCHING_DONE;
+	return SOS_OK;
+}
+
+static void bench_verify(void)
+{
+	uint8_t buf[FETCHER_FRAGMENT_SIZE];
+	uint16_t off;
+	uint8_t i;
+
+	for( off = 0; off < FETCHBENCH_SIZE; off += sizeof(buf) ) {
+		ker_codemem_read(cam.cm, DFLT_APP_ID0, buf, sizeof(buf), off);
+		for( i = 0; i < sizeof(buf); i++ ) {
+			if( buf[i] != pattern(off + i) ) {
+				printf("fetchbench: node %d bad byte at %d\n", ker_id(), off + i);
+				return;
+			}
+		}
+	}
+	printf("fetchbench: node %d got %ld bytes in %.3f s\n", ker_id(),
+			FETCHBENCH_SIZE, (vtime_now() - start) / 1e6);
+}
+
+static int8_t bench_msg_handler(void *state, Message *msg)
+{
+	switch (msg->type) {
+		case MSG_INIT:
+			return bench_init();
+		case MSG_FINAL:
+			return SOS_OK;
+		case MSG_TIMER_TIMEOUT:
+			start = vtime_now();
+			return fetcher_request(DFLT_APP_ID0, sys_shm_name(DFLT_APP_ID0, 0),
+					FETCHBENCH_SIZE, ker_id() - 1);
+		case MSG_FETCHER_DONE:
+		{
+			fetcher_state_t *f = (fetcher_state_t*)msg->data;
+
+			if( is_fetcher_succeed(f) == false ) {
+				f = (fetcher_state_t*)ker_msg_take_data(DFLT_APP_ID0, msg);
+				fetcher_restart(f, ker_id() - 1);
+				return SOS_OK;
+			}
+			fetcher_commit(f, true);
+			bench_verify();
+			return SOS_OK;
+		}
+	}
+	return -EINVAL;
+}
+
+void sos_start(void)
+{
+	ker_register_module(sos_get_header_address(mod_header));
+}
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * @brief message throughput benchmark for the scheduler
+ *
+ * MSGBENCH_PEERS copies of the bench module pass MSGBENCH_INFLIGHT
+ * messages around a ring with post_short(), one hop per handler call,
+ * until MSGBENCH_COUNT messages have been handled.  With one peer every
+ * message goes to the same module, with more the destinations alternate.
+ * The result is printed in messages per second of wall clock time.
+ */
+#include <sos.h>
+#include <sys/time.h>
+
+#ifndef SOS_SIM
+#error msgbench only runs on the sim platform
+#endif
+
+#ifndef MSGBENCH_COUNT
+#define MSGBENCH_COUNT     10000000L
+#endif
+#ifndef MSGBENCH_PEERS
+#define MSGBENCH_PEERS     1
+#endif
+#ifndef MSGBENCH_INFLIGHT
+#define MSGBENCH_INFLIGHT  4
+#endif
+
+enum {
+	MSG_BENCH = (MOD_MSG_START + 0),
+};
+
+typedef struct {
+	sos_pid_t next;               //!< where this peer sends its messages
+} bench_state_t;
+
+static int8_t bench_msg_handler(void *state, Message *msg);
+
+static const mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = DFLT_APP_ID0,
+	.state_size     = sizeof(bench_state_t),
+	.num_sub_func   = 0,
+	.num_prov_func  = 0,
+	.platform_type  = HW_TYPE,
+	.processor_type = MCU_TYPE,
+	.code_id        = ehtons(DFLT_APP_ID0),
+	.module_handler = bench_msg_handler,
+};
+
+static uint32_t handled;
+static uint32_t posted;
+static struct timeval start;
+
+static void bench_done(void)
+{
+	struct timeval end;
+	double sec;
+
+	gettimeofday(&end, NULL);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	printf("msgbench: %u messages, %d peers, %d in flight: %.3f s, %.0f msgs/sec\n",
+			handled, MSGBENCH_PEERS, MSGBENCH_INFLIGHT, sec, handled / sec);
+	exit(0);
+}
+
+static int8_t bench_msg_handler(void *state, Message *msg)
+{
+	bench_state_t *s = (bench_state_t*)state;
+
+	switch (msg->type) {
+		case MSG_INIT:
+		case MSG_FINAL:
+			return SOS_OK;
+		case MSG_BENCH:
+			if( ++handled == MSGBENCH_COUNT ) {
+				bench_done();
+			}
+			if( posted < MSGBENCH_COUNT ) {
+				posted++;
+				post_short(s->next, msg->did, MSG_BENCH, msg->data[0], 0, 0);
+			}
+			return SOS_OK;
+	}
+	return -EINVAL;
+}
+
+void sos_start(void)
+{
+	sos_pid_t pid[MSGBENCH_PEERS];
+	uint8_t i;
+
+	pid[0] = DFLT_APP_ID0;
+	ker_register_module(sos_get_header_address(mod_header));
+	for( i = 1; i < MSGBENCH_PEERS; i++ ) {
+		pid[i] = ker_spawn_module(sos_get_header_address(mod_header), NULL, 0,
+				SOS_CREATE_THREAD);
+		if( pid[i] == NULL_PID ) {
+			printf("msgbench: unable to create peer %d\n", i);
+			exit(1);
+		}
+	}
+	for( i = 0; i < MSGBENCH_PEERS; i++ ) {
+		bench_state_t *s = (bench_state_t*)ker_get_module_state(pid[i]);
+		s->next = pid[(i + 1) % MSGBENCH_PEERS];
+	}
+	gettimeofday(&start, NULL);
+	for( i = 0; i < MSGBENCH_INFLIGHT; i++ ) {
+		posted++;
+		post_short(pid[i % MSGBENCH_PEERS], DFLT_APP_ID0, MSG_BENCH, i, 0, 0);
+	}
+}
@@ -351,24 +351,11 @@ static inline void uart_reset_recv() {
 }
 	
 /**
- * @brief ISR for reception
- * This is the writer of rx_queue.
+ * @brief run one received byte through the receive state machine
  */
-uart_recv_interrupt() {
-#ifdef SOS_USE_PREEMPTION
-	HAS_PREEMPTION_SECTION;
-	DISABLE_PREEMPTION();
-#endif
-	
-	uint8_t err;
-	uint8_t byte_in;
+static void uart_recv_byte(uint8_t byte_in, uint8_t err) {
 	static uint16_t crc_in;
 	static uint8_t saved_state;
-	SOS_MEASUREMENT_IDLE_END()
-	LED_DBG(LED_YELLOW_TOGGLE);
-	//! NOTE that the order has to be this in AVR
-	err = uart_checkError();
-	byte_in = uart_getByte();
 
 	//DEBUG("uart_recv_interrupt... %d %d %d %d %d\n", byte_in, err, 
 	//		state[RX].state, state[RX].msg_state, state[RX].hdlc_state);
@@ -585,6 +572,27 @@ uart_recv_interrupt() {
 				uart_reset_recv();
 				break;
 	} // state[RX].state
+}
+
+/**
+ * @brief ISR for reception
+ * This is the writer of rx_queue.
+ */
+uart_recv_interrupt() {
+#ifdef SOS_USE_PREEMPTION
+	HAS_PREEMPTION_SECTION;
+	DISABLE_PREEMPTION();
+#endif
+	
+	uint8_t err;
+	uint8_t byte_in;
+	SOS_MEASUREMENT_IDLE_END();
+	LED_DBG(LED_YELLOW_TOGGLE);
+	//! NOTE that the order has to be this in AVR
+	err = uart_checkError();
+	byte_in = uart_getByte();
+
+	uart_recv_byte(byte_in, err);
 
 #ifdef SOS_USE_PREEMPTION
   // enable interrupts because 
@@ -594,6 +602,61 @@ uart_recv_interrupt() {
   ENABLE_PREEMPTION(NULL);
 #endif
 }
+
+#ifdef UART_BLOCK_RECV
+/**
+ * @brief receive a block of bytes at once
+ *
+ * For a HAL that reads the line in chunks.  Payload bytes up to the next
+ * flag or escape are copied with one memcpy() and one crcBytes(), the
+ * rest goes through uart_recv_byte().  The last payload byte is always
+ * left to uart_recv_byte() since it moves on to the crc.
+ */
+void uart_recv_block(const uint8_t *buf, uint16_t len) {
+#ifdef SOS_USE_PREEMPTION
+	HAS_PREEMPTION_SECTION;
+	DISABLE_PREEMPTION();
+#endif
+	SOS_MEASUREMENT_IDLE_END();
+	LED_DBG(LED_YELLOW_TOGGLE);
+
+	while (len > 0) {
+		if ((state[RX].state == UART_DATA) && (state[RX].hdlc_state == HDLC_DATA) &&
+				((state[RX].msg_state == SOS_MSG_RX_DATA) || (state[RX].msg_state == SOS_MSG_RX_RAW)) &&
+				(state[RX].idx + 1 < state[RX].msgLen)) {
+			const uint8_t *stop;
+			uint16_t run = state[RX].msgLen - state[RX].idx - 1;
+
+			if (run > len) {
+				run = len;
+			}
+			if ((stop = memchr(buf, HDLC_FLAG, run)) != NULL) {
+				run = stop - buf;
+			}
+			if ((stop = memchr(buf, HDLC_CTR_ESC, run)) != NULL) {
+				run = stop - buf;
+			}
+			if (run > 0) {
+				memcpy(state[RX].buff + state[RX].idx, buf, run);
+				if (state[RX].flags & UART_CRC_FLAG) {
+					state[RX].crc = crcBytes(state[RX].crc, buf, run);
+				}
+				state[RX].idx += run;
+				buf += run;
+				len -= run;
+				continue;
+			}
+		}
+		uart_recv_byte(*buf++, 0);
+		len--;
+	}
+
+#ifdef SOS_USE_PREEMPTION
+  ENABLE_GLOBAL_INTERRUPTS();
+  ENABLE_PREEMPTION(NULL);
+#endif
+}
+#endif
 #else
 uart_send_interrupt() {
 	uart_disable();
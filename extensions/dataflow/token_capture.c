@@ -18,13 +18,17 @@ void release_token(token_type_t *t) {
 	if (t != NULL) t->locked = 0;
 }
 
+void hold_token(token_type_t *t) {
+	if (t != NULL) t->refcnt++;
+}
+
 void *capture_token_data(token_type_t *t, sos_pid_t pid) {
 	uint8_t new_owner = (pid > KER_MOD_MAX_PID) ? ELEMENT : ENGINE;
 	void *data_copy;
 
 	if (t == NULL) return NULL;
 
-	if (t->locked == 0) {
+	if ((t->locked == 0) && (t->refcnt <= 1)) {
 		// The token is free to be transferred to anyone.
 		// The new owner captures and locks it.
 		t->owner = new_owner;
@@ -32,7 +36,7 @@ void *capture_token_data(token_type_t *t, sos_pid_t pid) {
 		return t->data;
 	}
 
-	// The token data is locked. 
+	// The token data is locked or shared. 
 	// Need to make a copy of the data and return the pointer to new data
 	// with appropriate ownership information.
 	if (t->length > 0) {
@@ -68,6 +72,7 @@ static token_type_t *create_token_internal(void *data, token_length_t length, ui
 	}
 	t->type = type;
 	t->locked = 1;
+	t->refcnt = 1;
 
 	return t;
 }
@@ -89,6 +94,11 @@ void destroy_token_data(void *data, uint8_t type, uint16_t length) {
 
 void destroy_token(token_type_t *t) {
 	if (t == NULL) return;
+	if (t->refcnt > 1) {
+		// Still held by someone else.
+		t->refcnt--;
+		return;
+	}
 	if (t->locked == 0) {
 		destroy_token_data(t->data, t->type, t->length);
 	}
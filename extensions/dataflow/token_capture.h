@@ -19,6 +19,7 @@ typedef struct token_type_t {
 	uint8_t type : 5;
 	uint8_t owner : 2;
 	uint8_t locked : 1;
+	uint8_t refcnt;			//!< Holders of the token, see hold_token()
 	token_length_t length;
 	void *data;
 } PACK_STRUCT token_type_t;
@@ -29,6 +30,12 @@ void set_token_type(token_type_t *t, uint8_t type);
 
 void release_token(token_type_t *t);
 
+// Share the token with one more holder. Each holder calls
+// destroy_token() when done; the last one frees it. The data of
+// a shared token is never handed over, capture_token_data() 
+// returns a copy instead.
+void hold_token(token_type_t *t);
+
 void *capture_token_data(token_type_t *t, sos_pid_t pid);
 
 void *get_token_data(token_type_t *t);
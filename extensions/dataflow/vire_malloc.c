@@ -1,45 +1,37 @@
 /* -*- Mode: C; tab-width:4 -*- */
 /* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
 
-// A memory manager based on free list implementation.
-// Used only for fixed sized tokens.
-// + Constant allocate and de-allocate time.
+// A memory manager for fixed sized tokens, built on the
+// kernel slab allocator.
+// + Constant allocate and de-allocate time within a pool.
+// + Pools are added on demand and given back when idle.
 
 #include <sos.h>
 #include <string.h>
+#include <slab.h>
 #include "token_capture.h"
 #include "vire_malloc.h"
 
 // Maximum number of tokens that can be handled in the 
 // system at any given time.
-// TO DO: Modify implementation so that there is no
-// static limit on the max number of tokens.
+#ifndef MAX_NUM_TOKENS
 #define MAX_NUM_TOKENS	16
+#endif
+
+// Tokens per slab pool (the slab allocator handles at most 8).
+#define TOKENS_PER_POOL	8
 
 // This token manager is only used if the desired
 // execution optimization is enabled by defining the 
 // flag USE_VIRE_TOKEN_MEM
 
 #ifdef USE_VIRE_TOKEN_MEM
-// A block in the token slab. If it is in use,
-// its contents can be accessed through variable
-// "token". Otherwise, "next" points to the next
-// free element in the token slab. 
-typedef struct token_table_t {
-	union {
-		token_type_t token;
-		struct token_table_t *next;
-	} content;
-} token_table_t;
-
 typedef struct {
-	token_table_t *token_block;	//!< A pointer to the token slab (comprises MAX_NUM_TOKENS)
-	token_table_t *free_list;	//!< A pointer to the free list.
+	slab_t token_slab;	//!< Pools of token headers
+	bool ready;			//!< The first pool was allocated
 } server_state_t;
 
 static server_state_t st;
-
-static void init_token_block();
 #endif
 
 static int8_t module(void *state, Message *msg);
@@ -58,9 +50,12 @@ static int8_t module(void *state, Message *msg) {
 		case MSG_INIT:
 		{
 		#ifdef USE_VIRE_TOKEN_MEM
-			st.token_block = (token_table_t *)ker_malloc(MAX_NUM_TOKENS*sizeof(token_table_t), VIRE_MEM_SERVER_PID);
-			if (st.token_block != NULL) init_token_block();
-			st.free_list = st.token_block;
+			// One pool is kept at all times, the rest come and go
+			// with the load up to MAX_NUM_TOKENS.
+			st.ready = (ker_slab_init(VIRE_MEM_SERVER_PID, &st.token_slab, 
+						sizeof(token_type_t), TOKENS_PER_POOL, SLAB_LONGTERM) == SOS_OK);
+			ker_slab_set_watermark(&st.token_slab, 1, 
+						(MAX_NUM_TOKENS + TOKENS_PER_POOL - 1) / TOKENS_PER_POOL);
 		#endif
 			break;
 		}
@@ -76,39 +71,16 @@ static int8_t module(void *state, Message *msg) {
 
 #ifdef USE_VIRE_TOKEN_MEM
 
-static void init_token_block() {
-	uint8_t i;
-
-	for (i = 0; i < MAX_NUM_TOKENS-1; i++) {
-		st.token_block[i].content.next = &(st.token_block[i+1]);
-	}
-	st.token_block[i].content.next = NULL;
-}
-
 void *token_malloc(sos_pid_t pid) {
-	// No more free blocks. Return NULL.
-	if (st.free_list == NULL) return NULL;
-
-	// Store a pointer to first free block.
-	token_table_t *blk = st.free_list;
+	if (!st.ready) return NULL;
 
-	// Advance the free_list to next free block.
-	st.free_list = (st.free_list)->content.next;
-
-	// Return stored block.
-	return blk;
+	return ker_slab_alloc(&st.token_slab, VIRE_MEM_SERVER_PID);
 }
 
 void token_free(void *ptr) {
-	// Perform a sanity check on the pointer first.
-	//int32_t diff = (int32_t)((uint8_t*)ptr - (uint8_t*)st.token_block);
-	token_table_t *t = (token_table_t *)ptr;
-
-	//if ((diff < 0) || ((diff % sizeof(token_table_t)) != 0)) return;
+	if (ptr == NULL) return;
 
-	// Add the block to the head of the free list.
-	t->content.next = st.free_list;
-	st.free_list = t;
+	ker_slab_free(&st.token_slab, ptr);
 }
 
 #endif
@@ -140,23 +140,32 @@ typedef struct routing_table_ram_t {
 #define get_epid_from_pid(p) ( (p) % MAX_NUM_ELEMENTS )
 #define get_port_from_pid_port(p) ( (p) & RTABLE_INPUT_PORT_MASK )
 
+// Number of tokens that can wait for a busy element,
+// counted over all its input ports.
+#ifndef TOKEN_RING_SIZE
+#define TOKEN_RING_SIZE			8
+#endif
+
+// This structure holds a token queued for later delivery.
+// Destination function CB is included for execution 
+// efficiency as it saves an extra fetch from the flash.
+// A free or delivered slot has t == NULL.
 typedef struct token_queue_t {
-	queue_header_t h;
 	token_type_t *t;
 	func_cb_ptr cb;
 	uint8_t portID;
 	uint8_t status;
 } PACK_STRUCT token_queue_t;
 
-// This structure holds the tokens (data, length) that have been
-// queued for later delivery. Destination function CB
-// and PID are included for execution efficiency as
-// it saves an extra fetch from the flash.
-typedef struct mesg_queue_t {
-	queue_header_t h;
-	sos_pid_t epid;
-	token_queue_t *tokens;
-} PACK_STRUCT mesg_queue_t;
+// Tokens waiting for one element, in arrival order. The engine
+// keeps one ring per element, indexed by get_epid_from_pid().
+// Tokens for different ports may be delivered out of order, so
+// a delivered slot is only reclaimed once it reaches the head.
+typedef struct token_ring_t {
+	uint8_t head;
+	uint8_t count;
+	token_queue_t slot[TOKEN_RING_SIZE];
+} PACK_STRUCT token_ring_t;
 
 // This is used to post a CONTINUATION task to the wiring
 // engine when a module completes a long running operation,
@@ -30,7 +30,7 @@ typedef struct {
 	uint8_t busy_bit_mask[MAX_NUM_ELEMENTS][(MAX_INPUT_PORTS_PER_ELEMENT+7)/8];	
 								//!< Tracking BUSY vs READY states 
 								// of input ports of modules
-	mesg_queue_t *mqueue;		//!< Pointer to the head of the token queue
+	token_ring_t *rings[MAX_NUM_ELEMENTS];	//!< Token queue of each element, NULL if never busy
 	queue_header_t *module_table;	//!< Pointer to elements table when it is loaded in RAM
 	routing_table_ram_t *routing_table_ram;	//!< Pointer to the routing table in RAM
 	func_cb_t f;		//Debug:
@@ -51,16 +51,14 @@ static void queue_insert(queue_header_t **head, queue_header_t *elm);
 static void queue_remove(queue_header_t **head, queue_header_t *elm, uint16_t size);
 static void queue_free(queue_header_t **head, uint16_t size);
 
-static void token_queue_remove(mesg_queue_t **head, uint8_t epid, queue_header_t *elm);
-static mesg_queue_t *mesg_queue_insert(mesg_queue_t **head, uint8_t epid);
-static void token_queue_free(token_queue_t **head);
+static void token_queue_remove(uint8_t epid, token_queue_t *elm);
+static token_queue_t *token_queue_insert(uint8_t epid);
+static void token_queue_free(uint8_t epid);
 static void purge_tokens(queue_header_t *module_table);
 static bool tokens_posted_for_element(sos_pid_t epid);
-static void mesg_queue_free(mesg_queue_t **head);
-static mesg_queue_t *search_mesg_queue(mesg_queue_t *head, sos_pid_t epid);
 
 static inline void reset_busy_mask();
-static inline void reset_mesg_queue();
+static inline void reset_token_queues();
 
 static void reset_engine();
 static uint8_t discovered(graph_element_t *head, common_table_header_t *row, sos_pid_t *modID);
@@ -134,7 +132,7 @@ static int8_t module(void *state, Message *msg) {
 			st.saved_wiring_table = CODEMEM_INVALID; 
 			st.saved_params_table = CODEMEM_INVALID; 
 			st.num_elements = 0;
-			st.mqueue = NULL;
+			memset(st.rings, 0, sizeof(st.rings));
 			st.module_table = NULL;
 			st.routing_table_ram = NULL;
 			reset_busy_mask();
@@ -158,6 +156,7 @@ static int8_t module(void *state, Message *msg) {
 			m->mptr->status = TOKEN_HANDLED;
 
 			// Release the token as it won't be used by the engine any more.
+			// If it is still queued for other elements, its data stays shared.
 			release_token(m->mptr->t);
 
 			// TODO: Mark the whole element as BUSY to prevent any race 
@@ -181,7 +180,7 @@ static int8_t module(void *state, Message *msg) {
 			destroy_token(m->mptr->t);
 
 			// Remove the token from the queue.
-			token_queue_remove(&st.mqueue, m->epid, (queue_header_t *)(m->mptr));
+			token_queue_remove(m->epid, m->mptr);
 
 			// Free the task memory
 			vire_free(m, sizeof(msg_continue_t));
@@ -293,9 +292,12 @@ static inline void reset_busy_mask() {
 	memset(st.busy_bit_mask, 0xFF, ((MAX_INPUT_PORTS_PER_ELEMENT+7)/8)*MAX_NUM_ELEMENTS);
 }
 
-static inline void reset_mesg_queue() {
-	mesg_queue_free(&st.mqueue);
-	st.mqueue = NULL;
+static inline void reset_token_queues() {
+	uint8_t i;
+
+	for (i = 0; i < MAX_NUM_ELEMENTS; i++) {
+		token_queue_free(i);
+	}
 }
 
 
@@ -312,7 +314,7 @@ static void reset_engine() {
 	queue_free(&st.module_table, sizeof(graph_element_t));
 	st.module_table = NULL;
 	reset_routing_table_in_ram();
-	reset_mesg_queue();
+	reset_token_queues();
 	reset_busy_mask();
 }
 
@@ -324,7 +326,7 @@ static int8_t install_new_configuration(codemem_t cm, uint8_t update_format,
 
 	// Reset busy mask and token queues in engine.
 	reset_busy_mask();
-	reset_mesg_queue();
+	reset_token_queues();
 	reset_routing_table_in_ram();
 
 	// Read the table from flash and deregister all modules.
@@ -438,7 +440,7 @@ static int8_t hot_swap_configuration(codemem_t cm, uint8_t update_format, size_t
 	// Deregister old unused elements
 	deregister_modules(st.module_table, UNMARKED);
 
-	// Purge tokens, belonging to unmarked modules, from the mqueue.
+	// Purge tokens, belonging to unmarked modules, from the token queues.
 	purge_tokens(st.module_table);
 
 	// Reset the busy masks of old unused elements.
@@ -1155,83 +1157,69 @@ static void queue_free(queue_header_t **head, uint16_t size) {
 	}
 }
 
-static mesg_queue_t *mesg_queue_insert(mesg_queue_t **head, uint8_t epid) {
-	// Find the head of token queue for element 'epid'
-	mesg_queue_t *itr = search_mesg_queue(*head, epid);
-
-	// If the element already exists, return it.
-	if (itr != NULL) return itr;
-
-	// Otherwise allocate space for it and insert it into the message queue.
-	itr = (mesg_queue_t *)vire_malloc(sizeof(mesg_queue_t), MULTICAST_SERV_PID);
-	if (itr == NULL) return NULL;
+static token_queue_t *token_queue_insert(uint8_t epid) {
+	// Find the token queue for element 'epid'
+	token_ring_t *ring = st.rings[epid];
+	token_queue_t *elm;
+
+	// Allocate it the first time the element is busy. It is kept
+	// till the element leaves the graph.
+	if (ring == NULL) {
+		ring = (token_ring_t *)vire_malloc(sizeof(token_ring_t), MULTICAST_SERV_PID);
+		if (ring == NULL) return NULL;
+		memset(ring, 0, sizeof(token_ring_t));
+		st.rings[epid] = ring;
+	}
 
-	itr->tokens = NULL;
-	itr->epid = epid;
-	queue_insert((queue_header_t **)head, (queue_header_t *)itr);
+	// No free slot left.
+	if (ring->count == TOKEN_RING_SIZE) return NULL;
 
-	return itr;
+	elm = &(ring->slot[(ring->head + ring->count) % TOKEN_RING_SIZE]);
+	ring->count++;
 
+	return elm;
 }
 
-static void token_queue_remove(mesg_queue_t **head, uint8_t epid, queue_header_t *elm) {
-	// Find the head of token queue for element 'epid'
-	mesg_queue_t *itr = search_mesg_queue(*head, epid);
+static void token_queue_remove(uint8_t epid, token_queue_t *elm) {
+	// Find the token queue for element 'epid'
+	token_ring_t *ring = st.rings[epid];
 
 	// Token queue not found. Return.
-	if ((itr == NULL) || (elm == NULL)) return;
-
-	// Token queue found. Remove the element 'elm' from it.
-	queue_remove((queue_header_t **)&itr->tokens, elm, sizeof(token_queue_t));
-
-	// If no more tokens, remove the head of token queue
-	// for element 'epid'
-	if (itr->tokens == NULL) {
-		queue_remove((queue_header_t **)head, (queue_header_t *)itr, sizeof(mesg_queue_t));
-	}
-
-}
+	if ((ring == NULL) || (elm == NULL)) return;
 
-static void token_queue_free(token_queue_t **head) {
-	// Free all the tokens in the token queue pointed 
-	// to by head.
-	while (*head != NULL) {
-		token_queue_t *del = *head;
-		*head = (token_queue_t *)((*head)->h.next);
-		destroy_token(del->t);
-		vire_free(del, sizeof(token_queue_t));
+	// Free the slot, and reclaim all the free slots at the head.
+	elm->t = NULL;
+	while ((ring->count > 0) && (ring->slot[ring->head].t == NULL)) {
+		ring->head = (ring->head + 1) % TOKEN_RING_SIZE;
+		ring->count--;
 	}
 }
 
-static void mesg_queue_free(mesg_queue_t **head) {
-	while (*head != NULL) {
-		mesg_queue_t *del = *head;
-		*head = (mesg_queue_t *)((*head)->h.next);
-		token_queue_free(&del->tokens);
-		vire_free(del, sizeof(mesg_queue_t));
-	}
-}
+static void token_queue_free(uint8_t epid) {
+	// Free all the tokens in the token queue of 
+	// element 'epid', and the queue itself.
+	token_ring_t *ring = st.rings[epid];
 
-static mesg_queue_t *search_mesg_queue(mesg_queue_t *head, sos_pid_t epid) {
-	mesg_queue_t *itr = head;
+	if (ring == NULL) return;
 
-	// Find the head of token queue for element 'epid'
-	while ((itr != NULL) && (itr->epid != epid)) {
-		itr = (mesg_queue_t *)(itr->h.next);
+	while (ring->count > 0) {
+		destroy_token(ring->slot[ring->head].t);
+		ring->head = (ring->head + 1) % TOKEN_RING_SIZE;
+		ring->count--;
 	}
-
-	return itr;
+	vire_free(ring, sizeof(token_ring_t));
+	st.rings[epid] = NULL;
 }
 
 static bool tokens_posted_for_element(sos_pid_t epid) {
-	mesg_queue_t *head = search_mesg_queue(st.mqueue, epid);
+	token_ring_t *ring = st.rings[epid];
+	uint8_t i;
 
-	if (head == NULL) return false;
+	if (ring == NULL) return false;
 
-	token_queue_t *itr = head->tokens;
-	while (itr != NULL) {
-		if (itr->status == TOKEN_POSTED) return true;
-		itr = (token_queue_t *)(itr->h.next);
+	for (i = 0; i < ring->count; i++) {
+		token_queue_t *itr = &(ring->slot[(ring->head + i) % TOKEN_RING_SIZE]);
+		if ((itr->t != NULL) && (itr->status == TOKEN_POSTED)) return true;
 	}
 
 	return false;
@@ -1243,14 +1231,8 @@ static void purge_tokens(queue_header_t *module_table) {
 	// For all UNMARKED elements
 	while (itr != NULL) {
 		if (itr->marked == UNMARKED) {
-			// Get the head of the token queue, if it exists
-			mesg_queue_t *del = search_mesg_queue(st.mqueue, get_epid_from_pid(itr->pid));
-			if (del != NULL) {
-				// Free the token queue
-				token_queue_free(&del->tokens);
-				// Remove the head from the message queue
-				queue_remove((queue_header_t **)&st.mqueue, (queue_header_t *)del, sizeof(mesg_queue_t));
-			}
+			// Free the token queue, if it exists
+			token_queue_free(get_epid_from_pid(itr->pid));
 		}
 		itr = (graph_element_t *)(itr->h.next);
 	}
@@ -1364,16 +1346,16 @@ static void	reset_element_busy_mask(queue_header_t *module_table) {
 }
 
 static void post_tokens_for_all_ports(sos_pid_t epid) {
-	// Search for head of token queue for element 'epid'
-	mesg_queue_t *head = search_mesg_queue(st.mqueue, epid);
-	token_queue_t *itr;
+	// Token queue for element 'epid'
+	token_ring_t *ring = st.rings[epid];
+	uint8_t i;
 
-	if (head == NULL) return;
+	if (ring == NULL) return;
 
-	itr = head->tokens;
-	while (itr != NULL) {
+	for (i = 0; i < ring->count; i++) {
+		token_queue_t *itr = &(ring->slot[(ring->head + i) % TOKEN_RING_SIZE]);
 		uint8_t pid_port = (epid << RTABLE_INPUT_PORT_BITS) | get_port_from_pid_port(itr->portID);
-		if (is_element_ready(pid_port) && (itr->status == TOKEN_QUEUED)) {
+		if ((itr->t != NULL) && is_element_ready(pid_port) && (itr->status == TOKEN_QUEUED)) {
 			msg_continue_t *m = (msg_continue_t *)vire_malloc(sizeof(msg_continue_t), MULTICAST_SERV_PID);
 			if (m == NULL) {
 				DEBUG("COULDN'T ALLOCATE NEXT TOKEN %d: MEMORY FULL\n", *((uint8_t*)itr->t->data));
@@ -1392,7 +1374,6 @@ static void post_tokens_for_all_ports(sos_pid_t epid) {
 			set_element_status(epid, get_port_from_pid_port(itr->portID), ELEMENT_BUSY);
 			itr->status = TOKEN_POSTED;
 		}
-		itr = (token_queue_t *)(itr->h.next);
 	}
 }
 
@@ -1414,6 +1395,7 @@ int8_t dispatch(func_cb_ptr caller_cb, token_type_t *t) {
 	// Get 'n' from the input port table
 	uint8_t num_connected_ports, i;
 	routing_table_ram_t port;
+	token_type_t *shared = NULL;	//!< Copy of 't' queued for busy elements
 
 	if (gid == INVALID_GID) goto set_element_ready;
 
@@ -1455,56 +1437,54 @@ int8_t dispatch(func_cb_ptr caller_cb, token_type_t *t) {
 				// Signal error to the base station.
 				// Post a message (RESET task, HIGHEST priority) to itself.
 				//graph_reset();
+				destroy_token(shared);
 				return -EINVAL;
 				//break;
 			}
 		} else {
 			// Element has already indicated busy status.
-			// Copy and enqueue this token.
-			token_queue_t *new = (token_queue_t *)vire_malloc(sizeof(token_queue_t), MULTICAST_SERV_PID); 
-			mesg_queue_t *tq = NULL;
-			void *token_data = NULL;
-			if (new == NULL) {
-				// Stop the application graph.
-				// Signal error to the base station.
-				DEBUG("\n");
-				DEBUG("TOKEN DROPPED: No more space for token %d.\n", *((uint8_t*)t->data));
-				DEBUG("\n");
-				continue;
-				//queue_free(&st.mqueue);
+			// Enqueue this token. All the busy ports share a single
+			// copy, each queue slot holding one reference to it.
+			token_queue_t *new;
+
+			if (shared == NULL) {
+				void *token_data = capture_token_data(t, MULTICAST_SERV_PID);
+				shared = create_token(token_data, t->length, MULTICAST_SERV_PID);
+				if (shared == NULL) {
+					// Stop the application graph.
+					// Signal error to the base station.
+					DEBUG("\n");
+					DEBUG("TOKEN DROPPED: No more space for token %d.\n", *((uint8_t*)t->data));
+					DEBUG("\n");
+					destroy_token_data(token_data, t->type, t->length);
+					continue;
+				}
+				set_token_type(shared, t->type);
+				// The data belongs to the queue slots, the last one
+				// to let go of the token frees it.
+				release_token(shared);
 			}
-			token_data = capture_token_data(t, MULTICAST_SERV_PID);
-			new->t = create_token(token_data, t->length, MULTICAST_SERV_PID);
-			if (new->t == NULL) {
+			new = token_queue_insert(get_epid_from_pid_port(port.index.pid_port));
+			if (new == NULL) {
 				// Stop the application graph.
 				// Signal error to the base station.
 				DEBUG("\n");
 				DEBUG("TOKEN DROPPED: No more space for token %d.\n", *((uint8_t*)t->data));
 				DEBUG("\n");
-				destroy_token_data(token_data, t->type, t->length);
-				vire_free(new, sizeof(token_queue_t));
 				continue;
-				//queue_free(&st.mqueue);
 			}
+			hold_token(shared);
+			new->t = shared;
 			new->cb = port.cb;
 			new->portID = get_port_from_pid_port(port.index.pid_port);
 			new->status = TOKEN_QUEUED;
-			tq = mesg_queue_insert(&st.mqueue, get_epid_from_pid_port(port.index.pid_port));
-			if (tq == NULL) {
-				// Stop the application graph.
-				// Signal error to the base station.
-				DEBUG("\n");
-				DEBUG("TOKEN DROPPED: No more space for token %d.\n", *((uint8_t*)t->data));
-				DEBUG("\n");
-				destroy_token(new->t);
-				vire_free(new, sizeof(token_queue_t));
-				continue;
-			}
-			queue_insert((queue_header_t **)&tq->tokens, (queue_header_t *)new);
 			DEBUG("Destination element is BUSY. Token %d queued.\n", *((uint8_t*)t->data));
 		}
 	}
 
+	// Drop the reference taken when the shared copy was made.
+	destroy_token(shared);
+
 	//If there are already tokens posted for the element,
 	//then probably placing token on another output port set it READY,
 	//or, there are some tokens waiting for other ports.
@@ -60,6 +60,18 @@ enum {
 	NEW_OP_FAILED,
 };
 
+#ifdef LOADER_PACKED_IMAGE
+#define loader_image(cam)  ((cam)->image.cm)
+//! status of the fetch running for cam, if any
+#define fetch_status(cam)  (((cam)->image.status != FETCHING_DONE)? \
+		(cam)->image.status : (cam)->fetcher.status)
+//! key that the unpacked module of module entry key is served under
+#define raw_key(key)       ((sos_shm_t)((key) + NUM_LOADER_MODULE_ENTRIES))
+#else
+#define loader_image(cam)  ((cam)->fetcher.cm)
+#define fetch_status(cam)  ((cam)->fetcher.status)
+#endif
+
 static int8_t loader_handler(void *state, Message *msg);
 
 static mod_header_t mod_header SOS_MODULE_HEADER =
@@ -113,6 +125,17 @@ static void block_protocol()
 	st.blocked = 1;
 }
 
+//! loader entry of key, which can also be the raw key of a module entry
+static loader_cam_t *get_cam( sos_shm_t key )
+{
+#ifdef LOADER_PACKED_IMAGE
+	if( (uint8_t)key >= LOADER_RAW_ENTRY ) {
+		key -= NUM_LOADER_MODULE_ENTRIES;
+	}
+#endif
+	return (loader_cam_t *) ker_shm_get( KER_DFT_LOADER_PID, key );
+}
+
 static void restartInterval( uint8_t new_tou )
 {
 	int32_t tou_interval = 0;
@@ -251,6 +274,383 @@ static int8_t handle_version_data( Message *msg )
 	return SOS_OK;
 }
 
+#ifdef LOADER_PACKED_IMAGE
+enum {
+	UNPACK_CHUNK = 32,
+};
+
+/**
+ * @brief state for unpacking one module
+ *
+ * The packed image is read and the module is written UNPACK_CHUNK bytes
+ * at a time, so the whole thing never has to be in RAM.
+ */
+typedef struct {
+	codemem_t src;                 //!< packed image
+	codemem_t dst;                 //!< module being built
+	codemem_t base;                //!< module a delta applies to
+	uint16_t  src_off;             //!< next chunk to read from src
+	uint16_t  src_end;
+	uint16_t  dst_off;             //!< bytes of out already in dst
+	uint16_t  size;                //!< size of the module
+	uint16_t  base_size;
+	uint8_t   in_pos;
+	uint8_t   in_len;
+	uint8_t   out_len;
+	uint8_t   sum1;
+	uint8_t   sum2;
+	uint8_t   in[UNPACK_CHUNK];
+	uint8_t   out[UNPACK_CHUNK];
+	uint8_t   tmp[UNPACK_CHUNK];
+} unpack_t;
+
+static void free_base( loader_cam_t *cam )
+{
+	if( cam->base != CODEMEM_INVALID ) {
+		// this also stops the module if it is running
+		ker_codemem_free( cam->base );
+		cam->base = CODEMEM_INVALID;
+	}
+}
+
+/**
+ * @brief m is the module of the entry with key, serve it to the neighbours
+ */
+static void set_image( loader_cam_t *cam, sos_shm_t key, codemem_t m )
+{
+	cam->image.cm = m;
+	cam->image.fetchtype = FETCHTYPE_MODULE;
+	cam->image.status = FETCHING_DONE;
+	ker_shm_open( KER_DFT_LOADER_PID, raw_key( key ), &(cam->image) );
+}
+
+/**
+ * @brief a new version of the entry in cam is on the way
+ *
+ * The installed module keeps running until the new version has been
+ * unpacked, because a delta is applied to it.
+ */
+static void keep_base( loader_cam_t *cam, sos_shm_t key )
+{
+	if( cam->image.cm != CODEMEM_INVALID ) {
+		ker_shm_close( KER_DFT_LOADER_PID, raw_key( key ) );
+		free_base( cam );
+		cam->base = cam->image.cm;
+		cam->base_ver = cam->version;
+	}
+	if( cam->fetcher.cm != cam->base ) {
+		ker_codemem_free( cam->fetcher.cm );
+	}
+	cam->image.cm = CODEMEM_INVALID;
+}
+
+//! true if the node has the version that a delta made against base_ver needs
+static bool has_base( loader_cam_t *cam, uint8_t base_ver )
+{
+	if( base_ver == 0 ) {
+		return true;
+	}
+	return cam->base != CODEMEM_INVALID && cam->base_ver == base_ver;
+}
+
+/**
+ * @brief fetch the unpacked module of the entry instead of its image
+ */
+static int8_t request_raw( sos_shm_t key, loader_cam_t *cam, uint8_t size, uint16_t saddr )
+{
+	if( size == 0 ) {
+		return -EINVAL;
+	}
+	cam->code_size = size;
+	cam->fetcher.fetchtype = FETCHTYPE_MODULE;
+	cam->fetcher.status = FETCHING_DONE;
+	cam->fetcher.cm = CODEMEM_INVALID;
+	cam->image.fetchtype = FETCHTYPE_MODULE;
+	cam->image.cm = ker_codemem_alloc(
+			size * LOADER_SIZE_MULTIPLIER,
+			CODEMEM_TYPE_EXECUTABLE);
+	DEBUG_PID( KER_DFT_LOADER_PID, "request unpacked module with size = %d\n",
+			size * LOADER_SIZE_MULTIPLIER);
+	if( cam->image.cm == CODEMEM_INVALID ) {
+		return -ENOMEM;
+	}
+	if( ker_shm_open( KER_DFT_LOADER_PID, raw_key( key ), &(cam->image) ) != SOS_OK ||
+			fetcher_request( KER_DFT_LOADER_PID, raw_key( key ),
+				(uint16_t)size * LOADER_SIZE_MULTIPLIER, saddr ) != SOS_OK ) {
+		ker_shm_close( KER_DFT_LOADER_PID, raw_key( key ) );
+		ker_codemem_free( cam->image.cm );
+		cam->image.cm = CODEMEM_INVALID;
+		return -ENOMEM;
+	}
+	block_protocol();
+	return SOS_OK;
+}
+
+//! stop fetching the unpacked module, if that is what cam is doing
+static void cancel_raw( loader_cam_t *cam, sos_shm_t key )
+{
+	if( cam->image.status != FETCHING_DONE ) {
+		fetcher_cancel( KER_DFT_LOADER_PID, raw_key( key ) );
+		ker_shm_close( KER_DFT_LOADER_PID, raw_key( key ) );
+		ker_codemem_free( cam->image.cm );
+		cam->image.cm = CODEMEM_INVALID;
+		cam->image.status = FETCHING_DONE;
+	}
+}
+
+static int8_t unpack_getc( unpack_t *u, uint8_t *b )
+{
+	if( u->in_pos == u->in_len ) {
+		uint16_t n;
+
+		//! the fetched image can be shorter than its own header
+		if( u->src_off >= u->src_end ) {
+			return -EINVAL;
+		}
+		n = u->src_end - u->src_off;
+		if( n > UNPACK_CHUNK ) {
+			n = UNPACK_CHUNK;
+		}
+		if( ker_codemem_read( u->src, KER_DFT_LOADER_PID, u->in, n, u->src_off ) != SOS_OK ) {
+			return -EIO;
+		}
+		u->src_off += n;
+		u->in_len = n;
+		u->in_pos = 0;
+	}
+	*b = u->in[u->in_pos++];
+	return SOS_OK;
+}
+
+static int8_t unpack_get16( unpack_t *u, uint16_t *w )
+{
+	uint8_t hi, lo;
+
+	if( unpack_getc( u, &hi ) != SOS_OK || unpack_getc( u, &lo ) != SOS_OK ) {
+		return -EINVAL;
+	}
+	*w = ((uint16_t)hi << 8) | lo;
+	return SOS_OK;
+}
+
+static int8_t unpack_flush( unpack_t *u )
+{
+	if( u->out_len == 0 ) {
+		return SOS_OK;
+	}
+	if( ker_codemem_write( u->dst, KER_DFT_LOADER_PID, u->out, u->out_len, u->dst_off ) != SOS_OK ) {
+		return -EIO;
+	}
+	u->dst_off += u->out_len;
+	u->out_len = 0;
+	return SOS_OK;
+}
+
+static int8_t unpack_put( unpack_t *u, uint8_t *buf, uint16_t len )
+{
+	uint16_t i;
+
+	if( (uint32_t)u->dst_off + u->out_len + len > u->size ) {
+		return -EINVAL;
+	}
+	for( i = 0; i < len; i++ ) {
+		u->out[u->out_len++] = buf[i];
+		u->sum1 += buf[i];
+		if( u->sum1 < buf[i] ) u->sum1++;   // sum1 = (sum1 + b) % 255
+		if( u->sum1 == 255 ) u->sum1 = 0;
+		u->sum2 += u->sum1;
+		if( u->sum2 < u->sum1 ) u->sum2++;
+		if( u->sum2 == 255 ) u->sum2 = 0;
+		if( u->out_len == UNPACK_CHUNK && unpack_flush( u ) != SOS_OK ) {
+			return -EIO;
+		}
+	}
+	return SOS_OK;
+}
+
+/**
+ * @brief copy len bytes from off in the module being built, or in the base
+ */
+static int8_t unpack_copy( unpack_t *u, codemem_t from, uint16_t off, uint16_t len )
+{
+	while( len > 0 ) {
+		uint16_t n = (len > UNPACK_CHUNK)? UNPACK_CHUNK : len;
+		uint8_t *p = u->tmp;
+
+		if( from == u->dst && off >= u->dst_off ) {
+			//! still in out, and may overlap what this copy writes
+			uint8_t b = u->out[off - u->dst_off];
+			n = 1;
+			p = &b;
+			if( unpack_put( u, p, n ) != SOS_OK ) {
+				return -EINVAL;
+			}
+		} else {
+			if( from == u->dst && off + n > u->dst_off ) {
+				n = u->dst_off - off;
+			}
+			if( ker_codemem_read( from, KER_DFT_LOADER_PID, p, n, off ) != SOS_OK ||
+					unpack_put( u, p, n ) != SOS_OK ) {
+				return -EINVAL;
+			}
+		}
+		off += n;
+		len -= n;
+	}
+	return SOS_OK;
+}
+
+static int8_t unpack_run( unpack_t *u )
+{
+	while( u->dst_off + u->out_len < u->size ) {
+		uint8_t op;
+		uint16_t len;
+		uint16_t off;
+
+		if( unpack_getc( u, &op ) != SOS_OK ) {
+			return -EINVAL;
+		}
+		switch( op & LOADER_OP_MASK ) {
+		case LOADER_OP_MATCH:
+		{
+			uint16_t pos = u->dst_off + u->out_len;
+			len = (op & ~LOADER_OP_MASK) + LOADER_MATCH_MIN;
+			if( unpack_get16( u, &off ) != SOS_OK || off == 0 || off > pos ||
+					unpack_copy( u, u->dst, pos - off, len ) != SOS_OK ) {
+				return -EINVAL;
+			}
+			break;
+		}
+		case LOADER_OP_BASE:
+		{
+			uint8_t lo;
+			if( u->base == CODEMEM_INVALID || unpack_getc( u, &lo ) != SOS_OK ||
+					unpack_get16( u, &off ) != SOS_OK ) {
+				return -EINVAL;
+			}
+			len = ((((uint16_t)op & ~LOADER_OP_MASK) << 8) | lo) + 1;
+			if( (uint32_t)off + len > u->base_size ||
+					unpack_copy( u, u->base, off, len ) != SOS_OK ) {
+				return -EINVAL;
+			}
+			break;
+		}
+		default:
+		{
+			//! literal run
+			len = op + 1;
+			while( len > 0 ) {
+				uint8_t b;
+				if( unpack_getc( u, &b ) != SOS_OK || unpack_put( u, &b, 1 ) != SOS_OK ) {
+					return -EINVAL;
+				}
+				len--;
+			}
+			break;
+		}
+		}
+	}
+	return unpack_flush( u );
+}
+
+/**
+ * @brief turn the fetched image of cam into a module
+ *
+ * An image that is not packed is used as it is.  Otherwise the module is
+ * rebuilt into new code memory and checked against the checksum in the
+ * header.  Either way cam->image is the module afterwards and the
+ * previous version is gone.
+ */
+static int8_t unpack_image( loader_cam_t *cam, sos_shm_t key )
+{
+	loader_image_hdr_t hdr;
+	unpack_t *u;
+	int8_t ret;
+
+	if( ker_codemem_read( cam->fetcher.cm, KER_DFT_LOADER_PID, &hdr, sizeof(hdr), 0 ) != SOS_OK ) {
+		return -EIO;
+	}
+	if( entohs( hdr.magic ) != LOADER_IMAGE_MAGIC ) {
+		free_base( cam );
+		set_image( cam, key, cam->fetcher.cm );
+		return SOS_OK;
+	}
+	u = (unpack_t *) ker_malloc( sizeof(unpack_t), KER_DFT_LOADER_PID );
+	if( u == NULL ) {
+		return -ENOMEM;
+	}
+	memset( u, 0, sizeof(unpack_t) );
+	u->src = cam->fetcher.cm;
+	u->src_off = sizeof(hdr);
+	u->src_end = (uint16_t)cam->code_size * LOADER_SIZE_MULTIPLIER;
+	u->size = entohs( hdr.size );
+	u->base = CODEMEM_INVALID;
+	if( hdr.encoding == LOADER_IMAGE_DELTA ) {
+		sos_code_id_t cid = entohs( hdr.base );
+		mod_header_ptr p;
+
+		//! the base has to be the installed version of the same module
+		if( hdr.base_ver == 0 || !has_base( cam, hdr.base_ver ) ) {
+			ker_free( u );
+			return -ENOENT;
+		}
+		p = ker_codemem_get_header_address( cam->base );
+		if( p == 0 || entohs( sos_read_header_word( p, offsetof(mod_header_t, code_id) ) ) != cid ) {
+			ker_free( u );
+			return -ENOENT;
+		}
+		u->base = cam->base;
+		u->base_size = entohs( hdr.base_size );
+	}
+	u->dst = ker_codemem_alloc( u->size, CODEMEM_TYPE_EXECUTABLE );
+	if( u->dst == CODEMEM_INVALID ) {
+		ker_free( u );
+		return -ENOMEM;
+	}
+	ret = unpack_run( u );
+	ker_codemem_flush( u->dst, KER_DFT_LOADER_PID );
+	if( ret == SOS_OK && ((uint16_t)u->sum2 << 8 | u->sum1) != entohs( hdr.sum ) ) {
+		ret = -EINVAL;
+	}
+	if( ret != SOS_OK ) {
+		ker_codemem_free( u->dst );
+		ker_free( u );
+		return ret;
+	}
+	DEBUG_PID( KER_DFT_LOADER_PID, "unpacked %d bytes into %d\n", u->src_off, u->size );
+	free_base( cam );
+	set_image( cam, key, u->dst );
+	ker_free( u );
+	return SOS_OK;
+}
+
+/**
+ * @brief make what was fetched for cam under key its new module
+ * @return SOS_OK if there is a module to load.  Otherwise the fetched
+ * image is dropped and the unpacked module is requested in its place.
+ */
+static int8_t install_image( loader_cam_t *cam, sos_shm_t key )
+{
+	if( (uint8_t)key >= LOADER_RAW_ENTRY ) {
+		//! the unpacked module, it replaces the previous version
+		free_base( cam );
+		return SOS_OK;
+	}
+	if( unpack_image( cam, key ) == SOS_OK ) {
+		return SOS_OK;
+	}
+	DEBUG_PID( KER_DFT_LOADER_PID, "cannot unpack module, fetching it unpacked\n" );
+	ker_codemem_free( cam->fetcher.cm );
+	cam->fetcher.cm = CODEMEM_INVALID;
+	if( request_raw( key, cam, st.version_data->mod_raw_size[(uint8_t)key - NUM_LOADER_PARAMS_ENTRIES],
+				st.recent_neighbor ) != SOS_OK ) {
+		//! the previous version, if any, stays installed
+		process_version_data( st.version_data, st.recent_neighbor );
+	}
+	return -EINVAL;
+}
+#endif
+
 static int8_t request_new_module(sos_shm_t key, loader_cam_t *cam, uint8_t size, uint16_t saddr, uint8_t type)
 {
   cam->code_size = size; 
@@ -282,6 +682,7 @@ static void process_version_data( msg_version_data_t *v, uint16_t saddr )
 		uint8_t type;
 		uint8_t size;
 		uint8_t ver;
+		int8_t ret;
 
 		if( i < NUM_LOADER_PARAMS_ENTRIES) {
 			size = (v->pam_size[i]);
@@ -312,31 +713,60 @@ static void process_version_data( msg_version_data_t *v, uint16_t saddr )
 				ker_free( cam );
 				return;
 			}
+#ifdef LOADER_PACKED_IMAGE
+			cam->image.cm = CODEMEM_INVALID;
+			cam->image.status = FETCHING_DONE;
+			cam->base = CODEMEM_INVALID;
+#endif
 		} else {
 			// we need to replace a module
 			if( cam->version == ver ) {
 				continue;
 			}
 			//! new version of module found...
-			if( cam->fetcher.status != FETCHING_DONE ) {
-				if( cam->fetcher.status == FETCHING_STARTED ) {
+			if( fetch_status(cam) != FETCHING_DONE ) {
+				if( fetch_status(cam) == FETCHING_STARTED ) {
 					st.blocked = 0;
 					restartInterval( 0 );
 				}
 				fetcher_cancel( KER_DFT_LOADER_PID, key );	
 				ker_codemem_free(cam->fetcher.cm);
+#ifdef LOADER_PACKED_IMAGE
+				cancel_raw( cam, key );
+#endif
 			} else /* if( cam->fetcher.status == FETCHING_DONE ) */ {
+#ifdef LOADER_PACKED_IMAGE
+				keep_base( cam, key );
+#else
 				ker_codemem_free(cam->fetcher.cm);
+#endif
 			}
 			if( size == 0 ) {
 				//! an rmmod case
+#ifdef LOADER_PACKED_IMAGE
+				free_base( cam );
+#endif
 				ker_shm_close( KER_DFT_LOADER_PID,  key );
 				ker_free( cam );
 				continue;
 			} 
 			//! an insmod case with cam
 		} 
-		if( request_new_module( key, cam, size, saddr, type) != SOS_OK ) {
+#ifdef LOADER_PACKED_IMAGE
+		if( type == FETCHTYPE_MODULE &&
+				!has_base( cam, v->mod_base[i - NUM_LOADER_PARAMS_ENTRIES] ) ) {
+			//! a delta is of no use without its base, get the module itself
+			ret = request_raw( key, cam, v->mod_raw_size[i - NUM_LOADER_PARAMS_ENTRIES], saddr );
+		} else {
+			ret = request_new_module( key, cam, size, saddr, type );
+		}
+#else
+		ret = request_new_module( key, cam, size, saddr, type );
+#endif
+		if( ret != SOS_OK ) {
+#ifdef LOADER_PACKED_IMAGE
+			free_base( cam );
+#endif
 			ker_shm_close( KER_DFT_LOADER_PID, key );
 			ker_free( cam );
 		} else {
@@ -359,7 +789,7 @@ static int8_t handle_fetcher_done( Message *msg )
 		st.blocked = 0;
 		restartInterval( 0 );
 
-		cam = ker_shm_get( KER_DFT_LOADER_PID,  f->map.key );
+		cam = get_cam( f->map.key );
 		if( cam->fetcher.fetchtype == FETCHTYPE_DATA) {
 			uint8_t buf[2];
 			ker_codemem_read( cam->fetcher.cm, KER_DFT_LOADER_PID, buf, 2, 0);
@@ -375,11 +805,16 @@ static int8_t handle_fetcher_done( Message *msg )
 		  uint8_t plat_type;
 #endif
 		  mod_header_ptr p;
-								
+
+#ifdef LOADER_PACKED_IMAGE
+		  if( install_image( cam, f->map.key ) != SOS_OK ) {
+			return SOS_OK;
+		  }
+#endif
 		  // Link and load the module here
-		  melf_load_module(cam->fetcher.cm);
+		  melf_load_module(loader_image(cam));
 		  // Get the address of the module header
-		  p = ker_codemem_get_header_address( cam->fetcher.cm ); 
+		  p = ker_codemem_get_header_address( loader_image(cam) ); 
 
 		  // get processor type and platform type
 		  mcu_type = sos_read_header_byte(p, 
@@ -403,11 +838,11 @@ static int8_t handle_fetcher_done( Message *msg )
 			   * simply for all platform with the same MCU
 			   */
 			  // mark module executable
-			  ker_codemem_mark_executable( cam->fetcher.cm );
+			  ker_codemem_mark_executable( loader_image(cam) );
 			  if (cam->version & 0x80) {
 #ifdef SOS_SFI
-				sfi_modtable_register(cam->fetcher.cm);
-				if (SOS_OK == ker_verify_module(cam->fetcher.cm)){
+				sfi_modtable_register(loader_image(cam));
+				if (SOS_OK == ker_verify_module(loader_image(cam))){
 				  sfi_modtable_flash(p);
 				  ker_register_module(p);
 				}
@@ -469,11 +904,16 @@ static int8_t handle_loader_ls_on_node( Message *msg )
 
 		cam = ker_shm_get( KER_DFT_LOADER_PID,  key );
 
-		if( cam != NULL && cam->fetcher.status == FETCHING_DONE ) {
+		if( cam != NULL && cam->fetcher.status == FETCHING_DONE
+#ifdef LOADER_PACKED_IMAGE
+				&& cam->image.cm != CODEMEM_INVALID
+				&& cam->image.status == FETCHING_DONE
+#endif
+				) {
 			mod_header_ptr p;
 			sos_code_id_t cid;
 			// Get the address of the module header
-			p = ker_codemem_get_header_address( cam->fetcher.cm );
+			p = ker_codemem_get_header_address( loader_image(cam) );
 			cid = sos_read_header_word( p, offsetof(mod_header_t, code_id));
 			// warning: already netowrk order...
 			reply->code_id[ i ] = cid;
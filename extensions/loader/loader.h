@@ -21,6 +21,7 @@ enum {
 	MSG_LOADER_RMDATA          = ( MOD_CMD_START + 9 ),
 	MSG_LOADER_LSDATA          = ( MOD_CMD_START + 10 ),
 	MSG_LOADER_DATA_AVAILABLE  = ( MOD_MSG_START + 11 ),
+	MSG_LOADER_UPDATE          = ( MOD_CMD_START + 12 ),
 };     
 
 typedef uint16_t version_t;
@@ -61,6 +62,12 @@ typedef struct {
 	uint8_t  mod_size [ NUM_LOADER_MODULE_ENTRIES ];  
 	uint8_t  ker_ver  [ NUM_LOADER_KERNEL_ENTRIES ];
 	uint16_t ker_size [ NUM_LOADER_KERNEL_ENTRIES ];
+#ifdef LOADER_PACKED_IMAGE
+	//! mod_ver a delta image applies to, 0 if the image is not a delta
+	uint8_t  mod_base [ NUM_LOADER_MODULE_ENTRIES ];
+	//! size of the unpacked module, same units as mod_size
+	uint8_t  mod_raw_size [ NUM_LOADER_MODULE_ENTRIES ];
+#endif
 } PACK_STRUCT
 msg_version_data_t;
 
@@ -71,10 +78,68 @@ typedef struct {
 } PACK_STRUCT
 msg_ls_reply_t;
 
+#ifdef LOADER_PACKED_IMAGE
+/**
+ * Packed module images (LOADER_IMAGE=packed)
+ *
+ * Instead of the module itself, the network can carry a packed image:
+ * the module LZ compressed, or a delta against the version of the module
+ * that is installed on the node.  A packed image is loader_image_hdr_t
+ * followed by operations that rebuild the module front to back:
+ *
+ *   0nnnnnnn                  n + 1 literal bytes follow
+ *   10nnnnnn dist             copy n + 3 bytes from dist bytes back in the module
+ *   11nnnnnn nnnnnnnn off     copy n + 1 bytes from off in the base (delta only)
+ *
+ * dist and off are 16 bits, big endian.  Only modules are packed, data
+ * entries are always sent as they are.
+ *
+ * Every node also serves its unpacked module under the raw key of the
+ * entry.  A node that does not have the version a delta was made
+ * against, or that cannot unpack the image it got, fetches that instead.
+ */
+enum {
+	LOADER_IMAGE_MAGIC        =  0x5a7eL,
+	LOADER_IMAGE_LZ           =     1,
+	LOADER_IMAGE_DELTA        =     2,
+
+	LOADER_OP_LITERAL         =  0x00,
+	LOADER_OP_MATCH           =  0x80,
+	LOADER_OP_BASE            =  0xc0,
+	LOADER_OP_MASK            =  0xc0,
+	LOADER_MATCH_MIN          =     3,
+	LOADER_MATCH_MAX          =  (0x3f + LOADER_MATCH_MIN),
+	LOADER_LITERAL_MAX        =  0x80,
+	LOADER_BASE_MAX           =  0x4000L,
+
+	//! raw key of module entry i is sys_shm_name(KER_DFT_LOADER_PID, LOADER_RAW_ENTRY + i)
+	LOADER_RAW_ENTRY          =  (NUM_LOADER_PARAMS_ENTRIES + NUM_LOADER_MODULE_ENTRIES),
+};
+
+/**
+ * All 16 bit fields are in network order
+ */
+typedef struct {
+	uint16_t      magic;      //!< LOADER_IMAGE_MAGIC
+	uint8_t       encoding;   //!< LOADER_IMAGE_LZ or LOADER_IMAGE_DELTA
+	uint8_t       base_ver;   //!< mod_ver of the module a delta applies to
+	uint16_t      size;       //!< size of the module
+	uint16_t      sum;        //!< Fletcher-16 checksum of the module
+	sos_code_id_t base;       //!< code id of the module a delta applies to
+	uint16_t      base_size;  //!< size of that module's image
+} PACK_STRUCT
+loader_image_hdr_t;
+#endif
+
 typedef struct {
   fetcher_cam_t fetcher;
   uint8_t version;
   uint8_t code_size;
+#ifdef LOADER_PACKED_IMAGE
+  fetcher_cam_t image;  //!< the module, served under the raw key; fetcher.cm holds what was fetched
+  codemem_t base;       //!< previous version, kept until the new one is unpacked
+  uint8_t base_ver;     //!< its version
+#endif
 } PACK_STRUCT
 loader_cam_t;
 #endif
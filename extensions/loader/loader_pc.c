@@ -10,6 +10,7 @@
 #include <ctype.h>
 #ifdef MINIELF_LOADER
 #include <melfloader.h>
+#include <minielfendian.h>
 #endif
 
 
@@ -77,6 +78,7 @@ typedef struct {
   uint8_t state;
   msg_ls_reply_t *reply;
   char* image_filename;
+  char* base_filename;
   sos_code_id_t    rmmod_code_id;
   uint8_t type_requested;   
   uint8_t rmdata_pid;
@@ -91,8 +93,10 @@ typedef struct {
 static dft_loader_t  st;
 static unsigned char image_buf[MAX_IMAGE_SIZE];    //!< buffer to store the image
 static int addr_end;                   //!< end of image buffer
+static unsigned char *net_buf = image_buf;         //!< what goes to the network
+static int net_end;
 static sos_pid_t module_id = 0;                          //!< module id of this insmod
-static codemem_t flashImage();
+static codemem_t flashImage( unsigned char *buf, int len );
 static void load_image_from_file( char *filename );
 static void load_data_from_file( char *filename );
 static void print_lsmod_reply( msg_ls_reply_t *reply, bool debug_flag );
@@ -101,6 +105,10 @@ static void check_rmmod( msg_ls_reply_t *reply, sos_code_id_t code_id );
 static void check_lddata( msg_ls_reply_t *reply, uint8_t *databuf );
 static void check_rmdata( msg_ls_reply_t *reply, uint8_t pid, uint8_t handle);
 static int process_insmod();
+static void process_update();
+static void check_update( msg_ls_reply_t *reply, mod_header_t *mod_hdr );
+static int pack_module( sos_code_id_t code_id, uint8_t base_ver );
+static void publish_raw( int i );
 static void process_rmmod();
 static void process_lddata();
 static void process_rmdata();
@@ -220,6 +228,10 @@ static int8_t handle_version_data( Message *msg )
 	process_insmod();
   }
 
+  if( st.type_requested == MSG_LOADER_UPDATE ) {
+	process_update();
+  }
+
   if( st.type_requested == MSG_LOADER_LDDATA ) {
 	process_lddata();
   }
@@ -257,7 +269,7 @@ static void process_lddata()
 	  break;
 	}
   }
-  cm = flashImage();
+  cm = flashImage( image_buf, addr_end );
   key = sys_shm_name( KER_DFT_LOADER_PID, (idx));
 
   cam->cm = cm;
@@ -290,17 +302,19 @@ static int process_insmod()
 #endif
   module_id = mod_hdr->mod_id;
   code_id = entohs(mod_hdr->code_id);
+  net_end = pack_module( 0, 0 );
 
   for( i = 0; i < NUM_LOADER_MODULE_ENTRIES; i++ ) {
 	if( st.version_data->mod_size[i] == 0 ) {
 	  st.version_data->mod_ver[i] ++;
-	  st.version_data->mod_size[i] = (addr_end + (LOADER_SIZE_MULTIPLIER - 1)) / LOADER_SIZE_MULTIPLIER;
+	  st.version_data->mod_size[i] = (net_end + (LOADER_SIZE_MULTIPLIER - 1)) / LOADER_SIZE_MULTIPLIER;
 	  st.version_data->version ++;
 	  if(st.type_requested == MSG_LOADER_LDMOD) {
 		st.version_data->mod_ver[i] &= 0x7f;
 	  } else {
 		st.version_data->mod_ver[i] |= 0x80;
 	  }
+	  publish_raw( i );
 	  idx = i;
 	  break;
 	}
@@ -319,8 +333,11 @@ static int process_insmod()
   //! print info
   printf("addr_start = %d\n", 0);
   printf("addr_end = %d\n", addr_end);
+  if( net_buf != image_buf ) {
+	printf("packed size = %d\n", net_end);
+  }
 
-  cm = flashImage();
+  cm = flashImage( net_buf, net_end );
   /*
    * store to CAM so that fetcher can find it
    */	
@@ -333,6 +350,52 @@ static int process_insmod()
   return 0;
 }
 
+/*
+ * Replace the module with the same code id in its own slot.  With packed
+ * images the nodes get a delta against the old image, if we have it.
+ */
+static void process_update()
+{
+  mod_header_t *mod_hdr;
+  sos_code_id_t code_id;
+  fetcher_cam_t *cam;
+  uint8_t ver;
+  int i;
+
+  cam = ker_malloc(sizeof(fetcher_cam_t), KER_DFT_LOADER_PID);
+  if( cam == NULL ) {
+	printf("ERROR: no memory for CAM\n");
+	hardware_exit(1);
+  }
+#ifdef MINIELF_LOADER
+  mod_hdr = melf_get_mod_header(image_buf);
+#else
+  mod_hdr = (mod_header_t*) image_buf;
+#endif
+  code_id = entohs(mod_hdr->code_id);
+  for( i = 0; i < NUM_LOADER_MODULE_ENTRIES; i++ ) {
+	if( st.reply->code_id[i] == code_id ) {
+	  break;
+	}
+  }
+  ver = st.version_data->mod_ver[i];
+  net_end = pack_module( code_id, ver );
+  st.version_data->mod_ver[i] = (ver & 0x80) | ((ver + 1) & 0x7f);
+  st.version_data->mod_size[i] = (net_end + (LOADER_SIZE_MULTIPLIER - 1)) / LOADER_SIZE_MULTIPLIER;
+  st.version_data->version ++;
+  publish_raw( i );
+
+  printf("code id = %d\n", code_id);
+  printf("addr_end = %d\n", addr_end);
+  if( net_buf != image_buf ) {
+	printf("packed size = %d\n", net_end);
+  }
+  cam->cm = flashImage( net_buf, net_end );
+  cam->fetchtype = FETCHTYPE_DATA;
+  ker_shm_open( KER_DFT_LOADER_PID,
+	  sys_shm_name( KER_DFT_LOADER_PID, (i + NUM_LOADER_PARAMS_ENTRIES)), cam);
+}
+
 static void process_rmmod()
 {
   int i;
@@ -373,23 +436,23 @@ static void process_rmdata()
 }
 
 
-static codemem_t flashImage()
+static codemem_t flashImage( unsigned char *buf, int len )
 {
   int i;
   codemem_t cm;
 
-  cm = ker_codemem_alloc(addr_end, CODEMEM_TYPE_EXECUTABLE);
+  cm = ker_codemem_alloc(len, CODEMEM_TYPE_EXECUTABLE);
   if( cm == CODEMEM_INVALID ) {
 	printf("Cannot open codemem for writing!\n");
 	printf("Quitting... \n");
 	hardware_exit(1);	
   }
-  for(i = 0; i < addr_end; 
+  for(i = 0; i < len; 
 	  i+= FLASH_PAGE_SIZE) {
-	if(addr_end > (i + FLASH_PAGE_SIZE)) {
-	  ker_codemem_write(cm, MOD_D_PC_PID, image_buf + i, FLASH_PAGE_SIZE, i);
+	if(len > (i + FLASH_PAGE_SIZE)) {
+	  ker_codemem_write(cm, MOD_D_PC_PID, buf + i, FLASH_PAGE_SIZE, i);
 	} else {
-	  ker_codemem_write(cm, MOD_D_PC_PID, image_buf + i, addr_end - i, i);
+	  ker_codemem_write(cm, MOD_D_PC_PID, buf + i, len - i, i);
 	}
   }
   ker_codemem_flush(cm, KER_DFT_LOADER_PID);
@@ -413,6 +476,23 @@ static int8_t handle_insmod( Message *msg )
   return handle_lsmod( msg );
 }
 
+static int8_t handle_update( Message *msg )
+{
+  char *sep;
+
+  //! <module.mlf>[,<old_module.mlf>]
+  st.image_filename = (char*) msg->data;
+  st.base_filename = NULL;
+  sep = strchr( st.image_filename, ',' );
+  if( sep != NULL ) {
+	*sep = '\0';
+	st.base_filename = sep + 1;
+  }
+  load_image_from_file( st.image_filename );
+
+  return handle_lsmod( msg );
+}
+
 static int8_t handle_lddata( Message *msg ) 
 {
   st.image_filename = (char *) msg->data;
@@ -499,6 +579,14 @@ static int8_t handle_lsmod_reply( Message *msg )
 #endif
   }
 
+  if( st.type_requested == MSG_LOADER_UPDATE ) {
+#ifdef MINIELF_LOADER
+	check_update( st.reply, melf_get_mod_header(image_buf) );
+#else
+	check_update( st.reply, (mod_header_t *) image_buf );
+#endif
+  }
+
   if( st.type_requested == MSG_LOADER_LDDATA ) {
 	check_lddata( st.reply, (uint8_t *) image_buf);
   }
@@ -570,6 +658,21 @@ static void check_insmod( msg_ls_reply_t *reply, mod_header_t *mod_hdr )
   }
 }
 
+static void check_update( msg_ls_reply_t *reply, mod_header_t *mod_hdr )
+{
+  uint8_t i;
+  sos_code_id_t code_id;
+
+  code_id = entohs(mod_hdr->code_id);
+  for(i = 0; i < NUM_LOADER_MODULE_ENTRIES; i++) {
+	if( code_id == reply->code_id[ i ] ) {
+	  return;
+	}
+  }
+  printf("ERROR: code_id %d is not installed, use insmod\n", code_id);
+  hardware_exit( 1 );
+}
+
 static void check_rmmod( msg_ls_reply_t *reply, sos_code_id_t code_id )
 {
   uint8_t i;
@@ -650,6 +753,310 @@ static void print_lsmod_reply( msg_ls_reply_t *reply, bool debug_flag )
   }
 }
 
+#ifdef LOADER_PACKED_IMAGE
+enum {
+  PACK_HASH_SIZE      =  4096,
+  PACK_CHAIN_MAX      =   256,   //!< candidates looked at per position
+  PACK_MATCH_COST     =     3,   //!< bytes of a LOADER_OP_MATCH
+  PACK_BASE_COST      =     4,   //!< bytes of a LOADER_OP_BASE
+  PACK_WINDOW         = 65535L,
+};
+
+static unsigned char base_buf[MAX_IMAGE_SIZE];     //!< the old version for a delta
+static unsigned char base_reloc[MAX_IMAGE_SIZE];   //!< bytes the node relocates in place
+static int base_end;
+static unsigned char pack_buf[sizeof(loader_image_hdr_t) + MAX_IMAGE_SIZE + MAX_IMAGE_SIZE / LOADER_LITERAL_MAX + 1];
+static int pack_end;
+static int head[PACK_HASH_SIZE];
+static int chain[MAX_IMAGE_SIZE];
+static int base_head[PACK_HASH_SIZE];
+static int base_chain[MAX_IMAGE_SIZE];
+
+static int pack_hash( unsigned char *p )
+{
+  return ((p[0] << 7) ^ (p[1] << 3) ^ p[2]) & (PACK_HASH_SIZE - 1);
+}
+
+static void pack_byte( int b )
+{
+  pack_buf[pack_end++] = (unsigned char) b;
+}
+
+static void pack_literals( int from, int to )
+{
+  while( from < to ) {
+	int n = to - from;
+	if( n > LOADER_LITERAL_MAX ) {
+	  n = LOADER_LITERAL_MAX;
+	}
+	pack_byte( LOADER_OP_LITERAL | (n - 1) );
+	memcpy( pack_buf + pack_end, image_buf + from, n );
+	pack_end += n;
+	from += n;
+  }
+}
+
+/*
+ * The node relocates the installed module in place, so the bytes at its
+ * relocation sites no longer match the file.  Never copy them.
+ */
+static void mark_base_relocations()
+{
+#ifdef MINIELF_LOADER
+  Melf_Mhdr mhdr;
+  Melf_Shdr shdr, progshdr;
+  Melf_Rela rela;
+  int i, j, k;
+  int have_prog = 0;
+
+  memset( base_reloc, 0, sizeof(base_reloc) );
+  if( base_end < (int)sizeof(Melf_Mhdr) ) {
+	return;
+  }
+  memcpy( &mhdr, base_buf, sizeof(Melf_Mhdr) );
+  entoh_Mhdr( &mhdr );
+  for( i = 0; i < mhdr.m_shnum; i++ ) {
+	int off = sizeof(Melf_Mhdr) + i * sizeof(Melf_Shdr);
+	if( off + (int)sizeof(Melf_Shdr) > base_end ) {
+	  return;
+	}
+	memcpy( &progshdr, base_buf + off, sizeof(Melf_Shdr) );
+	entoh_Shdr( &progshdr );
+	if( progshdr.sh_type == SHT_PROGBITS ) {
+	  have_prog = 1;
+	  break;
+	}
+  }
+  if( !have_prog ) {
+	return;
+  }
+  for( i = 0; i < mhdr.m_shnum; i++ ) {
+	memcpy( &shdr, base_buf + sizeof(Melf_Mhdr) + i * sizeof(Melf_Shdr), sizeof(Melf_Shdr) );
+	entoh_Shdr( &shdr );
+	if( shdr.sh_type != SHT_RELA ) {
+	  continue;
+	}
+	for( j = 0; j < (int)(shdr.sh_size / sizeof(Melf_Rela)); j++ ) {
+	  int off = shdr.sh_offset + j * sizeof(Melf_Rela);
+	  int site;
+	  if( off + (int)sizeof(Melf_Rela) > base_end ) {
+		break;
+	  }
+	  memcpy( &rela, base_buf + off, sizeof(Melf_Rela) );
+	  entoh_Rela( &rela );
+	  site = progshdr.sh_offset + rela.r_offset;
+	  for( k = site; k < site + 4 && k < base_end; k++ ) {
+		base_reloc[k] = 1;
+	  }
+	}
+  }
+#endif
+}
+
+static void load_base_from_file( char *filename )
+{
+  FILE *f;
+  int cin;
+
+  f = fopen( filename, "r" );
+  if( f == NULL ) {
+	fprintf(stderr, "%s does not exist\n", filename);
+	hardware_exit( 1 );
+  }
+  //! same layout as load_image_from_file(), which is what the node holds
+  memset( base_buf, 0xff, sizeof(base_buf) );
+  base_end = 0;
+  while( (cin = fgetc(f)) != EOF && base_end < MAX_IMAGE_SIZE - 1 ) {
+	base_buf[base_end++] = (unsigned char)cin;
+  }
+  base_end++;
+  fclose( f );
+  mark_base_relocations();
+}
+
+/*
+ * Longest match for position i in the base, or 0.  Only runs that avoid
+ * the relocation sites of the base count.
+ */
+static int base_match( int i, int *off )
+{
+  int best = 0;
+  int cand;
+  int n = 0;
+
+  if( base_end == 0 || i + 3 > addr_end ) {
+	return 0;
+  }
+  for( cand = base_head[pack_hash(image_buf + i)]; cand >= 0 && n < PACK_CHAIN_MAX;
+	   cand = base_chain[cand], n++ ) {
+	int len = 0;
+	while( i + len < addr_end && cand + len < base_end && len < LOADER_BASE_MAX &&
+		   base_reloc[cand + len] == 0 && image_buf[i + len] == base_buf[cand + len] ) {
+	  len++;
+	}
+	if( len > best ) {
+	  best = len;
+	  *off = cand;
+	}
+  }
+  return best;
+}
+
+//! longest match for position i earlier in the image, or 0
+static int window_match( int i, int *dist )
+{
+  int best = 0;
+  int cand;
+  int n = 0;
+
+  if( i + 3 > addr_end ) {
+	return 0;
+  }
+  for( cand = head[pack_hash(image_buf + i)]; cand >= 0 && i - cand <= PACK_WINDOW &&
+	   n < PACK_CHAIN_MAX; cand = chain[cand], n++ ) {
+	int len = 0;
+	while( i + len < addr_end && len < LOADER_MATCH_MAX &&
+		   image_buf[i + len] == image_buf[cand + len] ) {
+	  len++;
+	}
+	if( len > best ) {
+	  best = len;
+	  *dist = i - cand;
+	}
+  }
+  return best;
+}
+
+static void pack_insert( int i )
+{
+  if( i + 3 <= addr_end ) {
+	int h = pack_hash( image_buf + i );
+	chain[i] = head[h];
+	head[h] = i;
+  }
+}
+
+/*
+ * Pack image_buf.  base_buf, if loaded, is version base_ver that the
+ * nodes have installed under code_id.  Returns the number of bytes to
+ * send and points net_buf at them; the module goes as it is if packing
+ * does not make it smaller.
+ */
+static int pack_module( sos_code_id_t code_id, uint8_t base_ver )
+{
+  loader_image_hdr_t *hdr = (loader_image_hdr_t *) pack_buf;
+  unsigned int sum1 = 0, sum2 = 0;
+  int i, lit;
+
+  base_end = 0;
+  if( code_id != 0 && st.base_filename != NULL ) {
+	load_base_from_file( st.base_filename );
+  }
+  for( i = 0; i < PACK_HASH_SIZE; i++ ) {
+	head[i] = -1;
+	base_head[i] = -1;
+  }
+  for( i = base_end - 3; i >= 0; i-- ) {
+	if( base_reloc[i] == 0 && base_reloc[i + 1] == 0 && base_reloc[i + 2] == 0 ) {
+	  int h = pack_hash( base_buf + i );
+	  base_chain[i] = base_head[h];
+	  base_head[h] = i;
+	}
+  }
+
+  pack_end = sizeof(loader_image_hdr_t);
+  lit = 0;
+  i = 0;
+  while( i < addr_end ) {
+	int dist = 0, off = 0;
+	int wlen = window_match( i, &dist );
+	int blen = base_match( i, &off );
+	int len;
+
+	if( blen - PACK_BASE_COST >= wlen - PACK_MATCH_COST && blen > PACK_BASE_COST ) {
+	  pack_literals( lit, i );
+	  pack_byte( LOADER_OP_BASE | ((blen - 1) >> 8) );
+	  pack_byte( (blen - 1) & 0xff );
+	  pack_byte( off >> 8 );
+	  pack_byte( off & 0xff );
+	  len = blen;
+	} else if( wlen > PACK_MATCH_COST ) {
+	  pack_literals( lit, i );
+	  pack_byte( LOADER_OP_MATCH | (wlen - LOADER_MATCH_MIN) );
+	  pack_byte( dist >> 8 );
+	  pack_byte( dist & 0xff );
+	  len = wlen;
+	} else {
+	  pack_insert( i );
+	  i++;
+	  continue;
+	}
+	while( len-- > 0 ) {
+	  pack_insert( i++ );
+	}
+	lit = i;
+  }
+  pack_literals( lit, addr_end );
+
+  for( i = 0; i < addr_end; i++ ) {
+	sum1 = (sum1 + image_buf[i]) % 255;
+	sum2 = (sum2 + sum1) % 255;
+  }
+  hdr->magic = ehtons( LOADER_IMAGE_MAGIC );
+  hdr->encoding = (base_end > 0)? LOADER_IMAGE_DELTA : LOADER_IMAGE_LZ;
+  hdr->base_ver = (base_end > 0)? base_ver : 0;
+  hdr->size = ehtons( addr_end );
+  hdr->sum = ehtons( (sum2 << 8) | sum1 );
+  hdr->base = ehtons( (base_end > 0)? code_id : 0 );
+  hdr->base_size = ehtons( base_end );
+
+  if( pack_end >= addr_end ) {
+	net_buf = image_buf;
+	return addr_end;
+  }
+  net_buf = pack_buf;
+  return pack_end;
+}
+
+/*
+ * Tell the nodes what the image of module entry i needs, and serve the
+ * module itself under the raw key to the nodes that cannot use it.
+ */
+static void publish_raw( int i )
+{
+  loader_image_hdr_t *hdr = (loader_image_hdr_t *) pack_buf;
+  fetcher_cam_t *cam;
+
+  st.version_data->mod_base[i] = 0;
+  st.version_data->mod_raw_size[i] = (addr_end + (LOADER_SIZE_MULTIPLIER - 1)) / LOADER_SIZE_MULTIPLIER;
+  if( net_buf == image_buf ) {
+	return;
+  }
+  if( hdr->encoding == LOADER_IMAGE_DELTA ) {
+	st.version_data->mod_base[i] = hdr->base_ver;
+  }
+  cam = ker_malloc(sizeof(fetcher_cam_t), KER_DFT_LOADER_PID);
+  if( cam == NULL ) {
+	printf("ERROR: no memory for CAM\n");
+	hardware_exit(1);
+  }
+  cam->cm = flashImage( image_buf, addr_end );
+  cam->fetchtype = FETCHTYPE_DATA;
+  ker_shm_open( KER_DFT_LOADER_PID,
+	  sys_shm_name( KER_DFT_LOADER_PID, (LOADER_RAW_ENTRY + i)), cam);
+}
+#else
+static int pack_module( sos_code_id_t code_id, uint8_t base_ver )
+{
+  net_buf = image_buf;
+  return addr_end;
+}
+
+static void publish_raw( int i )
+{
+}
+#endif
+
 static void load_image_from_file( char *filename )
 {
   FILE *binFile;
@@ -738,6 +1145,7 @@ static int8_t handle_init()
 
   st.version_data = NULL;
   st.image_filename = NULL;
+  st.base_filename = NULL;
 
   return SOS_OK;
 }
@@ -764,6 +1172,11 @@ static int8_t loader_handler( void *state, Message *msg )
 	  st.type_requested = msg->type;
 	  return handle_insmod( msg );
 	}
+  case MSG_LOADER_UPDATE:
+	{
+	  st.type_requested = msg->type;
+	  return handle_update( msg );
+	}
   case MSG_LOADER_LDDATA:
 	{
 	  st.type_requested = msg->type;
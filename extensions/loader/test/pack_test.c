@@ -0,0 +1,481 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * \file pack_test.c
+ * \brief Round trip of the packed module images of the loader
+ *
+ * Packs modules with pack_module() of loader_pc.c, as LZ images and as
+ * deltas against an older version, and unpacks them with unpack_image()
+ * of loader.c against a codemem kept in RAM.  Checks that:
+ *   - every image unpacks to the module that was packed
+ *   - a delta is refused without the base it was made against
+ *   - a damaged or cut short image fails, and the partial module is freed
+ *
+ *   pack_test [-n rounds] [-s seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sos.h>
+#include <codemem.h>
+#include <sos_shm.h>
+#include <sos_timer.h>
+#include <sos_module_fetcher.h>
+#include <melfloader.h>
+#include "../loader.h"
+#include "pack_test.h"
+
+#define DEFAULT_ROUNDS   300
+#define DEFAULT_SEED     1
+#define MAX_MODULE       16000
+#define CODE_ID          0x1234
+#define NUM_CODEMEM      8
+#define CODEMEM_BYTES    65536L
+
+static int failures;
+static char image_file[] = "/tmp/pack_test_imageXXXXXX";
+static char base_file[] = "/tmp/pack_test_baseXXXXXX";
+
+//-----------------------------------------------------------------------------
+// codemem in RAM, only what the packed images need
+//-----------------------------------------------------------------------------
+static uint8_t cm_mem[NUM_CODEMEM][CODEMEM_BYTES];
+static uint16_t cm_size[NUM_CODEMEM];
+static bool cm_used[NUM_CODEMEM];
+
+codemem_t ker_codemem_alloc(uint16_t size, codemem_type_t type)
+{
+	codemem_t h;
+
+	for( h = 0; h < NUM_CODEMEM; h++ ) {
+		if( !cm_used[h] ) {
+			cm_used[h] = true;
+			cm_size[h] = size;
+			memset( cm_mem[h], 0xa5, CODEMEM_BYTES );
+			return h;
+		}
+	}
+	return CODEMEM_INVALID;
+}
+
+int8_t ker_codemem_free(codemem_t h)
+{
+	if( h == CODEMEM_INVALID ) {
+		return -ENOENT;
+	}
+	if( h >= NUM_CODEMEM || !cm_used[h] ) {
+		printf("FAIL: codemem %d freed twice\n", h);
+		failures++;
+		return -EINVAL;
+	}
+	cm_used[h] = false;
+	return SOS_OK;
+}
+
+int8_t ker_codemem_read(codemem_t h, sos_pid_t pid, void *buf, uint16_t nbytes, uint16_t offset)
+{
+	if( h >= NUM_CODEMEM || !cm_used[h] || (uint32_t)offset + nbytes > cm_size[h] ) {
+		return -EINVAL;
+	}
+	memcpy( buf, cm_mem[h] + offset, nbytes );
+	return SOS_OK;
+}
+
+int8_t ker_codemem_write(codemem_t h, sos_pid_t pid, void *buf, uint16_t nbytes, uint16_t offset)
+{
+	if( h >= NUM_CODEMEM || !cm_used[h] || (uint32_t)offset + nbytes > cm_size[h] ) {
+		return -EINVAL;
+	}
+	memcpy( cm_mem[h] + offset, buf, nbytes );
+	return SOS_OK;
+}
+
+int8_t ker_codemem_flush(codemem_t h, sos_pid_t pid)
+{
+	return SOS_OK;
+}
+
+mod_header_ptr ker_codemem_get_header_address(codemem_t h)
+{
+	if( h >= NUM_CODEMEM || !cm_used[h] ) {
+		return 0;
+	}
+	return (mod_header_ptr)cm_mem[h];
+}
+
+int8_t ker_codemem_mark_executable(codemem_t h)
+{
+	return SOS_OK;
+}
+
+static int codemem_in_use()
+{
+	int h, n = 0;
+
+	for( h = 0; h < NUM_CODEMEM; h++ ) {
+		n += cm_used[h];
+	}
+	return n;
+}
+
+static void codemem_reset()
+{
+	memset( cm_used, 0, sizeof(cm_used) );
+}
+
+//-----------------------------------------------------------------------------
+// the rest of the kernel is not used by the codec
+//-----------------------------------------------------------------------------
+void *sos_blk_mem_alloc(uint16_t size, sos_pid_t id, bool bCallFromModule) { return malloc( size ); }
+void sos_blk_mem_free(void *ptr, bool bCallFromModule) { free( ptr ); }
+void hardware_exit(int code) { exit( code ); }
+uint16_t ker_rand() { return rand(); }
+int8_t ker_shm_open(sos_pid_t pid, sos_shm_t name, void *shm) { return SOS_OK; }
+int8_t ker_shm_close(sos_pid_t pid, sos_shm_t name) { return SOS_OK; }
+void *ker_shm_get(sos_pid_t pid, sos_shm_t name) { return NULL; }
+int8_t fetcher_request(sos_pid_t req_id, sos_shm_t key, uint16_t size, uint16_t src) { return -EINVAL; }
+int8_t fetcher_cancel(sos_pid_t req_id, sos_shm_t key) { return -EINVAL; }
+void fetcher_commit(fetcher_state_t *s, bool commit) { }
+void fetcher_restart(fetcher_state_t *s, uint16_t src) { }
+int8_t melf_load_module(codemem_t h) { return -EINVAL; }
+mod_header_t *melf_get_mod_header(unsigned char *image_buf) { return (mod_header_t *) image_buf; }
+int8_t ker_register_module(mod_header_ptr h) { return -EINVAL; }
+uint8_t *ker_msg_take_data(sos_pid_t pid, Message *msg) { return NULL; }
+int8_t ker_permanent_timer_init(sos_timer_t *tt, sos_pid_t pid, uint8_t tid, uint8_t type) { return SOS_OK; }
+int8_t ker_timer_start(sos_pid_t pid, uint8_t tid, int32_t interval) { return SOS_OK; }
+int8_t ker_timer_stop(sos_pid_t pid, uint8_t tid) { return SOS_OK; }
+int8_t post_short(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t byte,
+		uint16_t word, uint16_t flag) { return SOS_OK; }
+int8_t post_link(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t len,
+		void *data, uint16_t flag, uint16_t daddr) { return SOS_OK; }
+
+//-----------------------------------------------------------------------------
+// modules
+//-----------------------------------------------------------------------------
+/**
+ * @brief something like a module: a header and code made of a few
+ * instructions with random operands, so that LZ finds matches
+ */
+static int make_module( uint8_t *buf, int size )
+{
+	static const uint8_t ops[][2] = {
+		{ 0x0e, 0x94 }, { 0x80, 0x91 }, { 0x90, 0x93 }, { 0x08, 0x95 },
+		{ 0x8f, 0x93 }, { 0x0c, 0x94 }, { 0x1f, 0x92 }, { 0xcf, 0x91 },
+	};
+	mod_header_t *hdr = (mod_header_t *) buf;
+	int i;
+
+	memset( buf, 0, sizeof(mod_header_t) );
+	hdr->code_id = ehtons( CODE_ID );
+	for( i = sizeof(mod_header_t); i + 4 <= size; i += 4 ) {
+		memcpy( buf + i, ops[rand() % 8], 2 );
+		buf[i + 2] = rand() % 16;
+		buf[i + 3] = rand() % 4;
+	}
+	for( ; i < size; i++ ) {
+		buf[i] = rand();
+	}
+	return size;
+}
+
+/**
+ * @brief the next version of the module in old, with a few changes
+ */
+static int edit_module( uint8_t *buf, uint8_t *old, int old_size )
+{
+	int size = 0, i = sizeof(mod_header_t);
+	int edits = 1 + rand() % 8;
+
+	memcpy( buf, old, i );
+	size = i;
+	while( edits-- > 0 ) {
+		int keep = rand() % ((old_size - i) / 2 + 1);
+		int n = 1 + rand() % 64;
+
+		memcpy( buf + size, old + i, keep );
+		size += keep;
+		i += keep;
+		switch( rand() % 3 ) {
+		case 0:   // new code
+			size += make_module( buf + size, n ) - sizeof(mod_header_t);
+			break;
+		case 1:   // code removed
+			i += n;
+			break;
+		default:  // code changed
+			memset( buf + size, rand(), n );
+			size += n;
+			i += n;
+			break;
+		}
+		if( i > old_size ) {
+			i = old_size;
+		}
+		if( size > MAX_MODULE ) {
+			size = MAX_MODULE;
+			return size;
+		}
+	}
+	if( size + old_size - i > MAX_MODULE ) {
+		old_size = MAX_MODULE - size + i;
+	}
+	memcpy( buf + size, old + i, old_size - i );
+	return size + old_size - i;
+}
+
+static void write_file( char *name, uint8_t *buf, int size )
+{
+	FILE *f = fopen( name, "w" );
+
+	if( f == NULL || fwrite( buf, 1, size, f ) != (size_t) size ) {
+		perror( name );
+		exit( 1 );
+	}
+	fclose( f );
+}
+
+//-----------------------------------------------------------------------------
+// round trip
+//-----------------------------------------------------------------------------
+enum {
+	DAMAGE_NONE = 0,
+	DAMAGE_BYTE,          //!< one byte of the image changed
+	DAMAGE_CUT,           //!< the image is fetched short
+};
+
+typedef struct {
+	const char *name;
+	uint8_t *module;
+	int size;
+	uint8_t *base;        //!< previous version of the module
+	int base_size;
+	bool installed;       //!< the node has base
+	bool delta;           //!< pack against base
+	uint8_t pack_ver;     //!< version the PC thinks the node has
+	uint8_t node_ver;     //!< version the node has
+	uint8_t damage;
+	int8_t expect;        //!< SOS_OK or the error unpack_image() returns
+	int encoding;         //!< expected encoding, -1 for a module sent as it is
+	bool raw_ok;          //!< a module too small to pack may also go as it is
+} round_trip_t;
+
+static int image_encoding( uint8_t *out, int n )
+{
+	loader_image_hdr_t hdr;
+
+	memcpy( &hdr, out, sizeof(hdr) );
+	if( n < (int) sizeof(hdr) || entohs( hdr.magic ) != LOADER_IMAGE_MAGIC ) {
+		return -1;
+	}
+	return hdr.encoding;
+}
+
+static void fail( round_trip_t *t, const char *what )
+{
+	printf("FAIL: %s: %s\n", t->name, what);
+	failures++;
+}
+
+static void round_trip( round_trip_t *t, int *packed_size )
+{
+	uint8_t *out;
+	codemem_t image, base = CODEMEM_INVALID, module;
+	int n, code_size, live;
+	int8_t ret;
+
+	codemem_reset();
+	write_file( image_file, t->module, t->size );
+	if( t->delta ) {
+		write_file( base_file, t->base, t->base_size );
+	}
+	n = test_pack( image_file, t->delta ? base_file : NULL, CODE_ID, t->pack_ver, &out );
+	if( packed_size != NULL ) {
+		*packed_size = n;
+	}
+	if( image_encoding( out, n ) != t->encoding &&
+			!(t->raw_ok && image_encoding( out, n ) == -1) ) {
+		fail( t, "unexpected encoding" );
+		return;
+	}
+
+	//! what the fetcher leaves on the node, the rest of the last page is junk
+	code_size = (n + LOADER_SIZE_MULTIPLIER - 1) / LOADER_SIZE_MULTIPLIER;
+	image = ker_codemem_alloc( code_size * LOADER_SIZE_MULTIPLIER, CODEMEM_TYPE_EXECUTABLE );
+	ker_codemem_write( image, KER_DFT_LOADER_PID, out, n, 0 );
+	if( t->damage == DAMAGE_BYTE ) {
+		cm_mem[image][sizeof(loader_image_hdr_t) + rand() % (n - sizeof(loader_image_hdr_t))] ^= 0x5a;
+	} else if( t->damage == DAMAGE_CUT ) {
+		code_size = (n / 2) / LOADER_SIZE_MULTIPLIER;
+	}
+	//! the node holds a module as loader_pc.c loads it from the file
+	if( t->installed ) {
+		base = ker_codemem_alloc( t->base_size + 1, CODEMEM_TYPE_EXECUTABLE );
+		ker_codemem_write( base, KER_DFT_LOADER_PID, t->base, t->base_size, 0 );
+		cm_mem[base][t->base_size] = 0xff;
+	}
+
+	ret = test_unpack( image, code_size, base, t->node_ver, &module );
+	if( ret != t->expect && !(t->expect != SOS_OK && ret != SOS_OK) ) {
+		printf("FAIL: %s: unpack_image() returned %d\n", t->name, ret);
+		failures++;
+		return;
+	}
+	if( ret == SOS_OK ) {
+		if( cm_size[module] < t->size + 1 ||
+				memcmp( cm_mem[module], t->module, t->size ) != 0 ||
+				cm_mem[module][t->size] != 0xff ) {
+			fail( t, "module differs" );
+		}
+		if( t->installed && cm_used[base] ) {
+			fail( t, "previous version not freed" );
+		}
+	}
+	//! only the fetched image, the module and a base kept on failure are left
+	live = 1;
+	if( ret == SOS_OK && module != image ) {
+		live++;
+	}
+	if( ret != SOS_OK && t->installed ) {
+		live++;
+	}
+	if( codemem_in_use() != live ) {
+		fail( t, "codemem leaked" );
+	}
+}
+
+static void test_cases()
+{
+	static uint8_t old[MAX_MODULE], new[MAX_MODULE], noise[MAX_MODULE];
+	int old_size, new_size, i;
+	int lz_size, delta_size;
+	round_trip_t t;
+
+	old_size = make_module( old, 6000 );
+	new_size = edit_module( new, old, old_size );
+	for( i = 0; i < 3000; i++ ) {
+		noise[i] = rand();
+	}
+
+	memset( &t, 0, sizeof(t) );
+	t.name = "lz";
+	t.module = new;
+	t.size = new_size;
+	t.encoding = LOADER_IMAGE_LZ;
+	round_trip( &t, &lz_size );
+
+	t.name = "lz over an installed version";
+	t.base = old;
+	t.base_size = old_size;
+	t.installed = true;
+	t.node_ver = 3;
+	round_trip( &t, NULL );
+
+	t.name = "delta";
+	t.delta = true;
+	t.pack_ver = 3;
+	t.encoding = LOADER_IMAGE_DELTA;
+	round_trip( &t, &delta_size );
+	if( delta_size >= lz_size ) {
+		fail( &t, "delta not smaller than lz" );
+	}
+	printf("module %d bytes, lz %d, delta %d\n", new_size + 1, lz_size, delta_size);
+
+	t.name = "delta without its base";
+	t.installed = false;
+	t.expect = -ENOENT;
+	round_trip( &t, NULL );
+
+	t.name = "delta against another version";
+	t.installed = true;
+	t.node_ver = 2;
+	round_trip( &t, NULL );
+
+	t.name = "delta with a damaged byte";
+	t.node_ver = 3;
+	t.damage = DAMAGE_BYTE;
+	t.expect = -EINVAL;
+	round_trip( &t, NULL );
+
+	t.name = "delta fetched short";
+	t.damage = DAMAGE_CUT;
+	round_trip( &t, NULL );
+
+	memset( &t, 0, sizeof(t) );
+	t.name = "lz with a damaged byte";
+	t.module = new;
+	t.size = new_size;
+	t.encoding = LOADER_IMAGE_LZ;
+	t.damage = DAMAGE_BYTE;
+	t.expect = -EINVAL;
+	round_trip( &t, NULL );
+
+	t.name = "lz fetched short";
+	t.damage = DAMAGE_CUT;
+	round_trip( &t, NULL );
+
+	memset( &t, 0, sizeof(t) );
+	t.name = "incompressible module sent as it is";
+	t.module = noise;
+	t.size = 3000;
+	t.encoding = -1;
+	round_trip( &t, NULL );
+}
+
+static void test_random( int rounds )
+{
+	static uint8_t old[MAX_MODULE], new[MAX_MODULE];
+	round_trip_t t;
+	int i;
+
+	for( i = 0; i < rounds; i++ ) {
+		memset( &t, 0, sizeof(t) );
+		t.name = "random";
+		t.base_size = make_module( old, sizeof(mod_header_t) + 64 + rand() % (MAX_MODULE / 2) );
+		t.size = edit_module( new, old, t.base_size );
+		t.module = new;
+		t.base = old;
+		t.installed = true;
+		t.delta = (i % 2) == 0;
+		t.pack_ver = t.node_ver = 1 + rand() % 0x7f;
+		t.encoding = t.delta ? LOADER_IMAGE_DELTA : LOADER_IMAGE_LZ;
+		t.raw_ok = !t.delta;
+		round_trip( &t, NULL );
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = DEFAULT_ROUNDS;
+	int seed = DEFAULT_SEED;
+	int c, fd;
+
+	while( (c = getopt( argc, argv, "n:s:" )) != -1 ) {
+		switch( c ) {
+		case 'n': rounds = atoi( optarg ); break;
+		case 's': seed = atoi( optarg ); break;
+		default:
+			fprintf(stderr, "usage: %s [-n rounds] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+	srand( seed );
+	if( (fd = mkstemp( image_file )) < 0 || close( fd ) < 0 ||
+			(fd = mkstemp( base_file )) < 0 || close( fd ) < 0 ) {
+		perror( "mkstemp" );
+		return 2;
+	}
+
+	test_cases();
+	test_random( rounds );
+
+	unlink( image_file );
+	unlink( base_file );
+	if( failures != 0 ) {
+		printf("pack_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("pack_test: ok, %d random round trips\n", rounds);
+	return 0;
+}
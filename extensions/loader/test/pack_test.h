@@ -0,0 +1,22 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+#ifndef _PACK_TEST_H_
+#define _PACK_TEST_H_
+
+/**
+ * @brief pack the module in file image, as a delta against file base if
+ * base is not NULL
+ * @return size of the image to send, *out points at it
+ */
+extern int test_pack( char *image, char *base, sos_code_id_t code_id, uint8_t base_ver, uint8_t **out );
+
+/**
+ * @brief unpack image as the loader does when its fetch is done
+ * @param base      installed module, or CODEMEM_INVALID
+ * @param base_ver  its version
+ * @return result of unpack_image(), *out is the module on SOS_OK
+ */
+extern int8_t test_unpack( codemem_t image, uint8_t code_size, codemem_t base, uint8_t base_ver,
+		codemem_t *out );
+
+#endif
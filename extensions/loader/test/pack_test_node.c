@@ -0,0 +1,27 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * \file pack_test_node.c
+ * \brief The node side of pack_test, unpack_image() of loader.c
+ */
+#include "../loader.c"
+
+#include "pack_test.h"
+
+int8_t test_unpack( codemem_t image, uint8_t code_size, codemem_t base, uint8_t base_ver,
+		codemem_t *out )
+{
+	loader_cam_t cam;
+	int8_t ret;
+
+	memset( &cam, 0, sizeof(cam) );
+	cam.code_size = code_size;
+	cam.fetcher.cm = image;
+	cam.image.cm = CODEMEM_INVALID;
+	cam.image.status = FETCHING_DONE;
+	cam.base = base;
+	cam.base_ver = base_ver;
+	ret = unpack_image( &cam, sys_shm_name( KER_DFT_LOADER_PID, NUM_LOADER_PARAMS_ENTRIES ) );
+	*out = cam.image.cm;
+	return ret;
+}
@@ -0,0 +1,19 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * \file pack_test_pc.c
+ * \brief The PC side of pack_test, pack_module() of loader_pc.c
+ */
+#define loader_get_header loader_pc_get_header
+#include "../loader_pc.c"
+
+#include "pack_test.h"
+
+int test_pack( char *image, char *base, sos_code_id_t code_id, uint8_t base_ver, uint8_t **out )
+{
+	load_image_from_file( image );
+	st.base_filename = base;
+	net_end = pack_module( code_id, base_ver );
+	*out = net_buf;
+	return net_end;
+}
@@ -0,0 +1,619 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+/**
+ * @brief log of sensor data on the external flash, see logstore.h
+ *
+ * Two pages in RAM: one is filled by ker_logstore_append() while the other
+ * one goes to the flash.  A page of the log is written with the built-in
+ * erase of the chip, one erase cycle per page and lap.  Page n of the log
+ * sits at flash page (n + offset) mod LOGSTORE_NUM_PAGES, the offset is
+ * found again at boot from the newest page.
+ */
+#include <sos.h>
+#include <hardware.h>
+#include <crc.h>
+#include <sos_timer.h>
+#ifdef SOS_USE_PREEMPTION
+#include <priority.h>
+#endif
+#include <logstore/logstore.h>
+
+#ifndef LOGSTORE_FIRST_PAGE
+#define LOGSTORE_FIRST_PAGE   0                   //!< first flash page of the log
+#endif
+#ifndef LOGSTORE_NUM_PAGES
+#define LOGSTORE_NUM_PAGES    EXFLASH_MAX_PAGES   //!< flash pages of the log
+#endif
+#ifndef LOGSTORE_INDEX_SIZE
+#define LOGSTORE_INDEX_SIZE   32                  //!< entries of the RAM index
+#endif
+#ifndef LOGSTORE_RETRY_MS
+#define LOGSTORE_RETRY_MS     16                  //!< wait for a busy flash
+#endif
+//! define LOGSTORE_OVERWRITE to drop the oldest page when the log is full
+
+//! flash pages per index entry
+#define LOGSTORE_GROUP_PAGES \
+	((LOGSTORE_NUM_PAGES + LOGSTORE_INDEX_SIZE - 1) / LOGSTORE_INDEX_SIZE)
+
+#define LOGSTORE_RETRY_TID    0
+#define LOGSTORE_ERASED       0xffffffffUL
+
+/**
+ * @brief head of a log page, the records follow
+ */
+typedef struct {
+	uint16_t crc;         //!< of the rest of the header and the records
+	uint8_t len;          //!< bytes of records
+	uint8_t sensors;      //!< sensors with records in the page
+	uint32_t seq;         //!< page of the log, all ones on an erased page
+	uint32_t tail;        //!< oldest page of the log when this one was written
+	uint32_t min_time;    //!< span of the record timestamps
+	uint32_t max_time;
+} logstore_hdr_t;
+
+#define LOGSTORE_PAYLOAD  (EXFLASH_PAGE_SIZE - sizeof(logstore_hdr_t))
+#define LOGSTORE_REC_HDR  sizeof(sensor_data_msg_t)
+
+typedef struct {
+	logstore_hdr_t hdr;
+	uint8_t data[LOGSTORE_PAYLOAD];
+} logstore_page_t;
+
+/**
+ * @brief what a group of LOGSTORE_GROUP_PAGES flash pages holds
+ */
+typedef struct {
+	uint32_t min_time;
+	uint32_t max_time;
+	uint8_t sensors;      //!< 0 when no page of the group holds records
+} logstore_index_t;
+
+//! flash operation in progress
+enum {
+	OP_IDLE = 0,
+	OP_WAIT,              // the flash was busy, wait for the retry timer
+	OP_RECOVER_READ,      // header of a page
+	OP_RECOVER_CRC,       // records of the page
+	OP_WRITE_ERASE,       // tell the flash not to read the page in
+	OP_WRITE_DATA,
+	OP_WRITE_FLUSH,
+	OP_SCAN_READ,
+};
+
+static struct {
+	uint8_t op;
+	bool ready;           // recovery done
+	bool found;           // recovery found a good page
+	uint16_t recover_page;
+	logstore_hdr_t hdr;   // header read during recovery
+	uint32_t tail;        // oldest page of the log
+	uint32_t end;         // page of the log written next
+	uint16_t offset;      // flash page of page 0, modulo LOGSTORE_NUM_PAGES
+	bool tail_dirty;      // tail has not been written yet
+	uint8_t fill;         // RAM page being filled
+	bool pending;         // the other RAM page waits for the flash
+	sos_pid_t sync_pid;
+	sos_pid_t scan_pid;
+	logstore_query_t query;
+	uint32_t scan_seq;
+	uint8_t scan_pages;   // pages delivered
+	logstore_page_t *scan_buf;
+} s;
+
+static logstore_page_t ram[2];
+static logstore_index_t group[LOGSTORE_INDEX_SIZE];
+
+static int8_t logstore_handler(void *state, Message *msg);
+
+#ifndef SOS_USE_PREEMPTION
+static sos_module_t logstore_module;
+#endif
+
+static mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = KER_LOGSTORE_PID,
+	.state_size     = 0,
+	.num_timers     = 1,
+	.num_sub_func   = 0,
+	.num_prov_func  = 0,
+	.module_handler = logstore_handler,
+};
+
+static void logstore_run(void);
+
+static uint16_t page_of(uint32_t seq)
+{
+	return (uint16_t)((seq + s.offset) % LOGSTORE_NUM_PAGES);
+}
+
+static exflashpage_t flash_page(uint16_t page)
+{
+	return LOGSTORE_FIRST_PAGE + page;
+}
+
+static bool log_full(void)
+{
+	return s.end - s.tail >= LOGSTORE_NUM_PAGES;
+}
+
+/**
+ * @brief samples that fit into a record of at most bytes
+ */
+static uint16_t samples_in(uint16_t bytes)
+{
+	return bytes > LOGSTORE_REC_HDR ? (bytes - LOGSTORE_REC_HDR) / sizeof(uint16_t) : 0;
+}
+
+static uint16_t page_room(void)
+{
+	return samples_in(LOGSTORE_PAYLOAD - ram[s.fill].hdr.len);
+}
+
+static uint16_t crc_page(logstore_page_t *p)
+{
+	uint8_t *b = (uint8_t*)&(p->hdr.len);
+	uint16_t n = sizeof(logstore_hdr_t) - sizeof(uint16_t) + p->hdr.len;
+	uint16_t crc = 0;
+
+	while (n-- > 0) {
+		crc = crcByte(crc, *b++);
+	}
+	return crc;
+}
+
+static void page_reset(logstore_page_t *p)
+{
+	p->hdr.len = 0;
+	p->hdr.sensors = 0;
+	p->hdr.min_time = LOGSTORE_ERASED;
+	p->hdr.max_time = 0;
+}
+
+static bool span_match(uint8_t sensors, uint32_t min_time, uint32_t max_time)
+{
+	return (sensors & s.query.sensors) != 0 &&
+		min_time <= s.query.end_time && max_time >= s.query.start_time;
+}
+
+static void group_add(uint16_t page, logstore_hdr_t *hdr)
+{
+	logstore_index_t *g = &group[page / LOGSTORE_GROUP_PAGES];
+
+	if (hdr->sensors == 0) return;
+	if (g->sensors == 0) {
+		g->min_time = hdr->min_time;
+		g->max_time = hdr->max_time;
+	} else {
+		if (hdr->min_time < g->min_time) g->min_time = hdr->min_time;
+		if (hdr->max_time > g->max_time) g->max_time = hdr->max_time;
+	}
+	g->sensors |= hdr->sensors;
+}
+
+/**
+ * @brief hand a request to the flash, or try again after a while
+ */
+static bool flash_started(int8_t ret, uint8_t op)
+{
+	if (ret == SOS_OK) {
+		s.op = op;
+		return true;
+	}
+	s.op = OP_WAIT;
+	ker_timer_start(KER_LOGSTORE_PID, LOGSTORE_RETRY_TID, LOGSTORE_RETRY_MS);
+	return false;
+}
+
+//
+// Recovery
+//
+static void recover_read(void)
+{
+	flash_started(ker_exflash_read(KER_LOGSTORE_PID, flash_page(s.recover_page),
+				0, &s.hdr, sizeof(logstore_hdr_t)), OP_RECOVER_READ);
+}
+
+static void recover_header(bool ok)
+{
+	if (ok && s.hdr.seq != LOGSTORE_ERASED && s.hdr.len <= LOGSTORE_PAYLOAD) {
+		flash_started(ker_exflash_computeCrc(KER_LOGSTORE_PID, flash_page(s.recover_page),
+					sizeof(uint16_t), sizeof(logstore_hdr_t) - sizeof(uint16_t) + s.hdr.len),
+				OP_RECOVER_CRC);
+		return;
+	}
+	s.recover_page++;
+}
+
+static void recover_page(bool ok, uint16_t crc)
+{
+	if (ok && crc == s.hdr.crc) {
+		if (!s.found || s.hdr.seq >= s.end) {
+			s.found = true;
+			s.end = s.hdr.seq + 1;
+			s.tail = s.hdr.tail;
+			s.offset = (uint16_t)((s.recover_page + LOGSTORE_NUM_PAGES -
+						s.hdr.seq % LOGSTORE_NUM_PAGES) % LOGSTORE_NUM_PAGES);
+		}
+		// pages of an older lap may be in the index, that only costs a read
+		group_add(s.recover_page, &s.hdr);
+	}
+	s.recover_page++;
+}
+
+static void recover_done(void)
+{
+	if (!s.found) {
+		s.end = s.tail = 0;
+		s.offset = 0;
+	}
+	s.ready = true;
+	DEBUG("logstore: pages %lu to %lu\n", (unsigned long)s.tail, (unsigned long)s.end);
+}
+
+//
+// Writing
+//
+static void seal(void)
+{
+	s.pending = true;
+	s.fill = !s.fill;
+	page_reset(&ram[s.fill]);
+}
+
+/**
+ * @brief start writing the pending page
+ * @return false if the log is full
+ */
+static bool write_start(void)
+{
+	logstore_page_t *p = &ram[!s.fill];
+
+	if (log_full()) {
+#ifdef LOGSTORE_OVERWRITE
+		s.tail = s.end - LOGSTORE_NUM_PAGES + 1;
+#else
+		return false;
+#endif
+	}
+	p->hdr.seq = s.end;
+	p->hdr.tail = s.tail;
+	p->hdr.crc = crc_page(p);
+	s.tail_dirty = false;
+	flash_started(ker_exflash_erase(KER_LOGSTORE_PID, flash_page(page_of(s.end)),
+				EXFLASH_DONT_ERASE), OP_WRITE_ERASE);
+	return true;
+}
+
+static void write_done(void)
+{
+	uint16_t page = page_of(s.end);
+	logstore_index_t *g = &group[page / LOGSTORE_GROUP_PAGES];
+
+	// Entering a group, forget the pages of the last lap unless the
+	// rest of the group still holds live pages
+	if (page % LOGSTORE_GROUP_PAGES == 0 &&
+			s.end + LOGSTORE_GROUP_PAGES <= s.tail + LOGSTORE_NUM_PAGES) {
+		g->sensors = 0;
+	}
+	group_add(page, &(ram[!s.fill].hdr));
+	s.end++;
+	s.pending = false;
+}
+
+static void page_add(sensor_data_msg_t *data, uint16_t first, uint16_t n)
+{
+	logstore_page_t *p = &ram[s.fill];
+	sensor_data_msg_t rec;
+
+	rec.status = data->status;
+	rec.sensor = data->sensor;
+	rec.num_samples = n;
+	rec.timestamp = data->timestamp;
+	memcpy(p->data + p->hdr.len, &rec, LOGSTORE_REC_HDR);
+	memcpy(p->data + p->hdr.len + LOGSTORE_REC_HDR, data->buf + first, n * sizeof(uint16_t));
+	p->hdr.len += LOGSTORE_REC_HDR + n * sizeof(uint16_t);
+	p->hdr.sensors |= LOGSTORE_SENSOR(data->sensor);
+	if (data->timestamp < p->hdr.min_time) p->hdr.min_time = data->timestamp;
+	if (data->timestamp > p->hdr.max_time) p->hdr.max_time = data->timestamp;
+}
+
+//
+// Scanning
+//
+static void scan_done(int16_t status)
+{
+	post_short(s.scan_pid, KER_LOGSTORE_PID, MSG_LOGSTORE, LOGSTORE_SCAN_DONE, (uint16_t)status, 0);
+	s.scan_pid = NULL_PID;
+}
+
+static void scan_next(void)
+{
+	uint16_t page = 0;
+
+	if (s.scan_seq < s.tail) s.scan_seq = s.tail;
+	// skip the groups that cannot match
+	while (s.scan_seq < s.end) {
+		logstore_index_t *g;
+
+		page = page_of(s.scan_seq);
+		g = &group[page / LOGSTORE_GROUP_PAGES];
+		if (span_match(g->sensors, g->min_time, g->max_time)) break;
+		if (LOGSTORE_NUM_PAGES - page < LOGSTORE_GROUP_PAGES - page % LOGSTORE_GROUP_PAGES) {
+			s.scan_seq += LOGSTORE_NUM_PAGES - page;
+		} else {
+			s.scan_seq += LOGSTORE_GROUP_PAGES - page % LOGSTORE_GROUP_PAGES;
+		}
+	}
+	if (s.scan_seq >= s.end ||
+			(s.query.max_pages != 0 && s.scan_pages == s.query.max_pages)) {
+		scan_done(s.scan_pages);
+		return;
+	}
+	s.scan_buf = (logstore_page_t*)ker_malloc(sizeof(logstore_page_t), KER_LOGSTORE_PID);
+	if (s.scan_buf == NULL) {
+		scan_done(-ENOMEM);
+		return;
+	}
+	if (!flash_started(ker_exflash_read(KER_LOGSTORE_PID, flash_page(page), 0,
+					s.scan_buf, sizeof(logstore_page_t)), OP_SCAN_READ)) {
+		ker_free(s.scan_buf);
+		s.scan_buf = NULL;
+	}
+}
+
+/**
+ * @brief move the matching records of the page to the front of the buffer
+ * @return bytes of records kept
+ */
+static uint8_t scan_filter(logstore_page_t *p, uint8_t *out)
+{
+	uint8_t *rec = p->data;
+	uint8_t *end = p->data + p->hdr.len;
+	uint8_t *next = out;
+
+	while (rec + LOGSTORE_REC_HDR <= end) {
+		sensor_data_msg_t h;
+		uint16_t size;
+
+		memcpy(&h, rec, LOGSTORE_REC_HDR);
+		size = LOGSTORE_REC_HDR + h.num_samples * sizeof(uint16_t);
+		if (rec + size > end) break;
+		if ((s.query.sensors & LOGSTORE_SENSOR(h.sensor)) != 0 &&
+				h.timestamp >= s.query.start_time && h.timestamp <= s.query.end_time) {
+			memmove(next, rec, size);
+			next += size;
+		}
+		rec += size;
+	}
+	return next - out;
+}
+
+static void scan_deliver(bool ok)
+{
+	logstore_page_t *p = s.scan_buf;
+	logstore_data_msg_t *out = (logstore_data_msg_t*)p;
+	uint32_t seq = s.scan_seq;
+	uint8_t len = 0;
+	int8_t ret;
+
+	s.scan_buf = NULL;
+	s.scan_seq++;
+	// the header is overwritten by the records
+	if (ok && p->hdr.seq == seq &&
+			span_match(p->hdr.sensors, p->hdr.min_time, p->hdr.max_time)) {
+		len = scan_filter(p, out->data);
+	}
+	if (len == 0) {
+		ker_free(p);
+		return;
+	}
+	out->seq = seq;
+	ret = post_long(s.scan_pid, KER_LOGSTORE_PID, MSG_LOGSTORE_DATA,
+			offsetof(logstore_data_msg_t, data) + len, out, SOS_MSG_RELEASE);
+	if (ret != SOS_OK) {
+		scan_done(ret);
+		return;
+	}
+	s.scan_pages++;
+}
+
+static void flash_done(bool ok, uint16_t crc)
+{
+	uint8_t op = s.op;
+
+	s.op = OP_IDLE;
+	switch (op) {
+		case OP_RECOVER_READ:
+			recover_header(ok);
+			break;
+		case OP_RECOVER_CRC:
+			recover_page(ok, crc);
+			break;
+		case OP_WRITE_ERASE:
+			flash_started(ok ? ker_exflash_write(KER_LOGSTORE_PID, flash_page(page_of(s.end)),
+						0, &ram[!s.fill], sizeof(logstore_page_t)) : -EIO, OP_WRITE_DATA);
+			break;
+		case OP_WRITE_DATA:
+			flash_started(ok ? ker_exflash_flush(KER_LOGSTORE_PID, flash_page(page_of(s.end))) : -EIO,
+					OP_WRITE_FLUSH);
+			break;
+		case OP_WRITE_FLUSH:
+			if (ok) {
+				write_done();
+			} else {
+				flash_started(-EIO, OP_IDLE);
+			}
+			break;
+		case OP_SCAN_READ:
+			scan_deliver(ok);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief start the next flash operation: recovery, then writes, then scans
+ */
+static void logstore_run(void)
+{
+	if (s.op != OP_IDLE) return;
+	if (!s.ready) {
+		if (s.recover_page < LOGSTORE_NUM_PAGES) {
+			recover_read();
+			return;
+		}
+		recover_done();
+	}
+	if (!s.pending && (page_room() == 0 ||
+				(s.sync_pid != NULL_PID && (ram[s.fill].hdr.len != 0 || s.tail_dirty)))) {
+		seal();
+	}
+	if (s.pending && write_start()) return;
+	if (s.sync_pid != NULL_PID) {
+		// still pending, the log is full until it is trimmed
+		post_short(s.sync_pid, KER_LOGSTORE_PID, MSG_LOGSTORE, LOGSTORE_SYNC_DONE,
+				s.pending ? (uint16_t)-ENOSPC : 0, 0);
+		s.sync_pid = NULL_PID;
+	}
+	if (s.scan_pid != NULL_PID) {
+		scan_next();
+	}
+}
+
+static int8_t logstore_handler(void *state, Message *msg)
+{
+	MsgParam *p = (MsgParam*)(msg->data);
+
+	switch (msg->type) {
+		case MSG_INIT:
+		{
+			ker_timer_init(KER_LOGSTORE_PID, LOGSTORE_RETRY_TID, TIMER_ONE_SHOT);
+			logstore_run();
+			break;
+		}
+		case MSG_TIMER_TIMEOUT:
+		{
+			if (s.op == OP_WAIT) s.op = OP_IDLE;
+			logstore_run();
+			break;
+		}
+		case MSG_EXFLASH_READDONE:
+		case MSG_EXFLASH_CRCDONE:
+		case MSG_EXFLASH_WRITEDONE:
+		case MSG_EXFLASH_FLUSHDONE:
+		case MSG_EXFLASH_ERASEDONE:
+		{
+			flash_done(p->byte != 0, p->word);
+			logstore_run();
+			break;
+		}
+		default:
+			return -EINVAL;
+	}
+	return SOS_OK;
+}
+
+int8_t ker_logstore_append(sensor_data_msg_t *data)
+{
+	uint16_t n, done = 0;
+
+	if (data == NULL || data->sensor >= MAX_NUM_SENSORS ||
+			data->num_samples > 2 * samples_in(LOGSTORE_PAYLOAD)) {
+		return -EINVAL;
+	}
+	n = data->num_samples;
+	if (n == 0) return SOS_OK;
+	if (n > page_room() + (s.pending ? 0 : samples_in(LOGSTORE_PAYLOAD))) {
+		// a fresh page may take it
+		if (!s.pending && ram[s.fill].hdr.len != 0) {
+			seal();
+			logstore_run();
+		}
+		if (n > page_room()) {
+			return (s.pending && log_full()) ? -ENOSPC : -EBUSY;
+		}
+	}
+	while (done < n) {
+		uint16_t k = page_room();
+
+		if (k == 0) {
+			seal();
+			continue;
+		}
+		if (k > n - done) k = n - done;
+		page_add(data, done, k);
+		done += k;
+	}
+	logstore_run();
+	return SOS_OK;
+}
+
+int8_t ker_logstore_scan(sos_pid_t pid, logstore_query_t *query)
+{
+	if (query == NULL) return -EINVAL;
+	if (s.scan_pid != NULL_PID) return -EBUSY;
+	s.scan_pid = pid;
+	s.query = *query;
+	s.scan_seq = query->from_seq;
+	s.scan_pages = 0;
+	logstore_run();
+	return SOS_OK;
+}
+
+int8_t ker_sys_logstore_scan(logstore_query_t *query)
+{
+	return ker_logstore_scan(ker_get_current_pid(), query);
+}
+
+int8_t ker_logstore_sync(sos_pid_t pid)
+{
+	if (s.sync_pid != NULL_PID && s.sync_pid != pid) return -EBUSY;
+	s.sync_pid = pid;
+	logstore_run();
+	return SOS_OK;
+}
+
+int8_t ker_sys_logstore_sync(void)
+{
+	return ker_logstore_sync(ker_get_current_pid());
+}
+
+int8_t ker_logstore_trim(uint32_t seq)
+{
+	if (!s.ready) return -EBUSY;
+	if (seq >= s.end) seq = s.end - 1;
+	if (s.end == 0 || seq < s.tail) return SOS_OK;
+	s.tail = seq + 1;
+	s.tail_dirty = true;
+	// a full log can take the pending page now
+	logstore_run();
+	return SOS_OK;
+}
+
+int8_t ker_logstore_info(logstore_info_t *info)
+{
+	if (info == NULL) return -EINVAL;
+	info->tail = s.tail;
+	info->end = s.end;
+	info->num_pages = LOGSTORE_NUM_PAGES;
+	info->ready = s.ready;
+	return SOS_OK;
+}
+
+int8_t logstore_init(void)
+{
+	memset(&s, 0, sizeof(s));
+	memset(group, 0, sizeof(group));
+	s.op = OP_IDLE;
+	s.sync_pid = NULL_PID;
+	s.scan_pid = NULL_PID;
+	page_reset(&ram[s.fill]);
+#ifdef SOS_USE_PREEMPTION
+	ker_register_module(sos_get_header_address(mod_header));
+#else
+	sched_register_kernel_module(&logstore_module, sos_get_header_address(mod_header), NULL);
+#endif
+	return SOS_OK;
+}
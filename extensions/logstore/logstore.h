@@ -0,0 +1,126 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+#ifndef _LOGSTORE_H_
+#define _LOGSTORE_H_
+
+#include <sos_types.h>
+#include <message_types.h>
+#include <sensor_system.h>
+
+/**
+ * @brief log of sensor data on the external flash
+ *
+ * Sensor data buffers are appended to a page in RAM.  A full page is
+ * written to the next flash page of the log with a sequence number and
+ * a CRC.  Pages are taken round robin, so every page of the log sees the
+ * same number of erase cycles.  At boot the log continues after the
+ * newest good page; a page torn by a reset fails its CRC and is reused.
+ * A small RAM index keeps the time span and the sensors of each group
+ * of pages, so that a scan only reads the pages that can match.
+ *
+ * Pages are numbered by their sequence number.  The log holds the pages
+ * from the tail up to the newest page written; sys_logstore_trim() moves
+ * the tail once the data has been drained.
+ *
+ * Build with LOGSTORE=true.
+ */
+
+//! event of a MSG_LOGSTORE message
+enum {
+	LOGSTORE_SCAN_DONE = 1,   //!< the scan ended, see logstore_get_status()
+	LOGSTORE_SYNC_DONE = 2,   //!< data appended before sys_logstore_sync() is on the flash, see logstore_get_status()
+};
+
+//! sensor mask bit of a sensor
+#define LOGSTORE_SENSOR(sensor)  ((uint8_t)(1 << (sensor)))
+#define LOGSTORE_ALL_SENSORS     0xff
+
+/**
+ * @brief range scan
+ */
+typedef struct {
+	uint32_t from_seq;    //!< first log page to look at
+	uint32_t start_time;  //!< earliest timestamp, inclusive
+	uint32_t end_time;    //!< latest timestamp, inclusive
+	uint8_t sensors;      //!< LOGSTORE_SENSOR() mask
+	uint8_t max_pages;    //!< pages to deliver before the scan ends, 0 for all
+} logstore_query_t;
+
+/**
+ * @brief Message Content (MSG_LOGSTORE_DATA)
+ *
+ * The matching records of one log page.  Every record is a
+ * sensor_data_msg_t with its samples, the next one follows directly.  A
+ * buffer that did not fit into a page is split into records that all
+ * carry the timestamp of the buffer.
+ */
+typedef struct {
+	uint32_t seq;         //!< log page the records were read from
+	uint8_t data[];
+} logstore_data_msg_t;
+
+//! size of a record in a MSG_LOGSTORE_DATA message
+#define LOGSTORE_RECORD_SIZE(rec) \
+	(sizeof(sensor_data_msg_t) + (rec)->num_samples * sizeof(uint16_t))
+
+typedef struct {
+	uint32_t tail;        //!< oldest page of the log
+	uint32_t end;         //!< one past the newest page on the flash
+	uint16_t num_pages;   //!< flash pages of the log
+	bool ready;           //!< the log has been recovered
+} logstore_info_t;
+
+static inline uint8_t logstore_get_event( Message *msg )
+{
+	MsgParam* params = (MsgParam*)(msg->data);
+	return params->byte;
+}
+
+/**
+ * @brief LOGSTORE_SCAN_DONE: pages delivered, or -errno if the scan stopped early
+ *
+ * LOGSTORE_SYNC_DONE: SOS_OK, or -ENOSPC if the log is full
+ */
+static inline int16_t logstore_get_status( Message *msg )
+{
+	MsgParam* params = (MsgParam*)(msg->data);
+	return (int16_t)params->word;
+}
+
+#ifndef _MODULE_
+/**
+ * @brief recover the log, needs the external flash
+ */
+int8_t logstore_init(void);
+
+/**
+ * @brief copy a sensor data buffer into the log
+ * @return SOS_OK, -EBUSY if the flash is behind, -ENOSPC if the log is full,
+ * -EINVAL if the buffer is larger than two pages
+ */
+int8_t ker_logstore_append(sensor_data_msg_t *data);
+
+/**
+ * @brief deliver the matching records as MSG_LOGSTORE_DATA, one message per page
+ * @return SOS_OK, -EBUSY if a scan is already running
+ * @event MSG_LOGSTORE, LOGSTORE_SCAN_DONE
+ */
+int8_t ker_logstore_scan(sos_pid_t pid, logstore_query_t *query);
+
+/**
+ * @brief write the page being filled, and the tail
+ * @event MSG_LOGSTORE, LOGSTORE_SYNC_DONE with the status
+ */
+int8_t ker_logstore_sync(sos_pid_t pid);
+
+/**
+ * @brief drop the pages up to and including seq
+ *
+ * The new tail is written with the next page, sys_logstore_sync() forces it.
+ */
+int8_t ker_logstore_trim(uint32_t seq);
+
+int8_t ker_logstore_info(logstore_info_t *info);
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+/**
+ * @brief unit test of the sensor data log
+ *
+ * At boot the test counts the samples that survived in the log.  It then
+ * appends TEST_BUFFERS sensor buffers as fast as the log takes them, reads
+ * them all back a few pages at a time, and runs a range scan over one
+ * sensor.  Sample j of buffer i is (i << 8) | j.
+ */
+#include <sys_module.h>
+
+#define TEST_PID          DFLT_APP_ID0
+#define TEST_TID          0
+#define TEST_BUFFERS      400
+#define TEST_MAX_SAMPLES  64
+#define TEST_DRAIN_PAGES  8
+#define TEST_SENSOR       1
+#define TEST_FROM         100   //!< buffers of the range scan
+#define TEST_TO           199
+
+enum {
+	TEST_WAIT_READY,
+	TEST_COUNT,      // samples left by earlier runs
+	TEST_APPEND,
+	TEST_SYNC,
+	TEST_DRAIN,      // everything of this run, TEST_DRAIN_PAGES at a time
+	TEST_RANGE,
+	TEST_DONE,
+};
+
+typedef struct {
+	uint8_t state;
+	uint32_t start;       //!< first page of this run
+	uint32_t base;        //!< timestamp of buffer 0
+	uint32_t from_seq;    //!< where the next drain scan starts
+	uint16_t next;        //!< buffer to append next
+	uint16_t refused;     //!< appends the log could not take yet
+	uint32_t samples;     //!< samples appended
+	uint32_t got;         //!< samples read back by the current scan
+	uint16_t errors;
+	uint32_t started;     //!< time of the first append
+} app_state_t;
+
+static int8_t logstore_app_msg_handler(void *state, Message *msg);
+
+static const mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = TEST_PID,
+	.state_size     = sizeof(app_state_t),
+	.num_timers     = 1,
+	.num_sub_func   = 0,
+	.num_prov_func  = 0,
+	.platform_type  = HW_TYPE,
+	.processor_type = MCU_TYPE,
+	.code_id        = ehtons(TEST_PID),
+	.module_handler = logstore_app_msg_handler,
+};
+
+static uint16_t test_samples(uint16_t i)
+{
+	return 1 + (i * 7) % TEST_MAX_SAMPLES;
+}
+
+static sensor_id_t test_sensor(uint16_t i)
+{
+	return i % 4;
+}
+
+static void start_scan(app_state_t *s, uint32_t from_seq, uint8_t sensors,
+		uint32_t start_time, uint32_t end_time, uint8_t max_pages)
+{
+	logstore_query_t q;
+
+	q.from_seq = from_seq;
+	q.sensors = sensors;
+	q.start_time = start_time;
+	q.end_time = end_time;
+	q.max_pages = max_pages;
+	s->got = 0;
+	if (sys_logstore_scan(&q) != SOS_OK) {
+		s->errors++;
+	}
+}
+
+static void append_some(app_state_t *s)
+{
+	uint8_t b[sizeof(sensor_data_msg_t) + TEST_MAX_SAMPLES * sizeof(uint16_t)];
+	sensor_data_msg_t *d = (sensor_data_msg_t *)b;
+	uint16_t j;
+
+	while (s->next < TEST_BUFFERS) {
+		int8_t ret;
+
+		d->status = SENSOR_DATA;
+		d->sensor = test_sensor(s->next);
+		d->num_samples = test_samples(s->next);
+		d->timestamp = s->base + s->next;
+		for (j = 0; j < d->num_samples; j++) {
+			d->buf[j] = (s->next << 8) | j;
+		}
+		ret = sys_logstore_append(d);
+		if (ret == -EBUSY) {
+			s->refused++;
+			return;
+		}
+		if (ret != SOS_OK) {
+			s->errors++;
+		}
+		s->samples += d->num_samples;
+		s->next++;
+	}
+	sys_timer_stop(TEST_TID);
+	DEBUG("logstore_test: %d buffers, %lu samples in %lu ticks, %d refused\n",
+			TEST_BUFFERS, (unsigned long)s->samples,
+			(unsigned long)(sys_time32() - s->started), s->refused);
+	s->state = TEST_SYNC;
+	sys_logstore_sync();
+}
+
+/**
+ * @brief count the samples of a MSG_LOGSTORE_DATA and check them
+ */
+static void check_records(app_state_t *s, Message *msg)
+{
+	logstore_data_msg_t *d = (logstore_data_msg_t *)(msg->data);
+	uint8_t *rec = d->data;
+	uint8_t *end = msg->data + msg->len;
+
+	while (rec < end) {
+		sensor_data_msg_t h;
+		uint16_t j;
+
+		memcpy(&h, rec, sizeof(h));
+		for (j = 0; j < h.num_samples; j++) {
+			uint16_t v;
+
+			memcpy(&v, rec + sizeof(h) + j * sizeof(uint16_t), sizeof(v));
+			if (s->state != TEST_COUNT &&
+					(v >> 8) != (uint8_t)(h.timestamp - s->base)) {
+				s->errors++;
+			}
+		}
+		if (s->state == TEST_RANGE && (h.sensor != TEST_SENSOR ||
+					h.timestamp < s->base + TEST_FROM || h.timestamp > s->base + TEST_TO)) {
+			s->errors++;
+		}
+		s->got += h.num_samples;
+		rec += LOGSTORE_RECORD_SIZE(&h);
+	}
+	s->from_seq = d->seq + 1;
+}
+
+static void scan_done(app_state_t *s, int16_t pages)
+{
+	uint32_t expect = 0;
+	uint16_t i;
+	logstore_info_t info;
+
+	switch (s->state) {
+		case TEST_COUNT:
+			sys_logstore_info(&info);
+			DEBUG("logstore_test: recovered pages %lu to %lu, %lu samples\n",
+					(unsigned long)info.tail, (unsigned long)info.end, (unsigned long)s->got);
+			s->start = info.end;
+			s->from_seq = info.end;
+			s->base = info.end << 10;
+			s->state = TEST_APPEND;
+			s->started = sys_time32();
+			s->got = 0;
+			sys_timer_start(TEST_TID, 10, TIMER_REPEAT);
+			append_some(s);
+			break;
+		case TEST_DRAIN:
+			if (pages == TEST_DRAIN_PAGES) {
+				// keep the count over the whole drain
+				uint32_t got = s->got;
+
+				start_scan(s, s->from_seq, LOGSTORE_ALL_SENSORS, 0, 0xffffffff, TEST_DRAIN_PAGES);
+				s->got = got;
+				break;
+			}
+			if (pages < 0 || s->got != s->samples) {
+				DEBUG("logstore_test: drained %lu of %lu samples (%d)\n",
+						(unsigned long)s->got, (unsigned long)s->samples, pages);
+				s->errors++;
+			}
+			s->state = TEST_RANGE;
+			start_scan(s, s->start, LOGSTORE_SENSOR(TEST_SENSOR),
+					s->base + TEST_FROM, s->base + TEST_TO, 0);
+			break;
+		case TEST_RANGE:
+			for (i = TEST_FROM; i <= TEST_TO; i++) {
+				if (test_sensor(i) == TEST_SENSOR) expect += test_samples(i);
+			}
+			if (s->got != expect) {
+				DEBUG("logstore_test: range scan %lu of %lu samples\n",
+						(unsigned long)s->got, (unsigned long)expect);
+				s->errors++;
+			}
+			// drop what earlier runs left, for good
+			if (s->start > 0) sys_logstore_trim(s->start - 1);
+			s->state = TEST_DONE;
+			sys_logstore_sync();
+			break;
+		default:
+			break;
+	}
+}
+
+static int8_t logstore_app_msg_handler(void *state, Message *msg)
+{
+	app_state_t *s = (app_state_t *)state;
+
+	switch (msg->type) {
+		case MSG_INIT:
+		{
+			s->state = TEST_WAIT_READY;
+			s->next = 0;
+			s->refused = 0;
+			s->samples = 0;
+			s->errors = 0;
+			sys_timer_start(TEST_TID, 10, TIMER_REPEAT);
+			break;
+		}
+		case MSG_TIMER_TIMEOUT:
+		{
+			logstore_info_t info;
+
+			if (s->state == TEST_APPEND) {
+				append_some(s);
+			} else if (s->state == TEST_WAIT_READY &&
+					sys_logstore_info(&info) == SOS_OK && info.ready) {
+				sys_timer_stop(TEST_TID);
+				s->state = TEST_COUNT;
+				start_scan(s, info.tail, LOGSTORE_ALL_SENSORS, 0, 0xffffffff, 0);
+			}
+			break;
+		}
+		case MSG_LOGSTORE_DATA:
+		{
+			check_records(s, msg);
+			break;
+		}
+		case MSG_LOGSTORE:
+		{
+			if (logstore_get_event(msg) == LOGSTORE_SYNC_DONE && s->state == TEST_SYNC) {
+				if (logstore_get_status(msg) != SOS_OK) {
+					DEBUG("logstore_test: sync failed (%d)\n", logstore_get_status(msg));
+					s->errors++;
+				}
+				s->state = TEST_DRAIN;
+				start_scan(s, s->start, LOGSTORE_ALL_SENSORS, 0, 0xffffffff, TEST_DRAIN_PAGES);
+			} else if (logstore_get_event(msg) == LOGSTORE_SYNC_DONE && s->state == TEST_DONE) {
+				logstore_info_t info;
+
+				sys_logstore_info(&info);
+				DEBUG("logstore_test: pages %lu to %lu, %s (%d errors)\n",
+						(unsigned long)info.tail, (unsigned long)info.end,
+						s->errors == 0 ? "PASS" : "FAIL", s->errors);
+			} else if (logstore_get_event(msg) == LOGSTORE_SCAN_DONE) {
+				scan_done(s, logstore_get_status(msg));
+			}
+			break;
+		}
+		case MSG_FINAL:
+		{
+			sys_timer_stop(TEST_TID);
+			break;
+		}
+		default:
+			return -EINVAL;
+	}
+	return SOS_OK;
+}
+
+#ifndef _MODULE_
+mod_header_ptr logstore_app_get_header()
+{
+	return sos_get_header_address(mod_header);
+}
+#endif
@@ -0,0 +1,9 @@
+
+#include <sos.h>
+
+mod_header_ptr logstore_app_get_header();
+
+void sos_start()
+{
+  ker_register_module(logstore_app_get_header());
+}
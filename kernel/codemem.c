@@ -222,24 +222,24 @@ static void codemem_cache_write( uint32_t addr, uint8_t* buf, uint16_t nbytes )
 
 static void codemem_cache_read( uint32_t addr, uint8_t* buf, uint16_t nbytes )
 {
-	uint16_t i = 0;
-	uint32_t start_addr = addr & ~((uint32_t)(FLASHMEM_PAGE_SIZE - 1));
-	uint16_t offset = addr % FLASHMEM_PAGE_SIZE;
-	
-	if( flash_cache_addr == start_addr ) {
-		uint16_t tmp = (FLASHMEM_PAGE_SIZE - offset);
-		for( i = 0; (i < tmp) && (nbytes != 0); i++, offset++ ) {
-			*buf = flash_cache_page[offset];
-			buf++;
-			nbytes--;
-			addr++;
-		}
-	}
-	if( nbytes == 0 ) {
+	uint32_t lo, hi;
+
+	flash_read( addr, buf, nbytes );
+	//
+	// The cached page is newer than flash.  The read can start before it,
+	// so copy whatever part of the read overlaps the cache.
+	//
+	if( flash_cache_addr == 0 ) {
 		return;
 	}
-	flash_read( addr, buf, nbytes );
-	return;
+	lo = (addr > flash_cache_addr)? addr : flash_cache_addr;
+	hi = addr + nbytes;
+	if( hi > flash_cache_addr + FLASHMEM_PAGE_SIZE ) {
+		hi = flash_cache_addr + FLASHMEM_PAGE_SIZE;
+	}
+	for( ; lo < hi; lo++ ) {
+		buf[lo - addr] = flash_cache_page[lo - flash_cache_addr];
+	}
 }
 
 //
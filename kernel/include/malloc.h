@@ -78,6 +78,11 @@ extern void *sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromMod
  */
 extern int8_t sos_blk_mem_change_own(void* ptr, sos_pid_t id, bool bCallFromModule);
 
+/**
+ * @brief Number of bytes usable in an allocated block, 0 if ptr is not one
+ */
+extern uint16_t sos_blk_mem_size(void* ptr);
+
 /**
  * @brief Allocate a block of memory for long term usage
  */
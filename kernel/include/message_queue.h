@@ -93,6 +93,36 @@ extern void mq_enqueue(mq_t *q, Message *m);
  * @return pointer to message, or NULL for empty queue
  */
 extern Message *mq_dequeue(mq_t *q);
+#ifndef SOS_USE_PREEMPTION
+/**
+ * @brief dequeue up to max messages of the highest queued priority
+ * @return NULL terminated list of messages, or NULL for empty queue
+ */
+extern Message *mq_dequeue_batch(mq_t *q, uint8_t max);
+/**
+ * @brief return messages from mq_dequeue_batch() to the front of the queue
+ */
+extern void mq_requeue_batch(mq_t *q, Message *m);
+/**
+ * @brief check for a queued message of higher priority than m
+ */
+extern bool mq_has_higher(mq_t *q, Message *m);
+/**
+ * @brief message filter for mq_dequeue_if()
+ */
+typedef bool (*mq_filter_t)(Message *m);
+/**
+ * @brief dequeue the first message of the highest queued priority that
+ * passes the filter
+ * @return pointer to message, or NULL if no such message
+ */
+extern Message *mq_dequeue_if(mq_t *q, mq_filter_t f);
+/**
+ * @brief remove the oldest low or high priority message to did
+ * @return pointer to message, or NULL if there is none
+ */
+extern Message *mq_remove_oldest(mq_t *q, sos_pid_t did);
+#endif
 /**
  * @brief get message that matches the header in the queue
  *
@@ -121,6 +151,37 @@ extern void msg_dispose(Message *m);
  */
 extern void msg_send_senddone(Message *msg_sent, bool succ, sos_pid_t msg_owner);
 
+/**
+ * @brief allocate a message payload
+ * @param len  payload length
+ * @param pid  owner of the payload
+ * @return the payload, or NULL for fail
+ *
+ * Short payloads come from the payload pools when they have a free buffer.
+ * The result is an ordinary heap block, so the owner may ker_free() it.
+ */
+extern void *msg_payload_alloc(uint16_t len, sos_pid_t pid);
+/**
+ * @brief release a payload of a message that has SOS_MSG_RELEASE
+ * The buffer goes back to a payload pool, or to the heap when the pool is full
+ */
+extern void msg_payload_free(void *data);
+/**
+ * @brief share a payload between refs message headers
+ * @param data  payload from msg_payload_alloc()
+ * @param refs  number of headers that will refer to the payload
+ * @return SOS_OK, or -ENOMEM when no more payloads can be shared
+ *
+ * The payload now belongs to the message queue.  The headers carry
+ * SOS_MSG_SHARED instead of SOS_MSG_RELEASE, and the last header that
+ * is disposed frees the payload.
+ */
+extern int8_t msg_payload_share(void *data, uint8_t refs);
+/**
+ * @brief drop one reference to a payload of a message that has SOS_MSG_SHARED
+ */
+extern void msg_payload_put(void *data);
+
 extern void mq_gc_mark_payload( mq_t *q, sos_pid_t pid );
 
 extern void mq_gc_mark_hdr( mq_t *q, sos_pid_t pid );
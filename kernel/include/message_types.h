@@ -175,6 +175,7 @@ enum {
   // Memory Management Flags
   SOS_MSG_RELIABLE        = 0x0008,    //!< Indicate senddone should be sent, memory will be included as payload
   SOS_MSG_RELEASE         = 0x0004,    //!< Indicate larg is dynamically allocated 
+  SOS_MSG_SHARED          = 0x0010,    //!< Payload is shared with other headers, see msg_payload_share()
   SOS_MSG_SEND_FAIL       = 0x0002,    //!< Message failed to send
   // MAC flags
   SOS_MSG_USE_UBMAC       = 0x0020,    //!< Send packet using UBMAC
@@ -209,6 +210,7 @@ enum{
 #define flag_high_priority(fflag)       ((fflag) & SOS_MSG_HIGH_PRIORITY)
 // Memory Management Flag Helpers
 #define flag_msg_release(fflag)         ((fflag) & SOS_MSG_RELEASE)
+#define flag_msg_shared(fflag)          ((fflag) & SOS_MSG_SHARED)
 #define flag_msg_reliable(fflag)        ((fflag) & SOS_MSG_RELIABLE)
 #define flag_send_fail(fflag)           ((fflag) & SOS_MSG_SEND_FAIL)
 #define flag_use_ubmac(fflag)           ((fflag) & SOS_MSG_USE_UBMAC)
@@ -267,6 +269,8 @@ enum {
 	MSG_TIMESTAMP         = (KER_MSG_START + 16), //!< timestamped packet (used only by post_net)
 	MSG_DISCOVERY         = (KER_MSG_START + 17), //!< discovery anouncement for new device detection on a link
 	MSG_SHM               = (KER_MSG_START + 18), //!< message from shm
+	MSG_LOGSTORE          = (KER_MSG_START + 19), //!< event from the sensor data log, see logstore.h
+	MSG_LOGSTORE_DATA     = (KER_MSG_START + 20), //!< records of a sensor data log scan
 	MSG_COMM_TEST         = (KER_MSG_START + 21), //!< test packet for developing comm layers 0x15 = 00010101 aiding scope debugging
 	MSG_KER_UNKNOWN       = (KER_MSG_START + 31), //!< undefined or unknown message type
 	//! MAXIMUM is 31 for now
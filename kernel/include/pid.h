@@ -46,11 +46,12 @@ enum {
 										//!< currently used in ViRe framework only.
 	/* 22 */	MULTICAST_SERV_PID,	//!< pid for ViRe framework engine.
 	/* 23 */	VIRE_MEM_SERVER_PID,	//!< pid for token memory manager in ViRe.
+	/* 24 */	KER_LOGSTORE_PID,   //!< pid for sensor data log (extensions/logstore)
 	/* 255 */	NULL_PID           = 255, //!< pid to indicate module does not exist
 };
 // PLEASE add the string to kernel/pid.c
 
-#define SYS_MAX_PID 24
+#define SYS_MAX_PID 25
 
 enum {
 	KER_MOD_MAX_PID    = 63,      //! highest pid kernel module can use
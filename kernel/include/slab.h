@@ -15,6 +15,13 @@ typedef struct slab_t {
 	uint8_t empty_vector;
 	uint8_t item_size;
 	uint8_t flag;
+	uint8_t num_pools;    //!< pools allocated now
+	uint8_t low_pools;    //!< low watermark: empty pools are kept up to this count
+	uint8_t high_pools;   //!< high watermark: most pools allowed, 0 for no limit
+	uint8_t peak_pools;   //!< most pools ever allocated
+	uint16_t num_used;    //!< items in use
+	uint16_t peak_used;   //!< most items ever in use
+	uint16_t num_fail;    //!< allocations refused by the watermark or by malloc
 } slab_t;
 
 #define SLAB_LONGTERM   0x80
@@ -26,6 +33,15 @@ typedef struct slab_t {
 extern int8_t ker_slab_init( sos_pid_t pid, slab_t *slab, 
 		uint8_t item_size, uint8_t items_per_pool, uint8_t flag );
 
+/**
+ * @brief set the pool watermarks of a slab
+ * @param low   empty pools are given back to the heap only above this count
+ * @param high  most pools the slab may hold, 0 for no limit
+ *
+ * The first pool allocated by ker_slab_init() is always kept.
+ */
+extern void ker_slab_set_watermark( slab_t *slab, uint8_t low, uint8_t high );
+
 extern void* ker_slab_alloc( slab_t *slab, sos_pid_t pid );
 
 extern void ker_slab_free( slab_t *slab, void* mem );
@@ -213,6 +213,47 @@ void ker_set_id(uint16_t alloc_address);
 
 #endif //QUALNET_PLATFORM
 
+#define MSG_PAYLOAD_POOLS 3
+
+/**
+ * @brief state of the message header slab and the payload pools
+ */
+typedef struct msg_pool_info_t {
+	uint8_t  hdr_pools;                          //!< slab pools holding message headers
+	uint8_t  hdr_peak_pools;                     //!< most header pools at once
+	uint16_t hdr_used;                           //!< message headers in use
+	uint16_t hdr_peak;                           //!< most message headers in use at once
+	uint16_t hdr_fail;                           //!< msg_create() failures
+	uint8_t  payload_size[MSG_PAYLOAD_POOLS];    //!< buffer size of each payload pool
+	uint8_t  payload_free[MSG_PAYLOAD_POOLS];    //!< free buffers in each pool
+	uint16_t payload_hit[MSG_PAYLOAD_POOLS];     //!< allocations served by the pool
+	uint16_t payload_miss[MSG_PAYLOAD_POOLS];    //!< allocations that went to malloc
+	uint16_t payload_shared;                     //!< payloads shared between headers
+	uint16_t payload_share_fail;                 //!< payloads copied since no share slot was free
+} msg_pool_info_t;
+
+/**
+ * @brief get the statistics of the message pools
+ */
+extern void ker_msg_pool_info(msg_pool_info_t *info);
+
+/**
+ * @brief sleep statistics of the scheduler, kept with SOS_IDLE_STATS
+ * Times are in ker_systime32() ticks.  The idle fraction is
+ * idle_time / run_time, and the wakeups per second are
+ * wakeups * 1000 / ticks_to_msec(run_time).
+ */
+typedef struct idle_info_t {
+	uint32_t wakeups;                            //!< times the processor woke up from sleep
+	uint32_t idle_time;                          //!< time spent sleeping
+	uint32_t run_time;                           //!< time since the scheduler started
+} idle_info_t;
+
+/**
+ * @brief get the sleep statistics of the scheduler
+ */
+extern void ker_idle_info(idle_info_t *info);
+
 #endif /* _MODULE_ */
 
 #endif /* _ID_H */
@@ -47,6 +47,30 @@ enum {
 	FETCHER_REQUEST_MAX_RETX  = 3,
 };
 
+#ifdef SOS_FETCHER_PIPELINE
+/**
+ * Pipelined transfer (FETCHER=pipeline)
+ *
+ * The sender keeps up to FETCHER_WINDOW fragments in the send queue and
+ * sends the next one as soon as one is done, reading the module from
+ * codemem FETCHER_PAGE_FRAGMENTS fragments at a time.  A receiver that
+ * hears nothing for FETCHER_NACK_TIMEOUT after a fragment sends its
+ * bitmap of missing fragments (a NACK) right away, instead of waiting
+ * for the request watchdog.
+ */
+#ifndef FETCHER_WINDOW
+#define FETCHER_WINDOW            4
+#endif
+#ifndef FETCHER_PAGE_FRAGMENTS
+#define FETCHER_PAGE_FRAGMENTS    4
+#endif
+enum {
+	FETCHER_PAGE_SIZE         = FETCHER_PAGE_FRAGMENTS * FETCHER_FRAGMENT_SIZE,
+	FETCHER_NACK_TIMEOUT      = 256L,  //!< 0.25 seconds
+	FETCHER_NACK_BACKOFF_SLOT = 32L,
+};
+#endif
+
 //! message types
 enum {
 	MSG_FETCHER_REQUEST        =   (MOD_MSG_START + 0),
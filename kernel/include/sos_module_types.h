@@ -68,8 +68,28 @@ typedef struct Module {
   uint8_t max_sub;
   uint8_t num_sub;
 #endif
+#ifdef SOS_MSG_QUOTA
+  //! messages in the scheduler queue for this module
+  uint8_t msg_queued;
+  //! limit of msg_queued and what to do over it, see ker_msg_set_quota()
+  uint8_t msg_quota;
+  uint8_t msg_policy;
+  //! round robin weight and credit left in this round, 0 for a fresh one
+  uint8_t rr_weight;
+  uint8_t rr_credit;
+#endif
 } sos_module_t;
 
+/**
+ * @brief what happens to a message posted to a module over its quota
+ *
+ * See sys_msg_set_quota(), the kernel has to be built with MSG_QUOTA=true
+ */
+enum {
+	SCHED_QUOTA_DROP_OLDEST = 0,   //!< the oldest queued message is dropped
+	SCHED_QUOTA_REJECT      = 1,   //!< post_* fails with -EBUSY
+};
+
 /** 
  * Flag used in ker_spawn_module
  */
@@ -135,9 +135,34 @@ extern int8_t sched_get_msg_rule(sos_pid_t pid, sos_ker_flag_t *rules);
 
 /**
  * @brief put message to scheduler queue
- * this function always succeed
+ * @return SOS_OK, or -EBUSY when the destination is over its quota
+ * and rejects new messages.  The message is disposed in that case.
+ * Without SOS_MSG_QUOTA this function always succeed
  */
-extern void sched_msg_alloc(Message *m);
+extern int8_t sched_msg_alloc(Message *m);
+
+#ifdef SOS_MSG_QUOTA
+/**
+ * @brief limit the messages waiting in the scheduler queue for a module
+ * @param pid     module id
+ * @param quota   largest number of queued messages, 0 for no limit
+ * @param policy  SCHED_QUOTA_DROP_OLDEST or SCHED_QUOTA_REJECT
+ * @param weight  messages the module may handle per round robin round
+ * @return SOS_OK, or -EINVAL if the module does not exist
+ *
+ * Modules start with SCHED_MSG_QUOTA, SCHED_QUOTA_DROP_OLDEST and weight 1
+ * when they are registered.  System priority messages such as MSG_INIT
+ * and MSG_FINAL are neither counted nor dropped.
+ */
+extern int8_t ker_msg_set_quota(sos_pid_t pid, uint8_t quota, uint8_t policy,
+		uint8_t weight);
+#endif
+
+/**
+ * @brief ker_msg_set_quota() for the current module, see sys_msg_set_quota()
+ * @return -EINVAL if the kernel is built without SOS_MSG_QUOTA
+ */
+extern int8_t ker_sys_msg_set_quota(uint8_t quota, uint8_t policy, uint8_t weight);
 
 /**
  * @brief remove message from scheduler queue
@@ -42,6 +42,7 @@ enum
 enum
   {
     TIMER_PRE_ALLOCATED = 0x02, //! Indicate Timer Block is Pre-allocated  
+    TIMER_RUNNING       = 0x04, //! Timer Block is on the timing wheel
   };
 
 /**
@@ -64,14 +65,20 @@ sos_timeout_t;
  * \struct sos_timer_t
  * \brief Kernel data structure for the timer (size is 16 bytes) 
  */
-typedef struct {
+typedef struct sos_timer {
   list_t    list;          //!< list 
   uint8_t   type;          //!< timer type
   sos_pid_t pid;           //!< module id of the timer requester
   uint8_t   tid;           //!< timer instance id
   int32_t   ticks;         //!< clock ticks for a repeat timer
-  int32_t   delta;         //!< current delta value 
+  int32_t   delta;         //!< current delta value (expiry time with SOS_TIMER_WHEEL)
   uint8_t   flag;          //!< Timer block status flags
+#ifdef SOS_TIMER_WHEEL
+  struct sos_timer *hash_next; //!< next timer in the (pid, tid) hash bucket
+#endif
+#ifdef SOS_TIMER_COALESCE
+  uint16_t  slack;         //!< ticks the timeout may be delayed to share a wakeup
+#endif
 } sos_timer_t;
 
 
@@ -130,6 +137,18 @@ extern int8_t ker_timer_init(sos_pid_t pid, uint8_t tid, uint8_t type);
  */
 extern int8_t ker_timer_start(sos_pid_t pid, uint8_t tid, int32_t interval);
 
+/**
+ * @brief Start a new timer that may fire up to slack ticks late
+ * @param slack ticks the timeout can be delayed
+ * @return same as ker_timer_start
+ * @note With SOS_TIMER_COALESCE the timer fires with the first hardware
+ * interrupt after interval ticks that is needed anyway, and at the
+ * latest after interval + slack ticks, so that timers with overlapping
+ * windows share one wakeup.  ker_timer_restart keeps the slack.
+ * Without SOS_TIMER_COALESCE the slack is ignored.
+ */
+extern int8_t ker_timer_start_slack(sos_pid_t pid, uint8_t tid, int32_t interval, uint16_t slack);
+
 /**
  * @brief Restart a timer
  * @param pid Modue Id
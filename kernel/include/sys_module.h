@@ -29,6 +29,7 @@
 #include <error_type.h>
 
 #include <sensor_system.h>
+#include <logstore/logstore.h>
 
 #include <sys_module_proc.h>
 #include <sys_module_plat.h>
@@ -48,6 +49,8 @@ void* ker_sys_msg_take_data(Message *msg);
 int8_t ker_sys_timer_start(uint8_t tid, int32_t interval, uint8_t type);
 int8_t ker_sys_timer_restart(uint8_t tid, int32_t interval);
 int8_t ker_sys_timer_stop(uint8_t tid);
+int8_t ker_sys_timer_start_slack(uint8_t tid, int32_t interval, uint8_t type, uint16_t slack);
+int8_t ker_sys_msg_set_quota(uint8_t quota, uint8_t policy, uint8_t weight);
 int8_t ker_sys_post(sos_pid_t did, uint8_t type, uint8_t size, 
 		    void *data, uint16_t flag);
 int8_t ker_sys_post_link(sos_pid_t dst_mod_id, uint8_t type,
@@ -77,6 +80,12 @@ int8_t ker_sys_sensor_start_sampling(sensor_id_t *sensors, unsigned int num_sens
 						sample_context_t *param, void *context);
 int8_t ker_sys_sensor_stop_sampling(sensor_id_t sensor); 
 
+int8_t ker_logstore_append(sensor_data_msg_t *data);
+int8_t ker_sys_logstore_scan(logstore_query_t *query);
+int8_t ker_sys_logstore_sync(void);
+int8_t ker_logstore_trim(uint32_t seq);
+int8_t ker_logstore_info(logstore_info_t *info);
+
 int8_t ker_i2c_reserve_bus(uint8_t calling_id, uint8_t ownAddress, uint8_t flags);
 int8_t ker_i2c_release_bus(uint8_t calling_id);
 int8_t ker_i2c_send_data(
@@ -352,6 +361,27 @@ static inline int8_t sys_timer_stop( uint8_t tid )
 	return ker_sys_timer_stop( tid );
 #endif
 }   
+
+/// \cond NOTYPEDEF
+typedef int8_t (* sys_timer_start_slack_ker_func_t)( uint8_t tid, int32_t interval, uint8_t type, uint16_t slack );
+/// \endcond
+/**
+ * Start a timer that may fire up to slack ticks late
+ *
+ * \param slack Ticks the timeout can be delayed to share a wakeup
+ * with other timers.  Ignored unless the kernel is built with
+ * SOS_TIMER_COALESCE.
+ *
+ * \return same as sys_timer_start
+ */
+static inline int8_t sys_timer_start_slack( uint8_t tid, int32_t interval, uint8_t type, uint16_t slack )
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((sys_timer_start_slack_ker_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*61))( tid, interval, type, slack );
+#else
+	return ker_sys_timer_start_slack( tid, interval, type, slack );
+#endif
+}
 /* @} */
 
 
@@ -601,6 +631,34 @@ static inline int8_t sys_post_value( sos_pid_t dst_mod_id, uint8_t type, uint32_
 	return ker_sys_post_value( dst_mod_id, type, data, flag );
 #endif
 }
+
+/// \cond NOTYPEDEF
+typedef int8_t (* sys_msg_set_quota_ker_func_t)( uint8_t quota, uint8_t policy, uint8_t weight );
+/// \endcond
+/**
+ * Limit the messages that can wait in the scheduler queue for this module
+ *
+ * \param quota Largest number of queued messages, 0 for no limit
+ *
+ * \param policy SCHED_QUOTA_DROP_OLDEST or SCHED_QUOTA_REJECT, what
+ * happens to a message posted over the quota
+ *
+ * \param weight Messages the module may handle per round robin round
+ * within its priority class
+ *
+ * \return SOS_OK, -EINVAL if the kernel is built without MSG_QUOTA=true
+ *
+ * \note Modules start with a quota of 16, SCHED_QUOTA_DROP_OLDEST and
+ * weight 1.  Call this from MSG_INIT to choose otherwise.
+ */
+static inline int8_t sys_msg_set_quota( uint8_t quota, uint8_t policy, uint8_t weight )
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((sys_msg_set_quota_ker_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*62))( quota, policy, weight );
+#else
+	return ker_sys_msg_set_quota( quota, policy, weight );
+#endif
+}
 /* @} */
 
 /**
@@ -1443,6 +1501,102 @@ static inline int8_t sys_sensor_control(uint8_t sensor_id, void* sensor_new_stat
 
 /* @} */
 
+/**
+ * \ingroup system_api
+ * \defgroup logstore Sensor Data Log
+ * Keep sensor data on the external flash, see logstore.h
+ *
+ * The kernel has to be built with LOGSTORE=true.
+ * @{
+ */
+/// \cond NOTYPEDEF
+typedef int8_t (*ker_logstore_append_func_t)(sensor_data_msg_t *data);
+/// \endcond
+
+/**
+ * Copy a sensor data buffer into the log
+ *
+ * \param data  buffer of a MSG_DATA_READY message, the caller keeps it
+ * \return SOS_OK, -EBUSY if the flash is behind, -ENOSPC if the log is full
+ */
+static inline int8_t sys_logstore_append(sensor_data_msg_t *data)
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((ker_logstore_append_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*56))(data);
+#else
+	return ker_logstore_append(data);
+#endif
+}
+
+/// \cond NOTYPEDEF
+typedef int8_t (*ker_sys_logstore_scan_func_t)(logstore_query_t *query);
+/// \endcond
+
+/**
+ * Read back the records that match the query
+ *
+ * \return SOS_OK, -EBUSY if a scan is already running.  The records come
+ * as MSG_LOGSTORE_DATA messages, one per page, followed by MSG_LOGSTORE
+ * with the event LOGSTORE_SCAN_DONE.
+ */
+static inline int8_t sys_logstore_scan(logstore_query_t *query)
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((ker_sys_logstore_scan_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*57))(query);
+#else
+	return ker_sys_logstore_scan(query);
+#endif
+}
+
+/// \cond NOTYPEDEF
+typedef int8_t (*ker_sys_logstore_sync_func_t)(void);
+/// \endcond
+
+/**
+ * Write out the data appended so far
+ *
+ * \return SOS_OK, MSG_LOGSTORE with the event LOGSTORE_SYNC_DONE follows
+ */
+static inline int8_t sys_logstore_sync(void)
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((ker_sys_logstore_sync_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*58))();
+#else
+	return ker_sys_logstore_sync();
+#endif
+}
+
+/// \cond NOTYPEDEF
+typedef int8_t (*ker_logstore_trim_func_t)(uint32_t seq);
+/// \endcond
+
+/**
+ * Drop the log pages up to and including seq, once they have been drained
+ */
+static inline int8_t sys_logstore_trim(uint32_t seq)
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((ker_logstore_trim_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*59))(seq);
+#else
+	return ker_logstore_trim(seq);
+#endif
+}
+
+/// \cond NOTYPEDEF
+typedef int8_t (*ker_logstore_info_func_t)(logstore_info_t *info);
+/// \endcond
+
+static inline int8_t sys_logstore_info(logstore_info_t *info)
+{
+#ifdef SYS_JUMP_TBL_START
+	return ((ker_logstore_info_func_t)(SYS_JUMP_TBL_START+SYS_JUMP_TBL_SIZE*60))(info);
+#else
+	return ker_logstore_info(info);
+#endif
+}
+
+/* @} */
+
 
 #endif
 
@@ -68,6 +68,10 @@
 #include <sfi_jumptable.h>
 #endif
 
+#ifdef SOS_LOGSTORE
+#include <logstore/logstore.h>
+#endif
+
 
 /**
  * @brief application start
@@ -139,6 +143,11 @@ int sos_main(uint8_t cond){
 	//! Initialize the code fetcher
 	fetcher_init();
 
+#ifdef SOS_LOGSTORE
+	//! recover the sensor data log from the external flash
+	logstore_init();
+#endif
+
     //! enable interrupt
 	ENABLE_GLOBAL_INTERRUPTS();
 
@@ -32,11 +32,15 @@
 #include <sos_sched.h>
 #include <malloc_conf.h>
 #include <string.h>
+#include <stddef.h>
 #include <sos_timer.h>
 #include <stdlib.h>
 #include <sos_logging.h>
 #include <message_queue.h>
 #include <hardware.h>
+#ifdef SOS_PROFILE_FRAGMENTATION
+#include <systime.h>
+#endif
 
 #if defined (SOS_UART_CHANNEL)
 #include <sos_uart.h>
@@ -86,18 +90,33 @@ static void printMem(char*);
 #define MEM_MOD_GC_STACK_SIZE    16
 #define RESERVED            0x8000          // must set the msb of BlockSizeType
 #define GC_MARK             0x4000
-#define MEM_MASK            (RESERVED | GC_MARK)
+#define PREV_FREE           0x2000          // the area before this one is free
+#define PREV_ONE            0x1000          // ... and it is a single block
+#define MEM_MASK            (RESERVED | GC_MARK | PREV_FREE | PREV_ONE)
+#define BLOCK_HDR_SIZE      offsetof(Block, userPart)
 #ifndef SOS_SFI
-#define BLOCKOVERHEAD (sizeof(BlockHeaderType) + 1) // The extra byte is for the guard byte
+#define BLOCKOVERHEAD (BLOCK_HDR_SIZE + 1) // The extra byte is for the guard byte
 #else
-#define BLOCKOVERHEAD (sizeof(BlockHeaderType)) 
+#define BLOCKOVERHEAD (BLOCK_HDR_SIZE) 
+#endif
+
+#ifdef SOS_MALLOC_SEGREGATED
+// free areas are kept in lists by floor(log2(blocks))
+#define SEG_NUM_CLASSES     8
 #endif
 
 //-----------------------------------------------------------------------------
 // MACROS
 //-----------------------------------------------------------------------------
-#define TO_BLOCK_PTR(p)     (Block*)((BlockHeaderType*)p - 1)
-#define BLOCKS_TO_BYTES(n)  (((n & ~MEM_MASK) << SHIFT_VALUE) - sizeof(BlockHeaderType))
+// sizeof(Block) is BLOCK_SIZE on the motes, but larger on 64 bit hosts
+#define TO_BLOCK_PTR(p)     ((Block*)((uint8_t*)(p) - BLOCK_HDR_SIZE))
+#define BLOCK_NUM(b)        ((b)->blockhdr.blocks & ~MEM_MASK)
+#define BYTES_TO_BLOCKS(n)  (((n) + BLOCKOVERHEAD + sizeof(Block) - 1) / sizeof(Block))
+#define BLOCKS_TO_BYTES(n)  ((((n) & ~MEM_MASK) * sizeof(Block)) - BLOCK_HDR_SIZE)
+#ifdef SOS_MALLOC_SEGREGATED
+// size of a free area of two blocks or more, kept in its last two bytes
+#define BLOCK_FOOTER(b, n)  (*((uint16_t*)((uint8_t*)((b) + (n)) - sizeof(uint16_t))))
+#endif
 #ifndef SOS_SFI
 #define BLOCK_GUARD_BYTE(p) (*((uint8_t*)((uint8_t*)((Block*)p + (p->blockhdr.blocks & ~MEM_MASK)))-1))
 #endif
@@ -134,11 +153,19 @@ typedef struct _Block
 //-----------------------------------------------------------------------------
 // LOCAL FUNCTIONS
 //-----------------------------------------------------------------------------
+#ifdef SOS_MALLOC_SEGREGATED
+static void SegInsert(Block* block, uint16_t blocks);
+static void SegUnlink(Block* block);
+static void SegRelease(Block* block);
+static Block* SegFind(uint16_t reqBlocks);
+#else
 static void InsertAfter(Block*);
 static void Unlink(Block*);
-static Block* MergeBlocks(Block* block);
 static Block* MergeBlocksQuick(Block *block, uint16_t req_blocks);
+#endif
+static Block* MergeBlocks(Block* block);
 static void SplitBlock(Block* block, uint16_t reqBlocks);
+static inline Block* WalkNext(Block* block);
 
 //-----------------------------------------------------------------------------
 // LOCAL VARIABLES
@@ -157,6 +184,9 @@ typedef struct malloc_frag_t {
 	uint16_t ptr_free;          // memory freed
 	uint16_t ker_gc_bytes;      // kernel memory GCed
 	uint8_t leak_pid;           // the module that leaks memory
+	uint16_t cs_alloc;          // longest critical section in malloc
+	uint16_t cs_free;           // longest critical section in free
+	uint16_t cs_realloc;        // longest critical section in realloc
 } PACK_STRUCT 
 malloc_frag_t;
 
@@ -166,12 +196,27 @@ static inline void malloc_record_efrag(uint16_t b);
 static inline void malloc_record_ifrag(Block *b, uint16_t size, sos_pid_t id);
 static inline void malloc_record_blocks(int16_t blks);
 static inline void malloc_record_outstanding(int8_t alloc);
+static inline uint16_t malloc_record_cs(uint16_t max, uint16_t start);
+// critical section lengths are in ker_systime16L() ticks
+#define CS_PROFILE_START(t)       t = ker_systime16L()
+#define CS_PROFILE_END(t, field)  mf.field = malloc_record_cs(mf.field, t)
+#else
+#define CS_PROFILE_START(t)
+#define CS_PROFILE_END(t, field)
 #endif
 
 #define NUM_HEAP_BLOCKS  ((MALLOC_HEAP_SIZE + (BLOCK_SIZE - 1))/BLOCK_SIZE)
 static Block*           mPool;
 static Block*           mSentinel;
 static Block            malloc_heap[NUM_HEAP_BLOCKS] SOS_HEAP_SECTION;
+// block counts share the header word with the MEM_MASK flags
+#if NUM_HEAP_BLOCKS >= PREV_ONE
+#error "MALLOC_HEAP_SIZE is too large for the block header"
+#endif
+#ifdef SOS_MALLOC_SEGREGATED
+static Block*           seg_head[SEG_NUM_CLASSES];
+static uint8_t          seg_map;        // bit c is set if seg_head[c] is not empty
+#endif
 
 
 #ifdef SOS_USE_GC
@@ -208,16 +253,61 @@ void* sos_blk_mem_longterm_alloc(uint16_t size, sos_pid_t id, bool bCallFromModu
 #ifdef SOS_SFI
 	int8_t domid;
 #endif
+#ifdef SOS_MALLOC_SEGREGATED
+	uint16_t max_blocks;
+	uint8_t c;
+#endif
 #ifdef SOS_PROFILE_FRAGMENTATION
 	uint16_t efrag = 0;
+	uint16_t cs_start;
 #endif
 
 
 	if (size == 0) { return NULL; }
 
 	printMem("malloc_longterm begin: ");
-	reqBlocks = (size + BLOCKOVERHEAD + sizeof(Block) - 1) >> SHIFT_VALUE;
+	reqBlocks = BYTES_TO_BLOCKS(size);
 	ENTER_CRITICAL_SECTION();
+	CS_PROFILE_START(cs_start);
+#ifdef SOS_MALLOC_SEGREGATED
+	// Free areas are always coalesced, so only look for the fitting
+	// area with the largest address
+	for (c = 0; c < SEG_NUM_CLASSES; c++) {
+		for (block = seg_head[c]; block != NULL; block = block->next) {
+			if( (block > max_block) && (BLOCK_NUM(block) >= reqBlocks) ) {
+				max_block = block;
+			}
+		}
+	}
+
+#ifdef SOS_PROFILE_FRAGMENTATION
+	// Record external fragmentation
+	for (c = 0; c < SEG_NUM_CLASSES; c++) {
+		for (block = seg_head[c]; block != NULL; block = block->next) {
+			if( block > max_block ) {
+				efrag += BLOCK_NUM(block);
+			}
+		}
+	}
+	malloc_record_efrag( efrag );
+#endif
+
+	if( max_block == NULL ) {
+		printMem("Malloc Failed!!!: ");
+		CS_PROFILE_END(cs_start, cs_alloc);
+		LEAVE_CRITICAL_SECTION();
+		return NULL;
+	}
+
+	// Now take the tail of this block, and put the rest back
+	max_blocks = BLOCK_NUM(max_block);
+	SegUnlink(max_block);
+	newBlock = max_block + (max_blocks - reqBlocks);
+	newBlock->blockhdr.blocks = reqBlocks;
+	if( newBlock != max_block ) {
+		SegInsert(max_block, max_blocks - reqBlocks);
+	}
+#else
 	// First defragment the memory
 	for (block = mSentinel->next; block != mSentinel; block = block->next) {
 		block = MergeBlocks(block);
@@ -232,14 +322,17 @@ void* sos_blk_mem_longterm_alloc(uint16_t size, sos_pid_t id, bool bCallFromModu
 
 #ifdef SOS_PROFILE_FRAGMENTATION
 	// Record external fragmentation
-	for (block = max_block->next; block != mSentinel; block = block->next) {
-		efrag += block->blockhdr.blocks;
+	for (block = mSentinel->next; block != mSentinel; block = block->next) {
+		if( block > max_block ) {
+			efrag += block->blockhdr.blocks;
+		}
 	}	
 	malloc_record_efrag( efrag );
 #endif
 
 	if( max_block == NULL ) {
 		printMem("Malloc Failed!!!: ");
+		CS_PROFILE_END(cs_start, cs_alloc);
 		LEAVE_CRITICAL_SECTION();
 		return NULL;
 	}
@@ -254,6 +347,7 @@ void* sos_blk_mem_longterm_alloc(uint16_t size, sos_pid_t id, bool bCallFromModu
 		max_block->blockhdr.blocks -= reqBlocks;
 		newBlock->blockhdr.blocks = reqBlocks;
 	}
+#endif
 
 #ifdef SOS_PROFILE_FRAGMENTATION
 	// Record internal fragmentation
@@ -277,6 +371,7 @@ void* sos_blk_mem_longterm_alloc(uint16_t size, sos_pid_t id, bool bCallFromModu
 #endif
 
 	printMem("malloc_longterm end: ");
+	CS_PROFILE_END(cs_start, cs_alloc);
 	LEAVE_CRITICAL_SECTION();
 	ker_log( SOS_LOG_MALLOC, id, reqBlocks );
 	return newBlock->userPart;
@@ -295,24 +390,43 @@ void* sos_blk_mem_alloc(uint16_t size, sos_pid_t id, bool bCallFromModule)
 	int8_t domid;
 #endif
 #ifdef SOS_PROFILE_FRAGMENTATION
+#ifndef SOS_MALLOC_SEGREGATED
 	uint16_t efrag = 0;
 #endif
+	uint16_t cs_start;
+#endif
 
 	// Check for errors.
 	if (size == 0) return NULL;
 
 	// Compute the number of blocks to satisfy the request.
-	reqBlocks = (size + BLOCKOVERHEAD + sizeof(Block) - 1) >> SHIFT_VALUE;
+	reqBlocks = BYTES_TO_BLOCKS(size);
 
 	//DEBUG("sizeof(BlockHeaderType) = %d, sizeof(block) = %d\n", sizeof(BlockHeaderType), sizeof(Block));
 	//DEBUG("req size = %d, reqBlocks = %d\n", size, reqBlocks);
 
 	ENTER_CRITICAL_SECTION();
+	CS_PROFILE_START(cs_start);
 	//verify_memory();
+	printMem("malloc_start: ");
+#ifdef SOS_MALLOC_SEGREGATED
+	block = SegFind(reqBlocks);
+	if (block == NULL)
+	{
+		printMem("Malloc Failed!!!: ");
+		CS_PROFILE_END(cs_start, cs_alloc);
+		LEAVE_CRITICAL_SECTION();
+		return NULL;
+	}
+	SegUnlink(block);
+	if (BLOCK_NUM(block) > reqBlocks)
+	{
+		SplitBlock(block, reqBlocks);
+	}
+#else
 	// Traverse the free list looking for the first block that will fit the
 	// request. This is a "first-fit" strategy.
 	//
-	printMem("malloc_start: ");
 	for (block = mSentinel->next; block != mSentinel; block = block->next)
 	{
 		block = MergeBlocksQuick(block, reqBlocks);
@@ -338,6 +452,7 @@ void* sos_blk_mem_alloc(uint16_t size, sos_pid_t id, bool bCallFromModule)
   if (block == mSentinel)
     {
       printMem("Malloc Failed!!!: ");
+      CS_PROFILE_END(cs_start, cs_alloc);
       LEAVE_CRITICAL_SECTION();
       return NULL;
     }
@@ -356,6 +471,7 @@ void* sos_blk_mem_alloc(uint16_t size, sos_pid_t id, bool bCallFromModule)
   // as reserved.
   //
   Unlink(block);
+#endif
 
 #ifdef SOS_PROFILE_FRAGMENTATION
 	// Record internal fragmentation
@@ -377,6 +493,7 @@ void* sos_blk_mem_alloc(uint16_t size, sos_pid_t id, bool bCallFromModule)
 #endif
 
   printMem("malloc_end: ");
+  CS_PROFILE_END(cs_start, cs_alloc);
   LEAVE_CRITICAL_SECTION();
 
   ker_log( SOS_LOG_MALLOC, id, reqBlocks );
@@ -395,6 +512,9 @@ void sos_blk_mem_free(void* pntr, bool bCallFromModule)
 #ifdef SOS_SFI
   uint16_t block_num;
   uint8_t perms;
+#endif
+#ifdef SOS_PROFILE_FRAGMENTATION
+  uint16_t cs_start;
 #endif
   HAS_CRITICAL_SECTION;
   // Check for errors.
@@ -450,10 +570,11 @@ void sos_blk_mem_free(void* pntr, bool bCallFromModule)
   // areas to accumulate at the head of the free list.
   //
   ENTER_CRITICAL_SECTION();
+  CS_PROFILE_START(cs_start);
   owner = baseArea->blockhdr.owner;
-  baseArea->blockhdr.blocks &= ~MEM_MASK;
+  baseArea->blockhdr.blocks &= ~(RESERVED | GC_MARK);
   baseArea->blockhdr.owner = NULL_PID;
-  freed_blocks = baseArea->blockhdr.blocks;
+  freed_blocks = BLOCK_NUM(baseArea);
   
 #ifdef SOS_SFI
   MEMMAP_SET_PERMS(block_num, BLOCK_FREE);
@@ -462,13 +583,19 @@ void sos_blk_mem_free(void* pntr, bool bCallFromModule)
 		      DOM_SEG_LATER(perms), 
 		      BLOCK_FREE);
 #endif
+#ifdef SOS_MALLOC_SEGREGATED
+  // coalesce with the free neighbors right away
+  SegRelease(baseArea);
+#else
   InsertAfter(baseArea);
+#endif
   printMem("free_end: ");
 #ifdef SOS_PROFILE_FRAGMENTATION
 	mf.ptr_free = (uint16_t)pntr;
 	malloc_record_blocks(-1*(int16_t)freed_blocks);
 	malloc_record_outstanding(0);
 #endif
+  CS_PROFILE_END(cs_start, cs_free);
   LEAVE_CRITICAL_SECTION();
   ker_log( SOS_LOG_FREE, owner, freed_blocks );
   return;
@@ -561,6 +688,21 @@ int8_t sos_blk_mem_change_own(void* ptr, sos_pid_t id, bool bCallFromModule)
   return SOS_OK;
 }
 
+//-----------------------------------------------------------------------------
+// Number of bytes the owner may use in an allocated area.  This may be more
+// than what was asked for since areas are made of whole blocks.
+//-----------------------------------------------------------------------------
+uint16_t sos_blk_mem_size(void* ptr)
+{
+  Block* blockptr = TO_BLOCK_PTR(ptr);
+
+  if ((NULL == ptr) || (blockptr < malloc_heap) || (blockptr >= (malloc_heap + NUM_HEAP_BLOCKS)) ||
+      ((blockptr->blockhdr.blocks & RESERVED) == 0)) {
+    return 0;
+  }
+  return BLOCKS_TO_BYTES(blockptr->blockhdr.blocks) - (BLOCKOVERHEAD - BLOCK_HDR_SIZE);
+}
+
 void mem_start() 
 {
 #ifdef SOS_USE_GC
@@ -576,12 +718,14 @@ int8_t mem_remove_all(sos_pid_t id)
 {
   HAS_CRITICAL_SECTION;
   Block* block = (Block*)malloc_heap;
+  Block* next;
 
   ENTER_CRITICAL_SECTION();
   for (block = (Block*)malloc_heap; 
        block != mSentinel; 
-       block += block->blockhdr.blocks & ~MEM_MASK) 
+       block = next) 
     {
+      next = WalkNext(block);
       if ( (block->blockhdr.owner == id) && (block->blockhdr.blocks & RESERVED) ){
 		ker_free(block->userPart);
       }		
@@ -610,6 +754,9 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
   uint8_t perms;  
   uint16_t oldSize;
   int8_t domid;
+#endif
+#ifdef SOS_PROFILE_FRAGMENTATION
+  uint16_t cs_start;
 #endif
   // Check for errors.
   //
@@ -640,13 +787,14 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
 
 
   Block* block = TO_BLOCK_PTR(pntr);   // convert user to block address
-  uint16_t reqBlocks = (newSize + BLOCKOVERHEAD + sizeof(Block) - 1) >> SHIFT_VALUE;
+  uint16_t reqBlocks = BYTES_TO_BLOCKS(newSize);
 
   ENTER_CRITICAL_SECTION();
+  CS_PROFILE_START(cs_start);
   id = block->blockhdr.owner;
   block->blockhdr.blocks &= ~RESERVED;         // expose the size
 #ifdef SOS_PROFILE_FRAGMENTATION
-  old_blocks = block->blockhdr.blocks;
+  old_blocks = BLOCK_NUM(block);
 #endif
 #ifdef SOS_SFI
   oldSize = BLOCKS_TO_BYTES(block->blockhdr.blocks);
@@ -657,7 +805,7 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
   //
   block = MergeBlocks(block);
 
-  if (block->blockhdr.blocks > reqBlocks)
+  if (BLOCK_NUM(block) > reqBlocks)
     {
       // The merge produced a larger block than required, so split it
       // into two blocks. This also takes care of the case where the
@@ -682,7 +830,7 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
 #endif
       
     }
-  else if (block->blockhdr.blocks < reqBlocks)
+  else if (BLOCK_NUM(block) < reqBlocks)
     {
       // Could not expand this block. Must attempt to allocate
       // a new one the correct size and copy the current contents.
@@ -691,6 +839,10 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
       uint16_t oldSize = BLOCKS_TO_BYTES(block->blockhdr.blocks);
 #endif
 	  block->blockhdr.blocks |= RESERVED;         // convert it back
+#ifndef SOS_SFI
+	  // the merge may have moved the end of the block
+	  BLOCK_GUARD_BYTE(block) = id;
+#endif
       block = (Block*)ker_malloc(newSize, id);
       if (NULL != block)
         {
@@ -706,12 +858,13 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
 	  // Cannot re-allocate this block. Note the old pointer
 	  // is still valid.
 	  //
+	  CS_PROFILE_END(cs_start, cs_realloc);
 	  LEAVE_CRITICAL_SECTION();
 	  return NULL;        // no valid options
         }
     }
 #ifdef SOS_SFI
-  else if (block->blockhdr.blocks == reqBlocks)
+  else if (BLOCK_NUM(block) == reqBlocks)
     {
       memmap_set_perms((Block*)(block + oldSize), 
 		       (reqBlocks - oldSize)*(sizeof(Block)), 
@@ -724,6 +877,7 @@ void* sos_blk_mem_realloc(void* pntr, uint16_t newSize, bool bCallFromModule)
 #ifndef SOS_SFI                                
   BLOCK_GUARD_BYTE(block) = id; 
 #endif
+  CS_PROFILE_END(cs_start, cs_realloc);
   LEAVE_CRITICAL_SECTION();
   printMem("realloc end: ");
   return block->userPart;
@@ -751,8 +905,15 @@ void mem_init(void)
   // Entire pool is initially a single unallocated area.
   //
   head = &mPool[0];
+#ifdef SOS_MALLOC_SEGREGATED
+  memset(seg_head, 0, sizeof(seg_head));
+  seg_map = 0;
+  head->blockhdr.owner = NULL_PID;
+  SegInsert(head, NUM_HEAP_BLOCKS-1);
+#else
   head->blockhdr.blocks = NUM_HEAP_BLOCKS-1;         // initially all of free memeory
   InsertAfter(head);                      // link the sentinel
+#endif
 
 #ifdef SOS_SFI
   memmap_init(); // Initialize all the memory to be owned by the kernel
@@ -762,9 +923,181 @@ void mem_init(void)
 #ifdef SOS_PROFILE_FRAGMENTATION
 	mf.num_blocks = 0;
 	mf.num_outstanding = 0;
+	mf.cs_alloc = 0;
+	mf.cs_free = 0;
+	mf.cs_realloc = 0;
+#endif
+
+}
+
+#ifdef SOS_MALLOC_SEGREGATED
+//-----------------------------------------------------------------------------
+// Segregated free lists. Free areas are never next to each other: an area
+// is merged with its free neighbors as soon as it is released. Every free
+// area records its size at its end (or with PREV_ONE in the next header
+// when it is a single block) so that the area before a released one can be
+// found without a search.
+//
+static uint8_t SegClass(uint16_t blocks)
+{
+  uint8_t c = 0;
+  while (blocks > 1 && c < SEG_NUM_CLASSES - 1)
+    {
+      blocks >>= 1;
+      c++;
+    }
+  return c;
+}
+
+static void SegInsert(Block* block, uint16_t blocks)
+{
+  Block* successor = block + blocks;
+  uint8_t c = SegClass(blocks);
+
+  block->blockhdr.blocks = blocks;
+  if (blocks > 1)
+    {
+      BLOCK_FOOTER(block, blocks) = blocks;
+      successor->blockhdr.blocks = (successor->blockhdr.blocks & ~PREV_ONE) | PREV_FREE;
+    }
+  else
+    {
+      successor->blockhdr.blocks |= PREV_FREE | PREV_ONE;
+    }
+  block->prev = NULL;
+  block->next = seg_head[c];
+  if (block->next != NULL)
+    {
+      block->next->prev = block;
+    }
+  seg_head[c] = block;
+  seg_map |= (1 << c);
+}
+
+static void SegUnlink(Block* block)
+{
+  uint16_t blocks = BLOCK_NUM(block);
+  uint8_t c = SegClass(blocks);
+
+  if (block->prev != NULL)
+    {
+      block->prev->next = block->next;
+    }
+  else
+    {
+      seg_head[c] = block->next;
+      if (seg_head[c] == NULL)
+        {
+	  seg_map &= ~(1 << c);
+        }
+    }
+  if (block->next != NULL)
+    {
+      block->next->prev = block->prev;
+    }
+  (block + blocks)->blockhdr.blocks &= ~(PREV_FREE | PREV_ONE);
+}
+
+//
+// Put an area that is not on any list back, merging it with its neighbors
+//
+static void SegRelease(Block* block)
+{
+  uint16_t blocks = BLOCK_NUM(block);
+  Block* successor = block + blocks;
+
+  if ((successor->blockhdr.blocks & RESERVED) == 0)
+    {
+      SegUnlink(successor);
+      blocks += BLOCK_NUM(successor);
+    }
+  if (block->blockhdr.blocks & PREV_FREE)
+    {
+      Block* predecessor;
+      if (block->blockhdr.blocks & PREV_ONE)
+        {
+	  predecessor = block - 1;
+        }
+      else
+        {
+	  predecessor = block - *((uint16_t*)block - 1);
+        }
+      SegUnlink(predecessor);
+      blocks += BLOCK_NUM(predecessor);
+      block = predecessor;
+    }
+  SegInsert(block, blocks);
+}
+
+//
+// First fit within the class of the request, otherwise the first area of
+// the next non-empty class, which always fits.
+//
+static Block* SegFind(uint16_t reqBlocks)
+{
+  Block* block;
+  uint8_t c = SegClass(reqBlocks);
+  uint8_t map;
+#ifdef SOS_PROFILE_FRAGMENTATION
+  uint16_t efrag = 0;
 #endif
 
+  for (block = seg_head[c]; block != NULL; block = block->next)
+    {
+      if (BLOCK_NUM(block) >= reqBlocks)
+        {
+	  break;
+        }
+#ifdef SOS_PROFILE_FRAGMENTATION
+      efrag += BLOCK_NUM(block);
+#endif
+    }
+#ifdef SOS_PROFILE_FRAGMENTATION
+  malloc_record_efrag( efrag );
+#endif
+  if (block != NULL)
+    {
+      return block;
+    }
+  map = seg_map >> (c + 1);
+  if (map == 0)
+    {
+      return NULL;
+    }
+  for (c++; (map & 1) == 0; c++)
+    {
+      map >>= 1;
+    }
+  return seg_head[c];
+}
+
+//
+// Grow an area that is not on any list with the free area after it
+//
+static Block* MergeBlocks(Block* block)
+{
+  Block* successor = block + BLOCK_NUM(block);
+
+  if ((successor->blockhdr.blocks & RESERVED) == 0)
+    {
+      SegUnlink(successor);
+      block->blockhdr.blocks += BLOCK_NUM(successor);
+    }
+  return block;
+}
+
+//
+// Shrink an area that is not on any list, releasing the remainder
+//
+static void SplitBlock(Block* block, uint16_t reqBlocks)
+{
+  Block* newBlock = block + reqBlocks;
+  newBlock->blockhdr.blocks = BLOCK_NUM(block) - reqBlocks;
+  newBlock->blockhdr.owner = NULL_PID;
+  block->blockhdr.blocks = reqBlocks | (block->blockhdr.blocks & MEM_MASK);
+  SegRelease(newBlock);
 }
+#else
 
 //-----------------------------------------------------------------------------
 // As each area is examined for a fit, we also examine the following area. 
@@ -854,6 +1187,21 @@ static void Unlink(Block* block)
   block->prev->next = block->next;
   block->next->prev = block->prev;
 }
+#endif // SOS_MALLOC_SEGREGATED
+
+//-----------------------------------------------------------------------------
+// Next area when walking the heap. A free area after this one is skipped as
+// well, since freeing this area may merge them.
+//
+static inline Block* WalkNext(Block* block)
+{
+  Block* next = block + BLOCK_NUM(block);
+  if (next != mSentinel && (next->blockhdr.blocks & RESERVED) == 0)
+    {
+      next += BLOCK_NUM(next);
+    }
+  return next;
+}
 
 #if 0
 static inline void mem_defrag()
@@ -970,6 +1318,7 @@ void malloc_gc(sos_pid_t pid)
 	int i;
 #endif
 	Block* block = (Block*)malloc_heap;
+	Block* next;
 	//
 	// Traverse the memory
 	// Look for matching pid
@@ -977,8 +1326,9 @@ void malloc_gc(sos_pid_t pid)
 	//
 	for (block = (Block*)malloc_heap; 
        block != mSentinel && block >= malloc_heap && block < &(malloc_heap[NUM_HEAP_BLOCKS]); 
-       block += block->blockhdr.blocks & ~MEM_MASK) 
+       block = next) 
     {
+		next = WalkNext(block);
 		if ( (block->blockhdr.owner == pid) &&
 		((block->blockhdr.blocks & RESERVED) != 0) ) { 
 			if( ((block->blockhdr.blocks & GC_MARK) == 0) ){
@@ -1301,12 +1651,12 @@ static void printMem(char* s)
 #ifdef SOS_PROFILE_FRAGMENTATION
 static void malloc_record_efrag(uint16_t b)
 {
-	mf.malloc_efrag = b << SHIFT_VALUE;
+	mf.malloc_efrag = b * sizeof(Block);
 }
 
 static void malloc_record_ifrag(Block *b, uint16_t size, sos_pid_t id)
 {
-	mf.malloc_ifrag = ((b->blockhdr.blocks << SHIFT_VALUE) - (size + BLOCKOVERHEAD));    
+	mf.malloc_ifrag = ((BLOCK_NUM(b) * sizeof(Block)) - (size + BLOCKOVERHEAD));    
 	mf.alloc = size;
 	mf.alloc_pid = id;
 
@@ -1326,6 +1676,12 @@ static void malloc_record_outstanding(int8_t alloc)
 	}
 	
 }
+
+static uint16_t malloc_record_cs(uint16_t max, uint16_t start)
+{
+	uint16_t len = ker_systime16L() - start;
+	return (len > max)? len : max;
+}
 #endif
 
 void* ker_sys_malloc(uint16_t size)
@@ -75,6 +75,7 @@ int8_t post_short(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t byte,
 {
   Message *m = msg_create();
   MsgParam *p;
+  int8_t ret;
   if(m == NULL){
 	return -ENOMEM;
   }
@@ -92,9 +93,9 @@ int8_t post_short(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t byte,
   p->byte = byte;
   p->word = word;
   m->flag = flag & ((sos_ker_flag_t)(~SOS_MSG_RELEASE));
-  sched_msg_alloc(m);
+  ret = sched_msg_alloc(m);
   ker_log( SOS_LOG_POST_SHORT, sid, did ); 
-  return SOS_OK;
+  return ret;
 }
 
 // Post a message with payload and source address
@@ -102,9 +103,12 @@ int8_t post_longer(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t len,
 				   void *data, uint16_t flag, uint16_t saddr)
 {
   Message *m = msg_create();
+  int8_t ret;
   if(m == NULL){
 	if(flag_msg_release(flag)){
-	  ker_free(data);
+	  msg_payload_free(data);
+	} else if(flag_msg_shared(flag)){
+	  msg_payload_put(data);
 	}
 	return -ENOMEM;
   }
@@ -120,9 +124,9 @@ int8_t post_longer(sos_pid_t did, sos_pid_t sid, uint8_t type, uint8_t len,
   m->priority = get_module_priority(did);
 #endif
   m->flag = flag;
-  sched_msg_alloc(m);
+  ret = sched_msg_alloc(m);
   ker_log( SOS_LOG_POST_LONG, sid, did ); 
-  return SOS_OK;
+  return ret;
 }
 
 // Post a message with payload
@@ -139,11 +143,13 @@ int8_t ker_sys_post(sos_pid_t did, uint8_t type, uint8_t size, void *data,
 		uint16_t flag)
 {
 	sos_pid_t my_id = ker_get_current_pid();
-	if(post_long(did, my_id, type, size, data, flag) != SOS_OK )
+	int8_t ret = post_long(did, my_id, type, size, data, flag);
+	// a full destination queue is not the fault of the sender
+	if(ret != SOS_OK && ret != -EBUSY)
 	{
 		return ker_mod_panic(my_id);
 	}
-	return SOS_OK;
+	return ret;
 }
 
 
@@ -165,7 +171,7 @@ uint8_t *ker_msg_take_data(sos_pid_t pid, Message *msg_in)
 	msg->flag &= ~(SOS_MSG_RELEASE);
 	return ret;
   } else {
-	ret = (uint8_t*)ker_malloc(msg->len, pid);
+	ret = (uint8_t*)msg_payload_alloc(msg->len, pid);
 	if(ret == NULL) return NULL;
 	memcpy(ret, msg->data, msg->len);
 	return ret;
@@ -206,9 +212,7 @@ int8_t ker_sys_post_value(sos_pid_t dst_mod_id,
 	m->priority = get_module_priority(dst_mod_id);
 #endif
 	m->flag = flag & ((sos_ker_flag_t)(~SOS_MSG_RELEASE));
-	sched_msg_alloc(m);
-
-	return SOS_OK;
+	return sched_msg_alloc(m);
 }
 
 #ifdef PC_PLATFORM
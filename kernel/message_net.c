@@ -121,24 +121,66 @@ static inline void msg_change_endian(Message* e){
   e->saddr = ehtons(e->saddr);
 }
 
-// Create a deep copy of the message
+// Give the extra link headers of a message their payload
 
 #if defined(SOS_UART_CHANNEL) || defined(SOS_I2C_CHANNEL) || defined(SOS_SPI_CHANNEL)
-static Message* msg_duplicate(Message* m){
-  Message* mcopy;
-	uint8_t* d;
-  mcopy = msg_create();
-  if (NULL == mcopy) return NULL;
-  d = (uint8_t*)ker_malloc(m->len, KER_SCHED_PID);
-  if ((NULL == d) && (0 != m->len)){
-    msg_dispose(mcopy);
-    return NULL;
+/*
+ * Fill out the headers in mcopy[] that are not m itself.  The headers
+ * share one payload: a released payload is shared with m, any other one
+ * is copied once for the copies.  A time stamped message gets a deep
+ * copy per link since each link writes its time into the payload, and so
+ * does a message that finds no free share slot.
+ */
+static int8_t msg_fanout(Message* m, Message** mcopy, uint8_t msg_count)
+{
+  uint8_t* d = m->data;
+  uint16_t flag = m->flag & ~(SOS_MSG_RELEASE | SOS_MSG_RELIABLE);
+  bool deep = false;
+  uint8_t i;
+
+  if (m->type == MSG_TIMESTAMP){
+    deep = true;
+  } else if (flag_msg_release(m->flag)){
+    if (msg_payload_share(d, msg_count) == SOS_OK){
+      m->flag = (m->flag & ~SOS_MSG_RELEASE) | SOS_MSG_SHARED;
+      flag |= SOS_MSG_SHARED;
+    } else {
+      deep = true;
+    }
+  } else if ((0 != m->len) && (d != m->payload)){
+    // m keeps the caller's buffer until the senddone
+    d = (uint8_t*)msg_payload_alloc(m->len, KER_SCHED_PID);
+    if (NULL != d){
+      memcpy(d, m->data, m->len);
+      if (msg_count == 2){
+        flag |= SOS_MSG_RELEASE;
+      } else if (msg_payload_share(d, msg_count - 1) == SOS_OK){
+        flag |= SOS_MSG_SHARED;
+      } else {
+        msg_payload_free(d);
+        deep = true;
+      }
+    } else {
+      deep = true;
+    }
+  }
+
+  for (i = 0; i < NUM_IO_LINKS; i++){
+    if ((NULL == mcopy[i]) || (m == mcopy[i])) continue;
+    memcpy(mcopy[i], m, sizeof(Message));
+    mcopy[i]->flag = flag;
+    if (m->data == m->payload){
+      mcopy[i]->data = mcopy[i]->payload;
+    } else if (deep){
+      mcopy[i]->data = (uint8_t*)msg_payload_alloc(m->len, KER_SCHED_PID);
+      if ((NULL == mcopy[i]->data) && (0 != m->len)) return -ENOMEM;
+      memcpy(mcopy[i]->data, m->data, m->len);
+      mcopy[i]->flag |= SOS_MSG_RELEASE;
+    } else {
+      mcopy[i]->data = d;
+    }
   }
-	memcpy(mcopy, m, sizeof(Message));
-	mcopy->data = d;
-	mcopy->flag |= SOS_MSG_RELEASE;
-  memcpy(mcopy->data, m->data, m->len);
-  return mcopy;
+  return SOS_OK;
 }
 #endif
 
@@ -157,7 +199,7 @@ int8_t post(Message *e){
   Message *m = msg_create();
   if(m == NULL){ 
 	if(flag_msg_release(e->flag)) {
-	  ker_free(e->data);
+	  msg_payload_free(e->data);
 		e->data = NULL;
 		e->len = 0;
 	}
@@ -189,7 +231,7 @@ int8_t post_link(sos_pid_t did, sos_pid_t sid,
   Message *m = msg_create();
   if (NULL == m){
     if (flag_msg_release(flag)){
-      ker_free(data);
+      msg_payload_free(data);
     }
     return -ENOMEM;
   }
@@ -263,9 +305,8 @@ static int8_t sos_msg_dispatch(Message* m)
 
   // Local Dispatch
   if (node_address == m->daddr){
-    sched_msg_alloc(m);
 		ker_log( SOS_LOG_POST_NET, m->sid, m->daddr );
-    return SOS_OK;
+    return sched_msg_alloc(m);
   }
 
 #if !defined(SOS_UART_CHANNEL) && !defined(SOS_I2C_CHANNEL) && !defined(SOS_RADIO_CHANNEL) && !defined(SOS_SPI_CHANNEL)
@@ -299,7 +340,7 @@ static int8_t sos_msg_dispatch(Message* m)
 		return SOS_OK;
 	}
 
-	// Pre-allocate the message copies to allow for
+	// Pre-allocate the message headers to allow for
 	// an atomic NOMEM failure
 #ifdef SOS_RADIO_CHANNEL
 	if (flag_msg_from_radio(m->flag)){
@@ -313,9 +354,8 @@ static int8_t sos_msg_dispatch(Message* m)
 		if (msg_count == 0){
 			mcopy[SOS_UART_LINK_ID] = m;
 		} else {
-			mcopy[SOS_UART_LINK_ID] = msg_duplicate(m);
+			mcopy[SOS_UART_LINK_ID] = msg_create();
 			if (NULL == mcopy[SOS_UART_LINK_ID]) goto dispatch_cleanup;
-			mcopy[SOS_UART_LINK_ID]->flag &= ~SOS_MSG_RELIABLE;
 		}
 		msg_count++;
 	}
@@ -326,9 +366,8 @@ static int8_t sos_msg_dispatch(Message* m)
 		if (msg_count == 0){
 			mcopy[SOS_I2C_LINK_ID] = m;
 		} else {
-			mcopy[SOS_I2C_LINK_ID] = msg_duplicate(m);
+			mcopy[SOS_I2C_LINK_ID] = msg_create();
 			if (NULL == mcopy[SOS_I2C_LINK_ID]) goto dispatch_cleanup;
-			mcopy[SOS_I2C_LINK_ID]->flag &= ~SOS_MSG_RELIABLE;
 		}
 		msg_count++;
 	}
@@ -339,14 +378,20 @@ static int8_t sos_msg_dispatch(Message* m)
 		if (msg_count == 0){
 			mcopy[SOS_SPI_LINK_ID] = m;
 		} else {
-			mcopy[SOS_SPI_LINK_ID] = msg_duplicate(m);
+			mcopy[SOS_SPI_LINK_ID] = msg_create();
 			if (NULL == mcopy[SOS_SPI_LINK_ID]) goto dispatch_cleanup;
-			mcopy[SOS_SPI_LINK_ID]->flag &= ~SOS_MSG_RELIABLE;
 		}
 		msg_count++;
 	}
 #endif
 
+#if defined(SOS_UART_CHANNEL) || defined(SOS_I2C_CHANNEL) || defined(SOS_SPI_CHANNEL)
+	// One payload for all the links
+	if ((msg_count > 1) && (msg_fanout(m, mcopy, msg_count) != SOS_OK)){
+		goto dispatch_cleanup;
+	}
+#endif
+
 	// Deliver to monitor only once
 	monitor_deliver_outgoing_msg_to_monitor(m);
 
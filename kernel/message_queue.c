@@ -49,6 +49,7 @@
 #include <sos_sched.h>
 #include <slab.h>
 #include <hardware.h>
+#include <sos_info.h>
 
 #if defined (SOS_UART_CHANNEL)
 #include <sos_uart.h>
@@ -65,21 +66,228 @@
 #define DEBUG(...)
 
 #define MSG_QUEUE_NUM_ITEMS 4
+
+//! header pools kept when they become empty
+#ifndef MSG_HDR_POOLS_LOW
+#define MSG_HDR_POOLS_LOW    2
+#endif
+//! most header pools, 0 for no limit
+#ifndef MSG_HDR_POOLS_HIGH
+#define MSG_HDR_POOLS_HIGH   0
+#endif
+//! payload buffers of each size allocated at boot
+#ifndef MSG_PAYLOAD_POOL_LOW
+#define MSG_PAYLOAD_POOL_LOW   1
+#endif
+//! most free payload buffers kept for each size
+#ifndef MSG_PAYLOAD_POOL_HIGH
+#define MSG_PAYLOAD_POOL_HIGH  4
+#endif
+//! most payloads shared between message headers at once
+#ifndef MSG_SHARED_PAYLOADS
+#define MSG_SHARED_PAYLOADS    4
+#endif
 //----------------------------------------------------------------------------
 //  Global data declarations
 //----------------------------------------------------------------------------
 static slab_t msg_slab;
 
+/*
+ * Payload pools
+ *
+ * The payloads cannot live in a slab since the receiver of a message may
+ * take the payload with ker_msg_take_data() and later ker_free() it.  So a
+ * pool is a free list of ordinary heap blocks owned by MSG_QUEUE_PID, and
+ * the first bytes of a free block link it to the next one.  Any released
+ * payload whose capacity falls into a pool can be recycled.
+ */
+static const uint8_t payload_size[MSG_PAYLOAD_POOLS] = {8, 16, 32};
+static void *payload_free[MSG_PAYLOAD_POOLS];
+static msg_pool_info_t pool_info;
+
+/*
+ * Shared payloads
+ *
+ * A message that goes out over several links needs one header per link,
+ * but the headers can refer to the same payload.  Such a payload is owned
+ * by MSG_QUEUE_PID and the headers carry SOS_MSG_SHARED rather than
+ * SOS_MSG_RELEASE, so the links never change its owner and a receiver
+ * that takes the data gets a copy.  The last header disposed frees it.
+ */
+typedef struct {
+	void    *data;
+	uint8_t  refcnt;
+} shared_payload_t;
+
+static shared_payload_t shared_payload[MSG_SHARED_PAYLOADS];
+
 //----------------------------------------------------------------------------
 //  Funcation declarations
 //----------------------------------------------------------------------------
 int8_t msg_queue_init()
 {
+	uint8_t i, j;
+
 	ker_slab_init( MSG_QUEUE_PID, &msg_slab, sizeof(Message), 
 			MSG_QUEUE_NUM_ITEMS, 0 );
+	ker_slab_set_watermark( &msg_slab, MSG_HDR_POOLS_LOW, MSG_HDR_POOLS_HIGH );
+
+	for( i = 0; i < MSG_PAYLOAD_POOLS; i++ ) {
+		payload_free[i] = NULL;
+		for( j = 0; j < MSG_PAYLOAD_POOL_LOW; j++ ) {
+			void *p = malloc_longterm( payload_size[i], MSG_QUEUE_PID );
+			if( p == NULL ) {
+				break;
+			}
+			*((void**)p) = payload_free[i];
+			payload_free[i] = p;
+			pool_info.payload_free[i]++;
+		}
+	}
     return 0;
 }
 
+/**
+ * @brief allocate a message payload of len bytes for pid
+ */
+void *msg_payload_alloc(uint16_t len, sos_pid_t pid)
+{
+	HAS_CRITICAL_SECTION;
+	uint8_t i;
+	void *p;
+
+	for( i = 0; i < MSG_PAYLOAD_POOLS; i++ ) {
+		if( len <= payload_size[i] ) {
+			break;
+		}
+	}
+	if( len == 0 || i == MSG_PAYLOAD_POOLS ) {
+		return ker_malloc( len, pid );
+	}
+
+	ENTER_CRITICAL_SECTION();
+	p = payload_free[i];
+	if( p != NULL ) {
+		payload_free[i] = *((void**)p);
+		pool_info.payload_free[i]--;
+		pool_info.payload_hit[i]++;
+		LEAVE_CRITICAL_SECTION();
+		ker_change_own( p, pid );
+		return p;
+	}
+	pool_info.payload_miss[i]++;
+	LEAVE_CRITICAL_SECTION();
+
+	//
+	// Allocate the full pool size so that the buffer can be recycled
+	//
+	p = ker_malloc( payload_size[i], pid );
+	if( p == NULL ) {
+		p = ker_malloc( len, pid );
+	}
+	return p;
+}
+
+/**
+ * @brief release a message payload
+ */
+void msg_payload_free(void *data)
+{
+	HAS_CRITICAL_SECTION;
+	uint16_t cap;
+	uint8_t i;
+
+	if( data == NULL ) {
+		return;
+	}
+	cap = sos_blk_mem_size( data );
+	for( i = MSG_PAYLOAD_POOLS; i > 0; i-- ) {
+		if( cap >= payload_size[i - 1] ) {
+			break;
+		}
+	}
+	//
+	// Only keep buffers that are not much larger than the pool size
+	//
+	if( i == 0 || cap >= 2 * payload_size[i - 1] ||
+			pool_info.payload_free[i - 1] >= MSG_PAYLOAD_POOL_HIGH ||
+			ker_change_own( data, MSG_QUEUE_PID ) != SOS_OK ) {
+		ker_free( data );
+		return;
+	}
+	i--;
+	ENTER_CRITICAL_SECTION();
+	*((void**)data) = payload_free[i];
+	payload_free[i] = data;
+	pool_info.payload_free[i]++;
+	LEAVE_CRITICAL_SECTION();
+}
+
+/**
+ * @brief share a payload between refs message headers
+ */
+int8_t msg_payload_share(void *data, uint8_t refs)
+{
+	HAS_CRITICAL_SECTION;
+	uint8_t i;
+
+	ENTER_CRITICAL_SECTION();
+	for( i = 0; i < MSG_SHARED_PAYLOADS; i++ ) {
+		if( shared_payload[i].refcnt == 0 ) {
+			shared_payload[i].data = data;
+			shared_payload[i].refcnt = refs;
+			pool_info.payload_shared++;
+			LEAVE_CRITICAL_SECTION();
+			ker_change_own( data, MSG_QUEUE_PID );
+			return SOS_OK;
+		}
+	}
+	pool_info.payload_share_fail++;
+	LEAVE_CRITICAL_SECTION();
+	return -ENOMEM;
+}
+
+/**
+ * @brief drop one reference to a shared payload
+ */
+void msg_payload_put(void *data)
+{
+	HAS_CRITICAL_SECTION;
+	uint8_t i;
+
+	ENTER_CRITICAL_SECTION();
+	for( i = 0; i < MSG_SHARED_PAYLOADS; i++ ) {
+		if( shared_payload[i].refcnt != 0 && shared_payload[i].data == data ) {
+			if( --shared_payload[i].refcnt == 0 ) {
+				shared_payload[i].data = NULL;
+				LEAVE_CRITICAL_SECTION();
+				msg_payload_free( data );
+				return;
+			}
+			break;
+		}
+	}
+	LEAVE_CRITICAL_SECTION();
+}
+
+void ker_msg_pool_info(msg_pool_info_t *info)
+{
+	HAS_CRITICAL_SECTION;
+	uint8_t i;
+
+	ENTER_CRITICAL_SECTION();
+	*info = pool_info;
+	info->hdr_pools = msg_slab.num_pools;
+	info->hdr_peak_pools = msg_slab.peak_pools;
+	info->hdr_used = msg_slab.num_used;
+	info->hdr_peak = msg_slab.peak_used;
+	info->hdr_fail = msg_slab.num_fail;
+	LEAVE_CRITICAL_SECTION();
+	for( i = 0; i < MSG_PAYLOAD_POOLS; i++ ) {
+		info->payload_size[i] = payload_size[i];
+	}
+}
+
 /**
  * @brief initialize the message queue
  */
@@ -242,6 +450,185 @@ Message *mq_dequeue(mq_t *q)
 	return tmp;
 }
 
+#ifndef SOS_USE_PREEMPTION
+/**
+ * @brief dequeue a burst of messages of the same priority
+ * @param max  largest number of messages to take
+ * @return the messages in queue order, linked by next, or NULL for empty queue
+ * The burst comes from the highest priority queue that is not empty, so
+ * that priority order is the same as with mq_dequeue()
+ */
+Message *mq_dequeue_batch(mq_t *q, uint8_t max)
+{
+	HAS_CRITICAL_SECTION;
+	Message **head;
+	uint8_t *cnt;
+	Message *first;
+	Message *last;
+	uint8_t n = 1;
+
+	ENTER_CRITICAL_SECTION();
+	if (q->hq_head != NULL) {
+		head = &q->hq_head;
+		cnt = &q->hm_cnt;
+	} else if (q->sq_head != NULL) {
+		head = &q->sq_head;
+		cnt = &q->sm_cnt;
+	} else if (q->lq_head != NULL) {
+		head = &q->lq_head;
+		cnt = &q->lm_cnt;
+	} else {
+		LEAVE_CRITICAL_SECTION();
+		return NULL;
+	}
+	first = last = *head;
+	while (n < max && last->next != NULL) {
+		last = last->next;
+		n++;
+	}
+	//! the tail is not used once the head is NULL
+	*head = last->next;
+	last->next = NULL;
+	*cnt -= n;
+	q->msg_cnt -= n;
+	LEAVE_CRITICAL_SECTION();
+	return first;
+}
+
+/**
+ * @brief put back the undispatched part of a burst from mq_dequeue_batch()
+ * The messages go back to the front of their queue, in the same order
+ */
+void mq_requeue_batch(mq_t *q, Message *m)
+{
+	HAS_CRITICAL_SECTION;
+	Message **head;
+	Message **tail;
+	uint8_t *cnt;
+	Message *last = m;
+	uint8_t n = 1;
+
+	if (m == NULL) return;
+	while (last->next != NULL) {
+		last = last->next;
+		n++;
+	}
+	if (flag_high_priority(m->flag)) {
+		head = &q->hq_head;
+		tail = &q->hq_tail;
+		cnt = &q->hm_cnt;
+	} else if (flag_system(m->flag)) {
+		head = &q->sq_head;
+		tail = &q->sq_tail;
+		cnt = &q->sm_cnt;
+	} else {
+		head = &q->lq_head;
+		tail = &q->lq_tail;
+		cnt = &q->lm_cnt;
+	}
+	ENTER_CRITICAL_SECTION();
+	if (*head == NULL) {
+		*tail = last;
+	}
+	last->next = *head;
+	*head = m;
+	*cnt += n;
+	q->msg_cnt += n;
+	LEAVE_CRITICAL_SECTION();
+}
+
+/**
+ * @brief first message in the list that passes the filter, and unlink it
+ * @param did  used instead of the filter when f is NULL
+ */
+static Message *mq_list_remove(Message **head, Message **tail, mq_filter_t f,
+		sos_pid_t did)
+{
+	Message *prev = NULL;
+	Message *curr;
+
+	for (curr = *head; curr != NULL; prev = curr, curr = curr->next) {
+		if ((f != NULL)? f(curr) : (curr->did == did)) {
+			if (prev == NULL) {
+				*head = curr->next;
+			} else {
+				prev->next = curr->next;
+			}
+			if (*tail == curr) {
+				*tail = prev;
+			}
+			return curr;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief dequeue the first message that passes the filter
+ * @return the message, or NULL if none of the messages of the highest
+ * queued priority passes
+ * Messages of lower priority are not looked at, so the caller keeps
+ * priority order by falling back to mq_dequeue()
+ */
+Message *mq_dequeue_if(mq_t *q, mq_filter_t f)
+{
+	HAS_CRITICAL_SECTION;
+	Message *tmp = NULL;
+
+	ENTER_CRITICAL_SECTION();
+	if (q->hq_head != NULL) {
+		if ((tmp = mq_list_remove(&q->hq_head, &q->hq_tail, f, NULL_PID)) != NULL) {
+			q->hm_cnt--;
+		}
+	} else if (q->sq_head != NULL) {
+		if ((tmp = mq_list_remove(&q->sq_head, &q->sq_tail, f, NULL_PID)) != NULL) {
+			q->sm_cnt--;
+		}
+	} else if (q->lq_head != NULL) {
+		if ((tmp = mq_list_remove(&q->lq_head, &q->lq_tail, f, NULL_PID)) != NULL) {
+			q->lm_cnt--;
+		}
+	}
+	if (tmp != NULL) {
+		q->msg_cnt--;
+	}
+	LEAVE_CRITICAL_SECTION();
+	return tmp;
+}
+
+/**
+ * @brief remove the oldest message to did
+ * Low priority messages go first, system messages are never removed
+ */
+Message *mq_remove_oldest(mq_t *q, sos_pid_t did)
+{
+	HAS_CRITICAL_SECTION;
+	Message *tmp;
+
+	ENTER_CRITICAL_SECTION();
+	if ((tmp = mq_list_remove(&q->lq_head, &q->lq_tail, NULL, did)) != NULL) {
+		q->lm_cnt--;
+	} else if ((tmp = mq_list_remove(&q->hq_head, &q->hq_tail, NULL, did)) != NULL) {
+		q->hm_cnt--;
+	}
+	if (tmp != NULL) {
+		q->msg_cnt--;
+	}
+	LEAVE_CRITICAL_SECTION();
+	return tmp;
+}
+
+/**
+ * @brief true if a message of higher priority than m is queued
+ */
+bool mq_has_higher(mq_t *q, Message *m)
+{
+	if (flag_high_priority(m->flag)) return false;
+	if (q->hq_head != NULL) return true;
+	return (flag_system(m->flag) == 0) && (q->sq_head != NULL);
+}
+#endif
+
 #ifdef SOS_USE_PREEMPTION
 static Message *mq_real_get(Message **head, Message *m)
 #else
@@ -420,6 +807,20 @@ void mq_gc( void )
 	uart_msg_gc();
 #endif
 	slab_gc( &msg_slab, MSG_QUEUE_PID );
+	{
+		uint8_t i;
+		void *p;
+		for( i = 0; i < MSG_PAYLOAD_POOLS; i++ ) {
+			for( p = payload_free[i]; p != NULL; p = *((void**)p) ) {
+				ker_gc_mark( MSG_QUEUE_PID, p );
+			}
+		}
+		for( i = 0; i < MSG_SHARED_PAYLOADS; i++ ) {
+			if( shared_payload[i].refcnt != 0 ) {
+				ker_gc_mark( MSG_QUEUE_PID, shared_payload[i].data );
+			}
+		}
+	}
 	malloc_gc( MSG_QUEUE_PID );
 #endif
 }
@@ -460,7 +861,9 @@ void msg_dispose(Message *m)
 	HAS_CRITICAL_SECTION;
 	
 	if(flag_msg_release(m->flag)) { 
-		ker_free(m->data); 
+		msg_payload_free(m->data); 
+	} else if(flag_msg_shared(m->flag)) {
+		msg_payload_put(m->data);
 	}
 
 	ENTER_CRITICAL_SECTION();
@@ -489,9 +892,13 @@ void msg_send_senddone(Message *msg_sent, bool succ, sos_pid_t msg_owner)
    * Release the memory 
    */
   if(flag_msg_release(msg_sent->flag)){
-	ker_free(msg_sent->data);
+	msg_payload_free(msg_sent->data);
 	msg_sent->flag &= ~(SOS_MSG_RELEASE);
 	msg_sent->data = NULL;
+  } else if(flag_msg_shared(msg_sent->flag)){
+	msg_payload_put(msg_sent->data);
+	msg_sent->flag &= ~(SOS_MSG_SHARED);
+	msg_sent->data = NULL;
   }
 
   if(succ == false) {
@@ -55,6 +55,9 @@
 #include <message.h>
 #include <sos_timer.h>
 #include <measurement.h>
+#ifdef SOS_IDLE_STATS
+#include <systime.h>
+#endif
 #include <timestamp.h>
 #include <fntable.h>
 #include <sos_module_fetcher.h>
@@ -153,6 +156,91 @@ static Message short_msg;
  */
 static sos_module_t* mod_bin[SCHED_NUMBER_BINS] NOINIT_VAR;
 
+#ifdef SOS_SCHED_BATCH
+#ifdef SOS_USE_PREEMPTION
+#error SCHED=batch does not support preemption
+#endif
+/**
+ * @brief largest number of messages dispatched per dequeue
+ * Interrupt callbacks and messages of higher priority still cut a burst
+ * short, see sched_dispatch_batch()
+ */
+#ifndef SCHED_BATCH_SIZE
+#define SCHED_BATCH_SIZE  8
+#endif
+/**
+ * @brief use a pid to module table in ker_get_module()
+ * The table takes 512 bytes of RAM on AVR and MSP430, so it is only on
+ * by default on the PC platforms.  Build with -DSCHED_MOD_TABLE=1 to
+ * use it on a mote.
+ */
+#ifndef SCHED_MOD_TABLE
+#ifdef PC_PLATFORM
+#define SCHED_MOD_TABLE  1
+#else
+#define SCHED_MOD_TABLE  0
+#endif
+#endif
+//! destination of the last dispatched message and its handler
+static sos_module_t* last_handle;
+static msg_handler_t last_handler;
+/**
+ * @brief rest of the burst being dispatched, see sched_batch_flush()
+ */
+static Message *sched_batch;
+#else
+#define SCHED_MOD_TABLE  0
+#endif
+
+#if SCHED_MOD_TABLE
+/**
+ * @brief pid to module, kept next to mod_bin for ker_get_module()
+ */
+static sos_module_t* mod_table[NULL_PID + 1];
+#define sched_cache_module(h)   (mod_table[(h)->pid] = (h))
+#define sched_uncache_module(h) (mod_table[(h)->pid] = NULL)
+#else
+//! last module found by ker_get_module()
+static sos_module_t* mod_cache;
+#define sched_cache_module(h)
+#define sched_uncache_module(h) do { \
+	if( mod_cache == (h) ) mod_cache = NULL; \
+} while(0)
+#endif
+
+#ifdef SOS_SCHED_BATCH
+#define sched_forget_module(h)  do { \
+	sched_uncache_module(h); \
+	last_handle = NULL; \
+} while(0)
+#else
+#define sched_forget_module(h)  sched_uncache_module(h)
+#endif
+
+#ifdef SOS_MSG_QUOTA
+#ifdef SOS_USE_PREEMPTION
+#error MSG_QUOTA does not support preemption
+#endif
+#ifdef SOS_SCHED_BATCH
+#error MSG_QUOTA does not support SCHED=batch
+#endif
+/**
+ * @brief default number of queued messages per module
+ */
+#ifndef SCHED_MSG_QUOTA
+#define SCHED_MSG_QUOTA  16
+#endif
+/**
+ * @brief modules that have used their round robin credit, one bit per pid
+ * Cleared when a new round starts.  The dispatcher tests it for every
+ * queued message, so it is kept apart from the module handles.
+ */
+static uint8_t rr_spent[(NULL_PID + 8) / 8];
+#define rr_is_spent(pid)  (rr_spent[(pid) / 8] & (1 << ((pid) % 8)))
+#define rr_set_spent(pid) (rr_spent[(pid) / 8] |= (1 << ((pid) % 8)))
+#define rr_clr_spent(pid) (rr_spent[(pid) / 8] &= ~(1 << ((pid) % 8)))
+#endif
+
 /**
  * @brief pid pool
  *
@@ -193,6 +281,18 @@ void sched_init(uint8_t cond)
   for(i = 0; i < SCHED_PID_SLOTS; i++) {
 		pid_pool[i] = 0;
   }
+#ifdef SOS_MSG_QUOTA
+	memset(rr_spent, 0, sizeof(rr_spent));
+#endif
+#if SCHED_MOD_TABLE
+	memset(mod_table, 0, sizeof(mod_table));
+#else
+	mod_cache = NULL;
+#endif
+#ifdef SOS_SCHED_BATCH
+	last_handle = NULL;
+	sched_batch = NULL;
+#endif
 
 	// Initialize PID stack
 	pid_sp = pid_stack;
@@ -256,13 +356,15 @@ static void handle_callback( void )
 // Get pointer to module control block
 sos_module_t* ker_get_module(sos_pid_t pid)
 {
-	static sos_module_t *cache = NULL;
+#if SCHED_MOD_TABLE
+	return mod_table[pid];
+#else
   uint8_t bins;
   sos_module_t *handle;
 
 	// Check the cache for module
-	if((cache != NULL) && (cache->pid == pid)) {
-		return cache;
+	if((mod_cache != NULL) && (mod_cache->pid == pid)) {
+		return mod_cache;
 	}
 
   //! first hash pid into bins
@@ -270,13 +372,14 @@ sos_module_t* ker_get_module(sos_pid_t pid)
   handle = mod_bin[bins];
   while(handle != NULL) {
 		if(handle->pid == pid) {
-			cache = handle;
+			mod_cache = handle;
 			return handle;
 		} else {
 			handle = handle->next;
 		}
   }
   return NULL;
+#endif
 }
 
 void* ker_get_module_state(sos_pid_t pid)
@@ -395,6 +498,14 @@ static int8_t sched_register_module(sos_module_t *h, mod_header_ptr p,
 
   // link the functions
   fntable_link(h);
+#ifdef SOS_MSG_QUOTA
+  h->msg_queued = 0;
+  h->msg_quota = SCHED_MSG_QUOTA;
+  h->msg_policy = SCHED_QUOTA_DROP_OLDEST;
+  h->rr_weight = 1;
+  h->rr_credit = 0;
+  rr_clr_spent(h->pid);
+#endif
   ENTER_CRITICAL_SECTION();
   /**
    * here is critical section.
@@ -403,6 +514,7 @@ static int8_t sched_register_module(sos_module_t *h, mod_header_ptr p,
   // add to the bin
   h->next = mod_bin[bins];
   mod_bin[bins] = h;
+  sched_cache_module(h);
   LEAVE_CRITICAL_SECTION();
   DEBUG("Register %d, Code ID %d,  Handle = %x\n", h->pid,
 		  sos_read_header_byte(h, offsetof(mod_header_t, mod_id)),
@@ -700,6 +812,7 @@ int8_t ker_deregister_module(sos_pid_t pid)
 	} else {
 		prev_handle->next = handle->next;
 	}
+	sched_forget_module(handle);
 	LEAVE_CRITICAL_SECTION();
 
 	// remove the thread pid allocation
@@ -765,6 +878,7 @@ void ker_deregister_module_split(sos_pid_t pid)
 	} else {
 		prev_handle->next = handle->next;
 	}
+	sched_forget_module(handle);
 	LEAVE_CRITICAL_SECTION();
 
 	// remove the thread pid allocation
@@ -862,13 +976,149 @@ void sched_dispatch_short_message(sos_pid_t dst, sos_pid_t src, uint8_t type, ui
 #endif
 }
 
+#ifdef SOS_SCHED_BATCH
+/**
+ * @brief message handler of a module
+ * Consecutive messages to the same module reuse the handler that was
+ * read from the module header for the first one
+ */
+static msg_handler_t sched_get_handler(sos_module_t *handle)
+{
+	if( handle != last_handle ) {
+		last_handler = (msg_handler_t)sos_read_header_ptr(handle->header,
+				offsetof(mod_header_t, module_handler));
+		last_handle = handle;
+	}
+	return last_handler;
+}
+#else
+#define sched_get_handler(handle) \
+	((msg_handler_t)sos_read_header_ptr((handle)->header, \
+		offsetof(mod_header_t, module_handler)))
+#endif
+
+#ifdef SOS_MSG_QUOTA
+/**
+ * @brief a queued message to m->did is gone
+ */
+static void sched_msg_uncount(Message *m)
+{
+	HAS_CRITICAL_SECTION;
+	sos_module_t *handle;
+
+	if( flag_system(m->flag) ) return;
+	ENTER_CRITICAL_SECTION();
+	handle = ker_get_module(m->did);
+	// the module may have been registered after m was queued
+	if( handle != NULL && handle->msg_queued != 0 ) {
+		handle->msg_queued--;
+	}
+	LEAVE_CRITICAL_SECTION();
+}
+
+/**
+ * @brief true if the destination of m has credit left in this round
+ */
+static bool sched_rr_eligible(Message *m)
+{
+	return rr_is_spent(m->did) == 0;
+}
+
+/**
+ * @brief take the next message with weighted round robin between modules
+ * Within the highest queued priority, the first message whose module has
+ * credit left is taken.  When every module with queued messages has used
+ * its credit, a new round starts and all the modules get rr_weight again.
+ */
+static Message *sched_dequeue(void)
+{
+	sos_module_t *handle;
+	Message *e;
+
+	e = mq_dequeue_if(&schedpq, sched_rr_eligible);
+	if( e == NULL ) {
+		memset(rr_spent, 0, sizeof(rr_spent));
+		e = mq_dequeue(&schedpq);
+		if( e == NULL ) return NULL;
+	}
+	handle = ker_get_module(e->did);
+	if( handle != NULL ) {
+		if( handle->rr_credit == 0 ) {
+			handle->rr_credit = handle->rr_weight;
+		}
+		if( --handle->rr_credit == 0 ) {
+			rr_set_spent(e->did);
+		}
+	}
+	sched_msg_uncount(e);
+	return e;
+}
+
+/**
+ * @brief queue m, applying the quota of its destination
+ */
+static int8_t sched_msg_enqueue(Message *m)
+{
+	HAS_CRITICAL_SECTION;
+	sos_module_t *handle;
+	Message *old = NULL;
+
+	ENTER_CRITICAL_SECTION();
+	handle = ker_get_module(m->did);
+	if( handle != NULL && flag_system(m->flag) == 0 ) {
+		if( handle->msg_quota != 0 && handle->msg_queued >= handle->msg_quota ) {
+			if( handle->msg_policy == SCHED_QUOTA_REJECT ||
+					(old = mq_remove_oldest(&schedpq, m->did)) == NULL ) {
+				LEAVE_CRITICAL_SECTION();
+				msg_dispose(m);
+				return -EBUSY;
+			}
+		} else {
+			if( handle->msg_queued == 0 && !rr_is_spent(m->did) ) {
+				// credit left over from before the module went idle
+				handle->rr_credit = 0;
+			}
+			handle->msg_queued++;
+		}
+	}
+	mq_enqueue(&schedpq, m);
+	LEAVE_CRITICAL_SECTION();
+	if( old != NULL ) {
+		DEBUG("Scheduler: module %d over quota, drop message type %d\n", old->did, old->type);
+		msg_send_senddone(old, false, KER_SCHED_PID);
+	}
+	return SOS_OK;
+}
+
+int8_t ker_msg_set_quota(sos_pid_t pid, uint8_t quota, uint8_t policy,
+		uint8_t weight)
+{
+	sos_module_t *handle = ker_get_module(pid);
+
+	if( handle == NULL || weight == 0 ) return -EINVAL;
+	handle->msg_quota = quota;
+	handle->msg_policy = policy;
+	handle->rr_weight = weight;
+	return SOS_OK;
+}
+#endif
+
+int8_t ker_sys_msg_set_quota(uint8_t quota, uint8_t policy, uint8_t weight)
+{
+#ifdef SOS_MSG_QUOTA
+	return ker_msg_set_quota(ker_get_current_pid(), quota, policy, weight);
+#else
+	return -EINVAL;
+#endif
+}
+
 /**
  * @brief    real dispatch function
  * We have to handle MSG_PKT_SENDDONE specially
  * In SENDDONE message, msg->data is pointing to the message just sent.
  */
 
-#ifdef SOS_USE_PREEMPTION
+#if defined(SOS_USE_PREEMPTION) || defined(SOS_SCHED_BATCH)
 static void do_dispatch(Message *e)
 {
 #else 
@@ -881,9 +1131,13 @@ static void do_dispatch()
 	sos_pid_t senddone_dst_pid = NULL_PID;     // Destination module ID for the MSG_PKT_SENDDONE
 	uint8_t senddone_flag = SOS_MSG_SEND_FAIL; // Status information for the MSG_PKT_SENDDONE
 
-#ifndef SOS_USE_PREEMPTION
+#if !defined(SOS_USE_PREEMPTION) && !defined(SOS_SCHED_BATCH)
 	SOS_MEASUREMENT_DEQUEUE_START();
+#ifdef SOS_MSG_QUOTA
+	e = sched_dequeue();
+#else
 	e = mq_dequeue(&schedpq);
+#endif
 	SOS_MEASUREMENT_DEQUEUE_END();
 #endif
 
@@ -918,9 +1172,7 @@ static void do_dispatch()
 			
 			
 			// Get the function pointer to the message handler
-			handler = (msg_handler_t)sos_read_header_ptr(handle->header,
-																									 offsetof(mod_header_t,
-																														module_handler));
+			handler = sched_get_handler(handle);
 			// Get the pointer to the module state
 			handler_state = handle->handler_state;
 			// Change ownership if the release flag is set
@@ -1001,6 +1253,52 @@ static void do_dispatch()
 	}
 }
 
+#ifdef SOS_SCHED_BATCH
+/**
+ * @brief give the undispatched part of the burst back to schedpq
+ * mq_get() and the message GC only see schedpq, so this runs before
+ * either looks at the queue
+ */
+static void sched_batch_flush(void)
+{
+	if(sched_batch != NULL) {
+		mq_requeue_batch(&schedpq, sched_batch);
+		sched_batch = NULL;
+	}
+}
+
+/**
+ * @brief dispatch a burst of messages taken from schedpq at once
+ * The burst stops early, and gives the rest of its messages back to the
+ * queue, when an interrupt callback or a message of higher priority is
+ * waiting, so neither waits for more than one message as before
+ */
+static void sched_dispatch_batch(void)
+{
+	Message *e;
+
+	SOS_MEASUREMENT_DEQUEUE_START();
+	e = mq_dequeue_batch(&schedpq, SCHED_BATCH_SIZE);
+	SOS_MEASUREMENT_DEQUEUE_END();
+
+	while(e != NULL) {
+		sched_batch = e->next;
+		e->next = NULL;
+		do_dispatch(e);
+		// the handler may have flushed the burst already
+		if(sched_batch == NULL) return;
+		if(int_ready != 0 || sched_stalled == true ||
+				mq_has_higher(&schedpq, sched_batch)) {
+			sched_batch_flush();
+			return;
+		}
+		e = sched_batch;
+	}
+}
+#else
+#define sched_batch_flush()
+#endif
+
 /**
  * @brief query the existence of task
  * @param pid module id
@@ -1022,7 +1320,7 @@ int8_t ker_query_task(uint8_t pid)
  * a NULL Message. 
  */
 
-void sched_msg_alloc(Message *m)
+int8_t sched_msg_alloc(Message *m)
 {
 #ifdef SOS_USE_PREEMPTION
 	HAS_CRITICAL_SECTION;
@@ -1037,7 +1335,7 @@ void sched_msg_alloc(Message *m)
 	// If preemption is disabled, simply queue the msg
 	if (GET_PREEMPTION_STATUS() == DISABLED) {
 		mq_enqueue(&schedpq, m);
-		return;
+		return SOS_OK;
 	}
 
 	// dispatch msg if of higher priority and no race conditions
@@ -1059,8 +1357,12 @@ void sched_msg_alloc(Message *m)
 		// if msg is not higher priority, queue up and return
 		mq_enqueue(&schedpq, m);
 	}
+	return SOS_OK;
+#elif defined(SOS_MSG_QUOTA)
+  return sched_msg_enqueue(m);
 #else
   mq_enqueue(&schedpq, m);
+  return SOS_OK;
 #endif
 }
 
@@ -1111,9 +1413,13 @@ uint8_t preemption_point (sos_pid_t pid)
 void sched_msg_remove(Message *m)
 {
   Message *tmp;
+  sched_batch_flush();
   while(1) {
 		tmp = mq_get(&schedpq, m);
 		if(tmp) {
+#ifdef SOS_MSG_QUOTA
+			sched_msg_uncount(tmp);
+#endif
 			msg_dispose(tmp);
 		} else {
 			break;
@@ -1124,6 +1430,7 @@ void sched_msg_remove(Message *m)
 void sched_gc( void )
 {
 	register uint8_t i = 0;
+	sched_batch_flush();
 	//
 	// Mark message payload
 	//
@@ -1145,6 +1452,7 @@ void sched_gc( void )
 
 void sched_msg_gc( void )
 {
+	sched_batch_flush();
 	mq_gc_mark_hdr( &schedpq, KER_SCHED_PID );
 }
 /**
@@ -1227,9 +1535,60 @@ static inline bool sched_message_filtered(sos_module_t *h, Message *m)
   return false;
 }
 
+#ifdef SOS_IDLE_STATS
+static idle_info_t idle_info;
+static uint32_t idle_boot;           //!< ker_systime32() when sched() started
+static uint32_t idle_since;          //!< ker_systime32() when the processor went to sleep
+static bool sched_idle = false;
+
+/**
+ * @brief the scheduler has nothing to do and goes to sleep
+ */
+void sched_idle_start(void)
+{
+	HAS_CRITICAL_SECTION;
+
+	ENTER_CRITICAL_SECTION();
+	idle_since = ker_systime32();
+	sched_idle = true;
+	LEAVE_CRITICAL_SECTION();
+}
+
+/**
+ * @brief the processor is awake again
+ * Called by the scheduler loop and by the interrupts that wake it up,
+ * only the first call after sched_idle_start() counts
+ */
+void sched_idle_end(void)
+{
+	HAS_CRITICAL_SECTION;
+
+	ENTER_CRITICAL_SECTION();
+	if( sched_idle ) {
+		sched_idle = false;
+		idle_info.wakeups++;
+		idle_info.idle_time += ker_systime32() - idle_since;
+	}
+	LEAVE_CRITICAL_SECTION();
+}
+
+void ker_idle_info(idle_info_t *info)
+{
+	HAS_CRITICAL_SECTION;
+
+	ENTER_CRITICAL_SECTION();
+	*info = idle_info;
+	info->run_time = ker_systime32() - idle_boot;
+	LEAVE_CRITICAL_SECTION();
+}
+#endif
+
 void sched(void)
 {
 	ENABLE_GLOBAL_INTERRUPTS();
+#ifdef SOS_IDLE_STATS
+	idle_boot = ker_systime32();
+#endif
 
 	ker_log_start();
 	for(;;){
@@ -1248,7 +1607,11 @@ void sched(void)
 	} else if( schedpq.msg_cnt != 0 ) {
 		ENABLE_GLOBAL_INTERRUPTS();
 		if (true == sched_stalled) continue;
+#ifdef SOS_SCHED_BATCH
+		sched_dispatch_batch();
+#else
 		do_dispatch();
+#endif
 #endif
 		}
 		else {
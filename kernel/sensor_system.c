@@ -2,6 +2,8 @@
 /* ex: set ts=2 shiftwidth=2 softtabstop=2 cindent: */
 
 #include <sos.h>
+#include <message_queue.h>
+#include <systime.h>
 #include <sensor_private.h>
 #ifdef SOS_USE_PREEMPTION
 #include <priority.h>
@@ -12,8 +14,44 @@
 #define DEBUG(...)
 #endif
 
+/*
+ * Sampling multiplexer
+ *
+ * Requests for a single sensor without a driver context do not go to the
+ * driver one by one.  They become subscribers of the sensor, and the driver
+ * runs one schedule for all of them, sampling at the GCD of their periods
+ * and posting its buffers to KER_SENSOR_PID.  A subscriber that wants every
+ * hardware sample in buffers of the hardware size gets the driver's buffer
+ * itself, shared with the other such subscribers.  The others get every
+ * step-th sample gathered into a buffer of their own.
+ */
+#ifndef SENSOR_MAX_SUBSCRIBERS
+#define SENSOR_MAX_SUBSCRIBERS  8   //!< single sensor requests served at once
+#endif
+#ifndef SENSOR_MAX_STEP
+#define SENSOR_MAX_STEP         16  //!< most hardware samples per sample of a subscriber
+#endif
+//! samples that fit into a MSG_DATA_READY
+#define SENSOR_MAX_EVENT_SAMPLES \
+	((255 - sizeof(sensor_data_msg_t)) / sizeof(uint16_t))
+
+typedef struct {
+	sos_pid_t app_id;             //! NULL_PID when the entry is free
+	sensor_id_t sensor;
+	uint8_t step;                 //! hardware samples per sample of the app
+	uint8_t skip;                 //! hardware samples to drop before the next one
+	bool direct;                  //! takes the current hardware buffer as it is
+	bool done;                    //! got all the samples it asked for
+	uint32_t period;
+	uint16_t samples;             //! samples still to deliver, 0 for ever
+	uint16_t event_samples;
+	sensor_data_msg_t *buf;       //! samples gathered for the app
+} sensor_sub_t;
+
 typedef struct {
 	sos_pid_t driver_id[MAX_NUM_SENSORS];		//! Process id of the sensor driver
+	sample_context_t hw[MAX_NUM_SENSORS];		//! Schedule run for the subscribers, period 0 when idle
+	sensor_sub_t sub[SENSOR_MAX_SUBSCRIBERS];
 } sensor_state_t;
 
 static sensor_state_t s;
@@ -63,11 +101,348 @@ static mod_header_t mod_header SOS_MODULE_HEADER =
 };
 
 
-static int8_t sensor_handler(void *state, Message *msg)
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b != 0) {
+		uint32_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/**
+ * @brief samples of the next buffer of a subscriber
+ */
+static uint16_t sub_want(sensor_sub_t *sub)
+{
+	if ((sub->samples > 0) && (sub->samples < sub->event_samples)) {
+		return sub->samples;
+	}
+	return sub->event_samples;
+}
+
+static void sub_free(sensor_sub_t *sub)
+{
+	if (sub->buf != NULL) {
+		msg_payload_free(sub->buf);
+		sub->buf = NULL;
+	}
+	sub->app_id = NULL_PID;
+}
+
+static void sub_delivered(sensor_sub_t *sub, uint16_t n)
+{
+	if (sub->samples == 0) return;
+	sub->samples -= n;
+	if (sub->samples == 0) sub->done = true;
+}
+
+/**
+ * @brief run the driver schedule that serves all subscribers of a sensor
+ * @return -EBUSY if the subscribers cannot share a schedule
+ */
+static int8_t sensor_schedule(sensor_id_t sensor)
+{
+	sample_context_t hw;
+	sensor_sub_t *last = NULL;
+	uint32_t period = 0;
+	uint32_t event = 0;
+	uint8_t i, n = 0;
+	int8_t ret;
+
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id != NULL_PID) && (s.sub[i].sensor == sensor)) {
+			period = gcd(s.sub[i].period, period);
+			last = &s.sub[i];
+			n++;
+		}
+	}
+
+	memset(&hw, 0, sizeof(hw));
+	if (n == 1) {
+		// Alone, the app gets what it asked for
+		hw.period = last->period;
+		hw.samples = last->samples;
+		hw.event_samples = last->event_samples;
+	} else if (n > 1) {
+		for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+			if ((s.sub[i].app_id != NULL_PID) && (s.sub[i].sensor == sensor)) {
+				uint32_t step = s.sub[i].period / period;
+				if ((period < 2) || (step > SENSOR_MAX_STEP)) return -EBUSY;
+				// Buffers of every app end with a hardware buffer
+				event = gcd(step * s.sub[i].event_samples, event);
+			}
+		}
+		hw.period = period;
+		hw.event_samples = (event < SENSOR_MAX_EVENT_SAMPLES) ? event : SENSOR_MAX_EVENT_SAMPLES;
+	}
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id != NULL_PID) && (s.sub[i].sensor == sensor)) {
+			s.sub[i].step = s.sub[i].period / hw.period;
+		}
+	}
+
+	if (memcmp(&hw, &(s.hw[sensor]), sizeof(hw)) == 0) return SOS_OK;
+
+	if (s.hw[sensor].period != 0) {
+		SOS_CALL(sensor_func_ptr[sensor], sensor_control_fn_t, SENSOR_STOP_DATA_COMMAND, 
+				KER_SENSOR_PID, sensor, NULL, NULL);
+		s.hw[sensor].period = 0;
+	}
+	if (n == 0) return SOS_OK;
+
+	DEBUG("sensor %d: period %ld, %d samples per buffer, %d apps\n", 
+			sensor, (long)hw.period, hw.event_samples, n);
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		s.sub[i].skip = 0;
+	}
+	// The driver may adjust the context it is given
+	memcpy(&(s.hw[sensor]), &hw, sizeof(hw));
+	ret = SOS_CALL(sensor_func_ptr[sensor], sensor_control_fn_t, SENSOR_REGISTER_REQUEST_COMMAND, 
+			KER_SENSOR_PID, sensor, &hw, NULL);
+	if (ret < 0) {
+		s.hw[sensor].period = 0;
+		return ret;
+	}
+	SOS_CALL(sensor_func_ptr[sensor], sensor_control_fn_t, SENSOR_GET_DATA_COMMAND, 
+			KER_SENSOR_PID, sensor, &hw, NULL);
+	return SOS_OK;
+}
+
+/**
+ * @brief post a buffer to the subscribers marked direct, they all share it
+ */
+static void sensor_deliver(sensor_data_msg_t *b)
+{
+	uint8_t len = sizeof(sensor_data_msg_t) + (b->num_samples * sizeof(uint16_t));
+	uint16_t flag = SOS_MSG_RELEASE;
+	uint8_t i, n = 0;
+
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id != NULL_PID) && s.sub[i].direct) n++;
+	}
+	if (n == 0) {
+		msg_payload_free(b);
+		return;
+	}
+	if ((n > 1) && (msg_payload_share(b, n) == SOS_OK)) {
+		flag = SOS_MSG_SHARED;
+	}
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id == NULL_PID) || !s.sub[i].direct) continue;
+		s.sub[i].direct = false;
+		if ((flag == SOS_MSG_RELEASE) && (--n > 0)) {
+			// No share slot left, all but the last app get a copy
+			void *d = msg_payload_alloc(len, KER_SENSOR_PID);
+			if (d == NULL) continue;
+			memcpy(d, b, len);
+			post_long(s.sub[i].app_id, KER_SENSOR_PID, MSG_DATA_READY, len, d, SOS_MSG_RELEASE);
+		} else {
+			post_long(s.sub[i].app_id, KER_SENSOR_PID, MSG_DATA_READY, len, b, flag);
+		}
+	}
+}
+
+/**
+ * @brief take the samples of a hardware buffer that are due for a subscriber
+ */
+static void sensor_gather(sensor_sub_t *sub, sensor_data_msg_t *b)
+{
+	uint16_t i;
+
+	for (i = 0; (i < b->num_samples) && !sub->done; i++) {
+		if (sub->skip > 0) {
+			sub->skip--;
+			continue;
+		}
+		sub->skip = sub->step - 1;
+		if (sub->buf == NULL) {
+			sub->buf = (sensor_data_msg_t *)msg_payload_alloc(sizeof(sensor_data_msg_t) + 
+					(sub_want(sub) * sizeof(uint16_t)), KER_SENSOR_PID);
+			// The sample is lost
+			if (sub->buf == NULL) continue;
+			sub->buf->status = SENSOR_DATA;
+			sub->buf->sensor = b->sensor;
+			sub->buf->num_samples = 0;
+			sub->buf->timestamp = b->timestamp;
+		}
+		sub->buf->buf[sub->buf->num_samples++] = b->buf[i];
+		if (sub->buf->num_samples == sub_want(sub)) {
+			uint16_t n = sub->buf->num_samples;
+			post_long(sub->app_id, KER_SENSOR_PID, MSG_DATA_READY, 
+					sizeof(sensor_data_msg_t) + (n * sizeof(uint16_t)), sub->buf, SOS_MSG_RELEASE);
+			sub->buf = NULL;
+			sub_delivered(sub, n);
+		}
+	}
+}
+
+/**
+ * @brief pass a status to all subscribers of a sensor and drop them
+ */
+static void sensor_drop(sensor_id_t sensor, sensor_data_msg_t *b)
 {
+	uint8_t i;
+
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id != NULL_PID) && (s.sub[i].sensor == sensor)) {
+			s.sub[i].direct = true;
+		}
+	}
+	if (b != NULL) {
+		sensor_deliver(b);
+	}
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id != NULL_PID) && (s.sub[i].sensor == sensor)) {
+			s.sub[i].direct = false;
+			sub_free(&s.sub[i]);
+		}
+	}
+	// The driver ended the schedule
+	s.hw[sensor].period = 0;
+}
+
+/**
+ * @brief fan a buffer of the driver out to the subscribers of its sensor
+ */
+static void sensor_data_ready(Message *msg)
+{
+	sensor_data_msg_t *b = (sensor_data_msg_t *)(msg->data);
+	bool done = false;
+	bool direct = false;
+	uint8_t i;
+
+	if ((msg->len < sizeof(sensor_data_msg_t)) || (b->sensor >= MAX_NUM_SENSORS)) return;
+
+	if (b->status != SENSOR_DATA) {
+		sensor_drop(b->sensor, (sensor_data_msg_t *)ker_msg_take_data(KER_SENSOR_PID, msg));
+		return;
+	}
+
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		sensor_sub_t *sub = &s.sub[i];
+
+		if ((sub->app_id == NULL_PID) || (sub->sensor != b->sensor)) continue;
+		if ((sub->buf == NULL) && (sub->step == 1) && (b->num_samples == sub_want(sub))) {
+			sub->direct = true;
+			direct = true;
+			sub_delivered(sub, b->num_samples);
+		} else {
+			sensor_gather(sub, b);
+		}
+		done = done || sub->done;
+	}
+
+	if (direct) {
+		sensor_data_msg_t *d = (sensor_data_msg_t *)ker_msg_take_data(KER_SENSOR_PID, msg);
+		if (d != NULL) {
+			sensor_deliver(d);
+		} else {
+			for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+				s.sub[i].direct = false;
+			}
+		}
+	}
+
+	if (done) {
+		for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+			if ((s.sub[i].app_id != NULL_PID) && s.sub[i].done) {
+				sub_free(&s.sub[i]);
+			}
+		}
+		sensor_schedule(b->sensor);
+	}
+}
+
+/**
+ * @brief add a single sensor request to the schedule of the sensor
+ */
+static int8_t sensor_subscribe(sos_pid_t app_id, sensor_id_t sensor, sample_context_t *param)
+{
+	sensor_sub_t *sub = NULL;
+	sensor_sub_t old;
+	uint8_t i;
+	int8_t ret;
+
+	if ((param->period < 2) || (param->event_samples == 0) || 
+		(param->event_samples > SENSOR_MAX_EVENT_SAMPLES)) {
+		return -EINVAL;
+	}
+
+	// A new request of the app replaces its old one
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id == app_id) && (s.sub[i].sensor == sensor)) {
+			sub = &s.sub[i];
+			break;
+		}
+	}
+	if (sub == NULL) {
+		for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+			if (s.sub[i].app_id == NULL_PID) {
+				sub = &s.sub[i];
+				break;
+			}
+		}
+	}
+	if (sub == NULL) return -ENOMEM;
+
+	memcpy(&old, sub, sizeof(old));
+	sub->app_id = app_id;
+	sub->sensor = sensor;
+	sub->direct = false;
+	sub->done = false;
+	sub->period = param->period;
+	sub->samples = param->samples;
+	sub->event_samples = param->event_samples;
+	if ((param->samples > 0) && (param->event_samples > param->samples)) {
+		sub->event_samples = param->samples;
+	}
+	sub->buf = NULL;
+
+	ret = sensor_schedule(sensor);
+	if (ret < 0) {
+		// Back to the schedule without the request
+		memcpy(sub, &old, sizeof(old));
+		sensor_schedule(sensor);
+		return ret;
+	}
+	if (old.app_id != NULL_PID) {
+		// The samples gathered for the old request
+		if (old.buf != NULL) msg_payload_free(old.buf);
+	}
+	return SOS_OK;
+}
+
+/**
+ * @brief remove the request of an app from the schedule of a sensor
+ * @return -EINVAL if the app has no request there
+ */
+static int8_t sensor_unsubscribe(sos_pid_t app_id, sensor_id_t sensor)
+{
+	uint8_t i;
+
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if ((s.sub[i].app_id == app_id) && (s.sub[i].sensor == sensor)) {
+			sub_free(&s.sub[i]);
+			sensor_schedule(sensor);
+			return SOS_OK;
+		}
+	}
 	return -EINVAL;
 }
 
+static int8_t sensor_handler(void *state, Message *msg)
+{
+	switch (msg->type) {
+		case MSG_DATA_READY: {
+			sensor_data_ready(msg);
+			return SOS_OK;
+		}
+		default: return -EINVAL;
+	}
+}
+
 
 /**
  * @brief Initialize the sensor interface
@@ -77,6 +452,11 @@ int8_t sensor_system_init() {
 
 	for (i = 0; i < MAX_NUM_SENSORS; i++) {
 		s.driver_id[i] = NULL_PID;
+		s.hw[i].period = 0;
+	}
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		s.sub[i].app_id = NULL_PID;
+		s.sub[i].buf = NULL;
 	}
 #ifdef SOS_USE_PREEMPTION
 	ker_register_module(sos_get_header_address(mod_header));
@@ -133,6 +513,16 @@ int8_t ker_sensor_driver_deregister(sos_pid_t driver_id, sensor_id_t sensor) {
 		return -EINVAL;
 	}
 
+	// Tell the apps sampling through the multiplexer.
+	sensor_data_msg_t *b = (sensor_data_msg_t *)msg_payload_alloc(sizeof(sensor_data_msg_t), KER_SENSOR_PID);
+	if (b != NULL) {
+		b->status = SENSOR_DRIVER_UNREGISTERED;
+		b->sensor = sensor;
+		b->num_samples = 0;
+		b->timestamp = ker_systime32();
+	}
+	sensor_drop(sensor, b);
+
 	// Driver de-registered.
 	s.driver_id[sensor] = NULL_PID;
 
@@ -167,6 +557,12 @@ int8_t ker_sensor_start_sampling(sos_pid_t app_id, sensor_id_t *sensors, unsigne
 
 	if (param == NULL) return -EINVAL;
 
+	// Requests for one sensor share a schedule.  A driver context
+	// configures the sensor for that request alone.
+	if ((num_sensors == 1) && (context == NULL)) {
+		return sensor_subscribe(app_id, sensors[0], param);
+	}
+
 	// Register request to sensor drivers.
 	for (i = 0; i < num_sensors; i++) {
 		int8_t ret = SOS_CALL(sensor_func_ptr[sensors[i]], sensor_control_fn_t, SENSOR_REGISTER_REQUEST_COMMAND, 
@@ -200,11 +596,13 @@ int8_t ker_sys_sensor_stop_sampling(sensor_id_t sensor) {
 
 int8_t ker_sensor_stop_sampling(sos_pid_t app_id, sensor_id_t sensor) {
 	if ((app_id == NULL_PID) ||
-		(sensor > MAX_NUM_SENSORS) ||
+		(sensor >= MAX_NUM_SENSORS) ||
 		(s.driver_id[sensor] == NULL_PID)) {
 		return -EINVAL;
 	}
 
+	if (sensor_unsubscribe(app_id, sensor) == SOS_OK) return SOS_OK;
+
 	int8_t ret = SOS_CALL(sensor_func_ptr[sensor], sensor_control_fn_t, SENSOR_STOP_DATA_COMMAND, 
 						app_id, sensor, NULL, NULL);
 
@@ -222,6 +620,11 @@ int8_t sensor_remove_all(sos_pid_t pid) {
 			ker_sensor_driver_deregister(pid, i);
 		}
 	}
+	for (i = 0; i < SENSOR_MAX_SUBSCRIBERS; i++) {
+		if (s.sub[i].app_id == pid) {
+			sensor_unsubscribe(pid, s.sub[i].sensor);
+		}
+	}
 
 	return SOS_OK;
 }
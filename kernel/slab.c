@@ -33,6 +33,13 @@ int8_t ker_slab_init( sos_pid_t pid, slab_t *slab, uint8_t item_size, uint8_t it
 	slab->empty_vector = 0;
 	slab->item_size = item_size;
 	slab->flag = flag;
+	slab->num_pools = 0;
+	slab->low_pools = 1;
+	slab->high_pools = 0;
+	slab->peak_pools = 0;
+	slab->num_used = 0;
+	slab->peak_used = 0;
+	slab->num_fail = 0;
 	for( i = 0; i < items_per_pool; i++ ) {
 		slab->empty_vector <<= 1;
 		slab->empty_vector |= 0x01;
@@ -50,9 +57,25 @@ int8_t ker_slab_init( sos_pid_t pid, slab_t *slab, uint8_t item_size, uint8_t it
 	slab->head->next = NULL;
 	slab->head->alloc = 0;
 	slab->head->gc_mark = 0;
+	slab->num_pools = 1;
+	slab->peak_pools = 1;
 	return SOS_OK;
 }
 
+void ker_slab_set_watermark( slab_t *slab, uint8_t low, uint8_t high )
+{
+	slab->low_pools = (low == 0)? 1 : low;
+	slab->high_pools = high;
+}
+
+static inline void slab_count_alloc( slab_t *slab )
+{
+	slab->num_used++;
+	if( slab->num_used > slab->peak_used ) {
+		slab->peak_used = slab->num_used;
+	}
+}
+
 void* ker_slab_alloc( slab_t *slab, sos_pid_t pid )
 {
 	slab_item_t *itr = slab->head;
@@ -73,6 +96,11 @@ void* ker_slab_alloc( slab_t *slab, sos_pid_t pid )
 		// The pool is exhausted, create a new one
 		//
 		DEBUG("pool exhausted\n");
+		if( slab->high_pools != 0 && slab->num_pools >= slab->high_pools ) {
+			DEBUG("high watermark reached\n");
+			slab->num_fail++;
+			return NULL;
+		}
 		if( slab->flag & SLAB_LONGTERM ) {
 			prev->next = malloc_longterm( sizeof( slab_item_t ) + slab->num_items_per_pool * slab->item_size, pid );
 		} else {
@@ -80,12 +108,18 @@ void* ker_slab_alloc( slab_t *slab, sos_pid_t pid )
 		}
 		if( prev->next == NULL ) {
 			DEBUG("alloc NULL\n");
+			slab->num_fail++;
 			return NULL;
 		}
 		itr = prev->next;
 		itr->next = NULL;
 		itr->alloc = 0x01;
 		itr->gc_mark = 0;
+		slab->num_pools++;
+		if( slab->num_pools > slab->peak_pools ) {
+			slab->peak_pools = slab->num_pools;
+		}
+		slab_count_alloc( slab );
 		return itr->mem;
 	} else {
 		uint8_t i;
@@ -95,6 +129,7 @@ void* ker_slab_alloc( slab_t *slab, sos_pid_t pid )
 		for( i = 0; i < slab->num_items_per_pool; i++, mask<<=1 ) {
 			if( (itr->alloc & mask)  == 0 ) {
 				itr->alloc |= mask;
+				slab_count_alloc( slab );
 				return itr->mem + (i * slab->item_size);
 			}
 		}
@@ -112,9 +147,16 @@ void ker_slab_free( slab_t *slab, void* mem )
 			uint8_t mask = 1 << ( ( ((uint8_t*)mem) - (itr->mem) ) / slab->item_size );
 			
 			itr->alloc &= ~mask;
+			slab->num_used--;
 			
-			if( itr->alloc == 0 && itr != slab->head ) {
+			//
+			// Keep up to low_pools pools around so that a burst of
+			// messages does not go back to malloc for every pool
+			//
+			if( itr->alloc == 0 && itr != slab->head &&
+					slab->num_pools > slab->low_pools ) {
 				prev->next = itr->next;
+				slab->num_pools--;
 				ker_free( itr );
 			}
 			return;
@@ -154,6 +196,15 @@ void slab_gc_mark( slab_t *slab, void *mem )
 	DEBUG_GC("cannot find memory %d\n", (int) mem);
 	//exit(1);
 }
+static uint8_t slab_count_items( uint8_t vector )
+{
+	uint8_t cnt = 0;
+	for( ; vector != 0; vector &= (vector - 1) ) {
+		cnt++;
+	}
+	return cnt;
+}
+
 #include <led.h>
 void slab_gc( slab_t *slab, sos_pid_t pid )
 {
@@ -167,10 +218,13 @@ void slab_gc( slab_t *slab, sos_pid_t pid )
 			// leak!
 			DEBUG_GC("leak in slab %d %d\n", itr->alloc, itr->gc_mark);
 			led_red_toggle();
+			slab->num_used -= slab_count_items( itr->alloc & ~itr->gc_mark );
 			itr->alloc = itr->gc_mark;
 			
-			if( itr->alloc == 0 && itr != slab->head ) {
+			if( itr->alloc == 0 && itr != slab->head &&
+					slab->num_pools > slab->low_pools ) {
 				prev->next = itr->next;
+				slab->num_pools--;
 				ker_free( itr );
 				itr = prev;
 			} else {
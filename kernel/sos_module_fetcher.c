@@ -46,7 +46,12 @@ static int8_t handle_data(Message *msg);
 static void free_send_state_map(void);
 static int8_t fetcher_handler(void *state, Message *msg);
 static inline void handle_request_timeout(void);
+#ifdef SOS_FETCHER_PIPELINE
+static void send_window(void);
+static inline void restart_nack_timer(void);
+#else
 static inline void send_fragment(void);
+#endif
 static inline void restart_request_timer(void);
 static void check_map_and_post(void);
 static void start_new_fetch(void);
@@ -70,7 +75,13 @@ static const mod_header_t mod_header SOS_MODULE_HEADER ={
 
 //! the status of sending fragment
 enum {
+#ifdef SOS_FETCHER_PIPELINE
+	//! send done clocks the window, the timer only restarts a stalled one
+    FETCHER_SENDING_FRAGMENT_INTERVAL  = 128L,
+	FETCHER_PAGE_NONE                  = 0xffff,
+#else
     FETCHER_SENDING_FRAGMENT_INTERVAL  = 512L,
+#endif
 	FETCHER_MAX_MSG_IN_QUEUE           = 2,
 };
 
@@ -82,6 +93,11 @@ typedef struct {
     sos_timer_t        timer;
 	uint8_t            num_funcs;
 	uint8_t            num_msg_in_queue;
+#ifdef SOS_FETCHER_PIPELINE
+	uint16_t           cursor;   //!< fragment to look at first in map
+	uint16_t           page_id;  //!< first fragment held in page
+	uint8_t            *page;    //!< FETCHER_PAGE_SIZE bytes read ahead
+#endif
 } fetcher_sending_state_t;
 
 /**
@@ -231,6 +247,10 @@ static void free_send_state_map()
 {
 	ker_free(send_state.map);
 	send_state.map = NULL;
+#ifdef SOS_FETCHER_PIPELINE
+	ker_free(send_state.page);
+	send_state.page = NULL;
+#endif
 	ker_timer_stop(KER_FETCHER_PID, FETCHER_TRANSMIT_TID);
 }
 
@@ -252,7 +272,11 @@ static int8_t fetcher_handler(void *state, Message *msg)
 				return SOS_OK;  //!< no request
 			}
 			//DEBUG_PID(KER_FETCHER_PID,"calling restart_request_timer()\n");
+#ifdef SOS_FETCHER_PIPELINE
+			restart_nack_timer();
+#else
 			restart_request_timer();
+#endif
 			fst->retx = 0;
 			//DEBUG_PID(KER_FETCHER_PID,"calling handle_data()\n");
 			return handle_data(msg);
@@ -285,9 +309,13 @@ static int8_t fetcher_handler(void *state, Message *msg)
 				handle_request_timeout();
 			} else if(params->byte == FETCHER_TRANSMIT_TID) {
 				//DEBUG("send fragment timeout\n");
+#ifdef SOS_FETCHER_PIPELINE
+				send_window();
+#else
 				if( send_state.num_msg_in_queue < FETCHER_MAX_MSG_IN_QUEUE ) {
 					send_fragment();
 				}
+#endif
 			}
 			return SOS_OK;
 		}
@@ -296,6 +324,9 @@ static int8_t fetcher_handler(void *state, Message *msg)
 			if( send_state.num_msg_in_queue > 0 ) {
 				send_state.num_msg_in_queue--;
 			}
+#ifdef SOS_FETCHER_PIPELINE
+			send_window();
+#endif
 			return SOS_OK;
 		}
 #ifdef SOS_HAS_EXFLASH
@@ -326,6 +357,9 @@ static int8_t fetcher_handler(void *state, Message *msg)
 			send_state.frag = NULL;
 			send_state.fragr = NULL;
 			send_state.num_msg_in_queue = 0;	
+#ifdef SOS_FETCHER_PIPELINE
+			send_state.page = NULL;
+#endif
 			ker_msg_change_rules(KER_FETCHER_PID, SOS_MSG_RULES_PROMISCUOUS);
 			ker_permanent_timer_init(&(send_state.timer), KER_FETCHER_PID, FETCHER_TRANSMIT_TID, TIMER_REPEAT);
 			ker_timer_init(KER_FETCHER_PID, FETCHER_REQUEST_TID, TIMER_ONE_SHOT);
@@ -343,6 +377,18 @@ static inline void restart_request_timer()
 			FETCHER_REQUEST_WATCHDOG + (FETCHER_REQUEST_BACKOFF_SLOT * ((ker_rand() % FETCHER_REQUEST_MAX_SLOT) + 1)));
 }
 
+#ifdef SOS_FETCHER_PIPELINE
+/**
+ * @brief data is flowing, NACK soon after it stops
+ */
+static inline void restart_nack_timer()
+{
+	ker_timer_restart(KER_FETCHER_PID,
+			FETCHER_REQUEST_TID,
+			FETCHER_NACK_TIMEOUT + (FETCHER_NACK_BACKOFF_SLOT * (ker_rand() % FETCHER_REQUEST_MAX_SLOT)));
+}
+#endif
+
 static inline void handle_request_timeout()
 {
 	if(fst == NULL) {
@@ -393,6 +439,133 @@ static inline void handle_overheard_fragment(Message *msg)
 	send_state.map->bitmap[(f->frag_id) / 8] &= ~(1 << ((f->frag_id) % 8));
 }
 
+#ifdef SOS_FETCHER_PIPELINE
+//! index of the lowest set bit, b must not be 0
+static inline uint8_t lowest_bit(uint8_t b)
+{
+	uint8_t n = 0;
+	if( (b & 0x0f) == 0 ) { n += 4; b >>= 4; }
+	if( (b & 0x03) == 0 ) { n += 2; b >>= 2; }
+	if( (b & 0x01) == 0 ) { n += 1; }
+	return n;
+}
+
+/**
+ * @brief next wanted fragment at or after cursor, wrapping around once
+ * @return fragment id, or -1 if the map is empty
+ */
+static int16_t find_next_fragment(fetcher_bitmap_t *m, uint16_t cursor)
+{
+	uint8_t i = cursor / 8;
+	uint16_t n;
+	uint8_t b;
+
+	if( i >= m->bitmap_size ) {
+		i = 0;
+		cursor = 0;
+	}
+	b = m->bitmap[i] & (uint8_t)(0xff << (cursor % 8));
+	for(n = 0; n <= m->bitmap_size; n++) {
+		if( b != 0 ) {
+			return (int16_t)i * 8 + lowest_bit(b);
+		}
+		if( ++i == m->bitmap_size ) {
+			i = 0;
+		}
+		b = m->bitmap[i];
+	}
+	return -1;
+}
+
+static int8_t send_next_fragment(void)
+{
+	int16_t frag_id;
+	uint16_t page_id;
+	int8_t ret;
+	fetcher_fragment_t *out_pkt;
+	fetcher_cam_t *cam;
+
+	cam = (fetcher_cam_t *) ker_shm_get( KER_FETCHER_PID, send_state.map->key);
+	if ( cam == NULL ) {
+		// file got deleted. give up!
+		free_send_state_map();
+		return -EINVAL;
+	}
+
+	frag_id = find_next_fragment(send_state.map, send_state.cursor);
+	if( frag_id < 0 ) {
+		//! no more fragment to send
+		free_send_state_map();
+		return -EINVAL;
+	}
+
+	//! read ahead a page at a time
+	if( send_state.page == NULL ) {
+		send_state.page = ker_malloc(FETCHER_PAGE_SIZE, KER_FETCHER_PID);
+		if( send_state.page == NULL ) {
+			return -ENOMEM;
+		}
+		send_state.page_id = FETCHER_PAGE_NONE;
+	}
+	page_id = frag_id - (frag_id % FETCHER_PAGE_FRAGMENTS);
+	if( send_state.page_id != page_id ) {
+		//! do not read past the fragments the map covers
+		uint16_t n = send_state.map->bitmap_size * 8 - page_id;
+		if( n > FETCHER_PAGE_FRAGMENTS ) {
+			n = FETCHER_PAGE_FRAGMENTS;
+		}
+		if( ker_codemem_read(cam->cm, KER_FETCHER_PID,
+					send_state.page, n * FETCHER_FRAGMENT_SIZE,
+					page_id * (code_addr_t)FETCHER_FRAGMENT_SIZE) != SOS_OK ) {
+			DEBUG_PID(KER_FETCHER_PID, "codemem_read failed\n");
+			return -EIO;
+		}
+		send_state.page_id = page_id;
+	}
+
+	out_pkt = (fetcher_fragment_t*)ker_malloc(sizeof(fetcher_fragment_t), KER_FETCHER_PID);
+	if(out_pkt == NULL){
+		DEBUG_PID(KER_FETCHER_PID,"malloc fetcher_fragment_t failed\n");
+		return -ENOMEM;
+	}
+	send_state.map->bitmap[frag_id / 8] &= ~(1 << (frag_id % 8));
+	send_state.cursor = frag_id + 1;
+	out_pkt->frag_id = ehtons(frag_id);
+	out_pkt->key = ehtons(send_state.map->key);
+	memcpy(out_pkt->fragment,
+			send_state.page + (frag_id - page_id) * FETCHER_FRAGMENT_SIZE,
+			FETCHER_FRAGMENT_SIZE);
+
+	DEBUG_PID(KER_FETCHER_PID, "send_fragment: frag_id = %d to %d\n", frag_id, send_state.dest);
+	ret = post_auto(KER_FETCHER_PID,
+			KER_FETCHER_PID,
+			MSG_FETCHER_FRAGMENT,
+			sizeof(fetcher_fragment_t),
+			out_pkt,
+			SOS_MSG_RELEASE | SOS_MSG_RELIABLE,
+			send_state.dest);
+	if( ret == SOS_OK ) {
+		send_state.num_msg_in_queue++;
+	}
+	return ret;
+}
+
+/**
+ * @brief fill the window, called again for every send done
+ */
+static void send_window(void)
+{
+	while( send_state.map != NULL &&
+			send_state.num_msg_in_queue < FETCHER_WINDOW ) {
+		if( send_next_fragment() != SOS_OK ) {
+			break;
+		}
+	}
+	if( send_state.map == NULL ) {
+		ker_timer_stop(KER_FETCHER_PID, FETCHER_TRANSMIT_TID);
+	}
+}
+#else
 static inline void send_fragment()
 {
 	uint16_t frag_id;
@@ -487,6 +660,7 @@ send_fragment_postproc:
 		free_send_state_map();
 	}
 }
+#endif
 
 static inline int8_t set_num_funcs_in_send_state(sos_shm_t key)
 {
@@ -536,6 +710,10 @@ static int8_t handle_request(Message *msg)
 		if(ret == SOS_OK) {
 			send_state.map = (fetcher_bitmap_t*)ker_msg_take_data(KER_FETCHER_PID, msg);
 			send_state.dest = msg->saddr;
+#ifdef SOS_FETCHER_PIPELINE
+			send_state.cursor = 0;
+			send_state.page_id = FETCHER_PAGE_NONE;
+#endif
 			DEBUG_PID(KER_FETCHER_PID,"send_state.map = 0x%x send_state.dest = 0x%x\n", (int)send_state.map, send_state.dest);
 		} else {
 			return -ENOMEM;
@@ -567,6 +745,9 @@ static int8_t handle_request(Message *msg)
 			send_state.map->bitmap[i] &= ~tmp;
 		}
 	}
+#ifdef SOS_FETCHER_PIPELINE
+	send_window();
+#endif
 	return SOS_OK;
 }
 
@@ -615,6 +796,13 @@ static int8_t handle_data(Message *msg)
 	}
 
 	fst->map.bitmap[(f->frag_id) / 8] &= ~(1 << ((f->frag_id) % 8));
+#ifdef SOS_FETCHER_PIPELINE
+	//! we may be forwarding this module, drop the page if it is stale now
+	if( send_state.map != NULL && send_state.map->key == f->key &&
+			(f->frag_id - (f->frag_id % FETCHER_PAGE_FRAGMENTS)) == send_state.page_id ) {
+		send_state.page_id = FETCHER_PAGE_NONE;
+	}
+#endif
 	check_map_and_post();
 	return SOS_OK;
 }
@@ -36,6 +36,46 @@
 #define MAX_SLEEP_INTERVAL 250
 #define MAX_REALTIME_CLOCK 4
 
+#ifdef SOS_TIMER_WHEEL
+#ifdef SOS_USE_PREEMPTION
+#error SOS_TIMER_WHEEL is not supported with SOS_USE_PREEMPTION
+#endif
+//! log2 of the number of slots in each level of the timing wheel
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS   4
+#endif
+//! number of levels, timers beyond 2^(BITS * LEVELS) ticks overflow
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS 4
+#endif
+//! number of (pid, tid) hash buckets, must be a power of two
+#ifndef TIMER_HASH_SIZE
+#define TIMER_HASH_SIZE    16
+#endif
+#if (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS) > 24
+#error the timing wheel cannot span more than 2^24 ticks
+#endif
+#define TIMER_WHEEL_SIZE     (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK     (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_OVERFLOW (TIMER_WHEEL_SIZE * TIMER_WHEEL_LEVELS)
+#define TIMER_WHEEL_SLOTS    (TIMER_WHEEL_OVERFLOW + 1)
+#if TIMER_WHEEL_SLOTS > 255
+#error the timing wheel cannot have more than 255 slots
+#endif
+#define TIMER_HASH(pid, tid) ((uint8_t)((pid) + ((tid) << 2)) & (TIMER_HASH_SIZE - 1))
+#endif
+
+#ifdef SOS_TIMER_COALESCE
+#ifdef SOS_USE_PREEMPTION
+#error SOS_TIMER_COALESCE is not supported with SOS_USE_PREEMPTION
+#endif
+#define timer_slack(h)     ((int32_t)((h)->slack))
+#else
+#define timer_slack(h)     0
+#endif
+//! no timer is running
+#define TIMER_NO_DEADLINE  0x7fffffffL
+
 //------------------------------------------------------------------------
 // INTERNAL DATA STRUCTURE
 //------------------------------------------------------------------------
@@ -48,11 +88,33 @@ typedef struct {
 //------------------------------------------------------------------------
 // GLOBAL VARIABLES
 //------------------------------------------------------------------------
+#ifdef SOS_TIMER_WHEEL
+static list_t   wheel[TIMER_WHEEL_SLOTS];      //!< Timing wheel slots
+static sos_timer_t *timer_hash[TIMER_HASH_SIZE]; //!< (pid, tid) index of initialized timers
+static uint32_t timer_now = 0;       //!< ticks counted by soft_interrupt
+static uint32_t wheel_time = 1;      //!< next tick the wheel will process
+static uint16_t wheel_timers = 0;    //!< number of running timers
+#define timer_queue_empty() (wheel_timers == 0)
+#else
 static list_t   deltaq;              //!< Timer delta queue
+#define timer_queue_empty() list_empty(&deltaq)
+#define timer_hash_add(tt)
+#define timer_hash_remove(tt)
+#endif
 static list_t   timer_pool;          //!< Pool of initialized timers
 static list_t   prealloc_timer_pool; //!< Pool of pre-allocated timers
 static list_t  periodic_pool;        //!< periodic pool used by soft_interrupt
 static int32_t  outstanding_ticks = 0; 
+#ifdef SOS_TIMER_COALESCE
+//! outstanding_ticks at which soft_interrupt has work to do
+static int32_t  timer_deadline = TIMER_NO_DEADLINE;
+//! outstanding_ticks is about to be cleared
+#define timer_deadline_rebase(ticks) do { \
+	if( timer_deadline != TIMER_NO_DEADLINE ) timer_deadline -= (ticks); \
+} while(0)
+#else
+#define timer_deadline_rebase(ticks)
+#endif
 
 static uint8_t num_realtime_clock = 0;
 static timer_realtime_t realtime[MAX_REALTIME_CLOCK];
@@ -74,6 +136,10 @@ static void timer_update_delta(void);
 #endif
 static void timer_pre_alloc_block_init(sos_timer_t *h, sos_pid_t pid);
 static uint16_t timer_update_realtime_clock(uint8_t cnt);
+#ifdef SOS_TIMER_WHEEL
+static void timer_hash_add(sos_timer_t *tt);
+static void timer_hash_remove(sos_timer_t *tt);
+#endif
 
 
 //------------------------------------------------------------------------
@@ -86,7 +152,16 @@ static uint16_t timer_update_realtime_clock(uint8_t cnt);
 void timer_init(void)
 {
 	uint8_t i;
+#ifdef SOS_TIMER_WHEEL
+  for(i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+	list_init(&wheel[i]);
+  }
+  for(i = 0; i < TIMER_HASH_SIZE; i++) {
+	timer_hash[i] = NULL;
+  }
+#else
   list_init(&deltaq);
+#endif
   list_init(&timer_pool);
   list_init(&prealloc_timer_pool);
   list_init(&periodic_pool);
@@ -136,26 +211,42 @@ int8_t timer_preallocate(sos_pid_t pid, uint8_t num_timers)
 /**
  * @brief remove timers for a particular pid
  */
-int8_t timer_remove_all(sos_pid_t pid)
+static void timer_remove_running(list_t *q, sos_pid_t pid)
 {
   list_link_t *link;
   
-  for(link = deltaq.l_next;
-	  link != (&deltaq); link = link->l_next) {
+  for(link = q->l_next;
+	  link != q; link = link->l_next) {
 	sos_timer_t *h = (sos_timer_t*)link;         
 	if(h->pid == pid) {
 	  link = link->l_prev;
 	  timer_remove_timer(h);
+	  timer_hash_remove(h);
 	  ker_slab_free( &timer_slab, h );
 	  //	break; Ram - Why are we breaking from this loop ?
 	}
   }
+}
+
+int8_t timer_remove_all(sos_pid_t pid)
+{
+  list_link_t *link;
+#ifdef SOS_TIMER_WHEEL
+  uint8_t i;
+
+  for(i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+	timer_remove_running(&wheel[i], pid);
+  }
+#else
+  timer_remove_running(&deltaq, pid);
+#endif
 	
   for (link = timer_pool.l_next; link != (&timer_pool); link = link->l_next){
 	sos_timer_t *h = (sos_timer_t*)link;
 	if (h->pid == pid){
 	  link = link->l_prev;
 	  list_remove((list_link_t*)h);
+	  timer_hash_remove(h);
 	  ker_slab_free(&timer_slab,h);
 	}
   }
@@ -222,6 +313,9 @@ static void timer_set_hw_top(int32_t cnt, bool update_outstanding)
 	} else {
 		outstanding_ticks = 0;
 	}
+#ifdef SOS_TIMER_COALESCE
+	timer_deadline = outstanding_ticks + cnt;
+#endif
 	if( num_realtime_clock > 0 ) {
 		rt_cnt = timer_update_realtime_clock(hw_cnt);
 
@@ -235,6 +329,275 @@ static void timer_set_hw_top(int32_t cnt, bool update_outstanding)
 	LEAVE_CRITICAL_SECTION();
 }
 
+/**
+ * @brief no timer is running, only the realtime clocks need interrupts
+ */
+static void timer_set_hw_idle(void)
+{
+	timer_set_hw_top(MAX_SLEEP_INTERVAL, false);
+#ifdef SOS_TIMER_COALESCE
+	timer_deadline = TIMER_NO_DEADLINE;
+#endif
+}
+
+#ifdef SOS_TIMER_WHEEL
+/*
+ * Hierarchical timing wheel
+ *
+ * Level l has TIMER_WHEEL_SIZE slots of 2^(l * TIMER_WHEEL_BITS) ticks.
+ * A running timer keeps its expiry time on the timer_now clock in delta
+ * and sits in the slot of the lowest level that can hold it, so starting
+ * and stopping a timer is a list operation.  Whenever a level wraps
+ * around, one slot of the level above is moved down (cascaded).  Timers
+ * too far away for the top level wait in the overflow slot, which is
+ * cascaded when the top level wraps around.
+ */
+
+#ifdef SOS_DEBUG_TIMER
+static void print_all_timers(char *context)
+{
+	list_link_t *link;
+	uint8_t i;
+
+	DEBUG(" *** ALL TIMER: %s, now = %d ***\n", context, timer_now);
+	for(i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		for(link = wheel[i].l_next; link != (&wheel[i]); link = link->l_next) {
+			sos_timer_t *h = (sos_timer_t*)link;
+			DEBUG("(%d) pid = %d, tid = %d, ticks = %d, expires = %d\n", i, h->pid, h->tid, h->ticks, h->delta);
+		}
+	}
+}
+#endif
+
+//! append all timers of list from to list to
+static void timer_list_move(list_t *from, list_t *to)
+{
+	if(list_empty(from) == true) {
+		return;
+	}
+	from->l_next->l_prev = to->l_prev;
+	to->l_prev->l_next = from->l_next;
+	from->l_prev->l_next = to;
+	to->l_prev = from->l_prev;
+	list_init(from);
+}
+
+/**
+ * @brief put a timer in the slot of its expiry time
+ */
+static void wheel_place(sos_timer_t *h)
+{
+	int32_t d = (int32_t)((uint32_t)h->delta - wheel_time);
+	list_t *slot;
+	uint8_t l;
+
+	if( d <= 0 ) {
+		// expires with the next tick processed
+		slot = &wheel[wheel_time & TIMER_WHEEL_MASK];
+	} else {
+		for( l = 0; l < TIMER_WHEEL_LEVELS; l++ ) {
+			if( (uint32_t)d < (1UL << (TIMER_WHEEL_BITS * (l + 1))) ) {
+				break;
+			}
+		}
+		if( l == TIMER_WHEEL_LEVELS ) {
+			slot = &wheel[TIMER_WHEEL_OVERFLOW];
+		} else {
+			slot = &wheel[l * TIMER_WHEEL_SIZE +
+				(((uint32_t)h->delta >> (TIMER_WHEEL_BITS * l)) & TIMER_WHEEL_MASK)];
+		}
+	}
+	list_insert_tail(slot, (list_link_t*)h);
+}
+
+static void wheel_requeue(list_t *slot)
+{
+	list_t q;
+
+	list_init(&q);
+	timer_list_move(slot, &q);
+	while(list_empty(&q) == false) {
+		list_link_t *link = q.l_next;
+		list_remove_head(&q);
+		wheel_place((sos_timer_t*)link);
+	}
+}
+
+/**
+ * @brief move down the timers of the slots that are due at wheel_time
+ * Called when level 0 wraps around
+ */
+static void wheel_cascade(void)
+{
+	uint8_t l;
+
+	for( l = 1; l < TIMER_WHEEL_LEVELS; l++ ) {
+		uint8_t idx = (wheel_time >> (TIMER_WHEEL_BITS * l)) & TIMER_WHEEL_MASK;
+		wheel_requeue(&wheel[l * TIMER_WHEEL_SIZE + idx]);
+		if( idx != 0 ) {
+			return;
+		}
+	}
+	wheel_requeue(&wheel[TIMER_WHEEL_OVERFLOW]);
+}
+
+/**
+ * @brief move all timers that expire up to timer_now into expired
+ * The timers keep their expiry order
+ */
+static void wheel_run(list_t *expired)
+{
+	if( wheel_timers == 0 ) {
+		wheel_time = timer_now + 1;
+		return;
+	}
+	while( (int32_t)(timer_now - wheel_time) >= 0 ) {
+		uint8_t idx = wheel_time & TIMER_WHEEL_MASK;
+		if( idx == 0 ) {
+			wheel_cascade();
+		}
+		timer_list_move(&wheel[idx], expired);
+		wheel_time++;
+	}
+}
+
+//! earliest expiry time (plus slack) in a slot that is not empty
+static uint32_t wheel_slot_min(list_t *slot, uint32_t next)
+{
+	list_link_t *link;
+
+	for(link = slot->l_next; link != slot; link = link->l_next) {
+		sos_timer_t *h = (sos_timer_t*)link;
+		uint32_t e = (uint32_t)(h->delta + timer_slack(h));
+		if( (int32_t)(e - next) < 0 ) {
+			next = e;
+		}
+	}
+	return next;
+}
+
+/**
+ * @brief the next tick at which a timer expires
+ * The result is at most MAX_SLEEP_INTERVAL ticks away.  The slots of a
+ * level cover consecutive time ranges, so only the first slot that is not
+ * empty needs to be looked at.  Cascades happen in wheel_run() on the way,
+ * so there is no need to wake up for them.
+ * With SOS_TIMER_COALESCE it is the earliest expiry plus slack, which can
+ * be in any slot before the result.
+ */
+static uint32_t wheel_next(void)
+{
+	uint32_t next = timer_now + MAX_SLEEP_INTERVAL;
+	uint8_t l, k;
+
+	for( l = 0; l < TIMER_WHEEL_LEVELS; l++ ) {
+		uint8_t shift = TIMER_WHEEL_BITS * l;
+		uint32_t base = wheel_time >> shift;
+		uint8_t first;
+
+		// between cascade points the current slot of a level holds the
+		// timers of its next round
+		first = ((wheel_time & ((1UL << shift) - 1)) == 0)? 0 : 1;
+		for( k = first; k < first + TIMER_WHEEL_SIZE; k++ ) {
+			list_t *slot = &wheel[l * TIMER_WHEEL_SIZE + ((base + k) & TIMER_WHEEL_MASK)];
+			if( (int32_t)(((base + k) << shift) - next) >= 0 ) {
+				break;
+			}
+			if( list_empty(slot) == false ) {
+				next = wheel_slot_min(slot, next);
+#ifndef SOS_TIMER_COALESCE
+				break;
+#endif
+			}
+		}
+	}
+	return wheel_slot_min(&wheel[TIMER_WHEEL_OVERFLOW], next);
+}
+
+/**
+ * @brief start a timer
+ * On entry delta is the interval, on return it is the expiry time
+ */
+static void timer_delta_q_insert(sos_timer_t *h, bool new_timer)
+{
+	int32_t hw_cnt = 0;
+	HAS_CRITICAL_SECTION;
+
+	if( wheel_timers == 0 ) {
+		//! no timer is running, start counting from now
+		if( new_timer ) {
+			timer_set_hw_top(h->delta + timer_slack(h), false);
+		}
+	} else {
+		ENTER_CRITICAL_SECTION();
+		hw_cnt = outstanding_ticks + timer_hardware_get_counter();
+		LEAVE_CRITICAL_SECTION();
+#ifdef SOS_TIMER_COALESCE
+		if( new_timer && hw_cnt + h->delta + timer_slack(h) < timer_deadline ) {
+#else
+		if( new_timer &&
+				h->delta < ((int32_t)timer_getInterval() - timer_hardware_get_counter()) ) {
+#endif
+			DEBUG("new timer expires before the hardware timer\n");
+			timer_set_hw_top(h->delta + timer_slack(h), true);
+		}
+	}
+	h->delta += (int32_t)(timer_now + hw_cnt);
+	h->flag |= TIMER_RUNNING;
+	wheel_timers++;
+	wheel_place(h);
+}
+
+static sos_timer_t* timer_hash_find(sos_pid_t pid, uint8_t tid)
+{
+	sos_timer_t *tt;
+
+	for( tt = timer_hash[TIMER_HASH(pid, tid)]; tt != NULL; tt = tt->hash_next ) {
+		if( (tt->pid == pid) && (tt->tid == tid) ) {
+			return tt;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief index a timer block that was just given its pid and tid
+ * A new block is never running
+ */
+static void timer_hash_add(sos_timer_t *tt)
+{
+	uint8_t h = TIMER_HASH(tt->pid, tt->tid);
+
+	tt->flag &= ~TIMER_RUNNING;
+	tt->hash_next = timer_hash[h];
+	timer_hash[h] = tt;
+}
+
+static void timer_hash_remove(sos_timer_t *tt)
+{
+	sos_timer_t **itr;
+
+	for( itr = &timer_hash[TIMER_HASH(tt->pid, tt->tid)]; *itr != NULL; itr = &((*itr)->hash_next) ) {
+		if( *itr == tt ) {
+			*itr = tt->hash_next;
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Locate a running timer
+ */
+static sos_timer_t* find_timer_block(sos_pid_t pid, uint8_t tid)
+{
+	sos_timer_t *tt = timer_hash_find(pid, tid);
+
+	if( (tt != NULL) && (tt->flag & TIMER_RUNNING) ) {
+		return tt;
+	}
+	return NULL;
+}
+#else
 #ifdef SOS_DEBUG_TIMER
 static void print_all_timers(char *context)
 {
@@ -250,6 +613,38 @@ static void print_all_timers(char *context)
 }
 #endif
 
+#ifdef SOS_TIMER_COALESCE
+/**
+ * @brief ticks until the first timer that cannot be delayed any longer
+ * Timers further down the queue expire later, so the scan stops at the
+ * first one that expires after the best deadline found so far.
+ */
+static int32_t timer_next_deadline(void)
+{
+	list_link_t *link;
+	int32_t t = 0;
+	int32_t next = TIMER_NO_DEADLINE;
+
+	for(link = deltaq.l_next; link != (&deltaq); link = link->l_next) {
+		sos_timer_t *h = (sos_timer_t*)link;
+		if( h->delta <= 0 && t == 0 ) {
+			// soft_interrupt is still dispatching expired timers
+			return 0;
+		}
+		t += h->delta;
+		if( t >= next ) {
+			break;
+		}
+		if( t + timer_slack(h) < next ) {
+			next = t + timer_slack(h);
+		}
+	}
+	return next;
+}
+#else
+#define timer_next_deadline() (((sos_timer_t*)(deltaq.l_next))->delta)
+#endif
+
 /**
  * @brief insert handle into delta queue
  * This routine assumes that the data structure is set
@@ -268,7 +663,7 @@ static void timer_delta_q_insert(sos_timer_t *h, bool new_timer)
 		if( new_timer ) {
 			// clear any outstnading ticks
 			// and start new timer
-			timer_set_hw_top(h->delta, false);
+			timer_set_hw_top(h->delta + timer_slack(h), false);
 		}
 		list_insert_head(&deltaq, (list_link_t*)h);
 		return;
@@ -286,6 +681,14 @@ static void timer_delta_q_insert(sos_timer_t *h, bool new_timer)
 		// ticks that are already passed in time
 		h->delta += hw_cnt;
 		DEBUG("get hw_cnt = %d\n", hw_cnt);
+#ifdef SOS_TIMER_COALESCE
+		// the hardware waits for the earliest expiry plus slack of all
+		// timers, which need not be the head of the queue
+		if( h->delta + timer_slack(h) < timer_next_deadline() ) {
+			timer_set_hw_top(h->delta + timer_slack(h) - hw_cnt, true);
+		}
+		new_timer = false;
+#endif
 	}
 
 	link = deltaq.l_next;
@@ -314,7 +717,11 @@ static void timer_delta_q_insert(sos_timer_t *h, bool new_timer)
 			list_insert_before(link, (list_link_t*)h);
 			return;
 		}
-		h->delta -= curr->delta;
+		if( curr->delta > 0 ) {
+			// timers that expired but are not dispatched yet keep
+			// how late they are in delta, they are all due now
+			h->delta -= curr->delta;
+		}
 	}
 	DEBUG("insert to tail\n");
 	list_insert_tail(&deltaq, (list_link_t*)h);
@@ -342,6 +749,7 @@ static sos_timer_t* find_timer_block(sos_pid_t pid, uint8_t tid)
 
    return NULL;
 }
+#endif
 
 static sos_timer_t *find_timer_in_periodic_pool(sos_pid_t pid, uint8_t tid)
 {
@@ -386,6 +794,46 @@ static sos_timer_t* alloc_from_preallocated_timer_pool(sos_pid_t pid)
 }
 
 
+#ifdef SOS_TIMER_WHEEL
+static sos_timer_t* alloc_from_timer_pool(sos_pid_t pid, uint8_t tid)
+{
+	sos_timer_t *tt = timer_hash_find(pid, tid);
+
+	if( (tt == NULL) || (tt->flag & TIMER_RUNNING) ) {
+		return NULL;
+	}
+	list_remove((list_t*)tt);
+	return tt;
+}
+
+/**
+ * @brief Remove a timer from the timing wheel
+ */
+static int8_t timer_remove_timer(sos_timer_t *tt)
+{
+	if( (tt->flag & TIMER_RUNNING) == 0 ) {
+		return -EINVAL;
+	}
+	list_remove((list_t*)tt);
+	tt->flag &= ~TIMER_RUNNING;
+	wheel_timers--;
+	return SOS_OK;
+}
+
+/**
+ * @brief advance the timer clock by the ticks counted in timer_interrupt
+ */
+static void timer_update_delta(void)
+{
+	HAS_CRITICAL_SECTION;
+
+	ENTER_CRITICAL_SECTION();
+	timer_now += outstanding_ticks;
+	timer_deadline_rebase(outstanding_ticks);
+	outstanding_ticks = 0;
+	LEAVE_CRITICAL_SECTION();
+}
+#else
 static sos_timer_t* alloc_from_timer_pool(sos_pid_t pid, uint8_t tid)
 {
    sos_timer_t* tt;
@@ -465,6 +913,7 @@ static void timer_update_delta(void)
 	
 	ENTER_CRITICAL_SECTION();
 	delta = outstanding_ticks;
+	timer_deadline_rebase(delta);
 	outstanding_ticks = 0;
 	LEAVE_CRITICAL_SECTION();
 	
@@ -487,6 +936,7 @@ static void timer_update_delta(void)
 	}
 }
 #endif
+#endif // SOS_TIMER_WHEEL
 
 /**
  * @brief Post the timeout messages
@@ -528,11 +978,15 @@ int8_t ker_timer_init(sos_pid_t pid, uint8_t tid, uint8_t type)
 	//! Init will fail if the system does not have sufficient resources
 	if (tt == NULL)
 	  return -ENOMEM;
+	tt->pid = pid;
+	tt->tid = tid;
+#ifdef SOS_TIMER_COALESCE
+	tt->slack = 0;
+#endif
+	timer_hash_add(tt);
   }
   
   //! Fill up the data structure and insert into the timer pool
-  tt->pid = pid;
-  tt->tid = tid;
   tt->type = type;
   
   list_insert_tail(&timer_pool, (list_link_t*)tt);
@@ -545,38 +999,40 @@ int8_t ker_permanent_timer_init(sos_timer_t* tt, sos_pid_t pid, uint8_t tid, uin
    tt->pid = pid;
    tt->tid = tid;
    tt->type = type | PERMANENT_TIMER_MASK;
+#ifdef SOS_TIMER_COALESCE
+   tt->slack = 0;
+#endif
+   timer_hash_add(tt);
    list_insert_tail(&timer_pool, (list_link_t*)tt);
 
    return SOS_OK; 
 }
 
-void timer_gc( void )
+static void timer_gc_mark_list( list_t *q )
 {
 	list_link_t *link;
 	
-	for(link = deltaq.l_next; link != (&deltaq); link = link->l_next) {
+	for(link = q->l_next; link != q; link = link->l_next) {
 		if( (((sos_timer_t*)link)->type & PERMANENT_TIMER_MASK) == 0 ) {
 			slab_gc_mark( &timer_slab, link );
 		} 
 	}
-	
-	for (link = timer_pool.l_next; link != (&timer_pool); link = link->l_next) {
-		if( (((sos_timer_t*)link)->type & PERMANENT_TIMER_MASK) == 0 ) {
-			slab_gc_mark( &timer_slab, link );
-		}
-	}
-	
-	for (link = prealloc_timer_pool.l_next; link != (&prealloc_timer_pool); link = link->l_next) {
-		if( (((sos_timer_t*)link)->type & PERMANENT_TIMER_MASK) == 0 ) {
-			slab_gc_mark( &timer_slab, link );
-		}
-	}
-	
-	for (link = periodic_pool.l_next; link != (&periodic_pool); link = link->l_next) {
-		if( (((sos_timer_t*)link)->type & PERMANENT_TIMER_MASK) == 0 ) {
-			slab_gc_mark( &timer_slab, link );
-		}
+}
+
+void timer_gc( void )
+{
+#ifdef SOS_TIMER_WHEEL
+	uint8_t i;
+
+	for(i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		timer_gc_mark_list( &wheel[i] );
 	}
+#else
+	timer_gc_mark_list( &deltaq );
+#endif
+	timer_gc_mark_list( &timer_pool );
+	timer_gc_mark_list( &prealloc_timer_pool );
+	timer_gc_mark_list( &periodic_pool );
 	
 	slab_gc( &timer_slab, TIMER_PID );
 	
@@ -585,6 +1041,11 @@ void timer_gc( void )
 
 
 int8_t ker_timer_start(sos_pid_t pid, uint8_t tid, int32_t interval)
+{
+  return ker_timer_start_slack(pid, tid, interval, 0);
+}
+
+int8_t ker_timer_start_slack(sos_pid_t pid, uint8_t tid, int32_t interval, uint16_t slack)
 {
   sos_timer_t* tt;
   //! Start the timer from the timer pool
@@ -599,6 +1060,9 @@ int8_t ker_timer_start(sos_pid_t pid, uint8_t tid, int32_t interval)
   //  tt->ticks = PROCESSOR_TICKS(interval);
   tt->ticks = interval;
   tt->delta = interval;
+#ifdef SOS_TIMER_COALESCE
+  tt->slack = slack;
+#endif
   
   //DEBUG("timer_start(%d) %d %d %d\n", tt->pid, tt->tid, tt->type, tt->ticks);
   
@@ -651,6 +1115,7 @@ int8_t ker_timer_stop_and_release(sos_pid_t pid, uint8_t tid)
 	return -EINVAL;
 
   //! Deep free of the timer
+  timer_hash_remove(tt);
   ker_slab_free(&timer_slab,tt); 
   
   return SOS_OK;   
@@ -698,7 +1163,7 @@ int8_t ker_timer_restart(sos_pid_t pid, uint8_t tid, int32_t interval)
   return SOS_OK;
 }
 
-int8_t ker_sys_timer_start(uint8_t tid, int32_t interval, uint8_t type)
+int8_t ker_sys_timer_start_slack(uint8_t tid, int32_t interval, uint8_t type, uint16_t slack)
 {
 #ifdef SOS_USE_PREEMPTION
   HAS_ATOMIC_PREEMPTION_SECTION;
@@ -708,7 +1173,7 @@ int8_t ker_sys_timer_start(uint8_t tid, int32_t interval, uint8_t type)
   ATOMIC_DISABLE_PREEMPTION();
 #endif
   if( (ker_timer_init(my_id, tid, type) != SOS_OK) ||       
-	  (ker_timer_start(my_id, tid, interval) != SOS_OK)) {
+	  (ker_timer_start_slack(my_id, tid, interval, slack) != SOS_OK)) {
 #ifdef SOS_USE_PREEMPTION
 	ATOMIC_ENABLE_PREEMPTION();
 #endif
@@ -724,6 +1189,11 @@ int8_t ker_sys_timer_start(uint8_t tid, int32_t interval, uint8_t type)
   return SOS_OK;                                            
 }
 
+int8_t ker_sys_timer_start(uint8_t tid, int32_t interval, uint8_t type)
+{
+  return ker_sys_timer_start_slack(tid, interval, type, 0);
+}
+
 int8_t ker_sys_timer_restart(uint8_t tid, int32_t interval)       
 {                                                             
 #ifdef SOS_USE_PREEMPTION
@@ -762,7 +1232,66 @@ int8_t ker_sys_timer_stop(uint8_t tid)
   return ret;                                            
 }
 
-#ifndef SOS_USE_PREEMPTION
+#ifdef SOS_TIMER_WHEEL
+// called from scheduler
+static void soft_interrupt( void )
+{
+  HAS_CRITICAL_SECTION;
+  list_t expired;
+
+  timer_update_delta();
+  list_init(&expired);
+  wheel_run(&expired);
+  while(list_empty(&expired) == false) {
+	sos_timer_t *h = (sos_timer_t*)(expired.l_next);
+	sos_pid_t pid = h->pid;
+	uint8_t tid = h->tid;
+	uint8_t flag;
+	list_remove_head(&expired);
+
+	if(((h->type) & SLOW_TIMER_MASK) == 0){
+	  flag = SOS_MSG_HIGH_PRIORITY;
+	} else {
+	  flag = 0;
+	}
+
+	//! the timer is back on the wheel or in the pool before
+	//! the handler runs, so that the handler can restart it
+	if (((h->type) & ONE_SHOT_TIMER_MASK) == 0){
+	  //! periocic timer, skip the periods that are already over
+	  do {
+		h->delta += h->ticks;
+	  } while((int32_t)((uint32_t)h->delta - timer_now) <= 0);
+	  wheel_place(h);
+	} else {
+	  h->flag &= ~TIMER_RUNNING;
+	  wheel_timers--;
+	  list_insert_tail(&timer_pool, (list_link_t*)h);
+	}
+	sched_dispatch_short_message(pid, TIMER_PID,
+								 MSG_TIMER_TIMEOUT, 
+								 tid, 0,
+								 flag);
+  }
+
+  if(wheel_timers != 0) {
+	int32_t next = (int32_t)(wheel_next() - timer_now);
+	int32_t hw_cnt;
+	ENTER_CRITICAL_SECTION();
+	hw_cnt = outstanding_ticks + timer_hardware_get_counter();
+	LEAVE_CRITICAL_SECTION();
+	if( next - hw_cnt > 0) {
+	  timer_set_hw_top(next - hw_cnt, true);	
+	} else {
+	  sched_add_interrupt(SCHED_TIMER_INT, soft_interrupt);
+	}
+  } else {
+	ENTER_CRITICAL_SECTION();
+	timer_set_hw_idle();
+	LEAVE_CRITICAL_SECTION();
+  }
+}
+#elif !defined(SOS_USE_PREEMPTION)
 // called from scheduler
 static void soft_interrupt( void )
 {
@@ -811,20 +1340,20 @@ static void soft_interrupt( void )
   }
   
   if(list_empty(&deltaq) == false) {
-	sos_timer_t *h = (sos_timer_t*)(deltaq.l_next);
+	int32_t next = timer_next_deadline();
 	int32_t hw_cnt;
 	ENTER_CRITICAL_SECTION();
 	hw_cnt = outstanding_ticks - timer_hardware_get_counter();
-	if( h->delta - hw_cnt > 0) {
+	if( next - hw_cnt > 0) {
 	  LEAVE_CRITICAL_SECTION();
-	  timer_set_hw_top(h->delta - hw_cnt, true);	
+	  timer_set_hw_top(next - hw_cnt, true);	
 	} else {
 	  LEAVE_CRITICAL_SECTION();
 	  sched_add_interrupt(SCHED_TIMER_INT, soft_interrupt);
 	}
   } else {
 	ENTER_CRITICAL_SECTION();
-	timer_set_hw_top(MAX_SLEEP_INTERVAL, false);
+	timer_set_hw_idle();
 	LEAVE_CRITICAL_SECTION();
   }
 }
@@ -833,13 +1362,13 @@ static void soft_interrupt( void )
 static void timer_realtime_set_hw_top(uint16_t value)
 {
   // compute the time it takes to have next interrupt
-  if(list_empty(&deltaq) == true) {
+  if(timer_queue_empty()) {
 	timer_set_hw_top(value, false);
   } else {
 	uint8_t hw_interval = timer_getInterval();
 	uint8_t hw_cnt = timer_hardware_get_counter();
 	if( (hw_interval - hw_cnt) >= value ) {
-	  if(list_empty(&deltaq) == true) {
+	  if(timer_queue_empty()) {
 		timer_set_hw_top(value, false);
 	  } else {
 		timer_set_hw_top(value, true);
@@ -1014,6 +1543,24 @@ timer_interrupt()
 #else
 	uint8_t cnt = timer_getInterval();
 	outstanding_ticks += cnt;
+#ifdef SOS_TIMER_COALESCE
+	if( outstanding_ticks < timer_deadline ) {
+		//! nothing is due yet, sleep on without waking the scheduler
+		int32_t rest = timer_deadline - outstanding_ticks;
+
+		if( timer_deadline == TIMER_NO_DEADLINE ) {
+			outstanding_ticks = 0;
+		}
+		if( num_realtime_clock > 0 ) {
+			uint16_t rt_cnt = timer_update_realtime_clock(cnt);
+			if( rt_cnt < rest ) {
+				rest = rt_cnt;
+			}
+		}
+		timer_set_hw_interval(rest);
+		return;
+	}
+#endif
 	sched_add_interrupt(SCHED_TIMER_INT, soft_interrupt);
 
 
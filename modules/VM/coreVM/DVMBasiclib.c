@@ -27,6 +27,15 @@
 //
 #define PER_DELAY                1000L
 #define COMPUTATION_DELAY        100L
+//
+// Operand classes for superinstructions
+//
+#define IS_VARLOAD(op)   ((((op) >= OP_GETVAR) && ((op) < OP_GETVAR + DVM_NUM_SHARED_VARS)) || \
+                          (((op) >= OP_GETLOCAL) && ((op) < OP_GETLOCAL + DVM_NUM_LOCAL_VARS)))
+#define IS_VARSTORE(op)  ((((op) >= OP_SETVAR) && ((op) < OP_SETVAR + DVM_NUM_SHARED_VARS)) || \
+                          (((op) >= OP_SETLOCAL) && ((op) < OP_SETLOCAL + DVM_NUM_LOCAL_VARS)))
+#define IS_ARITH(op)     (((op) == OP_ADD) || ((op) == OP_SUB) || ((op) == OP_MUL))
+#define IS_CMPJ(op)      (((op) >= OP_JGE) && ((op) <= OP_JNE))
 //--------------------------------------------------------------------
 // TYPEDEFS
 //--------------------------------------------------------------------
@@ -51,6 +60,9 @@ static void buffer_clear(DvmDataBuffer *buffer);
 static void buffer_append(DvmDataBuffer *buffer, uint8_t numBytes, uint16_t var);
 static void buffer_concatenate(DvmDataBuffer *dst, DvmDataBuffer *src);
 static int32_t convert_to_float(DvmStackVariable *arg1, DvmStackVariable *arg2);
+static inline DvmOpcode fetchOperand(dvm_state_t* dvm_st, DvmState *eventState, uint16_t which);
+static int8_t superop(DvmState *eventState, DvmOpcode instr, DVMBasiclib_state_t *s);
+static uint8_t superop_match(const DvmOpcode *code, DvmCapsuleLength avail);
 //--------------------------------------------------------------------
 // MESSAGE HANDLER
 //--------------------------------------------------------------------   
@@ -108,9 +120,15 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
 {
   DVMBasiclib_state_t *s = (&dvm_st->basiclib_st);
   DvmContext *context = &(eventState->context);
+  const DvmOpcode *thread = eventState->thread;
 	
   while ((context->state == DVM_STATE_RUN) && (context->num_executed < DVM_CPU_SLICE)) { 
-    DvmOpcode instr = getOpcode(dvm_st, context->which, context->pc);
+    DvmOpcode instr;
+    if (thread != NULL) {
+      instr = (context->pc < context->dataSize)? thread[context->pc] : OP_HALT;
+    } else {
+      instr = getOpcode(dvm_st, context->which, context->pc);
+    }
     DEBUG("-----------------------------------------------\n");
     DEBUG("[BASIC_LIB] execute: (%d) PC: %d. INSTR: %d\n",context->which, context->pc, instr);
     if(instr & LIB_ID_BIT)
@@ -118,6 +136,11 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
 	return SOS_OK;
       }
     context->num_executed++;
+    if ((thread != NULL) && (instr >= OP_SUPER_MIN)) {
+      if (superop(eventState, instr, s) == SOS_OK) continue;
+      // Operands did not suit the fused form, run the plain instruction
+      instr = eventState->code[context->pc];
+    }
     switch(instr)
       {
       case OP_START:
@@ -415,7 +438,7 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
 	}                                                             
       case OP_JMP:
 	{
-	  DvmOpcode line_num = getOpcode(dvm_st, context->which, ++context->pc);
+	  DvmOpcode line_num = fetchOperand(dvm_st, eventState, ++context->pc);
 	  context->pc = line_num;
 	  DEBUG("[BASIC_LIB] execute: JMP to %d\n", context->pc);
 	  break;
@@ -424,7 +447,7 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
       case OP_JZ:
 	{
 	  DvmStackVariable* arg1 = popOperand( eventState);
-	  DvmOpcode line_num = getOpcode(dvm_st, context->which, ++context->pc);
+	  DvmOpcode line_num = fetchOperand(dvm_st, eventState, ++context->pc);
 	  int32_t fl_arg1 = 1;
 
 	  DEBUG("[BASIC_LIB] execute: (%d) JNZ or JZ\n", context->pc);
@@ -459,7 +482,7 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
 	{
 	  DvmStackVariable* arg1 = popOperand( eventState);
 	  DvmStackVariable* arg2 = popOperand( eventState);
-	  DvmOpcode line_num = getOpcode( dvm_st,  context->which, context->pc + 1);
+	  DvmOpcode line_num = fetchOperand(dvm_st, eventState, context->pc + 1);
 	  context->pc += 1;
 	  DEBUG("[BASIC_LIB] execute: (%d) Executing JG %d.\n",context->which, line_num);
 	  int32_t fl_arg1, fl_arg2;
@@ -626,7 +649,7 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
       case OP_PUSH:
 	{
 	  context->pc += 1;
-	  DvmOpcode arg = getOpcode( dvm_st,  context->which, context->pc);
+	  DvmOpcode arg = fetchOperand(dvm_st, eventState, context->pc);
 	  pushValue( eventState, arg, DVM_TYPE_INTEGER);
 	  context->pc += 1;
 	  DEBUG("[BASIC_LIB] execute: (%i) PUSH %hi\n", (int)context->which, arg);
@@ -636,13 +659,13 @@ int8_t execute(dvm_state_t* dvm_st, DvmState *eventState)
 	{
 	  uint16_t arg;
 	  context->pc += 1;
-	  DvmOpcode arg1 = getOpcode( dvm_st,  context->which, context->pc), arg2, arg3, arg4;
+	  DvmOpcode arg1 = fetchOperand(dvm_st, eventState, context->pc), arg2, arg3, arg4;
 	  context->pc += 1;
-	  arg2 = getOpcode( dvm_st,  context->which, context->pc);
+	  arg2 = fetchOperand(dvm_st, eventState, context->pc);
 	  context->pc += 1;
-	  arg3 = getOpcode( dvm_st,  context->which, context->pc);
+	  arg3 = fetchOperand(dvm_st, eventState, context->pc);
 	  context->pc += 1;
-	  arg4 = getOpcode( dvm_st,  context->which, context->pc);
+	  arg4 = fetchOperand(dvm_st, eventState, context->pc);
 	  arg = arg3;
 	  arg = (arg << 8) + arg4;
 	  pushValue( eventState, arg, DVM_TYPE_FLOAT_DEC);
@@ -876,9 +899,9 @@ static inline int8_t call_op(dvm_state_t* dvm_st, DvmState *eventState, DVMBasic
   if (retValue->type != DVM_TYPE_BUFFER) {DEBUG("\n\n\nPROBLEM IN RET BUFFER\n\n\n");}
 
   context->pc += 1;
-  uint8_t mod_id = getOpcode( dvm_st,  context->which, context->pc);
+  uint8_t mod_id = fetchOperand(dvm_st, eventState, context->pc);
   context->pc += 1;
-  uint8_t fnid = getOpcode( dvm_st,  context->which, context->pc);
+  uint8_t fnid = fetchOperand(dvm_st, eventState, context->pc);
 
   if (sys_fntable_subscribe(mod_id, EXECUTE_SYNCALL, 0) != SOS_OK) {
     DEBUG("\n\n\n\nSUBSCRIPTION PROBLEMS\n\n\n\n\n");
@@ -906,9 +929,9 @@ static inline int8_t post_op(dvm_state_t* dvm_st, DvmState *eventState, DVMBasic
 
   DvmStackVariable *callArgs = popOperand( eventState);
   context->pc += 1;
-  uint8_t mod_id = getOpcode( dvm_st, context->which, context->pc);
+  uint8_t mod_id = fetchOperand(dvm_st, eventState, context->pc);
   context->pc += 1;
-  uint8_t fnid = getOpcode( dvm_st, context->which, context->pc);
+  uint8_t fnid = fetchOperand(dvm_st, eventState, context->pc);
 
   pmsg->fnid = fnid;
   pmsg->argBuf = callArgs;
@@ -1029,6 +1052,21 @@ int16_t lockNum(uint8_t instr)
   }
 }
 //--------------------------------------------------------------------
+// Build the threaded copy of a capsule: one dispatch byte per script
+// byte. Where a common instruction sequence starts, the byte is the
+// matching superinstruction; everywhere else it is the opcode itself.
+// Operands are still read from the script copy and pc keeps counting
+// script bytes, so jump targets, lock analysis and error reports are
+// not affected. Every offset is translated, so a jump into the middle
+// of a fused sequence simply starts at a plain instruction.
+void translateCapsule(DvmOpcode *thread, const DvmOpcode *code, DvmCapsuleLength len)
+{
+  DvmCapsuleLength i;
+  for (i = 0; i < len; i++) {
+    thread[i] = superop_match(code + i, len - i);
+  }
+}
+//--------------------------------------------------------------------
 // LOCAL FUNCTIONS
 //--------------------------------------------------------------------------------------------
 static void buffer_get(DvmDataBuffer *buffer, uint8_t numBytes, uint8_t bufferOffset, uint16_t *dest) 
@@ -1109,6 +1147,185 @@ static int32_t convert_to_float(DvmStackVariable *arg1, DvmStackVariable *arg2)
   */
 }
 //--------------------------------------------------------------------------------------------  
+static inline DvmOpcode fetchOperand(dvm_state_t* dvm_st, DvmState *eventState, uint16_t which)
+{
+  if ((eventState->code != NULL) && (which < eventState->context.dataSize))
+    return eventState->code[which];
+  return getOpcode(dvm_st, eventState->context.which, which);
+}
+//--------------------------------------------------------------------------------------------  
+// SUPERINSTRUCTIONS
+//--------------------------------------------------------------------------------------------  
+// Length of the GETVAR, GETLOCAL or PUSH at code[0], 0 for anything else
+static uint8_t load_len(const DvmOpcode *code, DvmCapsuleLength avail)
+{
+  if (avail == 0) return 0;
+  if (IS_VARLOAD(code[0])) return 1;
+  if ((code[0] == OP_PUSH) && (avail >= 2)) return 2;
+  return 0;
+}
+//--------------------------------------------------------------------------------------------  
+static uint8_t superop_match(const DvmOpcode *code, DvmCapsuleLength avail)
+{
+  DvmOpcode op = code[0];
+  uint8_t l1, l2;
+
+  if (!(op & LIB_ID_BIT) && (op >= OP_SUPER_MIN)) return OP_SUPER_UNDEF;
+  if (IS_VARLOAD(op) && (avail >= 4) && (code[1] == OP_PUSH) && IS_ARITH(code[3])) {
+    if ((avail >= 5) && IS_VARSTORE(code[4])) return OP_SUPER_UPDATE;
+    return OP_SUPER_LOADOP;
+  }
+  if (IS_VARLOAD(op) && (avail >= 3) && ((code[1] == OP_INCR) || (code[1] == OP_DECR)) &&
+      IS_VARSTORE(code[2])) {
+    return OP_SUPER_INCR;
+  }
+  l1 = load_len(code, avail);
+  if (l1 > 0) {
+    l2 = load_len(code + l1, avail - l1);
+    if ((l2 > 0) && (avail >= l1 + l2 + 2) && IS_CMPJ(code[l1 + l2])) return OP_SUPER_CMPJ;
+    if ((avail >= l1 + 2) && ((code[l1] == OP_JZ) || (code[l1] == OP_JNZ))) return OP_SUPER_TESTJ;
+  }
+  if ((op == OP_PUSH) && (avail >= 3) && IS_ARITH(code[2])) return OP_SUPER_PUSHOP;
+  return op;
+}
+//--------------------------------------------------------------------------------------------  
+// Shared or local variable named by a GETVAR, SETVAR, GETLOCAL or SETLOCAL
+static DvmStackVariable *var_slot(DvmState *eventState, DvmOpcode op, DVMBasiclib_state_t *s)
+{
+  if ((op >= OP_GETVAR) && (op < OP_GETVAR + DVM_NUM_SHARED_VARS)) return &s->shared_vars[op - OP_GETVAR];
+  if ((op >= OP_SETVAR) && (op < OP_SETVAR + DVM_NUM_SHARED_VARS)) return &s->shared_vars[op - OP_SETVAR];
+  if ((op >= OP_SETLOCAL) && (op < OP_SETLOCAL + DVM_NUM_LOCAL_VARS)) return &eventState->vars[op - OP_SETLOCAL];
+  return &eventState->vars[op - OP_GETLOCAL];
+}
+//--------------------------------------------------------------------------------------------  
+// Integer value pushed by the load at code[0]. Returns the length of the
+// load, or 0 if it would not push a single integer.
+static uint8_t load_int(DvmState *eventState, const DvmOpcode *code, int16_t *val, DVMBasiclib_state_t *s)
+{
+  DvmStackVariable *var;
+  if (code[0] == OP_PUSH) {
+    *val = code[1];
+    return 2;
+  }
+  var = var_slot(eventState, code[0], s);
+  if (var->type != DVM_TYPE_INTEGER) return 0;
+  *val = var->value.var;
+  return 1;
+}
+//--------------------------------------------------------------------------------------------  
+// Integer ADD/SUB/MULT as execute() does it; arg1 is the top of stack
+static inline int16_t arith(DvmOpcode op, int16_t arg1, int16_t arg2)
+{
+  if (op == OP_ADD) return arg1 + arg2;
+  if (op == OP_SUB) return arg1 - arg2;
+  return (int16_t)(arg1 * arg2);
+}
+//--------------------------------------------------------------------------------------------  
+static inline uint8_t compare(DvmOpcode op, int16_t arg1, int16_t arg2)
+{
+  switch (op) {
+  case OP_JG:  return (arg1 > arg2);
+  case OP_JGE: return (arg1 >= arg2);
+  case OP_JL:  return (arg1 < arg2);
+  case OP_JLE: return (arg1 <= arg2);
+  case OP_JE:  return (arg1 == arg2);
+  default:     return (arg1 != arg2);
+  }
+}
+//--------------------------------------------------------------------------------------------  
+// Run the superinstruction at context->pc with the same effect as its
+// instructions one by one. The fused path only handles integers, and
+// the stack and the CPU slice must have room for the whole sequence.
+// Otherwise nothing is changed and -EINVAL tells execute() to run the
+// first instruction on its own.
+static int8_t superop(DvmState *eventState, DvmOpcode instr, DVMBasiclib_state_t *s)
+{
+  DvmContext *context = &(eventState->context);
+  const DvmOpcode *code = eventState->code + context->pc;
+  uint8_t sp = eventState->stack.sp;
+  uint16_t left = DVM_CPU_SLICE + 1 - context->num_executed;
+  DvmStackVariable *var;
+  int16_t a, b;
+  uint8_t l1, l2;
+
+  switch (instr) {
+  case OP_SUPER_INCR:
+    {
+      var = var_slot(eventState, code[0], s);
+      if ((left < 3) || (sp >= DVM_OPDEPTH) || (var->type != DVM_TYPE_INTEGER)) return -EINVAL;
+      a = var->value.var + ((code[1] == OP_INCR)? 1 : -1);
+      var = var_slot(eventState, code[2], s);
+      var->type = DVM_TYPE_INTEGER;
+      var->value.var = a;
+      DEBUG("[BASIC_LIB] execute: (%d) SUPER INCR %d\n", context->pc, a);
+      context->num_executed += 2;
+      context->pc += 3;
+      return SOS_OK;
+    }
+  case OP_SUPER_LOADOP:
+  case OP_SUPER_UPDATE:
+    {
+      var = var_slot(eventState, code[0], s);
+      if ((left < ((instr == OP_SUPER_UPDATE)? 4 : 3)) || (sp + 2 > DVM_OPDEPTH) ||
+	  (var->type != DVM_TYPE_INTEGER)) return -EINVAL;
+      a = arith(code[3], code[2], var->value.var);
+      DEBUG("[BASIC_LIB] execute: (%d) SUPER LOADOP/UPDATE %d\n", context->pc, a);
+      if (instr == OP_SUPER_UPDATE) {
+	var = var_slot(eventState, code[4], s);
+	var->type = DVM_TYPE_INTEGER;
+	var->value.var = a;
+	context->num_executed += 3;
+	context->pc += 5;
+      } else {
+	pushValue(eventState, a, DVM_TYPE_INTEGER);
+	context->num_executed += 2;
+	context->pc += 4;
+      }
+      return SOS_OK;
+    }
+  case OP_SUPER_PUSHOP:
+    {
+      if ((left < 2) || (sp == 0) || (sp >= DVM_OPDEPTH)) return -EINVAL;
+      var = &(eventState->stack.stack[sp - 1]);
+      if (var->type != DVM_TYPE_INTEGER) return -EINVAL;
+      var->value.var = arith(code[2], code[1], var->value.var);
+      DEBUG("[BASIC_LIB] execute: (%d) SUPER PUSHOP %d\n", context->pc, var->value.var);
+      context->num_executed += 1;
+      context->pc += 3;
+      return SOS_OK;
+    }
+  case OP_SUPER_CMPJ:
+    {
+      if ((left < 3) || (sp + 2 > DVM_OPDEPTH)) return -EINVAL;
+      if ((l1 = load_int(eventState, code, &a, s)) == 0) return -EINVAL;
+      if ((l2 = load_int(eventState, code + l1, &b, s)) == 0) return -EINVAL;
+      DEBUG("[BASIC_LIB] execute: (%d) SUPER CMPJ %d %d\n", context->pc, b, a);
+      context->num_executed += 2;
+      if (compare(code[l1 + l2], b, a)) {
+	context->pc = code[l1 + l2 + 1];
+      } else {
+	context->pc += l1 + l2 + 2;
+      }
+      return SOS_OK;
+    }
+  case OP_SUPER_TESTJ:
+    {
+      if ((left < 2) || (sp >= DVM_OPDEPTH)) return -EINVAL;
+      if ((l1 = load_int(eventState, code, &a, s)) == 0) return -EINVAL;
+      DEBUG("[BASIC_LIB] execute: (%d) SUPER TESTJ %d\n", context->pc, a);
+      context->num_executed += 1;
+      if ((code[l1] == OP_JNZ)? (a != 0) : (a == 0)) {
+	context->pc = code[l1 + 1];
+      } else {
+	context->pc += l1 + 2;
+      }
+      return SOS_OK;
+    }
+  default:
+    return -EINVAL;
+  }
+}
+//--------------------------------------------------------------------------------------------  
 // The following code is used to debug the
 /*
 #ifdef OUTLIER_SCRIPT_DBG
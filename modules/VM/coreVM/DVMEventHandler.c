@@ -138,6 +138,11 @@ DvmOpcode getOpcode(dvm_state_t* dvm_st, uint8_t id, uint16_t which)
   if (s->stateBlock[id] != NULL) {
     DvmState *ds = s->stateBlock[id];
     DvmOpcode op;
+    // Fast path: the capsule was copied into RAM at install time
+    if (ds->code != NULL) {
+      if (which < ds->context.dataSize) return ds->code[which];
+      return OP_HALT;
+    }
     // get the opcode at index "which" from codemem and return it.
     // handler for codemem is in s->stateBlock[id]->script
     if(sys_codemem_read(ds->cm, &(op), sizeof(op), offsetof(DvmScript, data) + which) == SOS_OK) {
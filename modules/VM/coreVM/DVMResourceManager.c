@@ -15,6 +15,12 @@
 #include <sos_sched.h>
 #endif
 
+//----------------------------------------------------------------------------
+// STATIC FUNCTION DEFINITIONS
+//----------------------------------------------------------------------------
+static void code_cache_fill(DVMResourceManager_state_t *s, DvmState *ds);
+static void code_cache_release(DVMResourceManager_state_t *s, DvmState *ds);
+
 //----------------------------------------------------------------------------
 // HANDLER FUNCTIONS
 //----------------------------------------------------------------------------
@@ -33,6 +39,7 @@ int8_t resmanager_init(dvm_state_t* dvm_st, Message *msg)
   }
   for (i = 0; i < DVM_NUM_SCRIPT_BLOCKS; i++)
     s->script_block_owners[i] = NULL_CAPSULE;
+  s->code_cache_used = 0;
   
   DEBUG("RES MNGR: Initialized\n");
   return SOS_OK;
@@ -75,6 +82,7 @@ int8_t resmanager_loader_data_handler(dvm_state_t* dvm_st, Message *msg)
   sys_codemem_read(cm, &(ds->context.libraryMask), sizeof(ds->context.libraryMask), offsetof(DvmScript, libraryMask));
   DEBUG("RESOURCE_MANAGER: Library Mask = 0x%x, offset = %ld \n", ds->context.libraryMask, offsetof(DvmScript, libraryMask));
   ds->cm = cm;
+  code_cache_fill(&(dvm_st->resmgr_st), ds);
   initEventHandler(dvm_st, ds, id);
   return SOS_OK;
 }
@@ -104,6 +112,9 @@ DvmState *mem_allocate(dvm_state_t* dvm_st, uint8_t capsuleNum)
     }
     // If control reaches here, this means space has been successfully
     // allocated for context etc.
+  } else {
+    // Capsule is being replaced, drop the cached copy of the old version
+    code_cache_release(s, s->scripts[capsuleNum]);
   }
   memset(s->scripts[capsuleNum], 0, DVM_STATE_SIZE);
   return s->scripts[capsuleNum];
@@ -113,6 +124,8 @@ int8_t mem_free(dvm_state_t* dvm_st, uint8_t capsuleNum)
 {
   DVMResourceManager_state_t *s = &(dvm_st->resmgr_st);
   uint8_t i;
+  if (s->scripts[capsuleNum] == NULL) return SOS_OK;
+  code_cache_release(s, s->scripts[capsuleNum]);
   //Free script space
   for (i = 0; i < DVM_NUM_SCRIPT_BLOCKS; i++) {
     if (s->script_block_owners[i] == capsuleNum) {
@@ -126,3 +139,62 @@ int8_t mem_free(dvm_state_t* dvm_st, uint8_t capsuleNum)
   return SOS_OK;
 }
 //----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+//----------------------------------------------------------------------------
+// Copy the script body into RAM so that getOpcode() does not have to go
+// to codemem for every instruction. If the budget is exhausted or the
+// heap is short, ds->code stays NULL and the script runs out of codemem.
+// When there is room for it, a threaded copy for execute() is built
+// right behind the script copy.
+static void code_cache_fill(DVMResourceManager_state_t *s, DvmState *ds)
+{
+  DvmCapsuleLength len = ds->context.dataSize;
+  uint16_t size = len;
+  ds->code = NULL;
+  ds->thread = NULL;
+  if ((len == 0) || (len > DVM_MAX_SCRIPT_LENGTH) ||
+      (s->code_cache_used + len > DVM_CODE_CACHE_BUDGET)) {
+    DEBUG("RES MNGR: Capsule %d (%d bytes) not cached\n", ds->context.which, len);
+    return;
+  }
+#if DVM_THREADED_CODE
+  {
+    uint8_t options = 0;
+    sys_codemem_read(ds->cm, &options, sizeof(options), offsetof(DvmScript, options));
+    if (!(options & DVM_SCRIPT_OPT_NOFUSE) &&
+	(s->code_cache_used + 2 * len <= DVM_CODE_CACHE_BUDGET)) {
+      size = 2 * len;
+    }
+  }
+#endif
+  ds->code = (DvmOpcode *)sys_malloc(size);
+  if (ds->code == NULL) {
+    DEBUG("RES MNGR: No memory to cache capsule %d\n", ds->context.which);
+    return;
+  }
+  if (sys_codemem_read(ds->cm, ds->code, len, offsetof(DvmScript, data)) != SOS_OK) {
+    sys_free(ds->code);
+    ds->code = NULL;
+    return;
+  }
+  if (size > len) {
+    ds->thread = ds->code + len;
+    translateCapsule(ds->thread, ds->code, len);
+  }
+  s->code_cache_used += size;
+  DEBUG("RES MNGR: Capsule %d cached%s, %d of %d bytes used\n", ds->context.which,
+	(ds->thread != NULL)? " and threaded" : "", s->code_cache_used, DVM_CODE_CACHE_BUDGET);
+}
+//----------------------------------------------------------------------------
+static void code_cache_release(DVMResourceManager_state_t *s, DvmState *ds)
+{
+  if (ds->code == NULL) return;
+  sys_free(ds->code);
+  ds->code = NULL;
+  if (ds->thread != NULL) {
+    s->code_cache_used -= ds->context.dataSize;
+    ds->thread = NULL;
+  }
+  s->code_cache_used -= ds->context.dataSize;
+}
+//----------------------------------------------------------------------------
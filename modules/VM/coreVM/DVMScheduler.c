@@ -14,6 +14,14 @@
 #include <VM/dvm_types.h>
 #include <led.h>
 #include <sys_module.h>
+#if defined(DVM_PROFILE_IPS) && defined(PC_PLATFORM)
+#include <sys/time.h>
+#endif
+
+// Number of instructions between two instructions/second reports
+#ifndef DVM_PROFILE_IPS_WINDOW
+#define DVM_PROFILE_IPS_WINDOW 10000
+#endif
 
 
 typedef int8_t (*execute_lib_func_t)(func_cb_ptr cb, DvmContext* context, DvmOpcode instr);
@@ -37,6 +45,10 @@ int8_t dvmsched_init(dvm_state_t* dvm_st, Message *msg){
   s->flags.errorFlipFlop = 0;
   s->libraries = 1;	             //Basic library is already there.
   s->runningContext = NULL;
+#ifdef DVM_PROFILE_IPS
+  s->prof_instr = 0;
+  s->prof_usec = 0;
+#endif
   DEBUG("DVM ENGINE: Initialized\n");
   engineReboot(dvm_st);
   return SOS_OK;
@@ -194,6 +206,11 @@ static inline int8_t computeInstruction(dvm_state_t *dvm_st) {
       return -EINVAL;
     }
   }
+#if defined(DVM_PROFILE_IPS) && defined(PC_PLATFORM)
+  struct timeval prof_start, prof_end;
+  uint16_t prof_executed = context->num_executed;
+  gettimeofday(&prof_start, NULL);
+#endif
   while ((context->state == DVM_STATE_RUN) && (context->num_executed < DVM_CPU_SLICE)) {
     if (instr & LIB_ID_BIT) {	//Extension Library
       uint8_t library_mod = (instr ^ LIB_ID_BIT) >> EXT_LIB_OP_SHIFT;
@@ -207,6 +224,20 @@ static inline int8_t computeInstruction(dvm_state_t *dvm_st) {
     }
     instr = getOpcode(dvm_st, context->which, context->pc);
   }
+#if defined(DVM_PROFILE_IPS) && defined(PC_PLATFORM)
+  gettimeofday(&prof_end, NULL);
+  s->prof_usec += (prof_end.tv_sec - prof_start.tv_sec) * 1000000 +
+    (prof_end.tv_usec - prof_start.tv_usec);
+  if (context->num_executed > prof_executed)
+    s->prof_instr += context->num_executed - prof_executed;
+  if (s->prof_instr >= DVM_PROFILE_IPS_WINDOW) {
+    fprintf(stderr, "[DVM PROFILE] capsule %d: %u instructions in %u us (%u instr/sec)\n",
+	    context->which, s->prof_instr, s->prof_usec,
+	    (s->prof_usec > 0)? (uint32_t)(((uint64_t)s->prof_instr * 1000000) / s->prof_usec) : 0);
+    s->prof_instr = 0;
+    s->prof_usec = 0;
+  }
+#endif
   if (context->num_executed >= DVM_CPU_SLICE)
     sys_post_value(DVM_MODULE_PID, MSG_RUN_TASK, 0, 0);
   else if (context->state != DVM_STATE_RUN)
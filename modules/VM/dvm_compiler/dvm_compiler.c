@@ -20,7 +20,7 @@ typedef struct {
 	unsigned char eventType;
 	unsigned short length;
 	unsigned char libraryMask;
-	unsigned char padding;
+	unsigned char options;
 	unsigned char data[DVM_MAX_SCRIPT_LENGTH];
 } __attribute__((packed)) DvmScript;
 
@@ -179,14 +179,22 @@ char **argv;
 	int temp;
 	
 	script.libraryMask = 0;
+	script.options = 0;
 	data_ptr = script.data;	
 	i = 0;
 	inc = 1;
 	
+	if ((argc > 1) && (strcmp(argv[1], "-n") == 0)) {
+		script.options |= DVM_SCRIPT_OPT_NOFUSE;
+		argc--;
+		argv++;
+	}
+
 	if (argc < 3)
 	{
 		printf("Usage Error!\n");
-		printf("dvm_compiler <filename> <capsule name> [<event module> <event type>]\n");
+		printf("dvm_compiler [-n] <filename> <capsule name> [<event module> <event type>]\n");
+		printf("  -n  install the capsule without superinstructions\n");
 		return 1;
 	}
 
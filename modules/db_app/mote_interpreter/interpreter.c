@@ -41,12 +41,9 @@ typedef struct {
 	uint8_t num_queries;
 	query_details_t *queries[8]; // each time a query comes in, we link it into one of these pointers
 							                 // when a query finishes, the pointer is returned to being null
-	uint8_t sensor_timers[8];    // save the timer id for each sensor value we respond to
-	                             // a timer id of 0 signifies that the sensor is not involved in a query
-															 // the timer id is a combination between two indexes
-															 // the upper 4 bits is the index to the queries of this data structur
-															 // the lower 4 bits is the index to both queries, results and recieved of 
-															 // query_details_t data structure
+	uint8_t sensor_waiting[8];   // the queries waiting for a reading of each sensor, one bit per query
+	                             // all the queries on a sensor share one reading, so a sensor is
+															 // read once however many queries ask for it at the same time
 } mote_state_t;
 
 
@@ -55,6 +52,7 @@ static int8_t free_query(query_details_t* query, uint8_t q_index);
 static int8_t is_value_qualified(qualifier_t *qual, uint16_t value);
 static uint8_t perform_rel_op(bool prev, bool curr, uint8_t rel_op);
 static uint8_t execute_trigger(trigger_t *trig,uint8_t num_trigs);
+static uint8_t query_slot(query_details_t *q, uint8_t sid);
 static query_details_t* recieve_new_query(uint8_t *new_query, uint8_t msg_len);
 
 static const mod_header_t mod_header SOS_MODULE_HEADER = {
@@ -87,7 +85,7 @@ static int8_t interpreter_msg_handler(void *state, Message *msg){
 					s->num_queries = 8;
 					for (i = 0; i < 8; i++){
 						s->queries[i] = NULL;
-						s->sensor_timers[i] = 0xff;
+						s->sensor_waiting[i] = 0;
 					}
 
 					sys_timer_start(255, 1024, TIMER_ONE_SHOT);
@@ -139,17 +137,10 @@ static int8_t interpreter_msg_handler(void *state, Message *msg){
 									for (j = 0; j < query->num_queries; j++){
 										DEBUG("<INTERPRETER> adding query for sensor: %d\n", query->queries[j]);
 										if (query->queries[j] < NUM_SENSORS){
-											// test to make sure that the sensor isn't already involved in a query
-											if (s->sensor_timers[query->queries[j]] != 0xff){
-												DEBUG("<INTERPRETER> collison for query on sensor: %d\n", query->queries[j]);
-												free_query(query, i);
-												sys_led(LED_RED_TOGGLE);
-											query = NULL;
-											break;
-											}
+											// the timer id is the index of the query in the upper 4 bits
+											// and the index of the sensor in the query in the lower 4 bits
 											uint8_t tid;
 											tid = (i << 4) | j;
-											s->sensor_timers[query->queries[j]] = tid;
 											sys_timer_start(tid, query->interval, TIMER_REPEAT);
 											DEBUG("<INTERPRETER> timer id: %d for sensor %d\n", tid, j);
 										}
@@ -188,12 +179,19 @@ static int8_t interpreter_msg_handler(void *state, Message *msg){
 						sid = s->queries[q_index]->queries[s_index];
 
 						DEBUG("<INTERPRETER> getting data for sensor: %d\n", sid);
-						if (sid > NUM_SENSORS){
+						if (sid >= NUM_SENSORS){
 							// do some stuff for special ops;
 							// this shouldn't really happen anyways
+						}	else if (s->sensor_waiting[sid] != 0 && !(s->sensor_waiting[sid] & (1 << q_index))){
+							// another query is already waiting, it shares that reading
+							s->sensor_waiting[sid] |= 1 << q_index;
 						}	else{ 
+							// if this query is still waiting from its last period, that
+							// reading was lost and the sensor is asked again
+							s->sensor_waiting[sid] |= 1 << q_index;
 #ifndef SOS_SIM
-							sys_sensor_get_data(sid);
+							if (sys_sensor_get_data(sid) != SOS_OK)
+								s->sensor_waiting[sid] = 0;
 #else
 							sys_post_value(s->pid, MSG_DATA_READY, 0x00ffff00 | (sid << 24), 0);
 #endif
@@ -234,19 +232,30 @@ static int8_t interpreter_msg_handler(void *state, Message *msg){
 					DEBUG("Data Ready\nsensor = %d\nvalue = %d\n", data->sensor, data->value);
 
 					if (data->sensor < NUM_SENSORS){
-						q_index = s->sensor_timers[data->sensor] >> 4;
-						s_index = s->sensor_timers[data->sensor] & 0x0F;
+						// hand the reading to every query that waits for it
+						uint8_t waiting = s->sensor_waiting[data->sensor];
+						s->sensor_waiting[data->sensor] = 0;
 
-						DEBUG("<INTERPRETER> q_index=%d  s_index = %d\n", q_index, s_index);
-						DEBUG("<INTERPRETER> recieved=%d num_queries=%d\n", s->queries[q_index]->recieved, s->queries[q_index]->num_queries);
+						for (q_index = 0; q_index < s->num_queries; q_index++){
+							query_details_t *q = s->queries[q_index];
 
-						s->queries[q_index]->results[s_index] = data->value;
-						s->queries[q_index]->recieved++;
+							if (!(waiting & (1 << q_index)) || q == NULL)
+								continue;
+							s_index = query_slot(q, data->sensor);
+							if (s_index == q->num_queries)
+								continue;
 
-						if (s->queries[q_index]->recieved == s->queries[q_index]->num_queries){
-							sys_post_value(s->pid, MSG_VALIDATE, q_index, SOS_MSG_RELEASE); // this message will dispatch the results since we've gotten all the results
-					    s->queries[q_index]->total_samples--;
-					  }
+							DEBUG("<INTERPRETER> q_index=%d  s_index = %d\n", q_index, s_index);
+							DEBUG("<INTERPRETER> recieved=%d num_queries=%d\n", q->recieved, q->num_queries);
+
+							q->results[s_index] = data->value;
+							q->recieved++;
+
+							if (q->recieved == q->num_queries){
+								sys_post_value(s->pid, MSG_VALIDATE, q_index, SOS_MSG_RELEASE); // this message will dispatch the results since we've gotten all the results
+								q->total_samples--;
+							}
+						}
 					}
 					sys_free(data);
 				}
@@ -267,9 +276,10 @@ static int8_t interpreter_msg_handler(void *state, Message *msg){
 						bool is_prev_valid = true;
 						uint8_t rel_op;
 						for (i=0; i<q->num_qualifiers; i++){
-							uint8_t sid_index = s->sensor_timers[q->qualifiers[i].sid] & 0x0F;
+							uint8_t sid_index = query_slot(q, q->qualifiers[i].sid);
 							rel_op = q->qualifiers[i].comp_op_and_relation & 0x0F;
-							is_curr_valid = is_value_qualified(&(q->qualifiers[i]), q->results[sid_index]);
+							is_curr_valid = (sid_index < q->num_queries) &&
+								is_value_qualified(&(q->qualifiers[i]), q->results[sid_index]);
               is_prev_valid = perform_rel_op(is_prev_valid, is_curr_valid, rel_op);
 						}
 
@@ -432,7 +442,7 @@ static int8_t free_query(query_details_t* query, uint8_t q_index){
 		sys_timer_stop(tid);
 
 		if (query->queries[i] < NUM_SENSORS)
-			s->sensor_timers[query->queries[i]] = 0xff;
+			s->sensor_waiting[query->queries[i]] &= ~(1 << q_index);
 	}
 
 	sys_free(query->queries);
@@ -444,6 +454,16 @@ static int8_t free_query(query_details_t* query, uint8_t q_index){
 	return SOS_OK;
 }
 
+// index of a sensor in a query, num_queries if the query does not read it
+static uint8_t query_slot(query_details_t *q, uint8_t sid){
+	uint8_t j;
+	for (j = 0; j < q->num_queries; j++){
+		if (q->queries[j] == sid)
+			break;
+	}
+	return j;
+}
+
 static uint8_t execute_trigger(trigger_t *trig,uint8_t num_trigs){
 	int i;
 	for (i = 0; i < num_trigs; i++){
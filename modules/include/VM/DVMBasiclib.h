@@ -19,6 +19,7 @@ int8_t execute(dvm_state_t* dvm_st, DvmState* eventState);
 void rebooted(dvm_state_t* dvm_st); 
 int16_t lockNum(uint8_t instr);
 uint8_t bytelength(uint8_t opcode);
+void translateCapsule(DvmOpcode *thread, const DvmOpcode *code, DvmCapsuleLength len);
 //int8_t execute_extlib(uint8_t fnid, DvmStackVariable *arg, uint8_t size, DvmStackVariable *res);
 
 
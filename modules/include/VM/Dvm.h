@@ -151,6 +151,10 @@ typedef struct {
   DvmOperandStack stack;
   DvmStackVariable vars[DVM_NUM_LOCAL_VARS];
   codemem_t cm;                                 // the handle to codemem
+  // The two pointers cost 4 bytes per installed capsule on the motes.
+  // The copies they point to come out of DVM_CODE_CACHE_BUDGET.
+  DvmOpcode *code;                              // RAM copy of the script (NULL if read from codemem)
+  DvmOpcode *thread;                            // Threaded copy with superinstructions (or NULL)
 } DvmState;
   
 typedef struct {
@@ -179,7 +183,7 @@ typedef struct {
 	uint8_t eventType;
 	DvmCapsuleLength length;
 	uint8_t libraryMask;
-	uint8_t padding;
+	uint8_t options;                        // DVM_SCRIPT_OPT_* flags
 	uint8_t data[DVM_MAX_SCRIPT_LENGTH];
 } PACK_STRUCT DvmScript;
 
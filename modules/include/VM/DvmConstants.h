@@ -11,6 +11,20 @@
 #define EXT_LIB_OP_MASK 	0x1F
 #define EXT_LIB_OP_SHIFT 	5
 
+// Superinstructions. These codes only appear in the threaded copy of a
+// capsule built by translateCapsule(), never in the script itself. They
+// use the unassigned basic opcodes above OP_NOP.
+enum {
+  OP_SUPER_MIN		= 113,
+  OP_SUPER_INCR		= OP_SUPER_MIN + 0,	// GETx a, INCR|DECR, SETx b
+  OP_SUPER_LOADOP	= OP_SUPER_MIN + 1,	// GETx a, PUSH k, ADD|SUB|MULT
+  OP_SUPER_UPDATE	= OP_SUPER_MIN + 2,	// GETx a, PUSH k, ADD|SUB|MULT, SETx b
+  OP_SUPER_PUSHOP	= OP_SUPER_MIN + 3,	// PUSH k, ADD|SUB|MULT
+  OP_SUPER_CMPJ		= OP_SUPER_MIN + 4,	// load, load, JG|JGE|JL|JLE|JE|JNE
+  OP_SUPER_TESTJ	= OP_SUPER_MIN + 5,	// load, JZ|JNZ
+  OP_SUPER_UNDEF	= 127,			// undefined basic opcode in the script
+};
+
 enum {
   DVM_OPDEPTH      	= 8,
   DVM_BUF_LEN      	= 64, //Ram - This has to be 64 for outlier detection//32,//20
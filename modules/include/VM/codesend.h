@@ -44,6 +44,9 @@ typedef enum {
 
 #define FLOAT_PRECISION	100L
 
+// Script header options
+#define DVM_SCRIPT_OPT_NOFUSE	0x01	// do not translate into superinstructions
+
 typedef enum { // instruction set
   OP_HALT = (BASICLIB_MIN_OPCODE + 0),
   OP_PUSH = (BASICLIB_MIN_OPCODE + 1),
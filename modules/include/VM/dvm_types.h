@@ -20,10 +20,25 @@
 #define DVM_NUM_SCRIPT_BLOCKS		2
 #define DVM_DEFAULT_MEM_ALLOC_SIZE	(DVM_NUM_SCRIPT_BLOCKS*DVM_STATE_SIZE)
 
+// Total RAM (in bytes) that may be spent on decoded capsule copies.
+// Capsules that do not fit are executed straight out of codemem.
+// Build with -DDVM_CODE_CACHE_BUDGET=0 to disable the cache.
+#ifndef DVM_CODE_CACHE_BUDGET
+#define DVM_CODE_CACHE_BUDGET		(2*DVM_MAX_SCRIPT_LENGTH)
+#endif
+
+// Cached capsules are also translated into a threaded copy with fused
+// superinstructions, which takes one more byte per script byte out of
+// the budget above. Build with -DDVM_THREADED_CODE=0 to disable.
+#ifndef DVM_THREADED_CODE
+#define DVM_THREADED_CODE		1
+#endif
+
 typedef struct {
   DvmState *scripts[DVM_CAPSULE_NUM];
   uint8_t script_block_owners[DVM_NUM_SCRIPT_BLOCKS];
   DvmState *script_block_ptr;
+  uint16_t code_cache_used;
 } DVMResourceManager_state_t;
 
 typedef struct 
@@ -47,6 +62,10 @@ typedef struct {
   uint8_t taskRunning   : 1;
   uint8_t halted        : 1;
   } flags;
+#ifdef DVM_PROFILE_IPS
+  uint32_t prof_instr;            // instructions since last report
+  uint32_t prof_usec;             // interpreter time since last report
+#endif
 } DVMScheduler_state_t;
 
 typedef struct {
@@ -59,12 +59,39 @@ typedef struct {
 	uint16_t children[10];
 	uint8_t child_msg_type;
 	uint8_t curr_child;
+	uint8_t *aggr_buf;   // forwarding queue, already packed as MSG_TR_AGGR_PKT
+	uint16_t aggr_dest;  // parent the queued packets are bound for
+	uint8_t aggr_len;
+	uint8_t aggr_cnt;
 } tree_route_state_t;   
 
 //-------------------------------------------------------------
 // MODULE TIMERS
 //-------------------------------------------------------------
+enum {
+	TR_AGGR_TID        = 0,   //! Forwarding queue deadline
+};
 
+//-------------------------------------------------------------
+// FORWARDING QUEUE
+//-------------------------------------------------------------
+#ifndef TR_AGGR_DEADLINE
+#define TR_AGGR_DEADLINE   128L               //! Max. time a packet waits for company
+#endif
+#define TR_AGGR_MTU        RADIO_MAX_MSG_LEN  //! Size of an aggregated frame
+
+//-------------------------------------------------------------
+// SCHEDULER QUEUE
+//-------------------------------------------------------------
+// The module forwards the traffic of its whole subtree, so it may queue
+// and handle more messages than a leaf module.  The oldest packet is the
+// one to drop under a burst.
+#ifndef TR_MSG_QUOTA
+#define TR_MSG_QUOTA       32                 //! Max. messages waiting for the module
+#endif
+#ifndef TR_RR_WEIGHT
+#define TR_RR_WEIGHT       4                  //! Messages handled per round robin round
+#endif
 
 
 //-------------------------------------------------------------
@@ -76,6 +103,10 @@ static uint8_t tr_set_child_msg_type(func_cb_ptr p, uint8_t new_type);
 static uint32_t evaluateCost(uint8_t sendEst, uint8_t receiveEst) ;
 static void choose_parent(tree_route_state_t *s) ;
 static int8_t tr_send_data(tree_route_state_t *s, uint8_t msg_len, uint16_t saddr, tr_hdr_t* hdr);
+static int8_t tr_recv_data(tree_route_state_t *s, uint8_t msg_len, uint16_t saddr, tr_hdr_t* hdr);
+static void tr_aggr_enqueue(tree_route_state_t *s, uint8_t msg_len, tr_hdr_t* hdr);
+static void tr_aggr_flush(tree_route_state_t *s);
+static void tr_aggr_unpack(tree_route_state_t *s, uint8_t frame_len, uint16_t saddr, uint8_t *frame);
 #ifdef PC_PLATFORM
 #endif //PC_PLATFORM
 
@@ -86,7 +117,7 @@ static int8_t tr_send_data(tree_route_state_t *s, uint8_t msg_len, uint16_t sadd
 static const mod_header_t mod_header SOS_MODULE_HEADER = {
   .mod_id         =  TREE_ROUTING_PID,
   .state_size     =  sizeof(tree_route_state_t),
-  .num_timers     =  0,
+  .num_timers     =  1,
   .num_sub_func   =  0,
   .num_prov_func  =  2,
   .code_id        =  ehtons(TREE_ROUTING_PID),
@@ -124,6 +155,8 @@ static int8_t tree_routing_module(void *state, Message *msg)
 			s->children[i] = sys_id();
 	  s->curr_child = 0;
 	  s->child_msg_type = (MOD_MSG_START + 1);
+	  s->aggr_buf = NULL;
+	  sys_msg_set_quota(TR_MSG_QUOTA, SCHED_QUOTA_DROP_OLDEST, TR_RR_WEIGHT);
 
 	  if(sys_id() == BASE_STATION_ADDRESS) {
 		  s->sr.parent = sys_id();
@@ -185,22 +218,27 @@ static int8_t tree_routing_module(void *state, Message *msg)
 		// Packet was addressed to us
 		uint8_t msg_len = msg->len;
 		tr_hdr_t *hdr = (tr_hdr_t*) sys_msg_take_data(msg);
-		if(my_id == BASE_STATION_ADDRESS) {
-		  // At base station, send pkt to tree routing client
-		  DEBUG("<TR> src = %d, hop = %d\n", 
-				entohs(hdr->originaddr),
-				hdr->originhopcount);
-		  sys_post(hdr->dst_pid,
-					MSG_TR_DATA_PKT, msg_len, hdr, 	
-					SOS_MSG_RELEASE);
-		  return SOS_OK;
-		} else {
-		  // Forward the packet
-		  return tr_send_data(s, msg_len, msg->saddr, hdr);
-		}
+		return tr_recv_data(s, msg_len, msg->saddr, hdr);
 	  } 
 	  break;
 	}
+
+  case MSG_TR_AGGR_PKT:
+	{
+	  DEBUG("<TR> RECV AGGR from %d to %d\n", msg->saddr, msg->daddr);
+	  if(msg->daddr == sys_id()){
+		tr_aggr_unpack(s, msg->len, msg->saddr, msg->data);
+	  }
+	  break;
+	}
+
+  case MSG_TIMER_TIMEOUT:
+	{
+	  if(timer_get_tid(msg) == TR_AGGR_TID) {
+		tr_aggr_flush(s);
+	  }
+	  break;
+	}
   case MSG_SEND_PACKET:
 	{
 	  // Send out packet
@@ -261,6 +299,7 @@ static int8_t tree_routing_module(void *state, Message *msg)
 
   case MSG_FINAL:
 	{
+	  tr_aggr_flush(s);
 	  sys_shm_stopwait( sys_shm_name(NBHOOD_PID, SHM_NBR_LIST) );
 	  sys_shm_close( sys_shm_name(TREE_ROUTING_PID, SHM_TR_VALUE));
 	  return SOS_OK;
@@ -395,14 +434,117 @@ static int8_t tr_send_data(tree_route_state_t *s, uint8_t msg_len, uint16_t sadd
 	hdr->hopcount = s->sr.hop_count;
 
 	hdr->seqno = ehtons(s->seq_no++); 
-	sys_post_net(TREE_ROUTING_PID, 
-			 MSG_TR_DATA_PKT, msg_len, hdr,     
-			 SOS_MSG_RELEASE, s->sr.parent);
 	DEBUG("Forward data: %d <-- %d, orig(%d)\n", 
 		  s->sr.parent, sys_id(), entohs(hdr->originaddr));
+	tr_aggr_enqueue(s, msg_len, hdr);
 	return SOS_OK;		
 }
 
+static int8_t tr_recv_data(tree_route_state_t *s, uint8_t msg_len, uint16_t saddr, tr_hdr_t* hdr)
+{
+  if(hdr == NULL) return -ENOMEM;
+
+  if(sys_id() == BASE_STATION_ADDRESS) {
+	// At base station, send pkt to tree routing client
+	DEBUG("<TR> src = %d, hop = %d\n", 
+		  entohs(hdr->originaddr),
+		  hdr->originhopcount);
+	sys_post(hdr->dst_pid,
+			 MSG_TR_DATA_PKT, msg_len, hdr, 	
+			 SOS_MSG_RELEASE);
+	return SOS_OK;
+  }
+  // Forward the packet
+  return tr_send_data(s, msg_len, saddr, hdr);
+}
+
+/**
+ * Queue a packet for the parent.  Packets are copied straight into the
+ * frame that will go on the air, which is sent once it is full or when
+ * the oldest packet in it has waited TR_AGGR_DEADLINE.
+ */
+static void tr_aggr_enqueue(tree_route_state_t *s, uint8_t msg_len, tr_hdr_t* hdr)
+{
+#ifndef TR_NO_AGGREGATION
+  if((s->aggr_buf != NULL) &&
+	 ((s->aggr_dest != s->sr.parent) || 
+	  (s->aggr_len + 1 + msg_len > TR_AGGR_MTU))) {
+	// Parent changed or no room left
+	tr_aggr_flush(s);
+  }
+  if((s->aggr_buf == NULL) && (msg_len < TR_AGGR_MTU)) {
+	s->aggr_buf = (uint8_t*) sys_malloc(TR_AGGR_MTU);
+	if(s->aggr_buf != NULL) {
+	  s->aggr_dest = s->sr.parent;
+	  s->aggr_len = 0;
+	  s->aggr_cnt = 0;
+	  sys_timer_start(TR_AGGR_TID, TR_AGGR_DEADLINE, TIMER_ONE_SHOT);
+	}
+  }
+  if(s->aggr_buf != NULL) {
+	s->aggr_buf[s->aggr_len++] = msg_len;
+	memcpy(s->aggr_buf + s->aggr_len, hdr, msg_len);
+	s->aggr_len += msg_len;
+	s->aggr_cnt++;
+	sys_free(hdr);
+	if(s->aggr_len + 1 + sizeof(tr_hdr_t) > TR_AGGR_MTU) {
+	  // Nothing else fits
+	  tr_aggr_flush(s);
+	}
+	return;
+  }
+#endif
+  // Too large to share a frame, or no memory for the queue
+  sys_post_net(TREE_ROUTING_PID, 
+			   MSG_TR_DATA_PKT, msg_len, hdr,     
+			   SOS_MSG_RELEASE, s->sr.parent);
+}
+
+static void tr_aggr_flush(tree_route_state_t *s)
+{
+  uint8_t *frame = s->aggr_buf;
+
+  if(frame == NULL) return;
+  s->aggr_buf = NULL;
+  sys_timer_stop(TR_AGGR_TID);
+
+  if(s->aggr_cnt == 1) {
+	// A lone packet goes out in its plain form
+	uint8_t msg_len = frame[0];
+	memmove(frame, frame + 1, msg_len);
+	sys_post_net(TREE_ROUTING_PID, 
+				 MSG_TR_DATA_PKT, msg_len, frame,     
+				 SOS_MSG_RELEASE, s->aggr_dest);
+	return;
+  }
+  DEBUG("<TR> Flush %d packets (%d bytes) to %d\n", 
+		s->aggr_cnt, s->aggr_len, s->aggr_dest);
+  sys_post_net(TREE_ROUTING_PID, 
+			   MSG_TR_AGGR_PKT, s->aggr_len, frame,     
+			   SOS_MSG_RELEASE, s->aggr_dest);
+}
+
+static void tr_aggr_unpack(tree_route_state_t *s, uint8_t frame_len, uint16_t saddr, uint8_t *frame)
+{
+  uint8_t off = 0;
+
+  while(off < frame_len) {
+	uint8_t msg_len = frame[off++];
+	tr_hdr_t *hdr;
+
+	if((msg_len < sizeof(tr_hdr_t)) || (msg_len > frame_len - off)) {
+	  DEBUG("<TR> Malformed aggregate from %d\n", saddr);
+	  return;
+	}
+	hdr = (tr_hdr_t*) sys_malloc(msg_len);
+	if(hdr != NULL) {
+	  memcpy(hdr, frame + off, msg_len);
+	  tr_recv_data(s, msg_len, saddr, hdr);
+	}
+	off += msg_len;
+  }
+}
+
 // Dynamic function that will actually route the message
 /*
 static int8_t tree_route_msg(char* proto, sos_pid_t did, uint8_t length, void* data)
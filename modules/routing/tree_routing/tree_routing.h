@@ -24,6 +24,13 @@ enum {
    MSG_NEW_CHILD,
    MSG_SEND_TO_CHILDREN,
 			MSG_REMOVE_CHILD,
+   /**
+    * Several data packets bound for the sink in one frame, packed back to
+    * back.  Every record is one length byte followed by the packet itself
+    * (tr_hdr_t and data).  The parent unpacks the records and routes each
+    * one as if it had arrived in its own MSG_TR_DATA_PKT.
+    */
+   MSG_TR_AGGR_PKT,
 };
 
 //-------------------------------------------------------------
@@ -0,0 +1,165 @@
+/* -*- Mode: C; tab-width:2 -*- */
+/* ex: set ts=2 shiftwidth=2 softtabstop=2 cindent: */
+
+#include <sys_module.h>
+#include <string.h>
+
+#define LED_DEBUG
+#include <led_dbg.h>
+
+#define TEST_PID DFLT_APP_ID0
+
+/* messages exchanged with uart_throughput.py
+ * MSG_TEST_DATA   payload with a pattern, in both directions
+ * MSG_TEST_BURST  from the PC, asks for a burst of MSG_TEST_DATA
+ * MSG_TEST_REPORT from the PC asks for the receive counters, the module answers with the same type
+ */
+#define MSG_TEST_DATA   (MOD_MSG_START + 1)
+#define MSG_TEST_BURST  (MOD_MSG_START + 2)
+#define MSG_TEST_REPORT (MOD_MSG_START + 3)
+
+/* messages of a burst in flight at once */
+#define TEST_WINDOW 4
+
+typedef struct {
+	uint16_t count;     //!< messages in the burst
+	uint8_t len;        //!< payload length
+} PACK_STRUCT burst_msg_t;
+
+typedef struct {
+	uint16_t msgs;      //!< MSG_TEST_DATA received since the last report
+	uint16_t errors;    //!< of which had a bad pattern
+	uint32_t bytes;     //!< payload bytes received
+} PACK_STRUCT report_msg_t;
+
+typedef struct {
+	report_msg_t rx;
+	uint16_t tx_seq;    //!< next message of the burst
+	uint16_t tx_count;  //!< messages in the burst
+	uint8_t tx_len;
+} app_state_t;
+
+static int8_t uart_throughput_msg_handler(void *state, Message *msg);
+
+static const mod_header_t mod_header SOS_MODULE_HEADER = {
+	.mod_id         = TEST_PID,
+	.state_size     = sizeof(app_state_t),
+	.num_timers     = 0,
+	.num_sub_func   = 0,
+	.num_prov_func  = 0,
+	.platform_type = HW_TYPE,
+	.processor_type = MCU_TYPE,
+	.code_id = ehtons(TEST_PID),
+	.module_handler = uart_throughput_msg_handler,
+};
+
+/* byte i of message seq is (seq + i), the first two bytes are seq itself */
+static void send_next(app_state_t *s)
+{
+	uint8_t *d;
+	uint8_t i;
+
+	if (s->tx_seq == s->tx_count) {
+		return;
+	}
+	d = (uint8_t *) sys_malloc(s->tx_len);
+	if (d == NULL) {
+		return;
+	}
+	d[0] = (uint8_t) s->tx_seq;
+	d[1] = (uint8_t) (s->tx_seq >> 8);
+	for (i = 2; i < s->tx_len; i++) {
+		d[i] = (uint8_t) (s->tx_seq + i);
+	}
+	if (sys_post_uart(TEST_PID, MSG_TEST_DATA, s->tx_len, d,
+				SOS_MSG_RELEASE | SOS_MSG_RELIABLE, BCAST_ADDRESS) == SOS_OK) {
+		s->tx_seq++;
+	}
+}
+
+static int8_t uart_throughput_msg_handler(void *state, Message *msg)
+{
+	app_state_t *s = (app_state_t *) state;
+
+	switch ( msg->type ) {
+
+		case MSG_INIT:
+			sys_led(LED_GREEN_OFF);
+			sys_led(LED_YELLOW_OFF);
+			sys_led(LED_RED_OFF);
+			memset(s, 0, sizeof(app_state_t));
+			break;
+
+		case MSG_FINAL:
+			break;
+
+		case MSG_TEST_DATA:
+			{
+				uint16_t seq;
+				uint8_t i;
+
+				s->rx.msgs++;
+				s->rx.bytes += msg->len;
+				if (msg->len < 2) {
+					s->rx.errors++;
+					break;
+				}
+				seq = msg->data[0] | ((uint16_t) msg->data[1] << 8);
+				for (i = 2; i < msg->len; i++) {
+					if (msg->data[i] != (uint8_t) (seq + i)) {
+						s->rx.errors++;
+						break;
+					}
+				}
+				LED_DBG(LED_YELLOW_TOGGLE);
+			}
+			break;
+
+		case MSG_TEST_REPORT:
+			{
+				report_msg_t *r = (report_msg_t *) sys_malloc(sizeof(report_msg_t));
+
+				if (r == NULL) {
+					return -ENOMEM;
+				}
+				memcpy(r, &s->rx, sizeof(report_msg_t));
+				memset(&s->rx, 0, sizeof(report_msg_t));
+				sys_post_uart(TEST_PID, MSG_TEST_REPORT, sizeof(report_msg_t), r,
+						SOS_MSG_RELEASE, BCAST_ADDRESS);
+			}
+			break;
+
+		case MSG_TEST_BURST:
+			{
+				burst_msg_t *b = (burst_msg_t *) msg->data;
+				uint8_t i;
+
+				if (msg->len < sizeof(burst_msg_t) || b->len < 2) {
+					return -EINVAL;
+				}
+				s->tx_seq = 0;
+				s->tx_count = b->count;
+				s->tx_len = b->len;
+				for (i = 0; i < TEST_WINDOW; i++) {
+					send_next(s);
+				}
+			}
+			break;
+
+		case MSG_PKT_SENDDONE:
+			LED_DBG(LED_GREEN_TOGGLE);
+			send_next(s);
+			break;
+
+		default:
+			return -EINVAL;
+			break;
+	}
+	return SOS_OK;
+}
+
+#ifndef _MODULE_
+mod_header_ptr uart_throughput_get_header() {
+	return sos_get_header_address(mod_header);
+}
+#endif
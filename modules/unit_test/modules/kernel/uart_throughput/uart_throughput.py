@@ -0,0 +1,76 @@
+
+import sys
+import time
+import pysos
+
+# these have to match uart_throughput.c
+TEST_MODULE = 0x80
+MSG_TEST_DATA = 33
+MSG_TEST_BURST = 34
+MSG_TEST_REPORT = 35
+
+NUM_MSGS = 1000
+PAYLOAD_LEN = 64
+TIMEOUT = 60.0
+
+def payload(seq, length):
+    """ byte i of message seq is (seq + i), the first two bytes are seq itself """
+    data = pysos.pack('<H', seq)
+    for i in range(2, length):
+        data += chr((seq + i) & 0xff)
+    return data
+
+def check(msg):
+    data = msg['data']
+    if len(data) < 2:
+        return False
+    (seq,) = pysos.unpack('<H', data[0:2])
+    return data == payload(seq, len(data))
+
+def rate(num, length, secs):
+    return "%d messages of %d bytes in %.3f s, %.1f msgs/s, %.1f kB/s" % \
+        (num, length, secs, num / secs, num * length / secs / 1024.0)
+
+if __name__ == "__main__":
+
+    if len(sys.argv) > 1:
+        NUM_MSGS = int(sys.argv[1])
+    if len(sys.argv) > 2:
+        PAYLOAD_LEN = int(sys.argv[2])
+
+    srv = pysos.sossrv()
+    failed = False
+
+    # PC -> node: send the messages, the report comes back after the last one
+    start = time.time()
+    for seq in range(NUM_MSGS):
+        srv.post(did=TEST_MODULE, type=MSG_TEST_DATA, data=payload(seq, PAYLOAD_LEN))
+    reply = srv.post_rpc(did=TEST_MODULE, type=MSG_TEST_REPORT, rsid=TEST_MODULE,
+                         rtype=MSG_TEST_REPORT, timeout=TIMEOUT)
+    secs = time.time() - start
+    if not reply:
+        print "no report from the node"
+        sys.exit(1)
+    (msgs, errors, nbytes) = pysos.unpack('<HHL', reply[0]['data'])
+    print "receive:", rate(msgs, PAYLOAD_LEN, secs)
+    if msgs != NUM_MSGS or errors != 0:
+        print "node got %d of %d messages, %d bad" % (msgs, NUM_MSGS, errors)
+        failed = True
+
+    # node -> PC: ask for a burst and time it
+    start = time.time()
+    msgs = srv.post_rpc(did=TEST_MODULE, type=MSG_TEST_BURST,
+                        data=pysos.pack('<HB', NUM_MSGS, PAYLOAD_LEN),
+                        rsid=TEST_MODULE, rtype=MSG_TEST_DATA,
+                        nreplies=NUM_MSGS, timeout=TIMEOUT)
+    secs = time.time() - start
+    bad = len([m for m in msgs if not check(m)])
+    print "send:   ", rate(len(msgs), PAYLOAD_LEN, secs)
+    if len(msgs) != NUM_MSGS or bad != 0:
+        print "got %d of %d messages, %d bad" % (len(msgs), NUM_MSGS, bad)
+        failed = True
+
+    srv.disconnect()
+    if failed:
+        sys.exit(1)
+    print "test passed"
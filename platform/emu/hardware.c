@@ -68,6 +68,7 @@ void hardware_exit( int code )
 		in_exit = true;
 		//printf("Terminating Raio...\n");
 		radio_final();
+		exflash_terminate();
 		//printf("Terminating Timer...\n");
 		timer_hardware_terminate();
 		//printf("Terminating User thread\n");
@@ -135,7 +135,7 @@ static void recv_thread(int fd)
 		if( recv_msg ) {
 			memcpy(recv_msg, &recv_hdr, SOS_MSG_HEADER_SIZE);
 			if(recv_hdr.len != 0) {
-				recv_msg->data = ker_malloc(recv_hdr.len, RADIO_PID);
+				recv_msg->data = msg_payload_alloc(recv_hdr.len, RADIO_PID);
 				if(recv_msg->data != NULL) {
 					recv_msg->flag = SOS_MSG_RELEASE;
 					if(read(sock_to_sossrv, (void*)&(recv_msg->data[0]), recv_hdr.len) != recv_hdr.len) {
@@ -51,6 +51,7 @@
 #include <timestamp.h>
 #include <sos_info.h>
 #include <message.h>
+#include <message_queue.h>
 #include <string.h> // for memcpy
 #include "cc1k_lpl.h"
 #include "crc.h"
@@ -886,7 +887,7 @@ int8_t cc1k_radio_spi_interrupt(uint8_t data_in){
 			  RadioState = IDLE_STATE;
 			  return SOS_OK;
 			}			  
-			rxmsg->data = ker_malloc(rxmsg->len, RADIO_PID);
+			rxmsg->data = msg_payload_alloc(rxmsg->len, RADIO_PID);
 			if (rxmsg->data == NULL){
 			  //! There is no memory to receive the packet anyway so dump it !!
 			  RadioState = IDLE_STATE;
@@ -994,7 +994,7 @@ int8_t cc1k_radio_spi_interrupt(uint8_t data_in){
 			  RadioState = IDLE_STATE;
 			  return SOS_OK;
 			}			  
-			rxmsg->data = ker_malloc(rxmsg->len, RADIO_PID);
+			rxmsg->data = msg_payload_alloc(rxmsg->len, RADIO_PID);
 			if (rxmsg->data == NULL){
 			  //! There is no memory to receive the packet anyway so dump it !!
 			  RadioState = IDLE_STATE;
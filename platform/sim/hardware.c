@@ -19,6 +19,7 @@
 #include <kertable_proc.h>
 #include <uart_hal.h>
 #include <server.h>
+#include <vtime.h>
 
 #if defined(PROC_KER_TABLE) && defined(PLAT_KER_TABLE)
 void* ker_jumptable[128] =
@@ -77,6 +78,7 @@ void hardware_exit( int code )
 		radio_final();
 		//printf("Terminating UART...\n");
 		uart_hardware_terminate();
+		exflash_terminate();
 		//printf("Terminating Timer...\n");
 		timer_hardware_terminate();
 		exit( code );
@@ -125,6 +127,8 @@ void sig_handler(int sig)
     }
 }
 
+// the multi-node simulator has its own main() in simnet.c
+#ifndef SIM_MULTINODE
 static void userThread(int fd)
 {
     char user_input[255];
@@ -273,6 +277,9 @@ static void print_help()
     printf(" --gps_loc.y.sec <gps y sec>    Set node gps y seconds\n");
     printf(" --gps_loc.z <gps z location>   Set node gps z location\n");
     printf(" --gps_loc.unit <gps unit>      Set node gps units\n");
+    printf(" --vtime <seed>                 Run in virtual time with random seed\n");
+    printf(" --stop_time <seconds>          Exit at this virtual time\n");
+    printf(" --exflash <dir>                Keep the external flash in <dir>/exflash_<node>.img\n");
 }
 
 static void debug_socket_init(void)
@@ -331,6 +338,9 @@ static struct option long_options[] = {
     {"gps_loc.y.sec", 1, 0, 0},
     {"gps_loc.unit", 1, 0, 0},
     {"gps_loc.z", 1, 0, 0},
+    {"vtime", 1, 0, 0},
+    {"stop_time", 1, 0, 0},
+    {"exflash", 1, 0, 0},
     {0, 0, 0, 0},
 };
 
@@ -338,6 +348,9 @@ static struct option long_options[] = {
 int main(int argc, char **argv)
 {
 	int ch;
+	bool use_vtime = false;
+	uint32_t vtime_seed = 0;
+	vtime_t stop_time = VTIME_NEVER;
 	if(signal(SIGTERM, sig_handler) == SIG_ERR){
 		fprintf(stderr, "ignore SIGTERM failed\n");
 		exit(1);
@@ -420,6 +433,16 @@ int main(int argc, char **argv)
                 }else if(long_opt_is("gps_loc.z")){
                     gps_loc.z = atoi(optarg);
                     printf("gps_loc.z = %d\n",gps_loc.z);
+                }else if(long_opt_is("vtime")){
+                    use_vtime = true;
+                    vtime_seed = strtoul(optarg, NULL, 0);
+                    printf("vtime seed = %u\n",vtime_seed);
+                }else if(long_opt_is("stop_time")){
+                    stop_time = (vtime_t)(atof(optarg) * 1000000);
+                    printf("stop_time = %s s\n",optarg);
+                }else if(long_opt_is("exflash")){
+                    exflash_dir = optarg;
+                    printf("exflash = %s\n",optarg);
                 }
                 break;
             case '?': case 'h':
@@ -453,12 +476,16 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 #endif
+	if(use_vtime) {
+		vtime_init(vtime_seed, stop_time);
+	}
     debug_socket_init();
 	sim_radio_init();
 
 	sos_main(SOS_BOOT_NORMAL);
 	return 0;
 }
+#endif // SIM_MULTINODE
 
 void msg_header_out(uint8_t *prefix, Message *m)
 {
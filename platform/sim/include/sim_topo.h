@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+#ifndef _SIM_TOPO_H
+#define _SIM_TOPO_H
+
+#include <sos_types.h>
+#include <sos_info.h>
+
+/**
+ * @brief topology of the simulated network
+ *
+ * A topology is read either from the text format of topo.def
+ *
+ *   <number of nodes>
+ *   <id> <unit> <x> <y> <z> <r2>      (one line per node, '#' for comments)
+ *
+ * or from the binary format written by topo2bin.py, which is meant for
+ * large networks.  All binary fields are little endian:
+ *
+ *   "SOST" <version:u16> <reserved:u16> <number of nodes:u32>
+ *   <id:u16> <unit:i16> <x:i16> <y:i16> <z:i16> <r2:u32>   (14 bytes per node)
+ *
+ * Node ids are the 16 bit addresses of Message.saddr and daddr, so a
+ * topology holds at most SIM_TOPO_MAX_NODES nodes with ids below
+ * BCAST_ADDRESS.  Larger topologies are rejected.
+ *
+ * Node j hears node i if ker_loc_r2() between them is at most the r2 of
+ * node i.  The neighbor lists are computed once at load time with a
+ * uniform grid, so the cost of sending a frame is proportional to the
+ * number of nodes that hear it.
+ */
+
+#define SIM_TOPO_MAGIC      "SOST"
+#define SIM_TOPO_VERSION    1
+#define SIM_TOPO_MAX_NODES  BCAST_ADDRESS
+
+typedef struct {
+	uint16_t id;
+	node_loc_t loc;
+	uint32_t r2;
+	uint32_t first_nbr;      //!< index of the first link in sim_topo_t.nbr
+	uint32_t num_nbr;        //!< number of nodes that hear this node
+} sim_topo_node_t;
+
+typedef struct {
+	uint32_t num_nodes;
+	sim_topo_node_t *nodes;
+	uint32_t *nbr;           //!< node positions of all the links
+	uint8_t *nbr_succ;       //!< success rate of each link, in percent
+	int32_t *index;          //!< node id to position, -1 if not in the topology
+} sim_topo_t;
+
+/**
+ * @brief load a topology file and compute the neighbor lists
+ * @param succ_rate  success rate given to every link, in percent
+ * @return SOS_OK, or -EINVAL / -ENOMEM after printing the reason
+ */
+extern int8_t sim_topo_load(sim_topo_t *t, const char *file, uint8_t succ_rate);
+
+/**
+ * @brief position of a node in the topology, -1 if it is not there
+ */
+static inline int32_t sim_topo_find(sim_topo_t *t, uint16_t id)
+{
+	return t->index[id];
+}
+
+#endif // _SIM_TOPO_H
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+#ifndef _SIMNET_H
+#define _SIMNET_H
+
+#include <sos_types.h>
+#include <vtime.h>
+
+/**
+ * @brief Multi-node simulator
+ *
+ * With SIM_MULTINODE the sim platform runs every node of the topology
+ * inside one executable.  The writable data of the kernel and the
+ * statically linked modules is collected into one region by simnet.ld.
+ * Each node owns a copy of that region and its own stack.  When a node
+ * becomes idle its region is swapped for the next node's.
+ *
+ * Nodes are split across worker processes that advance in lockstep
+ * windows of SIMNET_LOOKAHEAD microseconds of virtual time.  A packet
+ * always takes at least that long on the air, so anything sent inside
+ * a window is delivered after the window ends.  Within a window the
+ * nodes are independent of each other.
+ */
+
+//! air time of one byte (mica2 radio at 19.2 kbps)
+#define SIMNET_BYTE_US        416
+//! preamble, sync and CRC bytes sent with every packet
+#define SIMNET_PKT_OVERHEAD   18
+//! smallest delay between a send and its delivery (us)
+#define SIMNET_LOOKAHEAD      ((vtime_t)SIMNET_PKT_OVERHEAD * SIMNET_BYTE_US)
+
+/**
+ * @brief radio frame waiting for delivery
+ */
+typedef struct simnet_pkt {
+	struct simnet_pkt *next;
+	vtime_t stamp;      //!< delivery time
+	uint32_t seq;       //!< sequence number of the sender
+	uint16_t src;       //!< address of the sender
+	uint16_t len;       //!< size of data
+	uint8_t data[];     //!< message header followed by the payload
+} simnet_pkt_t;
+
+/**
+ * @brief broadcast a radio frame from the current node
+ * @param buf    message header followed by the payload
+ * @param len    size of buf
+ * @param daddr  link layer destination
+ * @param stamp  delivery time, at least SIMNET_LOOKAHEAD from now
+ * @param seq    per node sequence number
+ * @return true if a node with address daddr received the frame
+ */
+extern bool simnet_send(const uint8_t *buf, uint16_t len, uint16_t daddr,
+		vtime_t stamp, uint32_t seq);
+
+/**
+ * @brief end of the window the current node is allowed to run in
+ */
+extern vtime_t simnet_horizon(void);
+
+/**
+ * @brief hand control back to the worker until the next window
+ */
+extern void simnet_yield(vtime_t next);
+
+/**
+ * @brief hand a frame to the network stack of the current node
+ *
+ * Implemented by simnet_radio.c.  The frame is freed afterwards.
+ */
+extern void simnet_radio_deliver(void *pkt);
+
+#endif // _SIMNET_H
@@ -53,6 +53,8 @@
 #include <message_queue.h>
 #include <net_stack.h>
 #include <sos_info.h>
+#include <vtime.h>
+#include <sim_topo.h>
 
 #include "radio.h"
 
@@ -63,12 +65,29 @@
 
 
 #define MAXLENHOSTNAME	   256
-#define LINE_BUF_SIZE      255
 #define TOPO_TYPE_SELF     1
 #define TOPO_TYPE_NEIGHBOR 2
 #define TOPO_TYPE_OTHER    3
 #define NUM_SENDDONES_MSG        512
 
+/**
+ * @brief virtual time radio model
+ *
+ * In virtual time every datagram carries the time at which it is delivered
+ * and a promise that the sender will not send anything earlier than that.
+ * A node only runs events that are earlier than the smallest promise of
+ * the nodes that can reach it, which keeps all nodes causally consistent
+ * (conservative synchronization with null messages).
+ */
+//! air time of one byte (mica2 radio at 19.2 kbps)
+#define SIM_VTIME_BYTE_US        416
+//! preamble, sync and CRC bytes sent with every packet
+#define SIM_VTIME_PKT_OVERHEAD   18
+//! smallest delay between send and delivery
+#define SIM_VTIME_LOOKAHEAD      (SIM_VTIME_PKT_OVERHEAD * SIM_VTIME_BYTE_US)
+//! advertise our progress whenever the clock moved this far (us)
+#define SIM_VTIME_NULL_QUANTUM   100000
+
 //! this is defined in hardware.c
 extern char *topofile;
 extern uint16_t radio_pkt_success_rate;
@@ -83,11 +102,29 @@ typedef struct Topology{
     unsigned int r2;
 	int type;
 	double succ_rate;
+	bool in_neighbor;  // this node can reach us
+	vtime_t promise;   // virtual time this node has promised to reach
 } Topology;
 
+typedef struct {
+	vtime_t stamp;     //!< delivery time, VTIME_NEVER if there is no packet
+	vtime_t promise;   //!< sender sends nothing stamped earlier than this
+	uint32_t seq;
+	uint16_t src;
+} sim_vtime_hdr_t;
+
+typedef struct {
+	int cnt;
+	uint8_t data[];
+} sim_vtime_pkt_t;
+
 static Topology topo_self;
 static Topology *topo_array;
 static int totalNodes = 0;             // total number of nodes in topofile
+static sim_topo_t topo;                // neighbor lists of all the nodes
+static sim_topo_node_t *topo_node;     // our entry in topo
+static uint32_t *in_nbr;               // nodes that can reach us
+static uint32_t num_in_nbr = 0;
 static struct sockaddr_in	sockaddr;
 
 /**
@@ -105,6 +142,9 @@ static int get_sin_port(int16_t id);
 static mq_t      senddoneq;
 static bool senddone_callback_requested = false;
 
+static uint32_t vtime_tx_seq = 0;
+static vtime_t vtime_promised = 0;  //!< last promise sent to the neighbors
+
 /**
  * @brief receiver state
  */
@@ -133,6 +173,16 @@ static void handle_senddone( void )
 	senddone_callback_requested = false;
 }
 
+static void radio_vtime_senddone(void *arg)
+{
+	handle_senddone();
+}
+
+static vtime_t radio_vtime_airtime(uint8_t len)
+{
+	return (vtime_t)(SIM_VTIME_PKT_OVERHEAD + SOS_MSG_HEADER_SIZE + len) * SIM_VTIME_BYTE_US;
+}
+
 /**
  * @brief allocate send buffer
  */
@@ -171,7 +221,19 @@ void radio_msg_alloc(Message *m)
 		// always broadcast
 		uint8_t send_buf[SEND_BUF_SIZE];
 		int k = 0;
+		vtime_t done_time = 0;
 		DEBUG("sim: send_thread %d\n",radio_pkt_success_rate);
+		if( vtime_enabled ) {
+			sim_vtime_hdr_t *hdr = (sim_vtime_hdr_t*)send_buf;
+			vtime_t now = vtime_now();
+			done_time = now + radio_vtime_airtime(txmsgptr->len);
+			hdr->stamp = (done_time > vtime_promised)? done_time : vtime_promised;
+			hdr->promise = (now + SIM_VTIME_LOOKAHEAD > vtime_promised)?
+				now + SIM_VTIME_LOOKAHEAD : vtime_promised;
+			hdr->seq = vtime_tx_seq++;
+			hdr->src = ker_id();
+			k = sizeof(sim_vtime_hdr_t);
+		}
 		for(i = 0; i < SOS_MSG_HEADER_SIZE; i++, k++) {
 			send_buf[k] = *(((uint8_t*)txmsgptr) + i);
 		}
@@ -179,27 +241,28 @@ void radio_msg_alloc(Message *m)
 			send_buf[k] = txmsgptr->data[i];
 		}
 
-		DEBUG("totalNodes = %d\n", totalNodes);
-		for(i = 0; i < totalNodes; i++){
-			if(topo_array[i].type == TOPO_TYPE_NEIGHBOR){
+		DEBUG("neighbors = %d\n", topo_node->num_nbr);
+		for(i = 0; i < topo_node->num_nbr; i++){
+			uint32_t e = topo_node->first_nbr + i;
+			Topology *nb = &topo_array[topo.nbr[e]];
+			if(topo.nbr_succ[e] < 100){
 				int r;
 				r = (int) (100.0*rand()/RAND_MAX);
-				if(r <= radio_pkt_success_rate){
-					if((txmsgptr->daddr == topo_array[i].id) ||
-							(txmsgptr->daddr == BCAST_ADDRESS))
-						succ = true;
-					name.sin_port = htons( get_sin_port(topo_array[i].id) );
-					DEBUG("sim: sending to topo_array[%d].id = %d\n",i,topo_array[i].id);
-					bytes_sent = sendto(sock, send_buf, k, 0,
-							(struct sockaddr *)&name,
-							sizeof(struct sockaddr_in));
-					if (bytes_sent < 0) {
-						DEBUG("Radio: Error Sending Packet ! \n");
-					}
-					else {
-						DEBUG("Radio: Sent %d bytes to port %d\n", bytes_sent, ntohs(name.sin_port));
-					}
-				}
+				if(r > topo.nbr_succ[e]) continue;
+			}
+			if((txmsgptr->daddr == nb->id) ||
+					(txmsgptr->daddr == BCAST_ADDRESS))
+				succ = true;
+			name.sin_port = htons( get_sin_port(nb->id) );
+			DEBUG("sim: sending to %d\n",nb->id);
+			bytes_sent = sendto(sock, send_buf, k, 0,
+					(struct sockaddr *)&name,
+					sizeof(struct sockaddr_in));
+			if (bytes_sent < 0) {
+				DEBUG("Radio: Error Sending Packet ! \n");
+			}
+			else {
+				DEBUG("Radio: Sent %d bytes to port %d\n", bytes_sent, ntohs(name.sin_port));
 			}
 		}
 		if(bTsEnable) {
@@ -212,7 +275,11 @@ void radio_msg_alloc(Message *m)
 		mq_enqueue( &senddoneq, txmsgptr );
 
 		if( senddone_callback_requested == false ) {
-			interrupt_add_callbacks(handle_senddone);
+			if( vtime_enabled ) {
+				vtime_schedule(done_time, radio_vtime_senddone, NULL);
+			} else {
+				interrupt_add_callbacks(handle_senddone);
+			}
 			senddone_callback_requested = true;
 		}
 	}
@@ -250,12 +317,8 @@ static void print_nodes()
 
 static int getj(int16_t id)
 {
-	int myj;
-	for(myj = 0; myj < totalNodes; myj++){
-		if(topo_array[myj].id == id)
-			break;
-	}
-	if( myj == totalNodes ){
+	int myj = sim_topo_find(&topo, id);
+	if( myj < 0 ){
 		fprintf(stderr, "myj is not found\n");
 		fprintf(stderr, "nid = %d\n", id);
 		print_nodes();
@@ -263,6 +326,96 @@ static int getj(int16_t id)
 	}
 	return myj;
 }
+/**
+ * @brief hand a received packet to the network stack
+ */
+static void radio_deliver(uint8_t *read_buf, int cnt)
+{
+	Message *recv_msg = NULL;
+
+	if(cnt < SOS_MSG_HEADER_SIZE) {
+		DEBUG("Radio: get incomplete header\n");
+		//! something is wrong...
+		return;
+	}
+	if((((Message*)read_buf)->len) != (cnt - SOS_MSG_HEADER_SIZE)) {
+		DEBUG("Radio: invalid data payload size\n");
+		return;
+	}
+	recv_msg = msg_create();
+	if(recv_msg == NULL) {
+		DEBUG("Radio: no message header\n");
+		return;
+	}
+	memcpy(recv_msg, read_buf, SOS_MSG_HEADER_SIZE);
+
+	if(recv_msg->len != 0) {
+		recv_msg->data = msg_payload_alloc(recv_msg->len, RADIO_PID);
+		if(recv_msg->data != NULL) {
+			recv_msg->flag = SOS_MSG_RELEASE;
+			memcpy(recv_msg->data, read_buf + SOS_MSG_HEADER_SIZE, recv_msg->len);
+			if(recv_msg->type == MSG_TIMESTAMP)
+			{
+				uint32_t timestamp = ker_systime32();
+				memcpy(&recv_msg->data[4], (uint8_t *)(&timestamp), sizeof(uint32_t));
+			}
+
+			if(bTsEnable) {
+				timestamp_incoming(recv_msg, ker_systime32());
+			}
+			DEBUG("handle incoming msg \n");
+			handle_incoming_msg(recv_msg, SOS_MSG_RADIO_IO);
+		} else {
+			msg_dispose(recv_msg);
+		}
+	} else {
+		recv_msg->data = NULL;
+		recv_msg->flag = 0;
+		if(bTsEnable) {
+			timestamp_incoming(recv_msg, ker_systime32());
+		}
+		handle_incoming_msg(recv_msg, SOS_MSG_RADIO_IO);
+	}
+}
+
+static void radio_vtime_deliver(void *arg)
+{
+	sim_vtime_pkt_t *pkt = (sim_vtime_pkt_t*)arg;
+	radio_deliver(pkt->data, pkt->cnt);
+	free(pkt);
+}
+
+/**
+ * @brief record the promise of a neighbor and queue its packet
+ */
+static void radio_vtime_receive(uint8_t *read_buf, int cnt)
+{
+	sim_vtime_hdr_t *hdr = (sim_vtime_hdr_t*)read_buf;
+	sim_vtime_pkt_t *pkt;
+	int j;
+
+	if(cnt < (int)sizeof(sim_vtime_hdr_t)) {
+		DEBUG("Radio: get incomplete virtual time header\n");
+		return;
+	}
+	j = getj(hdr->src);
+	if(hdr->promise > topo_array[j].promise) {
+		topo_array[j].promise = hdr->promise;
+	}
+	if(hdr->stamp == VTIME_NEVER) {
+		return;
+	}
+	cnt -= sizeof(sim_vtime_hdr_t);
+	pkt = (sim_vtime_pkt_t*)malloc(sizeof(sim_vtime_pkt_t) + cnt);
+	if(pkt == NULL) {
+		DEBUG("Radio: no memory to queue packet\n");
+		return;
+	}
+	pkt->cnt = cnt;
+	memcpy(pkt->data, read_buf + sizeof(sim_vtime_hdr_t), cnt);
+	vtime_schedule_remote(hdr->stamp, hdr->src, hdr->seq, radio_vtime_deliver, pkt);
+}
+
 /**
  * @brief receiver thread
  */
@@ -272,7 +425,6 @@ static void recv_thread(int fd)
 	while(1)
 	{
 		uint8_t read_buf[SEND_BUF_SIZE];
-		Message *recv_msg = NULL;
 		int cnt;
 
 		//sched_yield();
@@ -288,88 +440,111 @@ static void recv_thread(int fd)
 		if( cnt == 0 || cnt == -1) {
 			return;
 		}
-		if(cnt < SOS_MSG_HEADER_SIZE) {
-			DEBUG("Radio: get incomplete header\n");
-			//! something is wrong...
-			return;
-		}
-		if((((Message*)read_buf)->len) != (cnt - SOS_MSG_HEADER_SIZE)) {
-			DEBUG("Radio: invalid data payload size\n");
-			return;
-		}
-		recv_msg = msg_create();
-		if(recv_msg == NULL) {
-			DEBUG("Radio: no message header\n");
-			return;
-		}
-		memcpy(recv_msg, read_buf, SOS_MSG_HEADER_SIZE);
-
-		if(recv_msg->len != 0) {
-			recv_msg->data = ker_malloc(recv_msg->len, RADIO_PID);
-			if(recv_msg->data != NULL) {
-				recv_msg->flag = SOS_MSG_RELEASE;
-				memcpy(recv_msg->data, read_buf + SOS_MSG_HEADER_SIZE, recv_msg->len);
-				if(recv_msg->type == MSG_TIMESTAMP)
-				{
-					uint32_t timestamp = ker_systime32();
-					memcpy(&recv_msg->data[4], (uint8_t *)(&timestamp), sizeof(uint32_t));
-				}
-
-				if(bTsEnable) {
-					timestamp_incoming(recv_msg, ker_systime32());
-				}
-				DEBUG("handle incoming msg \n");
-				handle_incoming_msg(recv_msg, SOS_MSG_RADIO_IO);
-			} else {
-				msg_dispose(recv_msg);
-			}
+		if( vtime_enabled ) {
+			radio_vtime_receive(read_buf, cnt);
 		} else {
-			recv_msg->data = NULL;
-			recv_msg->flag = 0;
-			if(bTsEnable) {
-				timestamp_incoming(recv_msg, ker_systime32());
-			}
-			handle_incoming_msg(recv_msg, SOS_MSG_RADIO_IO);
+			radio_deliver(read_buf, cnt);
 		}
 	}
 }
 
+/**
+ * @brief smallest promise of the nodes that can reach us
+ */
+static vtime_t radio_vtime_horizon(void)
+{
+	vtime_t horizon = VTIME_NEVER;
+	uint32_t j;
+
+	for(j = 0; j < num_in_nbr; j++) {
+		if(topo_array[in_nbr[j]].promise < horizon) {
+			horizon = topo_array[in_nbr[j]].promise;
+		}
+	}
+	return horizon;
+}
+
+static void radio_vtime_send_promise(vtime_t promise)
+{
+	struct sockaddr_in name;
+	sim_vtime_hdr_t hdr;
+	uint32_t j;
+
+	hdr.stamp = VTIME_NEVER;
+	hdr.promise = promise;
+	hdr.seq = 0;
+	hdr.src = ker_id();
+	name.sin_family = AF_INET;
+	name.sin_addr.s_addr = sockaddr.sin_addr.s_addr;
+	for(j = 0; j < topo_node->num_nbr; j++) {
+		name.sin_port = htons( get_sin_port(topo_array[topo.nbr[topo_node->first_nbr + j]].id) );
+		sendto(send_sock, &hdr, sizeof(hdr), 0,
+				(struct sockaddr *)&name, sizeof(struct sockaddr_in));
+	}
+	vtime_promised = promise;
+}
+
+/**
+ * @brief nothing can run before next, tell the neighbors how far we will get
+ */
+static void radio_vtime_blocked(vtime_t next)
+{
+	vtime_t horizon = radio_vtime_horizon();
+	vtime_t base = (next < horizon)? next : horizon;
+	vtime_t promise = (base == VTIME_NEVER)? VTIME_NEVER : base + SIM_VTIME_LOOKAHEAD;
+
+	if(promise > vtime_promised) {
+		radio_vtime_send_promise(promise);
+	}
+}
+
+static void radio_vtime_advanced(vtime_t now)
+{
+	if(vtime_promised != VTIME_NEVER &&
+			now >= vtime_promised + SIM_VTIME_NULL_QUANTUM) {
+		radio_vtime_send_promise(now + SIM_VTIME_LOOKAHEAD);
+	}
+}
+
 static int get_sin_port(int16_t id)
 {
 	return (int) (SIM_PORT_OFFSET+SIM_MAX_GROUP_ID+1)
 		+ node_group_id*(SIM_MAX_MOTE_ID+1) + id;
 }
+
+static int cmp_nbr(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
 void sim_radio_init()
 {
 	//! initialize node id and location
-	FILE *fid;
-	char line_buf[LINE_BUF_SIZE];    // line buffer
-	int j = 0;
+	char newtopofile[256];
+	uint32_t j = 0;
+	int8_t ret;
 
-	if((fid = fopen(topofile, "r")) == NULL){
+	ret = sim_topo_load(&topo, topofile, radio_pkt_success_rate);
+	if(ret == -ENOENT){
 		char* sosrootdir;
-		char newtopofile[256];
 		sosrootdir = getenv("SOSROOT");
 		strcpy(newtopofile, sosrootdir);
 		printf("Unable to open %s\n", topofile);
 		strcat(newtopofile, "/platform/sim/topo.def\0");
-		if((fid = fopen(newtopofile, "r")) == NULL){
+		topofile = newtopofile;
+		ret = sim_topo_load(&topo, topofile, radio_pkt_success_rate);
+		if(ret == -ENOENT){
 			printf("Unable to open %s\n", newtopofile);
 			exit(1);
 		}
-		else
-			topofile = newtopofile;
 	}
-	printf("Using topology file %s\n", topofile);
-	// remove comments
-	do{
-		fgets(line_buf, LINE_BUF_SIZE, fid);
-	} while(line_buf[0] == '#');
-
-	if(sscanf(line_buf, "%d", &totalNodes) != 1){
-		fprintf(stderr, "no data in %s\n", topofile);
+	if(ret != SOS_OK){
 		exit(1);
 	}
+	printf("Using topology file %s\n", topofile);
+	totalNodes = topo.num_nodes;
 
 	topo_array = (Topology*)malloc((totalNodes + 1) * sizeof(Topology));
 	if (topo_array == NULL){
@@ -378,32 +553,21 @@ void sim_radio_init()
 	}
 
 	for(j = 0; j < totalNodes; j++){
-		do{
-			// remove comments
-			fgets(line_buf, LINE_BUF_SIZE, fid);
-		}while(line_buf[0] == '#');
-		if(sscanf(line_buf, "%d %d %d %d %d %u",
-					&topo_array[j].id,
-					&topo_array[j].unit,
-					&topo_array[j].x,
-					&topo_array[j].y,
-					&topo_array[j].z,
-					&topo_array[j].r2) != 6){
-			fprintf(stderr, "not enough definitions in %s: %s\n", topofile, line_buf);
-			exit(1);
-		}
-		//topo_array[j].id = j;
+		topo_array[j].id = topo.nodes[j].id;
+		topo_array[j].unit = topo.nodes[j].loc.unit;
+		topo_array[j].x = topo.nodes[j].loc.x;
+		topo_array[j].y = topo.nodes[j].loc.y;
+		topo_array[j].z = topo.nodes[j].loc.z;
+		topo_array[j].r2 = topo.nodes[j].r2;
 		topo_array[j].type = TOPO_TYPE_OTHER;
 		topo_array[j].sock = -1;
+		topo_array[j].in_neighbor = false;
+		topo_array[j].promise = 0;
 	}
 #if 0
 	print_nodes();
 	exit(1);
 #endif
-	if(fclose(fid) != 0){
-		perror("fclose");
-		exit(1);
-	}
 
 	// finding node id by finding available port
 	//for(j = 1; j <= totalNodes; j++)
@@ -465,28 +629,28 @@ void sim_radio_init()
 		}
 	}
 
+	//! nodes that hear us, from the neighbor list of the topology
+	topo_node = &topo.nodes[getj(ker_id())];
+	for(j = 0; j < topo_node->num_nbr; j++){
+		uint32_t nb = topo.nbr[topo_node->first_nbr + j];
+		topo_array[nb].type = TOPO_TYPE_NEIGHBOR;
+		DEBUG("node %d is reachable\n", topo_array[nb].id);
+	}
+	//! nodes we hear, which bound our virtual time
+	in_nbr = (uint32_t*)malloc((totalNodes + 1) * sizeof(uint32_t));
+	if (in_nbr == NULL){
+		fprintf(stderr, "not enough memory\n");
+		exit(1);
+	}
+	num_in_nbr = 0;
 	for(j = 0; j < totalNodes; j++){
-		uint32_t r2;
-		uint16_t id;
-		node_loc_t self, neighbor;
-		id = ker_id();
-		self = ker_loc();
-		if(topo_array[j].type == TOPO_TYPE_SELF) continue;
-		neighbor.unit = topo_array[j].unit;
-		neighbor.x = topo_array[j].x;
-		neighbor.y = topo_array[j].y;
-		neighbor.z = topo_array[j].z;
-		r2 = ker_loc_r2(&self,&neighbor);
-		if(r2 < 0){
-			fprintf(stderr, "units for neighbor do not agree.\n");
-			fprintf(stderr, "self.unit = %d : neighbor.unit = %d.\n",
-					self.unit, neighbor.unit);
-			exit(1);
-		}
-		DEBUG("neighbor %d r2 = %d, self r2 = %d\n", topo_array[j].id, r2, topo_self.r2);
-		if(r2 <= topo_self.r2){
-			topo_array[j].type = TOPO_TYPE_NEIGHBOR;
-			DEBUG("node %d is reachable\n", topo_array[j].id);
+		sim_topo_node_t *n = &topo.nodes[j];
+		uint32_t self_j = topo_node - topo.nodes;
+		if(n == topo_node) continue;
+		if(bsearch(&self_j, topo.nbr + n->first_nbr, n->num_nbr,
+					sizeof(uint32_t), cmp_nbr) != NULL){
+			topo_array[j].in_neighbor = true;
+			in_nbr[num_in_nbr++] = j;
 		}
 	}
 	{
@@ -535,10 +699,18 @@ void radio_init()
 	interrupt_add_read_fd(topo_self.sock, recv_thread);
 	
 	mq_init(&senddoneq);
+
+	if( vtime_enabled ) {
+		vtime_set_sync(radio_vtime_horizon, radio_vtime_blocked, radio_vtime_advanced);
+	}
 }
 
 void radio_final()
 {
+	if( vtime_enabled ) {
+		// let the neighbors run to completion without us
+		radio_vtime_send_promise(VTIME_NEVER);
+	}
 	close(topo_self.sock);
 	close(send_sock);
 
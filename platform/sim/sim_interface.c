@@ -68,10 +68,13 @@ mod_header_ptr get_header_from_sim(sos_code_id_t cid)
 
 void delete_module_image( sos_code_id_t cid )
 {
+	// with SIM_MULTINODE the image may still be used by another node
+#ifndef SIM_MULTINODE
 	if( dlfd[cid] != NULL ) {
 		DEBUG("sim closing cid %d\n", cid);
 		dlclose(dlfd[cid]);
 		dlfd[cid] = NULL;
 	}
+#endif
 }
 
@@ -0,0 +1,295 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * @brief topology loader and neighbor index for the simulated radio
+ *
+ * This file keeps no state of its own, everything is in the sim_topo_t
+ * of the caller.
+ */
+#include <hardware.h>
+#include <math.h>
+#include <sim_topo.h>
+
+#define LINE_BUF_SIZE       255
+#define SIM_TOPO_HDR_SIZE   12
+#define SIM_TOPO_REC_SIZE   14
+//! beyond this distance ker_loc_r2() clamps the coordinates
+#define SIM_TOPO_CLAMP      16384
+
+typedef struct {
+	uint32_t *data;
+	uint32_t len;
+	uint32_t size;
+} link_vec_t;
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static int8_t alloc_nodes(sim_topo_t *t, uint32_t n, const char *file)
+{
+	if( n > SIM_TOPO_MAX_NODES ) {
+		fprintf(stderr, "%s has %u nodes, at most %u fit in 16 bit addresses\n",
+				file, n, SIM_TOPO_MAX_NODES);
+		return -EINVAL;
+	}
+	t->num_nodes = n;
+	t->nodes = (sim_topo_node_t*)calloc(n, sizeof(sim_topo_node_t));
+	t->index = (int32_t*)malloc(65536 * sizeof(int32_t));
+	if( t->nodes == NULL || t->index == NULL ) {
+		fprintf(stderr, "not enough memory for %u nodes\n", n);
+		return -ENOMEM;
+	}
+	memset(t->index, 0xff, 65536 * sizeof(int32_t));
+	return SOS_OK;
+}
+
+static bool read_line(FILE *fid, char *line_buf)
+{
+	do {
+		if( fgets(line_buf, LINE_BUF_SIZE, fid) == NULL ) {
+			return false;
+		}
+	} while( line_buf[0] == '#' );
+	return true;
+}
+
+static int8_t load_text(sim_topo_t *t, FILE *fid, const char *file)
+{
+	char line_buf[LINE_BUF_SIZE];
+	uint32_t n;
+	uint32_t i;
+	int8_t ret;
+
+	if( read_line(fid, line_buf) == false || sscanf(line_buf, "%u", &n) != 1 ) {
+		fprintf(stderr, "no data in %s\n", file);
+		return -EINVAL;
+	}
+	if( (ret = alloc_nodes(t, n, file)) != SOS_OK ) {
+		return ret;
+	}
+	for( i = 0; i < n; i++ ) {
+		int id, unit, x, y, z;
+		unsigned int r2;
+
+		if( read_line(fid, line_buf) == false ||
+				sscanf(line_buf, "%d %d %d %d %d %u", &id, &unit, &x, &y, &z, &r2) != 6 ) {
+			fprintf(stderr, "not enough definitions in %s: %s\n", file, line_buf);
+			return -EINVAL;
+		}
+		if( id < 0 || id >= BCAST_ADDRESS ) {
+			fprintf(stderr, "bad node id %d in %s\n", id, file);
+			return -EINVAL;
+		}
+		t->nodes[i].id = id;
+		t->nodes[i].loc.unit = unit;
+		t->nodes[i].loc.x = x;
+		t->nodes[i].loc.y = y;
+		t->nodes[i].loc.z = z;
+		t->nodes[i].r2 = r2;
+	}
+	return SOS_OK;
+}
+
+static int8_t load_bin(sim_topo_t *t, FILE *fid, const char *file)
+{
+	uint8_t rec[SIM_TOPO_REC_SIZE];
+	uint32_t i;
+	int8_t ret;
+
+	if( fread(rec, 1, SIM_TOPO_HDR_SIZE, fid) != SIM_TOPO_HDR_SIZE ||
+			get_u16(rec + 4) != SIM_TOPO_VERSION ) {
+		fprintf(stderr, "unsupported binary topology %s\n", file);
+		return -EINVAL;
+	}
+	if( (ret = alloc_nodes(t, get_u32(rec + 8), file)) != SOS_OK ) {
+		return ret;
+	}
+	for( i = 0; i < t->num_nodes; i++ ) {
+		if( fread(rec, 1, SIM_TOPO_REC_SIZE, fid) != SIM_TOPO_REC_SIZE ) {
+			fprintf(stderr, "%s is truncated at node %u\n", file, i);
+			return -EINVAL;
+		}
+		t->nodes[i].id = get_u16(rec);
+		if( t->nodes[i].id == BCAST_ADDRESS ) {
+			fprintf(stderr, "bad node id %d in %s\n", t->nodes[i].id, file);
+			return -EINVAL;
+		}
+		t->nodes[i].loc.unit = (int16_t)get_u16(rec + 2);
+		t->nodes[i].loc.x = (int16_t)get_u16(rec + 4);
+		t->nodes[i].loc.y = (int16_t)get_u16(rec + 6);
+		t->nodes[i].loc.z = (int16_t)get_u16(rec + 8);
+		t->nodes[i].r2 = get_u32(rec + 10);
+	}
+	return SOS_OK;
+}
+
+//! smallest r with r * r >= r2
+static uint32_t radius(uint32_t r2)
+{
+	uint32_t r = (uint32_t)sqrt((double)r2);
+	while( (uint64_t)r * r < r2 ) r++;
+	return r;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static int8_t vec_add(link_vec_t *v, uint32_t x)
+{
+	if( v->len == v->size ) {
+		v->size = (v->size == 0)? 1024 : v->size * 2;
+		v->data = (uint32_t*)realloc(v->data, v->size * sizeof(uint32_t));
+		if( v->data == NULL ) {
+			fprintf(stderr, "not enough memory for neighbor lists\n");
+			return -ENOMEM;
+		}
+	}
+	v->data[v->len++] = x;
+	return SOS_OK;
+}
+
+/**
+ * @brief find the nodes that hear each node with a uniform grid over x/y
+ *
+ * The cell size is the largest radio range, so that a node usually only
+ * looks at the 3x3 cells around it.  Very sparse topologies get larger
+ * cells to bound the size of the grid.
+ */
+static int8_t build_neighbors(sim_topo_t *t, uint8_t succ_rate)
+{
+	int32_t minx = INT16_MAX, maxx = INT16_MIN, miny = INT16_MAX, maxy = INT16_MIN;
+	uint32_t max_r2 = 0;
+	uint32_t cell, cols, rows, ncells;
+	uint32_t *cell_start;
+	uint32_t *cell_nodes;
+	link_vec_t links = {NULL, 0, 0};
+	uint32_t i;
+
+	for( i = 0; i < t->num_nodes; i++ ) {
+		sim_topo_node_t *n = &t->nodes[i];
+		if( n->loc.x < minx ) minx = n->loc.x;
+		if( n->loc.x > maxx ) maxx = n->loc.x;
+		if( n->loc.y < miny ) miny = n->loc.y;
+		if( n->loc.y > maxy ) maxy = n->loc.y;
+		if( n->r2 > max_r2 ) max_r2 = n->r2;
+	}
+	cell = radius(max_r2);
+	if( cell == 0 ) cell = 1;
+	while( true ) {
+		cols = (maxx - minx) / cell + 1;
+		rows = (maxy - miny) / cell + 1;
+		if( (uint64_t)cols * rows <= 4 * (uint64_t)t->num_nodes + 16 ) break;
+		cell *= 2;
+	}
+	ncells = cols * rows;
+
+	// counting sort of the nodes by cell
+	cell_start = (uint32_t*)calloc(ncells + 1, sizeof(uint32_t));
+	cell_nodes = (uint32_t*)malloc(t->num_nodes * sizeof(uint32_t));
+	if( cell_start == NULL || cell_nodes == NULL ) {
+		fprintf(stderr, "not enough memory for the topology grid\n");
+		return -ENOMEM;
+	}
+#define CELL_OF(n) ((((n)->loc.y - miny) / cell) * cols + ((n)->loc.x - minx) / cell)
+	for( i = 0; i < t->num_nodes; i++ ) {
+		cell_start[CELL_OF(&t->nodes[i]) + 1]++;
+	}
+	for( i = 0; i < ncells; i++ ) {
+		cell_start[i + 1] += cell_start[i];
+	}
+	for( i = 0; i < t->num_nodes; i++ ) {
+		cell_nodes[cell_start[CELL_OF(&t->nodes[i])]++] = i;
+	}
+	for( i = ncells; i > 0; i-- ) {
+		cell_start[i] = cell_start[i - 1];
+	}
+	cell_start[0] = 0;
+
+	for( i = 0; i < t->num_nodes; i++ ) {
+		sim_topo_node_t *n = &t->nodes[i];
+		uint32_t r = radius(n->r2);
+		int32_t cx = (n->loc.x - minx) / cell;
+		int32_t cy = (n->loc.y - miny) / cell;
+		int32_t k = (r >= SIM_TOPO_CLAMP)? (int32_t)(cols + rows) : (int32_t)((r + cell - 1) / cell);
+		int32_t gx, gy;
+
+		n->first_nbr = links.len;
+		for( gy = cy - k; gy <= cy + k; gy++ ) {
+			if( gy < 0 || gy >= (int32_t)rows ) continue;
+			for( gx = cx - k; gx <= cx + k; gx++ ) {
+				uint32_t c, e;
+				if( gx < 0 || gx >= (int32_t)cols ) continue;
+				c = gy * cols + gx;
+				for( e = cell_start[c]; e < cell_start[c + 1]; e++ ) {
+					uint32_t j = cell_nodes[e];
+					if( j == i ) continue;
+					if( ker_loc_r2(&n->loc, &t->nodes[j].loc) > n->r2 ) continue;
+					if( vec_add(&links, j) != SOS_OK ) return -ENOMEM;
+				}
+			}
+		}
+		n->num_nbr = links.len - n->first_nbr;
+		// keep the order of the topology file
+		qsort(links.data + n->first_nbr, n->num_nbr, sizeof(uint32_t), cmp_u32);
+	}
+#undef CELL_OF
+	free(cell_start);
+	free(cell_nodes);
+
+	t->nbr = links.data;
+	t->nbr_succ = (uint8_t*)malloc(links.len + 1);
+	if( t->nbr_succ == NULL ) {
+		fprintf(stderr, "not enough memory for link table\n");
+		return -ENOMEM;
+	}
+	memset(t->nbr_succ, succ_rate, links.len + 1);
+	return SOS_OK;
+}
+
+int8_t sim_topo_load(sim_topo_t *t, const char *file, uint8_t succ_rate)
+{
+	FILE *fid;
+	char magic[4];
+	uint32_t i;
+	int8_t ret;
+
+	memset(t, 0, sizeof(sim_topo_t));
+	if( (fid = fopen(file, "r")) == NULL ) {
+		return -ENOENT;
+	}
+	if( fread(magic, 1, sizeof(magic), fid) == sizeof(magic) &&
+			memcmp(magic, SIM_TOPO_MAGIC, sizeof(magic)) == 0 ) {
+		rewind(fid);
+		ret = load_bin(t, fid, file);
+	} else {
+		rewind(fid);
+		ret = load_text(t, fid, file);
+	}
+	fclose(fid);
+	if( ret != SOS_OK ) {
+		return ret;
+	}
+	if( t->num_nodes == 0 ) {
+		fprintf(stderr, "no data in %s\n", file);
+		return -EINVAL;
+	}
+	for( i = 0; i < t->num_nodes; i++ ) {
+		if( t->index[t->nodes[i].id] != -1 ) {
+			fprintf(stderr, "node %d appears twice in %s\n", t->nodes[i].id, file);
+			return -EINVAL;
+		}
+		t->index[t->nodes[i].id] = i;
+	}
+	return build_neighbors(t, succ_rate);
+}
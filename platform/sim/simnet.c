@@ -0,0 +1,527 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * @brief multi-node simulator
+ *
+ * Runs all the nodes of a topology file in one executable.  See simnet.h
+ * for the overall model.
+ *
+ * Nothing in this file is part of the per-node region, so the state here
+ * is shared by all the nodes of a worker.  The node images, the mailboxes
+ * and the neighbor lists live on the heap or in shared memory.
+ *
+ * Workers are forked processes rather than threads: the kernel keeps its
+ * state in globals, and one address space can only have one node's
+ * globals in place at a time.  Frames between workers go through single
+ * producer / single consumer rings in a shared mapping, and the workers
+ * meet at a barrier at the end of every window.
+ */
+#include <hardware.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <ucontext.h>
+#include <sos_info.h>
+#include <vtime.h>
+#include <simnet.h>
+#include <sim_topo.h>
+
+//! stack of every simulated node
+#ifndef SIMNET_STACK_SIZE
+#define SIMNET_STACK_SIZE     (64 * 1024L)
+#endif
+
+//! size of the ring between each pair of workers
+#ifndef SIMNET_RING_SIZE
+#define SIMNET_RING_SIZE      (256 * 1024L)
+#endif
+
+#define SIMNET_MAX_WORKERS    64
+
+//! bounds of the per-node region, defined in simnet.ld
+extern uint8_t __start_sos_node_data[];
+extern uint8_t __stop_sos_node_data[];
+
+//! these are defined in hardware.c
+extern char *topofile;
+extern uint16_t radio_pkt_success_rate;
+
+typedef struct simnet_node {
+	uint16_t id;
+	uint16_t worker;
+	node_loc_t loc;
+	uint32_t *nbr;           //!< nodes that hear this node
+	uint8_t *nbr_succ;       //!< success rate of each of these links
+	uint32_t num_nbr;
+	// the fields below are only used by the owning worker
+	uint8_t *image;          //!< saved per-node region
+	void *stack;
+	ucontext_t ctx;
+	vtime_t next;            //!< earliest pending event
+	simnet_pkt_t *inbox;     //!< frames not yet given to the node
+	vtime_t inbox_next;
+	uint32_t rand_state;
+} simnet_node_t;
+
+typedef struct {
+	volatile uint64_t head;  //!< written by the consumer
+	volatile uint64_t tail;  //!< written by the producer
+	uint8_t data[SIMNET_RING_SIZE];
+} simnet_ring_t;
+
+//! ring record header, a zero size skips to the start of the ring
+typedef struct {
+	uint32_t size;
+	uint32_t dst;
+} simnet_rec_t;
+
+typedef struct {
+	volatile uint32_t arrived;
+	volatile uint32_t gen;
+	vtime_t next[SIMNET_MAX_WORKERS];
+	uint64_t events[SIMNET_MAX_WORKERS];
+	uint64_t frames[SIMNET_MAX_WORKERS];
+} simnet_ctl_t;
+
+static simnet_node_t *nodes;
+static uint32_t num_nodes;
+static uint16_t num_workers = 1;
+static uint16_t self_worker;
+static simnet_ctl_t *ctl;
+static simnet_ring_t *rings;
+
+static size_t region_size;
+static uint8_t *pristine;
+static simnet_node_t *current;
+static ucontext_t worker_ctx;
+static vtime_t window_end;
+static uint32_t vseed;
+static uint64_t num_frames;
+
+static void drain_rings(void);
+
+static simnet_ring_t *ring(uint16_t from, uint16_t to)
+{
+	return &rings[from * num_workers + to];
+}
+
+//-----------------------------------------------------------------------------
+// Topology
+//-----------------------------------------------------------------------------
+static void load_topology(void)
+{
+	static sim_topo_t topo;
+	uint32_t i;
+
+	if( sim_topo_load(&topo, topofile, radio_pkt_success_rate) != SOS_OK ) {
+		fprintf(stderr, "unable to load %s\n", topofile);
+		exit(1);
+	}
+	num_nodes = topo.num_nodes;
+	nodes = (simnet_node_t*)calloc(num_nodes, sizeof(simnet_node_t));
+	if( nodes == NULL ) {
+		fprintf(stderr, "not enough memory for %u nodes\n", num_nodes);
+		exit(1);
+	}
+	for( i = 0; i < num_nodes; i++ ) {
+		sim_topo_node_t *t = &topo.nodes[i];
+		nodes[i].id = t->id;
+		nodes[i].loc = t->loc;
+		nodes[i].nbr = topo.nbr + t->first_nbr;
+		nodes[i].nbr_succ = topo.nbr_succ + t->first_nbr;
+		nodes[i].num_nbr = t->num_nbr;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Node contexts
+//-----------------------------------------------------------------------------
+static void switch_to(simnet_node_t *n)
+{
+	if( current == n ) return;
+	if( current != NULL ) {
+		memcpy(current->image, __start_sos_node_data, region_size);
+	}
+	memcpy(__start_sos_node_data, n->image, region_size);
+	current = n;
+}
+
+static void node_main(void)
+{
+	sos_main(SOS_BOOT_NORMAL);
+}
+
+static void node_create(simnet_node_t *n)
+{
+	n->image = (uint8_t*)malloc(region_size);
+	n->stack = mmap(NULL, SIMNET_STACK_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( n->image == NULL || n->stack == MAP_FAILED ) {
+		fprintf(stderr, "not enough memory for node %d\n", n->id);
+		exit(1);
+	}
+	memcpy(n->image, pristine, region_size);
+	n->next = 0;
+	n->inbox = NULL;
+	n->inbox_next = VTIME_NEVER;
+	n->rand_state = vseed + n->id;
+
+	// set the identity of the node before it boots
+	switch_to(n);
+	node_address = n->id;
+	node_loc = n->loc;
+	vtime_init(vseed, VTIME_NEVER);
+
+	getcontext(&n->ctx);
+	n->ctx.uc_stack.ss_sp = n->stack;
+	n->ctx.uc_stack.ss_size = SIMNET_STACK_SIZE;
+	n->ctx.uc_link = NULL;
+	makecontext(&n->ctx, node_main, 0);
+}
+
+static void node_run(simnet_node_t *n)
+{
+	simnet_pkt_t *pkt;
+
+	switch_to(n);
+	while( (pkt = n->inbox) != NULL ) {
+		n->inbox = pkt->next;
+		vtime_schedule_remote(pkt->stamp, pkt->src, pkt->seq, simnet_radio_deliver, pkt);
+	}
+	n->inbox_next = VTIME_NEVER;
+	swapcontext(&worker_ctx, &n->ctx);
+	n->next = vtime_next();
+}
+
+vtime_t simnet_horizon(void)
+{
+	return window_end;
+}
+
+void simnet_yield(vtime_t next)
+{
+	swapcontext(&current->ctx, &worker_ctx);
+}
+
+//-----------------------------------------------------------------------------
+// Frame delivery
+//-----------------------------------------------------------------------------
+static void inbox_add(simnet_node_t *n, simnet_pkt_t *pkt)
+{
+	pkt->next = n->inbox;
+	n->inbox = pkt;
+	if( pkt->stamp < n->inbox_next ) {
+		n->inbox_next = pkt->stamp;
+	}
+}
+
+static void ring_put(uint16_t to, uint32_t dst, simnet_pkt_t *pkt)
+{
+	simnet_ring_t *r = ring(self_worker, to);
+	uint32_t size = (sizeof(simnet_rec_t) + sizeof(simnet_pkt_t) + pkt->len + 7) & ~7;
+	uint64_t tail = r->tail;
+
+	while( true ) {
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t room = SIMNET_RING_SIZE - (tail % SIMNET_RING_SIZE);
+		uint64_t need = (room < size)? room + size : size;
+
+		if( SIMNET_RING_SIZE - (tail - head) >= need ) {
+			if( room < size ) {
+				// not enough space before the end, wrap around
+				((simnet_rec_t*)&r->data[tail % SIMNET_RING_SIZE])->size = 0;
+				tail += room;
+			}
+			break;
+		}
+		// the consumer may be waiting on our ring too, keep ours moving
+		drain_rings();
+		sched_yield();
+	}
+	{
+		simnet_rec_t *rec = (simnet_rec_t*)&r->data[tail % SIMNET_RING_SIZE];
+		rec->size = size;
+		rec->dst = dst;
+		memcpy(rec + 1, pkt, sizeof(simnet_pkt_t) + pkt->len);
+	}
+	__atomic_store_n(&r->tail, tail + size, __ATOMIC_RELEASE);
+}
+
+static void drain_rings(void)
+{
+	uint16_t w;
+
+	for( w = 0; w < num_workers; w++ ) {
+		simnet_ring_t *r;
+		uint64_t head, tail;
+
+		if( w == self_worker ) continue;
+		r = ring(w, self_worker);
+		head = r->head;
+		tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		while( head != tail ) {
+			simnet_rec_t *rec = (simnet_rec_t*)&r->data[head % SIMNET_RING_SIZE];
+			simnet_pkt_t *src;
+			simnet_pkt_t *pkt;
+
+			if( rec->size == 0 ) {
+				head += SIMNET_RING_SIZE - (head % SIMNET_RING_SIZE);
+				continue;
+			}
+			src = (simnet_pkt_t*)(rec + 1);
+			pkt = (simnet_pkt_t*)malloc(sizeof(simnet_pkt_t) + src->len);
+			if( pkt == NULL ) {
+				fprintf(stderr, "simnet: not enough memory for frame\n");
+				exit(1);
+			}
+			memcpy(pkt, src, sizeof(simnet_pkt_t) + src->len);
+			inbox_add(&nodes[rec->dst], pkt);
+			head += rec->size;
+		}
+		__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	}
+}
+
+bool simnet_send(const uint8_t *buf, uint16_t len, uint16_t daddr,
+		vtime_t stamp, uint32_t seq)
+{
+	simnet_node_t *n = current;
+	bool succ = false;
+	uint32_t i;
+
+	for( i = 0; i < n->num_nbr; i++ ) {
+		simnet_node_t *nb = &nodes[n->nbr[i]];
+		simnet_pkt_t *pkt;
+
+		if( n->nbr_succ[i] < 100 &&
+				(int)(100.0 * rand_r(&n->rand_state) / RAND_MAX) > n->nbr_succ[i] ) {
+			continue;
+		}
+		if( daddr == nb->id || daddr == BCAST_ADDRESS ) {
+			succ = true;
+		}
+		pkt = (simnet_pkt_t*)malloc(sizeof(simnet_pkt_t) + len);
+		if( pkt == NULL ) {
+			fprintf(stderr, "simnet: not enough memory for frame\n");
+			exit(1);
+		}
+		pkt->stamp = stamp;
+		pkt->seq = seq;
+		pkt->src = n->id;
+		pkt->len = len;
+		memcpy(pkt->data, buf, len);
+		num_frames++;
+		if( nb->worker == self_worker ) {
+			inbox_add(nb, pkt);
+		} else {
+			ring_put(nb->worker, n->nbr[i], pkt);
+			free(pkt);
+		}
+	}
+	return succ;
+}
+
+//-----------------------------------------------------------------------------
+// Workers
+//-----------------------------------------------------------------------------
+static void barrier(void)
+{
+	uint32_t gen;
+
+	if( num_workers == 1 ) return;
+	gen = __atomic_load_n(&ctl->gen, __ATOMIC_ACQUIRE);
+	if( __atomic_add_fetch(&ctl->arrived, 1, __ATOMIC_ACQ_REL) == num_workers ) {
+		__atomic_store_n(&ctl->arrived, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&ctl->gen, gen + 1, __ATOMIC_RELEASE);
+		return;
+	}
+	while( __atomic_load_n(&ctl->gen, __ATOMIC_ACQUIRE) == gen ) {
+		drain_rings();
+		sched_yield();
+	}
+}
+
+static vtime_t local_next(void)
+{
+	vtime_t next = VTIME_NEVER;
+	uint32_t i;
+
+	for( i = 0; i < num_nodes; i++ ) {
+		simnet_node_t *n = &nodes[i];
+		if( n->worker != self_worker ) continue;
+		if( n->next < next ) next = n->next;
+		if( n->inbox_next < next ) next = n->inbox_next;
+	}
+	return next;
+}
+
+static void worker(vtime_t stop_time)
+{
+	vtime_t now = 0;
+	uint64_t events = 0;
+	uint32_t i;
+
+	for( i = 0; i < num_nodes; i++ ) {
+		if( nodes[i].worker == self_worker ) {
+			node_create(&nodes[i]);
+		}
+	}
+	while( now < stop_time ) {
+		uint16_t w;
+
+		window_end = now + SIMNET_LOOKAHEAD;
+		for( i = 0; i < num_nodes; i++ ) {
+			simnet_node_t *n = &nodes[i];
+			if( n->worker != self_worker ) continue;
+			if( n->next < window_end || n->inbox_next < window_end ) {
+				node_run(n);
+				events++;
+			}
+		}
+		// every frame sent in this window is now in a ring
+		barrier();
+		drain_rings();
+		ctl->next[self_worker] = local_next();
+		barrier();
+
+		now = window_end;
+		{
+			vtime_t next = VTIME_NEVER;
+			for( w = 0; w < num_workers; w++ ) {
+				if( ctl->next[w] < next ) next = ctl->next[w];
+			}
+			if( next == VTIME_NEVER ) break;
+			if( next > now ) now = next;
+		}
+	}
+	ctl->events[self_worker] = events;
+	ctl->frames[self_worker] = num_frames;
+}
+
+static void print_help(void)
+{
+	printf(" -f <file>                      Topology file\n");
+	printf(" -p <percent>                   Packet success rate\n");
+	printf(" -w <workers>                   Number of worker processes\n");
+	printf(" --vtime <seed>                 Random seed\n");
+	printf(" --stop_time <seconds>          Exit at this virtual time\n");
+	printf(" --exflash <dir>                Keep the external flash in <dir>/exflash_<node>.img\n");
+}
+
+static struct option long_options[] = {
+	{"file", 1, 0, 'f'},
+	{"packet_loss", 1, 0, 'p'},
+	{"workers", 1, 0, 'w'},
+	{"help", 0, 0, 'h'},
+	{"vtime", 1, 0, 0},
+	{"stop_time", 1, 0, 0},
+	{"exflash", 1, 0, 0},
+	{0, 0, 0, 0},
+};
+
+int main(int argc, char **argv)
+{
+	vtime_t stop_time = VTIME_NEVER;
+	struct timeval start, end;
+	uint64_t events = 0, frames = 0;
+	uint32_t i;
+	uint16_t w;
+	int ch;
+
+	while( 1 ) {
+		int option_index = 0;
+
+		ch = getopt_long(argc, argv, "hf:p:w:", long_options, &option_index);
+		if( ch == -1 ) break;
+		switch( ch ) {
+		case 0:
+			if( !strcmp(long_options[option_index].name, "vtime") ) {
+				vseed = strtoul(optarg, NULL, 0);
+			} else if( !strcmp(long_options[option_index].name, "stop_time") ) {
+				stop_time = (vtime_t)(atof(optarg) * 1000000);
+			} else if( !strcmp(long_options[option_index].name, "exflash") ) {
+				exflash_dir = optarg;
+			}
+			break;
+		case 'f':
+			topofile = optarg;
+			break;
+		case 'p':
+			radio_pkt_success_rate = atoi(optarg);
+			break;
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+		default:
+			print_help();
+			exit(1);
+		}
+	}
+	if( num_workers < 1 || num_workers > SIMNET_MAX_WORKERS ) {
+		fprintf(stderr, "number of workers must be between 1 and %d\n", SIMNET_MAX_WORKERS);
+		exit(1);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	load_topology();
+	if( num_workers > num_nodes ) num_workers = num_nodes;
+	for( i = 0; i < num_nodes; i++ ) {
+		// contiguous blocks keep neighbors on the same worker
+		nodes[i].worker = (uint16_t)(((uint64_t)i * num_workers) / num_nodes);
+	}
+
+	// snapshot of the region before any node touched it
+	region_size = __stop_sos_node_data - __start_sos_node_data;
+	pristine = (uint8_t*)malloc(region_size);
+	if( pristine == NULL ) {
+		fprintf(stderr, "not enough memory\n");
+		exit(1);
+	}
+	memcpy(pristine, __start_sos_node_data, region_size);
+
+	ctl = (simnet_ctl_t*)mmap(NULL, sizeof(simnet_ctl_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if( num_workers > 1 ) {
+		rings = (simnet_ring_t*)mmap(NULL, sizeof(simnet_ring_t) * num_workers * num_workers,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	}
+	if( ctl == MAP_FAILED || rings == MAP_FAILED ) {
+		perror("mmap");
+		exit(1);
+	}
+	printf("simnet: %u nodes, %u workers, %lu bytes per node\n",
+			num_nodes, num_workers, (unsigned long)region_size);
+
+	gettimeofday(&start, NULL);
+	for( w = 1; w < num_workers; w++ ) {
+		pid_t pid = fork();
+		if( pid < 0 ) {
+			perror("fork");
+			exit(1);
+		}
+		if( pid == 0 ) {
+			self_worker = w;
+			worker(stop_time);
+			fflush(stdout);
+			_exit(0);
+		}
+	}
+	self_worker = 0;
+	worker(stop_time);
+	for( w = 1; w < num_workers; w++ ) {
+		wait(NULL);
+	}
+	gettimeofday(&end, NULL);
+
+	for( w = 0; w < num_workers; w++ ) {
+		events += ctl->events[w];
+		frames += ctl->frames[w];
+	}
+	printf("simnet: %llu node runs, %llu frames in %.3f s\n",
+			(unsigned long long)events, (unsigned long long)frames,
+			(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+/**
+ * @brief radio emulation for the multi-node simulator
+ *
+ * Same interface as radio.c, but frames are handed to simnet.c in memory
+ * instead of being sent to other processes over UDP.  All the state in
+ * this file belongs to the node that is currently running.
+ */
+#include <hardware.h>
+#include <message_queue.h>
+#include <net_stack.h>
+#include <sos_info.h>
+#include <vtime.h>
+#include <simnet.h>
+
+#include "radio.h"
+
+#ifndef SOS_DEBUG_RADIO
+#undef DEBUG
+#define DEBUG(...)
+#endif
+
+#define SEND_BUF_SIZE  576
+
+static mq_t senddoneq;
+static bool senddone_callback_requested = false;
+static bool bTsEnable = false;
+static uint32_t tx_seq = 0;
+
+static void handle_senddone(void *arg)
+{
+	uint8_t succ;
+	Message *m;
+
+	while( 1 ) {
+		m = mq_dequeue( &senddoneq );
+		if( m == NULL ) {
+			break;
+		}
+		if( m->flag & SOS_MSG_SEND_FAIL ) {
+			succ = 0;
+		} else {
+			succ = 1;
+		}
+		m->flag &= ~SOS_MSG_SEND_FAIL;
+		msg_send_senddone( m, succ, RADIO_PID );
+	}
+	senddone_callback_requested = false;
+}
+
+void radio_msg_alloc(Message *m)
+{
+	uint8_t send_buf[SEND_BUF_SIZE];
+	vtime_t done_time;
+	int k = 0;
+	int i;
+	HAS_CRITICAL_SECTION;
+
+	if(flag_msg_release(m->flag)){
+		ker_change_own(m->data, RADIO_PID);
+	}
+	ENTER_CRITICAL_SECTION();
+	if(m->type == MSG_TIMESTAMP) {
+		uint32_t timestamp = ker_systime32();
+		memcpy(m->data, (uint8_t*)(&timestamp), sizeof(uint32_t));
+	}
+	for(i = 0; i < SOS_MSG_HEADER_SIZE; i++, k++) {
+		send_buf[k] = *(((uint8_t*)m) + i);
+	}
+	for(i = 0; i < m->len; i++, k++) {
+		send_buf[k] = m->data[i];
+	}
+	done_time = vtime_now() +
+		(vtime_t)(SIMNET_PKT_OVERHEAD + k) * SIMNET_BYTE_US;
+
+	if( simnet_send(send_buf, k, m->daddr, done_time, tx_seq++) == false ) {
+		m->flag |= SOS_MSG_SEND_FAIL;
+	}
+	if(bTsEnable) {
+		timestamp_outgoing(m, ker_systime32());
+	}
+	mq_enqueue( &senddoneq, m );
+	if( senddone_callback_requested == false ) {
+		vtime_schedule(done_time, handle_senddone, NULL);
+		senddone_callback_requested = true;
+	}
+	LEAVE_CRITICAL_SECTION();
+}
+
+void simnet_radio_deliver(void *arg)
+{
+	simnet_pkt_t *pkt = (simnet_pkt_t*)arg;
+	Message *recv_msg;
+
+	if(pkt->len < SOS_MSG_HEADER_SIZE ||
+			((Message*)pkt->data)->len != (pkt->len - SOS_MSG_HEADER_SIZE)) {
+		DEBUG("Radio: invalid frame\n");
+		free(pkt);
+		return;
+	}
+	recv_msg = msg_create();
+	if(recv_msg == NULL) {
+		DEBUG("Radio: no message header\n");
+		free(pkt);
+		return;
+	}
+	memcpy(recv_msg, pkt->data, SOS_MSG_HEADER_SIZE);
+	recv_msg->data = NULL;
+	recv_msg->flag = 0;
+	if(recv_msg->len != 0) {
+		recv_msg->data = msg_payload_alloc(recv_msg->len, RADIO_PID);
+		if(recv_msg->data == NULL) {
+			msg_dispose(recv_msg);
+			free(pkt);
+			return;
+		}
+		recv_msg->flag = SOS_MSG_RELEASE;
+		memcpy(recv_msg->data, pkt->data + SOS_MSG_HEADER_SIZE, recv_msg->len);
+		if(recv_msg->type == MSG_TIMESTAMP) {
+			uint32_t timestamp = ker_systime32();
+			memcpy(&recv_msg->data[4], (uint8_t *)(&timestamp), sizeof(uint32_t));
+		}
+	}
+	free(pkt);
+	if(bTsEnable) {
+		timestamp_incoming(recv_msg, ker_systime32());
+	}
+	handle_incoming_msg(recv_msg, SOS_MSG_RADIO_IO);
+}
+
+void radio_gc( void )
+{
+	mq_gc_mark_payload( &senddoneq, RADIO_PID );
+	malloc_gc( RADIO_PID );
+}
+
+void radio_msg_gc( void )
+{
+	mq_gc_mark_hdr( &senddoneq, RADIO_PID );
+}
+
+//! the topology is read by simnet.c
+void sim_radio_init()
+{
+}
+
+void radio_init()
+{
+	mq_init(&senddoneq);
+	vtime_set_sync(simnet_horizon, simnet_yield, NULL);
+}
+
+void radio_final()
+{
+}
+
+int8_t radio_set_timestamp(bool on)
+{
+	bTsEnable = on;
+	return SOS_OK;
+}
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+#
+# Convert a text topology (topo.def format) into the binary topology format
+# read by sim_topo.c.  See platform/sim/include/sim_topo.h for both formats.
+#
+# usage: topo2bin.py <topo.def> <topo.bin>
+#
+
+import struct
+import sys
+
+SIM_TOPO_MAGIC = b"SOST"
+SIM_TOPO_VERSION = 1
+
+def read_text(name):
+	lines = [l for l in open(name) if not l.startswith('#') and l.strip()]
+	count = int(lines[0].split()[0])
+	nodes = []
+	for l in lines[1:count + 1]:
+		f = l.split()
+		nodes.append([int(x) for x in f[:6]])
+	if len(nodes) != count:
+		raise ValueError("not enough definitions in %s" % name)
+	# node ids are 16 bit addresses below the broadcast address 0xffff
+	if count > 0xffff:
+		raise ValueError("%d nodes do not fit in 16 bit addresses" % count)
+	for n in nodes:
+		if n[0] < 0 or n[0] >= 0xffff:
+			raise ValueError("bad node id %d in %s" % (n[0], name))
+	return nodes
+
+def write_bin(name, nodes):
+	out = open(name, "wb")
+	out.write(SIM_TOPO_MAGIC)
+	out.write(struct.pack("<HHI", SIM_TOPO_VERSION, 0, len(nodes)))
+	for (id, unit, x, y, z, r2) in nodes:
+		out.write(struct.pack("<HhhhhI", id, unit, x, y, z, r2))
+	out.close()
+
+if __name__ == "__main__":
+	if len(sys.argv) != 3:
+		sys.stderr.write("usage: %s <topo.def> <topo.bin>\n" % sys.argv[0])
+		sys.exit(1)
+	nodes = read_text(sys.argv[1])
+	write_bin(sys.argv[2], nodes)
+	print("%d nodes written to %s" % (len(nodes), sys.argv[2]))
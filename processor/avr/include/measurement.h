@@ -2,7 +2,12 @@
 #ifndef _MEASUREMENT_H
 #define _MEASUREMENT_H
 
-#ifdef SOS_IDLE_MEASURE
+#ifdef SOS_IDLE_STATS
+extern void sched_idle_start(void);
+extern void sched_idle_end(void);
+#define SOS_MEASUREMENT_IDLE_START() sched_idle_start()
+#define SOS_MEASUREMENT_IDLE_END() sched_idle_end()
+#elif defined(SOS_IDLE_MEASURE)
 #define SOS_MEASUREMENT_IDLE_START() PORTC &= ~_BV(1)
 #define SOS_MEASUREMENT_IDLE_END() PORTC |= _BV(1)
 #else
@@ -1,12 +1,74 @@
-
 #include <hardware.h>
 #include <exflash.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vtime.h>
+#include "crc.h"
+
+/*
+ * AT45DB041 timing, the maximums of the data sheet, and currents, the
+ * typical values.  The SPI time is what the bit banged port of the
+ * mica2 takes for a byte.
+ */
+#ifndef EXFLASH_SPI_BYTE_US
+#define EXFLASH_SPI_BYTE_US     8      //!< one byte over SPI
+#endif
+#ifndef EXFLASH_XFER_US
+#define EXFLASH_XFER_US         250    //!< page to buffer transfer or compare
+#endif
+#ifndef EXFLASH_PROGRAM_US
+#define EXFLASH_PROGRAM_US      14000  //!< buffer to page, without erase
+#endif
+#ifndef EXFLASH_ERASE_PROGRAM_US
+#define EXFLASH_ERASE_PROGRAM_US 20000 //!< buffer to page, with built-in erase
+#endif
+#ifndef EXFLASH_ERASE_US
+#define EXFLASH_ERASE_US        8000   //!< page erase
+#endif
+#ifndef EXFLASH_READ_UA
+#define EXFLASH_READ_UA         4000   //!< current while reading
+#endif
+#ifndef EXFLASH_PROGRAM_UA
+#define EXFLASH_PROGRAM_UA      15000  //!< current while programming or erasing
+#endif
+#ifndef EXFLASH_MV
+#define EXFLASH_MV              3000
+#endif
+
+//! command and address bytes in front of every SPI transfer
+#define EXFLASH_CMD_BYTES       4
 
 typedef struct exflash_page {
-	uint8_t page[264];
+	uint8_t page[EXFLASH_PAGE_SIZE];
 } exflash_page_t;
 
-static exflash_page_t exflash[2048];
+//! layout of the image file
+typedef struct {
+	exflash_page_t page[EXFLASH_MAX_PAGES];
+	uint32_t erase_count[EXFLASH_MAX_PAGES];
+} exflash_image_t;
+
+char *exflash_dir = NULL;
+
+//! mapped on demand so that it is not copied with the node state
+static exflash_image_t *exflash;
+
+static struct {
+	exflashpage_t page;
+	bool clean;
+	bool erased;
+	uint8_t data[EXFLASH_PAGE_SIZE];
+} buffer[2];
+static uint8_t selected; // buffer used by the current op
+
+static exflash_stats_t stats;
+
+// request waiting for its done event in virtual time
+static sos_pid_t reqPid;
+static uint8_t reqMsg;
+static uint16_t reqWord;
 
 static int8_t exflash_handler(void *state, Message *e);
 static mod_header_t mod_header SOS_MODULE_HEADER ={
@@ -15,43 +77,256 @@ state_size : 0,
 num_sub_func : 0,
 num_prov_func : 0,
 module_handler: exflash_handler,
-};  
+};
 
 #ifndef SOS_USE_PREEMPTION
 static sos_module_t exflash_module;
 #endif
 
+/**
+ * @brief charge the chip for t microseconds at current ua
+ */
+static uint32_t busy(uint32_t t, uint32_t ua)
+{
+	stats.busy_us += t;
+	stats.energy_nj += (uint64_t)t * ua * EXFLASH_MV / 1000000;
+	return t;
+}
+
+static uint32_t spi(uint16_t bytes)
+{
+	return busy((EXFLASH_CMD_BYTES + bytes) * EXFLASH_SPI_BYTE_US, EXFLASH_READ_UA);
+}
+
+//! program the selected buffer into its page
+static uint32_t flushBuffer()
+{
+	exflashpage_t page = buffer[selected].page;
+	uint8_t *p = exflash->page[page].page;
+	uint32_t t;
+	uint16_t i;
+
+	if (buffer[selected].erased) {
+		// programming only clears bits
+		for (i = 0; i < EXFLASH_PAGE_SIZE; i++) {
+			p[i] &= buffer[selected].data[i];
+		}
+		t = busy(EXFLASH_PROGRAM_US, EXFLASH_PROGRAM_UA);
+	} else {
+		memcpy(p, buffer[selected].data, EXFLASH_PAGE_SIZE);
+		exflash->erase_count[page]++;
+		stats.erase_cycles++;
+		t = busy(EXFLASH_ERASE_PROGRAM_US, EXFLASH_PROGRAM_UA);
+	}
+	stats.page_programs++;
+	buffer[selected].clean = true;
+	buffer[selected].erased = false;
+	return t + spi(0);
+}
+
+//! get the page into a buffer, writing back what the buffer held
+static uint32_t selectPage(exflashpage_t page, bool fill)
+{
+	uint32_t t = 0;
+
+	if (page == buffer[0].page) {
+		selected = 0;
+		return 0;
+	}
+	if (page == buffer[1].page) {
+		selected = 1;
+		return 0;
+	}
+	selected = !selected; // LRU with 2 buffers...
+	if (!buffer[selected].clean) {
+		t += flushBuffer();
+	}
+	buffer[selected].page = page;
+	buffer[selected].clean = true;
+	buffer[selected].erased = false;
+	if (fill) {
+		memcpy(buffer[selected].data, exflash->page[page].page, EXFLASH_PAGE_SIZE);
+		stats.page_reads++;
+		t += busy(EXFLASH_XFER_US, EXFLASH_READ_UA) + spi(0);
+	}
+	return t;
+}
+
+static void requestDone(void *arg)
+{
+	sos_pid_t pid = reqPid;
+
+	reqPid = NULL_PID;
+	post_short(pid, EXFLASH_PID, reqMsg, true, reqWord, 0);
+}
+
+/**
+ * @brief post the done event once the chip would have finished
+ */
+static int8_t finish(sos_pid_t pid, uint8_t msg, uint16_t word, uint32_t t)
+{
+	reqPid = pid;
+	reqMsg = msg;
+	reqWord = word;
+	if (vtime_enabled) {
+		vtime_schedule(vtime_now() + t, requestDone, NULL);
+	} else {
+		requestDone(NULL);
+	}
+	return SOS_OK;
+}
+
+static int8_t checkRequest(exflashpage_t page, exflashoffset_t offset, exflashoffset_t n)
+{
+	if (page >= EXFLASH_MAX_PAGES || offset >= EXFLASH_PAGE_SIZE ||
+			n > EXFLASH_PAGE_SIZE || offset + n > EXFLASH_PAGE_SIZE)
+		return -EINVAL;
+	if (reqPid != NULL_PID)
+		return -EBUSY;
+	return SOS_OK;
+}
+
 int8_t ker_exflash_read(sos_pid_t pid,
 		exflashpage_t page, exflashoffset_t offset,
 		void *reqdata, exflashoffset_t n)
 {
-	uint8_t *d = (uint8_t *) reqdata;
+	int8_t ret = checkRequest(page, offset, n);
+	uint32_t t;
 
-	memcpy(d, &(exflash[page].page[offset]), n);
-	post_short(pid, EXFLASH_PID, MSG_EXFLASH_READDONE, true, 0, 0);
-	return SOS_OK;
+	if (ret != SOS_OK) return ret;
+	t = selectPage(page, true);
+	memcpy(reqdata, &(buffer[selected].data[offset]), n);
+	stats.bytes_read += n;
+	return finish(pid, MSG_EXFLASH_READDONE, 0, t + spi(n));
 }
 
-int8_t ker_exflash_write(sos_pid_t pid,                       
-		exflashpage_t page, exflashoffset_t offset,           
-		void *reqdata, exflashoffset_t n)                     
-{                                                             
-	uint8_t *d = (uint8_t *) reqdata;
-	memcpy(&(exflash[page].page[offset]), d, n);
-	post_short(pid, EXFLASH_PID, MSG_EXFLASH_WRITEDONE, true, 0, 0);
-	return SOS_OK;
+int8_t ker_exflash_computeCrc(sos_pid_t pid,
+		exflashpage_t page,
+		exflashoffset_t offset,
+		exflashoffset_t n)
+{
+	int8_t ret = checkRequest(page, offset, n);
+	uint32_t t;
+
+	if (ret != SOS_OK) return ret;
+	if (n == 0) return finish(pid, MSG_EXFLASH_CRCDONE, 0, 0);
+	t = selectPage(page, true);
+	return finish(pid, MSG_EXFLASH_CRCDONE,
+			crcBytes(0, &(buffer[selected].data[offset]), n), t + spi(n));
 }
 
-int8_t ker_exflash_flushAll(sos_pid_t pid)
+int8_t ker_exflash_write(sos_pid_t pid,
+		exflashpage_t page, exflashoffset_t offset,
+		void *reqdata, exflashoffset_t n)
 {
-	post_short(pid, EXFLASH_PID, MSG_EXFLASH_FLUSHDONE, true, 0, 0);
-	return SOS_OK;
+	int8_t ret = checkRequest(page, offset, n);
+	uint32_t t;
+
+	if (ret != SOS_OK) return ret;
+	t = selectPage(page, true);
+	memcpy(&(buffer[selected].data[offset]), reqdata, n);
+	buffer[selected].clean = false;
+	stats.bytes_written += n;
+	return finish(pid, MSG_EXFLASH_WRITEDONE, 0, t + spi(n));
+}
+
+int8_t ker_exflash_erase(sos_pid_t pid, exflashpage_t page, uint8_t eraseKind)
+{
+	int8_t ret = checkRequest(page, 0, 0);
+	uint32_t t;
+
+	if (ret != SOS_OK) return ret;
+	// The buffer keeps whatever it held, the page is not read in
+	t = selectPage(page, false);
+	switch (eraseKind) {
+		case EXFLASH_ERASE:
+			memset(exflash->page[page].page, 0xff, EXFLASH_PAGE_SIZE);
+			exflash->erase_count[page]++;
+			stats.erase_cycles++;
+			t += busy(EXFLASH_ERASE_US, EXFLASH_PROGRAM_UA) + spi(0);
+			buffer[selected].erased = true;
+			break;
+		case EXFLASH_PREVIOUSLY_ERASED:
+			// We believe the user...
+			buffer[selected].erased = true;
+			break;
+		default:
+			break;
+	}
+	return finish(pid, MSG_EXFLASH_ERASEDONE, 0, t);
+}
+
+static int8_t syncOrFlush(sos_pid_t pid, uint8_t buf, uint8_t msg, bool compare)
+{
+	uint32_t t = 0;
+
+	if (!buffer[buf].clean) {
+		selected = buf;
+		t = flushBuffer();
+		if (compare) {
+			t += busy(EXFLASH_XFER_US, EXFLASH_READ_UA) + spi(0);
+		}
+	}
+	return finish(pid, msg, 0, t);
+}
+
+int8_t ker_exflash_sync(sos_pid_t pid, exflashpage_t page)
+{
+	int8_t ret = checkRequest(page, 0, 0);
+
+	if (ret != SOS_OK) return ret;
+	if (page == buffer[0].page) return syncOrFlush(pid, 0, MSG_EXFLASH_SYNCDONE, true);
+	if (page == buffer[1].page) return syncOrFlush(pid, 1, MSG_EXFLASH_SYNCDONE, true);
+	return finish(pid, MSG_EXFLASH_SYNCDONE, 0, 0);
 }
 
 int8_t ker_exflash_flush(sos_pid_t pid, exflashpage_t page)
 {
-	post_short(pid, EXFLASH_PID, MSG_EXFLASH_FLUSHDONE, true, 0, 0);
-	return SOS_OK;
+	int8_t ret = checkRequest(page, 0, 0);
+
+	if (ret != SOS_OK) return ret;
+	if (page == buffer[0].page) return syncOrFlush(pid, 0, MSG_EXFLASH_FLUSHDONE, false);
+	if (page == buffer[1].page) return syncOrFlush(pid, 1, MSG_EXFLASH_FLUSHDONE, false);
+	return finish(pid, MSG_EXFLASH_FLUSHDONE, 0, 0);
+}
+
+static int8_t syncOrFlushAll(sos_pid_t pid, uint8_t msg, bool compare)
+{
+	uint32_t t = 0;
+	uint8_t i;
+
+	if (reqPid != NULL_PID) return -EBUSY;
+	for (i = 0; i < 2; i++) {
+		if (!buffer[i].clean) {
+			selected = i;
+			t += flushBuffer();
+			if (compare) {
+				t += busy(EXFLASH_XFER_US, EXFLASH_READ_UA) + spi(0);
+			}
+		}
+	}
+	return finish(pid, msg, 0, t);
+}
+
+int8_t ker_exflash_syncAll(sos_pid_t pid)
+{
+	return syncOrFlushAll(pid, MSG_EXFLASH_SYNCDONE, true);
+}
+
+int8_t ker_exflash_flushAll(sos_pid_t pid)
+{
+	return syncOrFlushAll(pid, MSG_EXFLASH_FLUSHDONE, false);
+}
+
+void exflash_get_stats(exflash_stats_t *s)
+{
+	*s = stats;
+}
+
+uint32_t exflash_get_erase_count(exflashpage_t page)
+{
+	if (page >= EXFLASH_MAX_PAGES) return 0;
+	return exflash->erase_count[page];
 }
 
 static int8_t exflash_handler(void *state, Message *e)
@@ -59,8 +334,55 @@ static int8_t exflash_handler(void *state, Message *e)
 	return -EINVAL;
 }
 
+/**
+ * @brief map the image of this node, a new image starts out erased
+ */
+static void exflash_map(void)
+{
+	char name[256];
+	struct stat st;
+	bool fresh = true;
+	int fd;
+
+	if (exflash_dir == NULL) {
+		exflash = (exflash_image_t*)mmap(NULL, sizeof(exflash_image_t),
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	} else {
+		snprintf(name, sizeof(name), "%s/exflash_%d.img", exflash_dir, node_address);
+		fd = open(name, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			perror(name);
+			exit(1);
+		}
+		if (st.st_size == sizeof(exflash_image_t)) {
+			fresh = false;
+		} else if (ftruncate(fd, sizeof(exflash_image_t)) < 0) {
+			perror(name);
+			exit(1);
+		}
+		exflash = (exflash_image_t*)mmap(NULL, sizeof(exflash_image_t),
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	if (exflash == MAP_FAILED) {
+		fprintf(stderr, "cannot map external flash\n");
+		exit(1);
+	}
+	if (fresh) {
+		memset(exflash->page, 0xff, sizeof(exflash->page));
+		memset(exflash->erase_count, 0, sizeof(exflash->erase_count));
+	}
+}
+
 int8_t exflash_init()
 {
+	exflash_map();
+	// pretend we're on an invalid non-existent page
+	buffer[0].page = buffer[1].page = EXFLASH_MAX_PAGES;
+	buffer[0].clean = buffer[1].clean = true;
+	buffer[0].erased = buffer[1].erased = false;
+	memset(&stats, 0, sizeof(stats));
+	reqPid = NULL_PID;
 #ifdef SOS_USE_PREEMPTION
 	ker_register_module(sos_get_header_address(mod_header));
 #else
@@ -68,3 +390,17 @@ int8_t exflash_init()
 #endif
 	return SOS_OK;
 }
+
+void exflash_terminate(void)
+{
+	if (exflash == NULL) return;
+	if (stats.busy_us != 0) {
+		DEBUG("exflash: %u bytes read, %u written, %u page reads, %u programs, "
+				"%u erases, busy %llu us, %llu nJ\n",
+				stats.bytes_read, stats.bytes_written, stats.page_reads,
+				stats.page_programs, stats.erase_cycles,
+				(unsigned long long)stats.busy_us, (unsigned long long)stats.energy_nj);
+	}
+	munmap(exflash, sizeof(exflash_image_t));
+	exflash = NULL;
+}
@@ -2,21 +2,40 @@
 
 #define KB			1024
 
+#ifdef SIM_MULTINODE
+#include <sys/mman.h>
+#endif
+
 #ifdef EMU_MICA2
 #define FLASH_SIZE	128L		// size in KB
 #define PAGE_SIZE	256L		// size in bytes
+#endif
+
+#ifdef EMU_XYZ
+#define FLASH_SIZE	256		// size in KB
+#define PAGE_SIZE	2048	// size in bytes
+#endif
+
+#ifdef SIM_MULTINODE
+//! here is the flash, every node maps its own the first time it writes
+static uint8_t *flash_image_buf;
+//! flash addresses are offsets into the flash of the running node, from
+//! FLASH_BASE so that 0 is never a valid address
+#define FLASH_BASE	0x10000000L
+#define flash_ptr(addr)	(flash_image_buf + ((addr) - FLASH_BASE))
+#else
+#define flash_ptr(addr)	((uint8_t *)(addr))
 //! here is the flash
 static uint8_t flash_image_buf[FLASH_SIZE * KB];
+#endif
+
+#ifdef EMU_MICA2
 uint16_t pgm_read_word_far(uint32_t addr) { return (flash_image_buf[addr + 1] << 8) | flash_image_buf[addr]; }
 uint16_t pgm_read_word(uint32_t addr) { return pgm_read_word_far(addr); }
 uint8_t pgm_read_byte(uint32_t addr) { return flash_image_buf[addr]; }
 #endif
 
 #ifdef EMU_XYZ
-#define FLASH_SIZE	256		// size in KB
-#define PAGE_SIZE	2048	// size in bytes
-//! here is the flash
-static uint8_t flash_image_buf[FLASH_SIZE * KB];
 uint32_t pgm_read_word_far(uint32_t addr) { return (flash_image_buf[addr + 3] << 24) | (flash_image_buf[addr + 2] << 16) | (flash_image_buf[addr + 1] << 8) | flash_image_buf[addr]; }		// proper endianess ?
 uint32_t pgm_read_word(uint32_t addr) { return pgm_read_word_far(addr); }
 uint8_t pgm_read_byte(uint32_t addr) { return flash_image_buf[addr]; }
@@ -29,13 +48,42 @@ uint8_t pgm_read_byte(uint32_t addr) { return flash_image_buf[addr]; }
 
 uint32_t flash_init( void )
 {
-	uint32_t i;
 	DEBUG("flash_init\n");
+#ifdef SIM_MULTINODE
+	flash_image_buf = NULL;
+	return FLASH_BASE;
+#else
+	uint32_t i;
+
 	for(i = 0; i < FLASH_SIZE * KB; i++) {
 		flash_image_buf[i] = 0xff;
 	}
 	return (uint32_t)&(flash_image_buf[0]);
+#endif
+}
+
+#ifdef SIM_MULTINODE
+/**
+ * @brief map the flash of the running node, it starts out erased
+ */
+static void flash_map(void)
+{
+	uint32_t i;
+
+	if(flash_image_buf != NULL) return;
+	flash_image_buf = (uint8_t*)mmap(NULL, FLASH_SIZE * KB, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(flash_image_buf == MAP_FAILED) {
+		fprintf(stderr, "cannot map flash\n");
+		exit(1);
+	}
+	for(i = 0; i < FLASH_SIZE * KB; i++) {
+		flash_image_buf[i] = 0xff;
+	}
 }
+#else
+#define flash_map()
+#endif
 
 /*
 static void dump_flash_image(int32_t start, int32_t end)
@@ -70,10 +118,11 @@ void flash_write( uint32_t address, uint8_t *data, uint16_t len )
 	uint16_t i;
 	
 	DEBUG("***Flash buffer write addr = %u, length = %hu\n", address, len);
+	flash_map();
 	//dump_flash_image();
 	for( i = 0; i < len; i++ ) {
 		//DEBUG_SHORT("%x ", data[i]);
-		((uint8_t *)address)[i] = data[i];
+		flash_ptr(address)[i] = data[i];
 		//flash_image_buf[address+i] = data[i];
 	}
 	//DEBUG_SHORT("\n ");
@@ -86,9 +135,15 @@ void flash_read( uint32_t address, void *buf, uint16_t size )
 	uint8_t *data = buf;
 	
 	DEBUG("***Flash buffer read addr = %u, len = %hu\n", address, size);
+#ifdef SIM_MULTINODE
+	if(flash_image_buf == NULL) {
+		memset(buf, 0xff, size);
+		return;
+	}
+#endif
 	//dump_flash_image();
 	for( i = 0; i < size; i++ ) {
-		data[i] = ((uint8_t *)address)[i];
+		data[i] = flash_ptr(address)[i];
 		//data[i] = flash_image_buf[address+i];
 		//DEBUG_SHORT("%x ", data[i]);
 	}
@@ -106,6 +161,7 @@ void *FlashGetProgmem(uint32_t addr)
 {
 	//DEBUG("Get Progmem %d\n", addr);
 	//return &(flash_image_buf[addr]);
-	return (void *)addr;
+	flash_map();
+	return flash_ptr(addr);
 }
 
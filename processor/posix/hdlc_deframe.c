@@ -0,0 +1,82 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+/**
+ * @brief Bulk HDLC deframing, see hdlc_deframe.h
+ */
+#include <string.h>
+#include <hdlc_deframe.h>
+#include <hdlc.h>
+
+void hdlc_rx_init(hdlc_rx_t *rx, uint8_t *buf, uint16_t size)
+{
+	rx->buf = buf;
+	rx->size = size;
+	rx->len = 0;
+	rx->state = HDLC_RX_FRAME;
+	rx->dropped = 0;
+}
+
+static inline void hdlc_rx_append(hdlc_rx_t *rx, const uint8_t *src, int len)
+{
+	if ((int)rx->len + len > rx->size) {
+		rx->state = HDLC_RX_HUNT;
+		return;
+	}
+	memcpy(rx->buf + rx->len, src, len);
+	rx->len += len;
+}
+
+int hdlc_deframe(hdlc_rx_t *rx, const uint8_t *data, int n,
+		hdlc_frame_cb_t cb, void *arg)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + n;
+	int frames = 0;
+
+	while (p < end) {
+		const uint8_t *flag = memchr(p, HDLC_FLAG, end - p);
+		const uint8_t *stop = (flag != NULL) ? flag : end;
+
+		//! unescape everything up to the flag, one memcpy per run
+		if ((rx->state == HDLC_RX_ESCAPE) && (p < stop)) {
+			uint8_t b = *p++ ^ 0x20;
+			rx->state = HDLC_RX_FRAME;
+			hdlc_rx_append(rx, &b, 1);
+		}
+		while ((p < stop) && (rx->state == HDLC_RX_FRAME)) {
+			const uint8_t *esc = memchr(p, HDLC_CTR_ESC, stop - p);
+			uint8_t b;
+
+			if (esc == NULL) {
+				hdlc_rx_append(rx, p, stop - p);
+				break;
+			}
+			hdlc_rx_append(rx, p, esc - p);
+			if (esc + 1 == stop) {
+				if (rx->state == HDLC_RX_FRAME) {
+					rx->state = HDLC_RX_ESCAPE;
+				}
+				break;
+			}
+			b = esc[1] ^ 0x20;
+			hdlc_rx_append(rx, &b, 1);
+			p = esc + 2;
+		}
+
+		if (flag == NULL) {
+			break;
+		}
+		if (rx->state != HDLC_RX_FRAME) {
+			//! overflowed, or aborted by an escaped flag
+			rx->dropped++;
+		} else if (rx->len > 0) {
+			cb(arg, rx->buf, rx->len);
+			frames++;
+		}
+		rx->len = 0;
+		rx->state = HDLC_RX_FRAME;
+		p = flag + 1;
+	}
+	return frames;
+}
@@ -33,24 +33,19 @@
 
 extern uint16_t crcTable[256];  //!< this is defined in crc.c
 
+/**
+ * @brief CRC-CCITT (poly 0x1021) of one byte, one table lookup
+ */
 static inline uint16_t crcByte(uint16_t crc, uint8_t b)
 {
-	unsigned char i;
-	crc = crc ^ b << 8;
-	i = 8;
-	do
-		if (crc & 0x8000)
-			crc = crc << 1 ^ 0x1021;
-		else
-			crc = crc << 1;
-	while (--i);
-	return crc; 
-
-	/*
-	   uint8_t *magic = (uint8_t *)&crcTable[oldCrc >> 8 ^ byte];
-
-	   return (*magic) | ((uint8_t)oldCrc ^ (*(magic + 1))) << 8;
-	 */
+	return crcTable[(uint8_t)(crc >> 8 ^ b)] ^ (uint16_t)(crc << 8);
 }
 
+/**
+ * @brief CRC-CCITT of a buffer, four bytes per step (slice-by-4)
+ * @param crc running crc, 0 for a new frame
+ * @return same value as calling crcByte() on every byte of buf
+ */
+extern uint16_t crcBytes(uint16_t crc, const uint8_t *buf, uint16_t len);
+
 #endif
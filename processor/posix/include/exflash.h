@@ -2,11 +2,45 @@
 #ifndef _EXFLASH_H
 #define _EXFLASH_H
 #include <proc_msg_types.h>
+
+/**
+ * @brief emulated AT45DB external flash
+ *
+ * The pages live in an image file that is mapped into memory, one file
+ * per node, so the contents survive a restart.  Like the real chip, reads
+ * and writes go through two page buffers and only reach the image when a
+ * buffer is flushed.  Every operation is charged the chip's time and
+ * energy.  In virtual time the done event comes when the operation would
+ * be finished, otherwise right away.
+ */
+enum {
+	EXFLASH_MAX_PAGES = 2048,
+	EXFLASH_PAGE_SIZE = 264,
+	EXFLASH_PAGE_SIZE_LOG2 = 8 // For those who want to ignore the last 8 bytes
+};
+
+//! Used for eraseKind
+enum {
+	EXFLASH_ERASE,
+	EXFLASH_DONT_ERASE,
+	EXFLASH_PREVIOUSLY_ERASED
+};
+
 typedef uint16_t exflashpage_t;
 typedef uint16_t exflashoffset_t; /* 0 to EXFLASH_PAGE_SIZE - 1 */
 
+/**
+ * @brief directory of the flash images, NULL keeps the flash in memory
+ */
+extern char *exflash_dir;
+
 int8_t exflash_init();
 
+/**
+ * @brief unmap the image, its contents are kept
+ */
+void exflash_terminate(void);
+
 /**
  * @brief read n bytes from external flash
  * @param pid module id
@@ -21,23 +55,66 @@ int8_t ker_exflash_read(sos_pid_t pid,
 		exflashpage_t page, exflashoffset_t offset,
 		void *reqdata, exflashoffset_t n);
 
-/**                                                           
- * @brief write n bytes to external flash                     
- * @param pid module id                                       
- * @param page flash page number, MAX = EXFLASH_MAX_PAGES - 1 
- * @param offset starting byte in the page                    
- * @param reqdata data buffer                                 
- * @param n buffer size                                       
- * @return errno                                              
+/**
+ * @brief crc of n bytes of a page
+ * @event MSG_EXFLASH_CRCDONE param->byte = success code, param->word = crc
+ */
+int8_t ker_exflash_computeCrc(sos_pid_t pid,
+		exflashpage_t page,
+		exflashoffset_t offset,
+		exflashoffset_t n);
+
+/**
+ * @brief write n bytes to external flash
+ * @param pid module id
+ * @param page flash page number, MAX = EXFLASH_MAX_PAGES - 1
+ * @param offset starting byte in the page
+ * @param reqdata data buffer
+ * @param n buffer size
+ * @return errno
  * @event MSG_EXFLASH_WRITEDONE param->byte = success code (0, 1)
- */                                                           
-int8_t ker_exflash_write(sos_pid_t pid,                       
-		exflashpage_t page, exflashoffset_t offset,           
+ */
+int8_t ker_exflash_write(sos_pid_t pid,
+		exflashpage_t page, exflashoffset_t offset,
 		void *reqdata, exflashoffset_t n);
 
+/**
+ * @brief erase a page, or tell the driver the page need not be read
+ * @param eraseKind EXFLASH_ERASE, EXFLASH_DONT_ERASE or EXFLASH_PREVIOUSLY_ERASED
+ * @event MSG_EXFLASH_ERASEDONE param->byte = success code (0, 1)
+ */
+int8_t ker_exflash_erase(sos_pid_t pid, exflashpage_t page, uint8_t eraseKind);
+
+/**
+ * @brief flush a page and compare it against its buffer
+ * @event MSG_EXFLASH_SYNCDONE param->byte = success code (0, 1)
+ */
+int8_t ker_exflash_sync(sos_pid_t pid, exflashpage_t page);
+
 int8_t ker_exflash_flush(sos_pid_t pid, exflashpage_t page);
 
+int8_t ker_exflash_syncAll(sos_pid_t pid);
+
 int8_t ker_exflash_flushAll(sos_pid_t pid);
 
-#endif
+/**
+ * @brief what the flash has done since the node started
+ */
+typedef struct {
+	uint32_t bytes_read;     //!< bytes read out of the page buffers
+	uint32_t bytes_written;  //!< bytes written into the page buffers
+	uint32_t page_reads;     //!< pages loaded into a buffer
+	uint32_t page_programs;  //!< buffers programmed into a page
+	uint32_t erase_cycles;   //!< page erases, explicit or as part of a program
+	uint64_t busy_us;        //!< time the chip was busy
+	uint64_t energy_nj;      //!< energy the chip used while busy
+} exflash_stats_t;
+
+void exflash_get_stats(exflash_stats_t *stats);
 
+/**
+ * @brief erase cycles of one page over the life of the image
+ */
+uint32_t exflash_get_erase_count(exflashpage_t page);
+
+#endif
@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+#ifndef _HDLC_DEFRAME_H
+#define _HDLC_DEFRAME_H
+
+#include <sos_inttypes.h>
+
+/**
+ * @brief Bulk HDLC deframing for the PC side of the serial link
+ *
+ * hdlc_deframe() takes whatever a read() returned and splits it into
+ * frames.  Instead of running a state machine per byte it looks for the
+ * next flag with memchr(), then copies the runs between escape bytes
+ * into the frame buffer with memcpy().  A frame is everything between two
+ * flags with the escapes removed: protocol byte, payload and crc.  Empty
+ * frames (back to back flags) are skipped.
+ */
+
+enum {
+	HDLC_RX_FRAME = 0,   //!< collecting frame bytes
+	HDLC_RX_ESCAPE,      //!< last byte was HDLC_CTR_ESC
+	HDLC_RX_HUNT,        //!< frame too long, skipping to the next flag
+};
+
+typedef struct hdlc_rx {
+	uint8_t *buf;        //!< frame buffer, owned by the caller
+	uint16_t size;       //!< size of buf
+	uint16_t len;        //!< bytes of the current frame in buf
+	uint8_t state;
+	uint32_t dropped;    //!< frames discarded because they did not fit
+} hdlc_rx_t;
+
+/**
+ * @brief called once for every complete frame
+ * @param frame unescaped frame, only valid during the call
+ */
+typedef void (*hdlc_frame_cb_t)(void *arg, uint8_t *frame, uint16_t len);
+
+/**
+ * @brief start a deframer on a caller supplied buffer
+ *
+ * The first bytes received are treated as a frame even if no flag has
+ * been seen yet.
+ */
+extern void hdlc_rx_init(hdlc_rx_t *rx, uint8_t *buf, uint16_t size);
+
+/**
+ * @brief feed received bytes, frames may span several calls
+ * @return number of frames delivered to cb
+ */
+extern int hdlc_deframe(hdlc_rx_t *rx, const uint8_t *data, int n,
+		hdlc_frame_cb_t cb, void *arg);
+
+#endif
@@ -2,8 +2,15 @@
 #ifndef _MEASUREMENT_H
 #define _MEASUREMENT_H
 
+#ifdef SOS_IDLE_STATS
+extern void sched_idle_start(void);
+extern void sched_idle_end(void);
+#define SOS_MEASUREMENT_IDLE_START() sched_idle_start()
+#define SOS_MEASUREMENT_IDLE_END() sched_idle_end()
+#else
 #define SOS_MEASUREMENT_IDLE_START()
 #define SOS_MEASUREMENT_IDLE_END()
+#endif
 
 #define SOS_MEASUREMENT_DEQUEUE_START() 
 #define SOS_MEASUREMENT_DEQUEUE_END() 
@@ -21,5 +21,11 @@ extern bool uart_is_disabled();
 extern void uart_recv_int_(void);
 extern void uart_send_int_(void);
 
+/**
+ * @brief the socket hands over whole reads, uart.c takes them at once
+ */
+#define UART_BLOCK_RECV
+extern void uart_recv_block(const uint8_t *buf, uint16_t len);
+
 #endif // _UART_HAL_H
 
@@ -0,0 +1,92 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+#ifndef _VTIME_H
+#define _VTIME_H
+
+#include <sos_types.h>
+
+/**
+ * @brief Discrete-event virtual time for the PC platforms
+ *
+ * When virtual time is enabled, timer interrupts, radio deliveries and
+ * UART events are not driven by the wall clock.  They are placed in an
+ * event heap ordered by (time, source, sequence) and the clock jumps
+ * directly to the next event once the node has nothing else to do.
+ *
+ * Time is kept in microseconds.
+ */
+typedef uint64_t vtime_t;
+
+#define VTIME_NEVER    ((vtime_t)-1)
+
+typedef void (*vtime_handler_t)(void *arg);
+
+typedef struct vtime_event vtime_event_t;
+
+/**
+ * @brief true if the node runs in virtual time
+ */
+extern bool vtime_enabled;
+
+/**
+ * @brief enable virtual time
+ * @param seed       seed for all random decisions of the simulator
+ * @param stop_time  virtual time at which the node exits, VTIME_NEVER to run forever
+ */
+extern void vtime_init(uint32_t seed, vtime_t stop_time);
+
+/**
+ * @brief seed given to vtime_init()
+ */
+extern uint32_t vtime_seed(void);
+
+/**
+ * @brief current virtual time
+ */
+extern vtime_t vtime_now(void);
+
+/**
+ * @brief schedule a local event at absolute virtual time
+ * @return handle that can be given to vtime_cancel()
+ */
+extern vtime_event_t *vtime_schedule(vtime_t when, vtime_handler_t f, void *arg);
+
+/**
+ * @brief schedule an event that originates from another node
+ *
+ * Events at the same time are ordered by source and sequence number,
+ * so that the order does not depend on when the event was received.
+ */
+extern vtime_event_t *vtime_schedule_remote(vtime_t when, uint16_t src, uint32_t seq,
+		vtime_handler_t f, void *arg);
+
+/**
+ * @brief cancel a pending event
+ */
+extern void vtime_cancel(vtime_event_t *e);
+
+/**
+ * @brief time of the earliest pending event, VTIME_NEVER if there is none
+ */
+extern vtime_t vtime_next(void);
+
+/**
+ * @brief run the earliest event if it is safe to do so
+ * @return false if there is no event that can run yet
+ */
+extern bool vtime_run_next(void);
+
+/**
+ * @brief hooks for synchronizing with other simulated nodes
+ *
+ * horizon() returns the time before which no more remote events can
+ * arrive.  Only events strictly earlier than the horizon are executed.
+ * blocked() is called with the time of the next pending event when the
+ * node cannot advance, advanced() after each time the clock moved.
+ */
+extern void vtime_set_sync(vtime_t (*horizon)(void),
+		void (*blocked)(vtime_t next),
+		void (*advanced)(vtime_t now));
+
+#endif // _VTIME_H
@@ -5,6 +5,8 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <hardware.h>
+#include <vtime.h>
 #ifdef MAX
 #undef MAX
 #endif
@@ -24,6 +26,8 @@ typedef struct {
 typedef struct {
 	int timeout;           // timeout in milliseconds
 	struct timeval starttime;
+	vtime_t start_vtime;   // start time in virtual time mode
+	vtime_event_t *event;  // pending expiry in virtual time mode
 	void (*callback)(void);
 } timeout_callback;
 
@@ -56,6 +60,14 @@ static void call_timeout_callback( void )
 	callback();
 }
 
+static void vtime_timeout(void *arg)
+{
+	to_callback.event = NULL;
+	if( to_callback.callback != NULL ) {
+		call_timeout_callback();
+	}
+}
+
 
 void interrupt_add_read_fd(int fd, void (*callback)(int) )
 {
@@ -109,6 +121,9 @@ int interrupt_get_elapsed_time( void )
 	if(to_callback.callback == NULL) {
 		return 0;
 	}
+	if( vtime_enabled ) {
+		return (int)((vtime_now() - to_callback.start_vtime) / 1000);
+	}
 	return elapsed_time(&(to_callback.starttime));
 }
 
@@ -116,6 +131,13 @@ void interrupt_set_timeout(int timeout, void (*callback)(void) )
 {
 	to_callback.timeout = timeout;
 	to_callback.callback = callback;
+	if( vtime_enabled ) {
+		vtime_cancel(to_callback.event);
+		to_callback.start_vtime = vtime_now();
+		to_callback.event = vtime_schedule(to_callback.start_vtime + (vtime_t)timeout * 1000,
+				vtime_timeout, NULL);
+		return;
+	}
 	gettimeofday(&(to_callback.starttime), NULL);
 }
 
@@ -129,13 +151,42 @@ void interrupt_add_callbacks( void (*callback)(void) )
 	num_callbacks++;
 }
 
-void interrupt_loop( void )
+/**
+ * @brief wait for input on the registered descriptors and run their callbacks
+ * @param to maximum time to wait, NULL to block
+ * @return number of ready descriptors, 0 on timeout
+ */
+static int dispatch_read_fds(struct timeval *to)
 {
 	int curr_sock_fd;
 	fd_set read_fds = master_fds;
+	int ret;
+
+	ret = select(fdmax+1, &read_fds, NULL, NULL, to);
+	if( ret == -1 ) {
+		perror("select");
+		exit(1);
+	}
+	for(curr_sock_fd = 0; ret > 0 && curr_sock_fd <= fdmax; curr_sock_fd++) {
+		if (FD_ISSET(curr_sock_fd, &read_fds)) {
+			int i;
+			for( i = 0; i < num_read_fd; i++ ) {
+				if(curr_sock_fd == r_list[i].fd ) {
+					(r_list[i].callback)(curr_sock_fd);
+					break;
+				}
+			}
+		}
+	}
+	return ret;
+}
+
+void interrupt_loop( void )
+{
 	struct timeval to = {0};
 	void_callback_t current_callback_list[NUM_CALLBACKS];
 	int current_num_callbacks = 0;
+	bool called = false;
 	int i;
 
 	int ret;
@@ -145,6 +196,7 @@ void interrupt_loop( void )
 	// Note the use of "while".  This is because callbacks will 
 	// generate more events.
 	while( num_callbacks != 0 ) {
+		called = true;
 		current_num_callbacks = num_callbacks;
 		for(i = 0; i < current_num_callbacks; i++ ) {
 			current_callback_list[i] = callback_list[i];
@@ -155,7 +207,31 @@ void interrupt_loop( void )
 			current_callback_list[i]();
 		}
 	}
+	// The callbacks may have posted messages (a send done, say), let the
+	// scheduler run them before blocking for input
+	if( called ) {
+		return;
+	}
+
 
+	if( vtime_enabled ) {
+#ifdef SIM_MULTINODE
+		// the other nodes of this process run while we are blocked
+		if( num_callbacks == 0 ) {
+			vtime_run_next();
+		}
+#else
+		struct timeval poll_to = {0};
+
+		// Pick up whatever input is already waiting, then either run
+		// the next event or block until another node lets us advance
+		dispatch_read_fds(&poll_to);
+		if( num_callbacks == 0 && vtime_run_next() == false ) {
+			dispatch_read_fds(NULL);
+		}
+#endif
+		return;
+	}
 
 	if(to_callback.callback != NULL) {
 		int to_int = to_callback.timeout - elapsed_time(&(to_callback.starttime));
@@ -170,29 +246,13 @@ void interrupt_loop( void )
 
 	//printf("fdmax = %d\n", fdmax);
 	if( to.tv_sec == 0 && to.tv_usec == 0 ) {
-		ret = select(fdmax+1, &read_fds, NULL, NULL, NULL );
+		ret = dispatch_read_fds(NULL);
 	} else {
-		ret = select(fdmax+1, &read_fds, NULL, NULL, &to );
+		ret = dispatch_read_fds(&to);
 	}
 
-	if( ret == -1 ) {
-		perror("select");
-		exit(1);
-	} else if( ret == 0 ) {
+	if( ret == 0 ) {
 		call_timeout_callback();
-	} else {
-		// adjust timeout value
-		for(curr_sock_fd = 0; curr_sock_fd <= fdmax; curr_sock_fd++) {
-			if (FD_ISSET(curr_sock_fd, &read_fds)) {
-				int i;
-				for( i = 0; i < num_read_fd; i++ ) {
-					if(curr_sock_fd == r_list[i].fd ) {
-						(r_list[i].callback)(curr_sock_fd);
-						break;
-					}
-				}
-			}
-		}
 	}
 }
 
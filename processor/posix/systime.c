@@ -1,5 +1,6 @@
 #include <hardware.h>
 #include <sys/time.h>
+#include <vtime.h>
 
 static struct timeval start_time;
 
@@ -19,6 +20,11 @@ uint32_t ker_systime32()
 {
 	uint32_t	avr_time;
     struct timeval t_now, t_result;
+
+    if( vtime_enabled ) {
+        // 8.68 us per tick, wrapping at the same point as the wall clock
+        return (uint32_t)(((vtime_now() * 25) / 217) % 0x7F000000);
+    }
     
     gettimeofday(&t_now, NULL);
     timersub(&t_now, &start_time, &t_result);
@@ -11,10 +11,26 @@
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
 
+#include <sos_info.h>
+#include <hdlc.h>
 #include <uart.h>
+#include <vtime.h>
 #include "uart_hal.h"
 
+//! time to shift out one byte at 57600 baud, used in virtual time mode
+#define UART_BYTE_TIME_US  174
+
+//! transmit buffer, one chunk holds an escaped frame of the longest message
+#define UART_TX_CHUNK      (2 * (HDLC_PROTOCOL_SIZE + SOS_MSG_HEADER_SIZE + UART_MAX_MSG_LEN + SOS_MSG_CRC_SIZE) + 2)
+//! frames sent with one writev()
+#ifndef UART_TX_CHUNKS
+#define UART_TX_CHUNKS     4
+#endif
+
 /**
  * @brief UART file id
  */
@@ -27,9 +43,90 @@ static volatile bool uart_status = false;
 static int uart_socket = -1;
 static int listen_sock = -1;
 
+/*
+ * Transmit buffer
+ *
+ * uart_setByte() only appends to the current chunk.  A chunk ends with
+ * its frame, when the driver disables the transmitter, or when it is
+ * full.  In real time the send interrupts of a whole frame run from one
+ * callback, and the frames started from within it share the writev()
+ * at its end.  In virtual time each byte still takes its byte time and
+ * the frame is written when it is complete.
+ */
+static uint8_t tx_buf[UART_TX_CHUNKS][UART_TX_CHUNK];
+static struct iovec tx_iov[UART_TX_CHUNKS];
+static uint8_t tx_chunk;            //!< chunk being filled
+static bool tx_pending;             //!< a byte was sent since the last send interrupt
+static bool tx_draining;            //!< uart_tx_drain() is scheduled or running
+
+static void uart_tx_flush(void)
+{
+	struct iovec *iov = tx_iov;
+	int cnt = tx_chunk;
+
+	if(tx_chunk < UART_TX_CHUNKS && tx_iov[tx_chunk].iov_len != 0) {
+		cnt++;
+	}
+
+	while(uart_socket >= 0 && cnt > 0) {
+		ssize_t n = writev(uart_socket, iov, cnt);
+		if(n < 0) {
+			if(errno == EAGAIN || errno == EINTR) {
+				struct pollfd pfd = {uart_socket, POLLOUT, 0};
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			DEBUG("remote connection to UART broken, exiting...\n");
+			hardware_exit(1);
+		}
+		//! skip what was written, the socket may take part of a chunk
+		while(cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0) {
+			iov->iov_base = (uint8_t*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	for(tx_chunk = 0; tx_chunk < UART_TX_CHUNKS; tx_chunk++) {
+		tx_iov[tx_chunk].iov_base = tx_buf[tx_chunk];
+		tx_iov[tx_chunk].iov_len = 0;
+	}
+	tx_chunk = 0;
+}
+
+//! close the current chunk, flush when no chunk is left
+static void uart_tx_next_chunk(void)
+{
+	if(tx_iov[tx_chunk].iov_len == 0) {
+		return;
+	}
+	if(++tx_chunk == UART_TX_CHUNKS) {
+		uart_tx_flush();
+	}
+}
+
+static void uart_tx_drain(void)
+{
+	while(tx_pending) {
+		tx_pending = false;
+		uart_send_int_();
+	}
+	tx_draining = false;
+	uart_tx_flush();
+}
+
 void uart_disable_tx()
 {
 	uart_status = false;
+	//! end of a frame
+	if(tx_draining) {
+		uart_tx_next_chunk();
+	} else {
+		uart_tx_flush();
+	}
 }
 
 void uart_enable_tx()
@@ -45,15 +142,27 @@ bool uart_is_disabled()
 	return ret_val;
 }
 
+static void uart_vtime_send_done(void *arg)
+{
+	uart_send_int_();
+}
+
 void uart_setByte(uint8_t b)
 {
-	if(uart_socket >= 0) {
-		if(write(uart_socket, &b, 1) != 1) {
-			DEBUG("remote connection to UART broken, exiting...\n");
-			hardware_exit(1);
-		}
+	if(tx_iov[tx_chunk].iov_len == UART_TX_CHUNK) {
+		uart_tx_next_chunk();
+	}
+	tx_buf[tx_chunk][tx_iov[tx_chunk].iov_len++] = b;
+
+	if( vtime_enabled ) {
+		vtime_schedule(vtime_now() + UART_BYTE_TIME_US, uart_vtime_send_done, NULL);
+		return;
+	}
+	tx_pending = true;
+	if(!tx_draining) {
+		tx_draining = true;
+		interrupt_add_callbacks(uart_tx_drain);
 	}
-	interrupt_add_callbacks(uart_send_int_);
 }
 
 
@@ -65,18 +174,12 @@ static void uart_recv_thread(int fd)
 {
 	uint8_t d[1024];
 	int cnt;
-	int i = 0;
-
-	while( true ) {
-		cnt = read(uart_socket, d, 1024);
-		if(cnt > 0){
-			for(i = 0; i < cnt; i++){
-				recv_buf = d[i];
-				uart_recv_int_();
-			}
-		} else {
-			break;
-		}
+
+	//! one read per wakeup, what is left waits in the socket until the
+	//! scheduler has run the messages of this one
+	cnt = read(uart_socket, d, 1024);
+	if(cnt > 0){
+		uart_recv_block(d, cnt);
 	}
 }
 
@@ -91,6 +194,7 @@ void uart_hardware_init(void)
 	struct sockaddr_in server_addr;
 	struct sockaddr_in remoteaddr;  //! Client address
 
+	uart_tx_flush();
 	//! check to see whether uart is required
 	if(uart_tcp_port < 0) return;
 	//! open TCP server
@@ -0,0 +1,190 @@
+/* -*- Mode: C; tab-width:4 -*- */
+/* ex: set ts=4 shiftwidth=4 softtabstop=4 cindent: */
+
+/**
+ * @brief discrete-event virtual time engine
+ *
+ * The pending events are kept in a binary min-heap.  Cancelled events
+ * stay in the heap and are dropped when they reach the top.
+ */
+#include <hardware.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sos_info.h>
+#include <vtime.h>
+
+#define VTIME_HEAP_INIT_SIZE  64
+
+struct vtime_event {
+	vtime_t time;
+	uint16_t src;
+	uint32_t seq;
+	bool cancelled;
+	vtime_handler_t f;
+	void *arg;
+};
+
+bool vtime_enabled = false;
+
+static vtime_t vnow = 0;
+static vtime_t vstop = VTIME_NEVER;
+static uint32_t vseed = 0;
+static uint32_t local_seq = 0;
+
+static vtime_event_t **heap = NULL;
+static int heap_len = 0;
+static int heap_size = 0;
+
+static vtime_t (*sync_horizon)(void) = NULL;
+static void (*sync_blocked)(vtime_t next) = NULL;
+static void (*sync_advanced)(vtime_t now) = NULL;
+
+static bool event_before(vtime_event_t *a, vtime_event_t *b)
+{
+	if( a->time != b->time ) return a->time < b->time;
+	if( a->src != b->src ) return a->src < b->src;
+	return a->seq < b->seq;
+}
+
+static void heap_push(vtime_event_t *e)
+{
+	int i;
+	if( heap_len == heap_size ) {
+		heap_size = (heap_size == 0)? VTIME_HEAP_INIT_SIZE : heap_size * 2;
+		heap = (vtime_event_t**)realloc(heap, heap_size * sizeof(vtime_event_t*));
+		if( heap == NULL ) {
+			fprintf(stderr, "vtime: not enough memory for event heap\n");
+			exit(1);
+		}
+	}
+	i = heap_len++;
+	while( i > 0 ) {
+		int parent = (i - 1) / 2;
+		if( !event_before(e, heap[parent]) ) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = e;
+}
+
+static vtime_event_t *heap_pop(void)
+{
+	vtime_event_t *top;
+	vtime_event_t *last;
+	int i = 0;
+
+	if( heap_len == 0 ) return NULL;
+	top = heap[0];
+	last = heap[--heap_len];
+	while( true ) {
+		int child = 2 * i + 1;
+		if( child >= heap_len ) break;
+		if( child + 1 < heap_len && event_before(heap[child + 1], heap[child]) ) {
+			child++;
+		}
+		if( !event_before(heap[child], last) ) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+//! drop cancelled events sitting at the top of the heap
+static vtime_event_t *heap_top(void)
+{
+	while( heap_len > 0 && heap[0]->cancelled ) {
+		free(heap_pop());
+	}
+	return (heap_len > 0)? heap[0] : NULL;
+}
+
+void vtime_init(uint32_t seed, vtime_t stop_time)
+{
+	vtime_enabled = true;
+	vseed = seed;
+	vstop = stop_time;
+	vnow = 0;
+	srand(seed + node_address);
+}
+
+uint32_t vtime_seed(void)
+{
+	return vseed;
+}
+
+vtime_t vtime_now(void)
+{
+	return vnow;
+}
+
+vtime_event_t *vtime_schedule_remote(vtime_t when, uint16_t src, uint32_t seq,
+		vtime_handler_t f, void *arg)
+{
+	vtime_event_t *e = (vtime_event_t*)malloc(sizeof(vtime_event_t));
+	if( e == NULL ) {
+		fprintf(stderr, "vtime: not enough memory for event\n");
+		exit(1);
+	}
+	if( when < vnow ) when = vnow;
+	e->time = when;
+	e->src = src;
+	e->seq = seq;
+	e->cancelled = false;
+	e->f = f;
+	e->arg = arg;
+	heap_push(e);
+	return e;
+}
+
+vtime_event_t *vtime_schedule(vtime_t when, vtime_handler_t f, void *arg)
+{
+	return vtime_schedule_remote(when, node_address, local_seq++, f, arg);
+}
+
+void vtime_cancel(vtime_event_t *e)
+{
+	if( e != NULL ) e->cancelled = true;
+}
+
+vtime_t vtime_next(void)
+{
+	vtime_event_t *e = heap_top();
+	return (e != NULL)? e->time : VTIME_NEVER;
+}
+
+bool vtime_run_next(void)
+{
+	vtime_event_t *e = heap_top();
+	vtime_t horizon = (sync_horizon != NULL)? sync_horizon() : VTIME_NEVER;
+
+	if( e == NULL || (horizon != VTIME_NEVER && e->time >= horizon) ) {
+		if( sync_blocked != NULL ) {
+			sync_blocked((e != NULL)? e->time : VTIME_NEVER);
+		}
+		return false;
+	}
+	if( vstop != VTIME_NEVER && e->time >= vstop ) {
+		vnow = vstop;
+		hardware_exit(0);
+	}
+	heap_pop();
+	if( e->time > vnow ) {
+		vnow = e->time;
+		if( sync_advanced != NULL ) {
+			sync_advanced(vnow);
+		}
+	}
+	e->f(e->arg);
+	free(e);
+	return true;
+}
+
+void vtime_set_sync(vtime_t (*horizon)(void),
+		void (*blocked)(vtime_t next),
+		void (*advanced)(vtime_t now))
+{
+	sync_horizon = horizon;
+	sync_blocked = blocked;
+	sync_advanced = advanced;
+}
@@ -9,6 +9,7 @@
 #include <melfloader.h>
 #include <minielfendian.h>
 #include <flash.h>
+#include <malloc.h>
 
 
 //----------------------------------------------------------
@@ -21,10 +22,38 @@ static int8_t melf_read_symtab_shdr(melf_desc_t* mdesc, Melf_Shdr* symshdr);
 static int8_t melf_read_symbol(melf_desc_t* mdesc, Melf_Shdr* symshdr, 
 			       Melf_Word symndx, Melf_Sym* sym);
 static int8_t melf_read_rela(melf_desc_t* mdesc, Melf_Shdr* relashdr, 
-			     Melf_Word relandx, Melf_Rela* rela);
+			     Melf_Word relandx, Melf_Rela* rela, Melf_Word num);
 static int8_t melf_relocate(melf_desc_t* mdesc, Melf_Shdr* relashdr, 
 			    Melf_Shdr* progshdr, Melf_Shdr* symshdr);
 
+//----------------------------------------------------------
+// RELOCATION STATE
+//----------------------------------------------------------
+enum {
+  MELF_RELA_BATCH = 8,       //!< Relocation records read with one codemem access
+  MELF_SYM_CACHE  = 8,       //!< Symbols remembered across relocation records
+  MELF_PAGE_NONE  = 0xffff,
+};
+
+/**
+ * \brief RAM copy of the code page that is being relocated
+ *
+ * elftomini writes the relocation records sorted by offset, so the records
+ * of one page come together and the page is read and written back once.
+ * Unsorted files still load, they just switch pages more often.
+ */
+typedef struct {
+  uint8_t *buf;          //!< FLASHMEM_PAGE_SIZE + MELF_RELOC_SLACK bytes
+  uint16_t start;        //!< Offset of buf[0] in the code memory, or MELF_PAGE_NONE
+  uint16_t lo;           //!< Patched range of buf, lo == hi if clean
+  uint16_t hi;
+} melf_page_t;
+
+typedef struct {
+  Melf_Word ndx;
+  Melf_Sym sym;
+} melf_symcache_t;
+
 
 
 
@@ -180,28 +209,110 @@ static int8_t melf_read_symbol(melf_desc_t* mdesc, Melf_Shdr* symshdr, Melf_Word
   return SOS_OK;
 }
 //----------------------------------------------------------
-static int8_t melf_read_rela(melf_desc_t* mdesc, Melf_Shdr* relashdr, Melf_Word relandx, Melf_Rela* rela)
+static int8_t melf_read_rela(melf_desc_t* mdesc, Melf_Shdr* relashdr, Melf_Word relandx, 
+			     Melf_Rela* rela, Melf_Word num)
 {
-  if (ker_codemem_read(mdesc->cmhdl, KER_DFT_LOADER_PID, (void*)rela, sizeof(Melf_Rela),
+  Melf_Word i;
+  if (ker_codemem_read(mdesc->cmhdl, KER_DFT_LOADER_PID, (void*)rela, num * sizeof(Melf_Rela),
 		       relashdr->sh_offset + relandx * sizeof(Melf_Rela)) != SOS_OK)
     return -EFAULT;
-  entoh_Rela(rela);
+  for (i = 0; i < num; i++){
+    entoh_Rela(&rela[i]);
+  }
   return SOS_OK;
 }
 //----------------------------------------------------------
+static void melf_page_flush(melf_desc_t* mdesc, melf_page_t* page)
+{
+  if (page->lo < page->hi){
+    ker_codemem_write(mdesc->cmhdl, KER_DFT_LOADER_PID, (void*)(page->buf + page->lo),
+		      page->hi - page->lo, page->start + page->lo);
+  }
+  page->lo = page->hi = 0;
+}
+//----------------------------------------------------------
+static uint8_t* melf_page_get(melf_desc_t* mdesc, melf_page_t* page, uint16_t offset)
+{
+  uint16_t start = offset & ~((uint16_t)(FLASHMEM_PAGE_SIZE - 1));
+
+  if (start != page->start){
+    melf_page_flush(mdesc, page);
+    // The slack lets a patch run over the end of the page
+    ker_codemem_read(mdesc->cmhdl, KER_DFT_LOADER_PID, (void*)page->buf, 
+		     FLASHMEM_PAGE_SIZE + MELF_RELOC_SLACK, start);
+    page->start = start;
+  }
+  return page->buf + (offset - start);
+}
+//----------------------------------------------------------
+static Melf_Sym* melf_symcache_get(melf_desc_t* mdesc, melf_symcache_t* cache, 
+				   Melf_Shdr* symshdr, Melf_Word symndx)
+{
+  melf_symcache_t* e = &cache[symndx % MELF_SYM_CACHE];
+
+  if (e->ndx != symndx){
+    if (melf_read_symbol(mdesc, symshdr, symndx, &(e->sym)) != SOS_OK){
+      return NULL;
+    }
+    e->ndx = symndx;
+  }
+  return &(e->sym);
+}
+//----------------------------------------------------------
 static int8_t melf_relocate(melf_desc_t* mdesc, Melf_Shdr* relashdr, 
 			    Melf_Shdr* progshdr, Melf_Shdr* symshdr)
 {
-  Melf_Word relandx;
-  Melf_Rela rela;
-  Melf_Sym sym;
+  Melf_Word relandx, numrela, i, n;
+  Melf_Rela rela[MELF_RELA_BATCH];
+  melf_symcache_t symcache[MELF_SYM_CACHE];
+  melf_page_t page;
+
+  page.buf = (uint8_t*)ker_malloc(FLASHMEM_PAGE_SIZE + MELF_RELOC_SLACK, KER_DFT_LOADER_PID);
+  if (page.buf == NULL){
+    return -ENOMEM;
+  }
+  page.start = MELF_PAGE_NONE;
+  page.lo = page.hi = 0;
+  for (i = 0; i < MELF_SYM_CACHE; i++){
+    // An index that can never hit in this slot
+    symcache[i].ndx = (i == 0) ? 1 : 0;
+  }
 
-  for (relandx = 0; relandx < (relashdr->sh_size/sizeof(Melf_Rela)); relandx++){
-    melf_read_rela(mdesc, relashdr, relandx, &rela);
-    melf_read_symbol(mdesc, symshdr, rela.r_symbol, &sym);
+  numrela = relashdr->sh_size/sizeof(Melf_Rela);
+  for (relandx = 0; relandx < numrela; relandx += n){
+    n = numrela - relandx;
+    if (n > MELF_RELA_BATCH){
+      n = MELF_RELA_BATCH;
+    }
+    if (melf_read_rela(mdesc, relashdr, relandx, rela, n) != SOS_OK){
+      break;
+    }
+    for (i = 0; i < n; i++){
+      Melf_Addr reloc_offset = (Melf_Addr)(progshdr->sh_offset) + rela[i].r_offset;
+      uint8_t *instr;
+      Melf_Sym *sym;
+      int8_t patched;
+
+      if ((sym = melf_symcache_get(mdesc, symcache, symshdr, rela[i].r_symbol)) == NULL){
+	continue;
+      }
+      instr = melf_page_get(mdesc, &page, reloc_offset);
+      patched = melf_arch_relocate(mdesc, &rela[i], sym, progshdr, instr);
+      if (patched > 0){
+	uint16_t lo = reloc_offset - page.start;
+	if (page.lo == page.hi){
+	  page.lo = lo;
+	  page.hi = lo + patched;
+	} else {
+	  if (lo < page.lo) page.lo = lo;
+	  if (lo + patched > page.hi) page.hi = lo + patched;
+	}
+      }
+    }
     watchdog_reset();
-    melf_arch_relocate(mdesc, &rela, &sym, progshdr);
   }
+  melf_page_flush(mdesc, &page);
+  ker_free(page.buf);
   ker_codemem_flush(mdesc->cmhdl, KER_DFT_LOADER_PID);
   return SOS_OK;
 }
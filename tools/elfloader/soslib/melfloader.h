@@ -54,9 +54,20 @@ mod_header_t* melf_get_mod_header(unsigned char* image_buf);
  * \param rela  Relocation Record
  * \param sym   Symbol Record
  * \param progshdr Program Section Header
+ * \param instr RAM copy of the code at the relocation site, at least MELF_RELOC_SLACK bytes
+ * \return Number of bytes of instr that were patched, negative upon failure
+ *
+ * The loader reads the code a page at a time and writes it back once all
+ * the relocations of that page are applied, so this routine must not touch
+ * code memory itself.
  */
 int8_t melf_arch_relocate(melf_desc_t* mdesc, Melf_Rela* rela, 
-			       Melf_Sym* sym, Melf_Shdr* progshdr);
+			  Melf_Sym* sym, Melf_Shdr* progshdr, uint8_t* instr);
+
+/**
+ * \brief Longest patch made by melf_arch_relocate() (R_AVR_CALL)
+ */
+#define MELF_RELOC_SLACK 4
 
 /**
  * \brief Initialize the Mini-ELF Descritpor and read the Mini-ELF header
@@ -9,7 +9,7 @@
 #include <codemem.h>
 
 //----------------------------------------------------------
-int8_t melf_arch_relocate(melf_desc_t* mdesc, Melf_Rela* rela, Melf_Sym* sym, Melf_Shdr* progshdr)
+int8_t melf_arch_relocate(melf_desc_t* mdesc, Melf_Rela* rela, Melf_Sym* sym, Melf_Shdr* progshdr, uint8_t* instr)
 {
 	return 0;
 }
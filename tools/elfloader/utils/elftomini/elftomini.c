@@ -63,6 +63,7 @@ typedef struct {
 static int printusage();
 static int convElfToMiniFile(char* elffilename, char* melffilename);
 static Melf_Data* convRelaScn(Elf_Scn* relascn, symbol_map_t* symmap); 
+static int cmpRelaOffset(const void* lhs, const void* rhs);
 static Melf_Data* convSymScn(symbol_map_t* symmap);
 static Melf_Data* convProgbitsScn(Elf_Scn* progbitsscn);
 static int initSymbolMap(symbol_map_t* symmap, Elf_Scn* symtabscn);
@@ -520,6 +521,8 @@ static Melf_Data* convRelaScn(Elf_Scn* relascn, symbol_map_t* symmap)
 	mreladata->d_numData++;
       }
       mreladata->d_size = mreladata->d_numData * sizeof(Melf_Rela);
+      // The node relocates a code page at a time, keep the records of a page together
+      qsort(mrela, mreladata->d_numData, sizeof(Melf_Rela), cmpRelaOffset);
       symmap->mreladata = mreladata;
       return mreladata;
     }
@@ -529,6 +532,18 @@ static Melf_Data* convRelaScn(Elf_Scn* relascn, symbol_map_t* symmap)
   return NULL;
 }
 
+//---------------------------------------------------------------------
+static int cmpRelaOffset(const void* lhs, const void* rhs)
+{
+  const Melf_Rela* l = (const Melf_Rela*)lhs;
+  const Melf_Rela* r = (const Melf_Rela*)rhs;
+
+  if (l->r_offset != r->r_offset){
+    return (l->r_offset < r->r_offset) ? -1 : 1;
+  }
+  return 0;
+}
+
 //---------------------------------------------------------------------
 static int addMelfSymbol(symbol_map_t* symmap, int elfsymndx)
 {
@@ -18,6 +18,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
 #include <soself.h>
 
 #include <avrinstr.h>
@@ -35,41 +38,56 @@
 // STATIC FUNCTIONS
 static void printusage();
 static int avrsandbox(file_desc_t *fdesc, char* outFileName, uint32_t startaddr, uint16_t calladdr);
+static int sandbox_file(char* inputFileName, char* outFileName, int ipstartaddr, uint16_t calladdr);
+static int sandbox_files(char** inputFileNames, int numfiles, int numjobs, int ipstartaddr, uint16_t calladdr);
+static double now_sec();
 
 //----------------------------------------------------------------------------
 int main(int argc, char** argv)
 {
   int ch;
-  uint32_t startaddr;
   uint16_t calladdr;
   char *inputFileName, *outFileName;
   int ipstartaddr;
-  file_desc_t fdesc;
+  int numjobs;
   
   ipstartaddr = -1;
   inputFileName = NULL;
-  startaddr = 0;
   calladdr = 0;
   outFileName = NULL;
+  numjobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
 
 
-  while ((ch = getopt(argc, argv, "s:f:o:c:w:h")) != -1){
+  while ((ch = getopt(argc, argv, "s:f:o:c:j:w:h")) != -1){
     switch (ch){
     case 's': ipstartaddr = (int)strtol(optarg, NULL, 0); break;
     case 'c': calladdr = (uint16_t)((uint32_t)(strtol(optarg, NULL, 0)) >> 1); break;
     case 'f': inputFileName = optarg; break;
     case 'o': outFileName = optarg; break;
+    case 'j': numjobs = (int)strtol(optarg, NULL, 0); break;
     case 'h': printusage(); return 0;
     case '?': printusage(); return 0;
     }
   }
   
+  // Many input files, one process each
+  if ((NULL == inputFileName) && (optind < argc)){
+    return sandbox_files(&argv[optind], argc - optind, numjobs, ipstartaddr, calladdr);
+  }
+
   // Check input file name
   if (NULL == inputFileName){
     printusage();
     return 0;
   }
 
+  return sandbox_file(inputFileName, outFileName, ipstartaddr, calladdr);
+}
+//----------------------------------------------------------------------------
+static int sandbox_file(char* inputFileName, char* outFileName, int ipstartaddr, uint16_t calladdr)
+{
+  uint32_t startaddr;
+  file_desc_t fdesc;
 
   // Open input file
   if (obj_file_open(inputFileName, &fdesc) != 0){
@@ -101,6 +119,95 @@ int main(int argc, char** argv)
   return 0;
 }
 //----------------------------------------------------------------------------
+// Sandbox every file in its own process, at most numjobs at a time.
+// foo.elf is written to foo.sbx, as the module Makerules expect.
+static int sandbox_files(char** inputFileNames, int numfiles, int numjobs, int ipstartaddr, uint16_t calladdr)
+{
+  pid_t* pids;
+  double* started;
+  double start;
+  int next, running, failed;
+
+  if (numjobs < 1) numjobs = 1;
+  pids = calloc(numfiles, sizeof(pid_t));
+  started = calloc(numfiles, sizeof(double));
+  if ((NULL == pids) || (NULL == started)){
+    fprintf(stderr, "avrsandbox: calloc -> Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  start = now_sec();
+  next = 0;
+  running = 0;
+  failed = 0;
+  while ((next < numfiles) || (running > 0)){
+    pid_t pid;
+    int status, i;
+
+    if ((next < numfiles) && (running < numjobs)){
+      char* outFileName;
+      char* ext;
+
+      if ((outFileName = malloc(strlen(inputFileNames[next]) + 5)) == NULL){
+	fprintf(stderr, "avrsandbox: malloc -> Out of memory.\n");
+	exit(EXIT_FAILURE);
+      }
+      strcpy(outFileName, inputFileNames[next]);
+      if ((ext = strrchr(outFileName, '.')) != NULL)
+	*ext = '\0';
+      strcat(outFileName, ".sbx");
+
+      fflush(stdout);
+      started[next] = now_sec();
+      pid = fork();
+      if (pid < 0){
+	perror("fork:");
+	exit(EXIT_FAILURE);
+      }
+      if (0 == pid){
+	// The per instruction trace is only useful for one file at a time
+	if (freopen("/dev/null", "w", stdout) == NULL)
+	  exit(EXIT_FAILURE);
+	exit(sandbox_file(inputFileNames[next], outFileName, ipstartaddr, calladdr));
+      }
+      free(outFileName);
+      pids[next++] = pid;
+      running++;
+      continue;
+    }
+
+    if ((pid = wait(&status)) < 0){
+      perror("wait:");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < next; i++){
+      if (pids[i] != pid) continue;
+      running--;
+      if (WIFEXITED(status) && (WEXITSTATUS(status) == 0)){
+	printf("%s: done in %.3f s\n", inputFileNames[i], now_sec() - started[i]);
+      }
+      else{
+	printf("%s: FAILED\n", inputFileNames[i]);
+	failed++;
+      }
+      break;
+    }
+  }
+
+  printf("==== SANDBOX DONE ======\n");
+  printf("%d files, %d failed, %d jobs, %.3f s\n", numfiles, failed, numjobs, now_sec() - start);
+  free(pids);
+  free(started);
+  return (failed > 0) ? EXIT_FAILURE : 0;
+}
+//----------------------------------------------------------------------------
+static double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+//----------------------------------------------------------------------------
 // Top level function
 static int avrsandbox(file_desc_t *fdesc, char* outFileName, uint32_t startaddr, uint16_t calladdr)
 {
@@ -347,6 +454,8 @@ static int avrsandbox(file_desc_t *fdesc, char* outFileName, uint32_t startaddr,
    printf("-c <calladdr>: Byte address of the memmap checker.\n");
    printf("-f <Filename>: Input SOS binary file.\n");
    printf("-o <OutputFilename>: Name of the output file.\n");
+   printf("avrsandbox [-s <startaddr>] [-c <calladdr>] [-j <jobs>] <file.elf> ...\n");
+   printf("-j <jobs>: Number of files sandboxed in parallel. Each file.elf is written to file.sbx.\n");
    return;  
  }
 //-------------------------------------------------------------------
@@ -5,6 +5,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include <linklist.h>
@@ -35,28 +36,42 @@ typedef struct _succ_str {
   uint8_t flag;            // Same flag used in basic block
 } succ_t;
 
+// Block boundaries in the order they are found
+typedef struct _blkbnd_str {
+  uint32_t* addr;
+  int cnt;
+  int size;
+} blkbnd_t;
+
+// The program from the start address on, decoded once
+typedef struct _prog_str {
+  avr_instr_t* instr;
+  int numinstr;
+  uint32_t startaddr;
+} prog_t;
+
 #define	Flip_int16(type)  (((type >> 8) & 0x00ff) | ((type << 8) & 0xff00))
 
 
 //--------------------------------------------------------------
 // STATIC FUNCTIONS
 //--------------------------------------------------------------
-static int8_t insert_blkbnd(bblklist_t* blist, uint32_t addr);
-static void find_block_boundaries(file_desc_t* fdesc, bblklist_t* blist, uint32_t startaddr);
-static uint8_t find_next_instr_size(file_desc_t* fdesc);
-static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, uint32_t startaddr);
-static void fill_basic_block(file_desc_t* fdesc, basicblk_t* currblk, basicblk_t* nextblk, uint32_t currAddr);
-static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instr, succ_t* succ);
+static void decode_program(file_desc_t* fdesc, uint32_t startaddr, prog_t* prog);
+static void insert_blkbnd(blkbnd_t* bnd, uint32_t addr);
+static void create_block_list(bblklist_t* blist, blkbnd_t* bnd, uint32_t startaddr);
+static void find_block_boundaries(file_desc_t* fdesc, bblklist_t* blist, prog_t* prog);
+static uint8_t find_next_instr_size(avr_instr_t* instr);
+static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, prog_t* prog);
+static void fill_basic_block(prog_t* prog, basicblk_t* currblk, basicblk_t* nextblk);
+static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instr, avr_instr_t* nextinstr, succ_t* succ);
+static int find_block_ndx(bblklist_t* blist, uint32_t addr);
 
 
-//static void sort_block_boundaries(bblklist_t* blist);
-//static int ltcmp_blkbnd(list_t* lhop, list_t* rhop);
-//static void swap_blkbnd(list_t* a, list_t* b);
-
 //--------------------------------------------------------------
 bblklist_t* create_cfg(file_desc_t* fdesc, uint32_t startaddr)
 {
   bblklist_t* blist;
+  prog_t prog;
 
 
   if ((blist = (bblklist_t*)malloc(sizeof(bblklist_t))) == NULL){
@@ -66,55 +81,82 @@ bblklist_t* create_cfg(file_desc_t* fdesc, uint32_t startaddr)
   blist->blk_1 = NULL;
   blist->blk_n = NULL;
   blist->cnt = 0;
-  find_block_boundaries(fdesc, blist, startaddr);
+  blist->blkarr = NULL;
+  decode_program(fdesc, startaddr, &prog);
+  find_block_boundaries(fdesc, blist, &prog);
 #ifdef DBGMODE
   disp_blkbndlist(blist);
 #endif
-  link_basic_blocks(fdesc, blist, startaddr);
+  link_basic_blocks(fdesc, blist, &prog);
 #ifdef DBGMODE
   disp_blocks(blist, startaddr);
 #endif
+  free(prog.instr);
 
   return blist;
 }
 //--------------------------------------------------------------
-static void find_block_boundaries(file_desc_t* fdesc, bblklist_t* blist, uint32_t startaddr)
+static void decode_program(file_desc_t* fdesc, uint32_t startaddr, prog_t* prog)
+{
+  uint8_t* progbyte;
+  int i;
+
+  if ((progbyte = obj_file_ptr(fdesc, startaddr)) == NULL){
+    fprintf(stderr, "decode_program: Start address 0x%x is beyond the end of the program.\n", (int)startaddr);
+    exit(EXIT_FAILURE);
+  }
+  prog->startaddr = startaddr;
+  prog->numinstr = (int)((fdesc->progsize - startaddr)/sizeof(avr_instr_t));
+  if ((prog->instr = malloc((prog->numinstr + 1) * sizeof(avr_instr_t))) == NULL){
+    fprintf(stderr, "decode_program: malloc out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(prog->instr, progbyte, prog->numinstr * sizeof(avr_instr_t));
+  for (i = 0; i < prog->numinstr; i++){
+#ifdef BBIG_ENDIAN
+    prog->instr[i].rawVal = Flip_int16(prog->instr[i].rawVal);
+#endif
+  }
+  return;
+}
+//--------------------------------------------------------------
+static void find_block_boundaries(file_desc_t* fdesc, bblklist_t* blist, prog_t* prog)
 {
-  avr_instr_t instr;
   uint32_t currAddr;
   succ_t succ;
+  blkbnd_t bnd;
+  int i;
 
-  // Set the file pointer to the start of first instruction
-  obj_file_seek(fdesc, startaddr, SEEK_SET);
+  bnd.addr = NULL;
+  bnd.cnt = 0;
+  bnd.size = 0;
 
   // Insert the first boundary
-  insert_blkbnd(blist, startaddr);
+  insert_blkbnd(&bnd, prog->startaddr);
 #if defined(DBGMODE) && defined(DBG_FIND_BLK_BND)
   printf("\n");
 #endif
 
-  currAddr = startaddr;
+  currAddr = prog->startaddr;
   succ.branchflag = 0;
   succ.fallflag = 0;
 
-  // Start reading the instructions - First pass through the file
-  while (obj_file_read(fdesc, &instr, sizeof(avr_instr_t), 1) != 0){
-#ifdef BBIG_ENDIAN
-    instr.rawVal = Flip_int16(instr.rawVal);
-#endif
+  // First pass through the instructions
+  for (i = 0; i < prog->numinstr; i++){
+    avr_instr_t* nextinstr = (i + 1 < prog->numinstr) ? &(prog->instr[i + 1]) : NULL;
 
 #if defined(DBGMODE) && defined(DBG_FIND_BLK_BND)
-    printf("0x%5x: %4x ", currAddr, instr.rawVal);
-    decode_avr_instr_word(&instr);
+    printf("0x%5x: %4x ", currAddr, prog->instr[i].rawVal);
+    decode_avr_instr_word(&(prog->instr[i]));
 #endif
 
-    find_succ(fdesc, currAddr, &instr, &succ);
+    find_succ(fdesc, currAddr, &(prog->instr[i]), nextinstr, &succ);
 
     if (succ.branchflag == 1){
-      insert_blkbnd(blist, succ.branchaddr);
+      insert_blkbnd(&bnd, succ.branchaddr);
     }
     if (succ.fallflag == 1){
-      insert_blkbnd(blist, succ.falladdr);
+      insert_blkbnd(&bnd, succ.falladdr);
     }
     currAddr += 2;
 #if defined(DBGMODE) && defined(DBG_FIND_BLK_BND)
@@ -123,37 +165,34 @@ static void find_block_boundaries(file_desc_t* fdesc, bblklist_t* blist, uint32_
 
   }
   // Insert a dummy boundary at the last address
-  insert_blkbnd(blist, currAddr);
+  insert_blkbnd(&bnd, currAddr);
+  create_block_list(blist, &bnd, prog->startaddr);
+  free(bnd.addr);
   // Basic Block with StartAddress
-  blist->blk_st = find_block(blist, startaddr);
+  blist->blk_st = find_block(blist, prog->startaddr);
   return;
 }
 //--------------------------------------------------------------
-static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, uint32_t startaddr)
+static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, prog_t* prog)
 {
-  avr_instr_t instr;
   uint32_t currAddr;
   succ_t succ;
   basicblk_t *currblk, *nextblk;
+  int i;
 
-  // Set the file pointer to the start of first instruction
-  obj_file_seek(fdesc, startaddr, SEEK_SET);
-
-  currAddr = startaddr;
-  currblk = find_block(blist, startaddr);
+  currAddr = prog->startaddr;
+  currblk = find_block(blist, prog->startaddr);
   nextblk = (basicblk_t*)(currblk->link.next);
   succ.branchflag = 0;
   succ.fallflag = 0;
 
-  // Start reading the instructions - Second pass through the file
-  while (obj_file_read(fdesc, &instr, sizeof(avr_instr_t), 1) != 0){
-#ifdef BBIG_ENDIAN
-    instr.rawVal = Flip_int16(instr.rawVal);
-#endif
+  // Second pass through the instructions
+  for (i = 0; i < prog->numinstr; i++){
+    avr_instr_t* nextinstr = (i + 1 < prog->numinstr) ? &(prog->instr[i + 1]) : NULL;
     DEBUG("Addr: 0x%x\n", currAddr);
 
     
-    find_succ(fdesc, currAddr, &instr, &succ);
+    find_succ(fdesc, currAddr, &(prog->instr[i]), nextinstr, &succ);
     currAddr += 2;
     
     if ((succ.branchflag == 1) || (succ.fallflag == 1)){
@@ -175,7 +214,7 @@ static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, uint32_t st
       }
       else
 	currblk->fall = NULL;  
-      fill_basic_block(fdesc, currblk, nextblk, currAddr);
+      fill_basic_block(prog, currblk, nextblk);
       currblk = nextblk;
       nextblk = (basicblk_t*)(currblk->link.next);
       continue;
@@ -186,7 +225,7 @@ static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, uint32_t st
       currblk->flag = 0;
       currblk->fall = nextblk;
       currblk->branch = NULL;
-      fill_basic_block(fdesc, currblk, nextblk, currAddr);
+      fill_basic_block(prog, currblk, nextblk);
       currblk = nextblk;
       nextblk = (basicblk_t*)(currblk->link.next);
       continue;
@@ -195,56 +234,43 @@ static void link_basic_blocks(file_desc_t* fdesc, bblklist_t* blist, uint32_t st
   return;
 }
 //--------------------------------------------------------------
-static void fill_basic_block(file_desc_t* fdesc, basicblk_t* currblk, basicblk_t* nextblk, uint32_t currAddr)
+static void fill_basic_block(prog_t* prog, basicblk_t* currblk, basicblk_t* nextblk)
 {
   if (nextblk != NULL)
     currblk->size = nextblk->addr - currblk->addr;
   
   if (currblk->size > 0){
-    avr_instr_t instr;
-    int i, numinstr;
-
-    // Set the file pointer and read
-    obj_file_seek(fdesc, currblk->addr, SEEK_SET);
-
+    int firstinstr, numinstr;
 
     // Assert currblk->instr is NULL
     if (currblk->instr != NULL){
       fprintf(stderr, "Memory corruption. Current Block Start Address: 0x%x\n", (int)currblk->addr);
       exit(EXIT_FAILURE);
     }
+    numinstr = (int)(currblk->size/sizeof(avr_instr_t));
+    firstinstr = (int)((currblk->addr - prog->startaddr)/sizeof(avr_instr_t));
+    if ((currblk->addr < prog->startaddr) || (firstinstr + numinstr > prog->numinstr)){
+      fprintf(stderr, "fill_basic_block: Error reading from file.\n");
+      exit(EXIT_FAILURE);
+    }
     // Allocate memory for currblk->instr
     if ((currblk->instr = malloc(currblk->size * sizeof(uint8_t))) == NULL){
       fprintf(stderr, "fill_basic_block: malloc out of memory\n");
       exit(EXIT_FAILURE);
     }
-
-    numinstr = (int)(currblk->size/sizeof(avr_instr_t));
-    for (i = 0; i < numinstr; i++){
-      if (obj_file_read(fdesc, &instr, sizeof(avr_instr_t), 1) == 0){
-	fprintf(stderr, "fill_basic_block: Error reading from file.\n");
-	exit(EXIT_FAILURE);
-      }
-#ifdef BBIG_ENDIAN
-      currblk->instr[i].rawVal = Flip_int16(instr.rawVal);
-#endif      
-    }
+    memcpy(currblk->instr, &(prog->instr[firstinstr]), numinstr * sizeof(avr_instr_t));
     // Allocate memory for addrmap
     if ((currblk->addrmap = malloc(numinstr * sizeof(uint32_t))) == NULL){
       fprintf(stderr,"fill_basic_block: Malloc out of memory for address map.\n");
       exit(EXIT_FAILURE);
     }
   }
-
-  // Set the file pointer back to the current address
-  obj_file_seek(fdesc, currAddr, SEEK_SET);
-  
   return;
 }
 //--------------------------------------------------------------
 // This function will determine the control flow successor addresses for a given instruction
 // The file pointer will point to the next instruction in the stream
-static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instrin, succ_t* succ)
+static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instrin, avr_instr_t* nextinstr, succ_t* succ)
 {
   static avr_instr_t previnstr;
   static int twowordinstr;
@@ -318,7 +344,7 @@ static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instri
       ((instr.rawVal & OP_TYPE11_MASK) == OP_SBIS))
     {
       uint8_t skip;
-      skip = find_next_instr_size(fdesc);
+      skip = find_next_instr_size(nextinstr);
       succ->branchaddr = currAddr + ((1 + skip) * 2);
       succ->branchflag = 1;
       succ->falladdr = currAddr + 2;
@@ -462,127 +488,105 @@ static void find_succ(file_desc_t* fdesc, uint32_t currAddr, avr_instr_t* instri
   return;
 }
 //--------------------------------------------------------------
-static int8_t insert_blkbnd(bblklist_t* blist, uint32_t addr)
+static void insert_blkbnd(blkbnd_t* bnd, uint32_t addr)
 {
-  basicblk_t *newblk;
-  basicblk_t *currblk;
 #if defined(DBGMODE) && defined(DBG_FIND_BLK_BND)
   printf("Addr: 0x%x ", addr);
 #endif
-  // Initialize new block boundary
-  if ((newblk = malloc(sizeof(basicblk_t))) == NULL){
-    fprintf(stderr, "Out of memory\n");
-    exit(EXIT_FAILURE);
-  }
-  newblk->addr = addr;
-  newblk->size = 0;
-  newblk->instr = NULL;
-  newblk->fall = NULL;
-  newblk->branch = NULL;
-
-  // If the list is empty
-  if ((blist->blk_1 == NULL) && (blist->blk_n == NULL)){
-    blist->blk_1 = newblk;
-    blist->blk_n = newblk;
-    newblk->link.prev = NULL;
-    newblk->link.next = NULL;
-    return 0;
-  }
-  
-  
-  currblk = blist->blk_n;
-  while (currblk->addr > newblk->addr){
-    currblk = (basicblk_t*)currblk->link.prev;
-    if (NULL == currblk) break;
-  }
-  
-  // Insert at beginning
-  if (NULL == currblk){
-    /*
-    fprintf(stderr, "Error in the program. Reaching an address before the start of program.\n");
-    exit(EXIT_FAILURE);
-    */
-    fprintf(stderr,"Inserting at address 0x%x. Before start address.\n", (int)newblk->addr);
-    newblk->link.next = (list_t*)blist->blk_1;
-    newblk->link.prev = NULL;
-    blist->blk_1->link.prev = (list_t*)newblk;
-    blist->blk_1 = newblk;
-    blist->cnt++;
-    return 0;
-    
+  if (bnd->cnt == bnd->size){
+    bnd->size = (bnd->size == 0) ? 256 : 2 * bnd->size;
+    if ((bnd->addr = realloc(bnd->addr, bnd->size * sizeof(uint32_t))) == NULL){
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
   }
+  bnd->addr[bnd->cnt++] = addr;
+}
+//--------------------------------------------------------------
+static int cmp_blkbnd(const void* lhop, const void* rhop)
+{
+  uint32_t lh = *(const uint32_t*)lhop;
+  uint32_t rh = *(const uint32_t*)rhop;
+  if (lh == rh) return 0;
+  return (lh < rh) ? -1 : 1;
+}
+//--------------------------------------------------------------
+// Sort the boundaries, drop duplicates and lay the blocks out in one array
+static void create_block_list(bblklist_t* blist, blkbnd_t* bnd, uint32_t startaddr)
+{
+  int i, n;
 
-  // Do not insert duplicate
-  if (currblk->addr == newblk->addr){
-    free(newblk);
-    return 0;
+  qsort(bnd->addr, bnd->cnt, sizeof(uint32_t), cmp_blkbnd);
+  for (i = 0, n = 0; i < bnd->cnt; i++){
+    if ((n == 0) || (bnd->addr[i] != bnd->addr[n - 1]))
+      bnd->addr[n++] = bnd->addr[i];
   }
 
-  // Insert at end
-  if (currblk == blist->blk_n){
-    blist->blk_n->link.next = (list_t*)newblk;
-    newblk->link.prev = (list_t*)blist->blk_n;
-    newblk->link.next = NULL;
-    blist->blk_n = newblk;
-    blist->cnt++;
-    return 0;
+  if ((blist->blkarr = calloc(n, sizeof(basicblk_t))) == NULL){
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
   }
-
-  // Insert after currblk
-  newblk->link.prev = (list_t*)currblk;
-  newblk->link.next = currblk->link.next;
-  currblk->link.next->prev = (list_t*)newblk;
-  currblk->link.next = (list_t*)newblk;
-  blist->cnt++;
-  return 0;
-
+  for (i = 0; i < n; i++){
+    basicblk_t* newblk = &(blist->blkarr[i]);
+    if (bnd->addr[i] < startaddr)
+      fprintf(stderr,"Inserting at address 0x%x. Before start address.\n", (int)bnd->addr[i]);
+    newblk->addr = bnd->addr[i];
+    newblk->link.prev = (i > 0) ? (list_t*)&(blist->blkarr[i - 1]) : NULL;
+    newblk->link.next = (i + 1 < n) ? (list_t*)&(blist->blkarr[i + 1]) : NULL;
+  }
+  blist->blk_1 = &(blist->blkarr[0]);
+  blist->blk_n = &(blist->blkarr[n - 1]);
+  blist->cnt = n;
 }
 
 //--------------------------------------------------------------
-static uint8_t find_next_instr_size(file_desc_t* fdesc)
+static uint8_t find_next_instr_size(avr_instr_t* instr)
 {
-  avr_instr_t instr;
-  
-  if (obj_file_read(fdesc, &instr, sizeof(avr_instr_t), 1) == 0){
+  if (NULL == instr){
     fprintf(stderr, "Error in find_next_instr_size\n");
     exit(EXIT_FAILURE);
   }
-  obj_file_seek(fdesc, -sizeof(avr_instr_t), SEEK_CUR);
-#ifdef BBIG_ENDIAN
-    instr.rawVal = Flip_int16(instr.rawVal);
-#endif
   // Check if it is a two word instruction
-    if ((match_optype10(&instr) == 0) || (match_optype19(&instr) == 0)){
+    if ((match_optype10(instr) == 0) || (match_optype19(instr) == 0)){
       return 2;
     }
   
   return 1;
 }
 //--------------------------------------------------------------
-basicblk_t* find_block(bblklist_t* blist, uint32_t addr)
+// Index of the last block starting at or before addr, -1 if there is none
+static int find_block_ndx(bblklist_t* blist, uint32_t addr)
 {
-  basicblk_t* cblk;
-  for (cblk = blist->blk_1; cblk != NULL; cblk = (basicblk_t*)cblk->link.next){
-    if (cblk->addr == addr)
-      return cblk;
+  int lo = 0;
+  int hi = blist->cnt;
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (blist->blkarr[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return lo - 1;
+}
+//--------------------------------------------------------------
+basicblk_t* find_block(bblklist_t* blist, uint32_t addr)
+{
+  int ndx = find_block_ndx(blist, addr);
+  if ((ndx >= 0) && (blist->blkarr[ndx].addr == addr))
+    return &(blist->blkarr[ndx]);
   return NULL;
 }
 //--------------------------------------------------------------
 uint32_t find_updated_address(bblklist_t* blist, uint32_t oldaddr)
 {
-  basicblk_t* cblk;
-  for (cblk = blist->blk_1; cblk != NULL; cblk = (basicblk_t*)cblk->link.next){
-    if ((cblk->addr <= oldaddr) && (oldaddr < (cblk->addr + cblk->size))){
+  int ndx = find_block_ndx(blist, oldaddr);
+  if (ndx >= 0){
+    basicblk_t* cblk = &(blist->blkarr[ndx]);
+    if (oldaddr < (cblk->addr + cblk->size)){
       // Found the basic block
       uint32_t blkoffset, instrndx;
       blkoffset = oldaddr - cblk->addr;
       instrndx = blkoffset/sizeof(avr_instr_t);
-      /*
-      printf("Size: %d  Addr: 0x%x ", cblk->size, (int)cblk->addr);
-      printf("NumInstr:%d  InstrNdx:%d  AddrMap:%d  NewAddr:0x%x\n",(int)(cblk->size/sizeof(avr_instr_t)),
-	     instrndx, (int)cblk->addrmap[instrndx], (int)cblk->newaddr);
-      */
       return (cblk->addrmap[instrndx] + cblk->newaddr);
     }
     if (cblk->addr == oldaddr) return cblk->newaddr;
@@ -594,8 +598,18 @@ uint32_t find_updated_address(bblklist_t* blist, uint32_t oldaddr)
 //--------------------------------------------------------------
 avr_instr_t find_instr_at_new_addr(bblklist_t* blist, uint32_t newaddr)
 {
-  basicblk_t* cblk;
-  for (cblk = blist->blk_1; cblk != NULL; cblk = (basicblk_t*)cblk->link.next){
+  // New addresses are only assigned from blk_st on, in address order
+  int lo = (int)(blist->blk_st - blist->blkarr);
+  int hi = blist->cnt;
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (blist->blkarr[mid].newaddr <= newaddr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > (int)(blist->blk_st - blist->blkarr)){
+    basicblk_t* cblk = &(blist->blkarr[lo - 1]);
     if ((cblk->newaddr <= newaddr) && (newaddr < (cblk->newaddr + cblk->newsize))){
       // Found the basic block
       uint32_t blkoffset, instrndx;
@@ -656,65 +670,3 @@ void disp_blkbndlist(bblklist_t* blist)
 //--------------------------------------------------------------
 //--------------------------------------------------------------
 //--------------------------------------------------------------
-/*
-static int ltcmp_blkbnd(list_t* lhop, list_t* rhop)
-{
-  basicblk_t *lh, *rh;
-  lh = (basicblk_t*)lhop;
-  rh = (basicblk_t*)rhop;
-  if (lh->addr < rh->addr)
-    return 1;
-  return 0;
-}
-//--------------------------------------------------------------
-static void swap_blkbnd(list_t* a, list_t* b)
-{
-  basicblk_t *aop, *bop;
-  basicblk_t temp;
-  aop = (basicblk_t*)a;
-  bop = (basicblk_t*)b;
-  temp.addr = aop->addr;
-  aop->addr = bop->addr;
-  bop->addr = temp.addr;
-  return;
-}
-//--------------------------------------------------------------
-static void sort_block_boundaries(bblklist_t* blist)
-{
-  basicblk_t *currBnd, *dupBnd;
-
-  qsortlist((list_t*)(blist->blk_1), (list_t*)(blist->blk_n),
-	    ltcmp_blkbnd, swap_blkbnd);
-
-
-  disp_blkbndlist(blist);
-
-  // Remove duplicate elements from list
-  currBnd = blist->blk_1;
-  while (currBnd != NULL){
-    dupBnd = (basicblk_t*)(currBnd->link.next);
-    if (NULL == dupBnd){
-      blist->blk_n = currBnd;
-      break;
-    }
-    while (dupBnd->addr == currBnd->addr){
-      list_t* delBnd;
-      delBnd = (list_t*)dupBnd;
-      dupBnd = (basicblk_t*)(dupBnd->link.next);
-      // Unlink and free the duplicate
-      (delBnd->prev)->next = delBnd->next;
-      (delBnd->next)->prev = delBnd->prev;
-      free(delBnd);
-      if (NULL == dupBnd){
-	blist->blk_n = currBnd;
-	break;
-      }
-    }
-    currBnd = dupBnd;
-  }
-
-  disp_blkbndlist(blist);
-
-  return;
-}
-*/
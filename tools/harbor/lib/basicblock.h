@@ -49,6 +49,7 @@ typedef struct _bblk_str {
   basicblk_t* blk_n;            //!< Last block in the list of basic blocks
   basicblk_t* blk_st;           //!< Basic block corresponding to the start address of program
   int cnt;                      //!< Number of basic blocks in the program
+  basicblk_t* blkarr;           //!< The blocks sorted by address, the list links them in the same order
 } bblklist_t;
 
 
@@ -81,6 +82,8 @@ void disp_blkbndlist(bblklist_t* blist);
  * \param blist Pointer to the basic block list of the program
  * \param addr Starting address of the basic block
  * \return Pointer to the basic block or NULL
+ *
+ * This and the two lookups below are binary searches over blist->blkarr.
  */
 basicblk_t* find_block(bblklist_t* blist, uint32_t addr);
 
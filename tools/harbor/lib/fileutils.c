@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <soself.h>
 
 
@@ -51,14 +54,32 @@ int obj_file_open(char* filename, file_desc_t* fdesc)
   // Copy file name
   fdesc->name = (char*)malloc(strlen(filename) + 1);
   strcpy(fdesc->name, filename);
+  fdesc->fd = NULL;
+  fdesc->elf = NULL;
+  fdesc->progbuf = NULL;
+  fdesc->progsize = 0;
+  fdesc->reloc = NULL;
+  fdesc->numreloc = 0;
   
   // Open the file
   if (BIN_FILE == fdesc->type){
     // Binary File
+    struct stat st;
     if ((fdesc->fd = fopen((char*)filename, "r")) == NULL){
       fprintf(stderr, "%s does not exist.\n", filename);
       return -1;
     }
+    if ((fstat(fileno(fdesc->fd), &st) != 0) || (st.st_size == 0)){
+      fprintf(stderr, "%s is empty.\n", filename);
+      return -1;
+    }
+    fdesc->progbuf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fdesc->fd), 0);
+    if (MAP_FAILED == fdesc->progbuf){
+      perror("mmap:");
+      return -1;
+    }
+    fdesc->progsize = (uint32_t)st.st_size;
+    fdesc->progbyte = fdesc->progbuf;
   }
   else {
     // ELF File
@@ -100,9 +121,10 @@ int obj_file_open(char* filename, file_desc_t* fdesc)
 	edata = NULL;
 	while ((edata = elf_getdata(scn, edata)) != NULL){
 	  if (ELF_T_BYTE == edata->d_type){
-	    fdesc->progdata = edata;
-	    fdesc->progbyte = (uint8_t*)edata->d_buf;
-	    DEBUG("Size of binary in bytes: %d\n", (int)fdesc->progdata->d_size);
+	    fdesc->progbuf = (uint8_t*)edata->d_buf;
+	    fdesc->progsize = (uint32_t)edata->d_size;
+	    fdesc->progbyte = fdesc->progbuf;
+	    DEBUG("Size of binary in bytes: %d\n", (int)fdesc->progsize);
 	  }
 	}
       }
@@ -114,57 +136,62 @@ int obj_file_open(char* filename, file_desc_t* fdesc)
 //-------------------------------------------------------------------
 int obj_file_close(file_desc_t* fdesc)
 {
-  if (BIN_FILE == fdesc->type)
+  if (BIN_FILE == fdesc->type){
+    munmap(fdesc->progbuf, fdesc->progsize);
     fclose(fdesc->fd);
+  }
   else{
     elf_end(fdesc->elf);
   }
+  free(fdesc->reloc);
+  fdesc->reloc = NULL;
   return 0;
 }
 
 //-------------------------------------------------------------------
 int obj_file_seek(file_desc_t* fdesc, uint32_t addr, int whence)
 {
-  if (BIN_FILE == fdesc->type)
-    return fseek(fdesc->fd, addr, whence);
-  // Elf File
-  uint32_t currOffset = fdesc->progbyte - (uint8_t*)fdesc->progdata->d_buf;
+  int32_t offset = (int32_t)addr;
+  int32_t newOffset;
+
   switch (whence){
   case SEEK_CUR:
-    if (((currOffset + addr) < 0) || ((currOffset + addr) > fdesc->progdata->d_size))
-      return -1;
-    fdesc->progbyte += addr;
+    newOffset = (int32_t)(fdesc->progbyte - fdesc->progbuf) + offset;
     break;
   case SEEK_SET:
-    if ((addr < 0) || (addr > fdesc->progdata->d_size))
-      return -1;
-    fdesc->progbyte = ((uint8_t*)fdesc->progdata->d_buf) + addr;
+    newOffset = offset;
     break;
   case SEEK_END:
-    if ((addr > 0) || (addr < (-1 * fdesc->progdata->d_size)))
-      return -1;
-    fdesc->progbyte = ((uint8_t*)(fdesc->progdata->d_buf)) + fdesc->progdata->d_size + addr;
+    newOffset = (int32_t)fdesc->progsize + offset;
     break;
   default:
-    break;
+    return -1;
   }
+  if ((newOffset < 0) || (newOffset > (int32_t)fdesc->progsize))
+    return -1;
+  fdesc->progbyte = fdesc->progbuf + newOffset;
   return 0;
 }
 
 //-------------------------------------------------------------------
 int obj_file_read(file_desc_t* fdesc, void* ptr, size_t size, size_t nmemb)
 {
-  if (BIN_FILE == fdesc->type)
-    return fread(ptr, size, nmemb, fdesc->fd);
-  // ELF File
    uint32_t currOffset;
-   currOffset = fdesc->progbyte - (uint8_t*)fdesc->progdata->d_buf;
-   if ((currOffset + (size * nmemb)) > fdesc->progdata->d_size){
+   currOffset = fdesc->progbyte - fdesc->progbuf;
+   if ((currOffset + (size * nmemb)) > fdesc->progsize){
      DEBUG("Curr Offset: %d, Size: %d, Read Size: %d\n", 
-	   (int)currOffset, (int)fdesc->progdata->d_size, (int)(size * nmemb)); 
+	   (int)currOffset, (int)fdesc->progsize, (int)(size * nmemb)); 
      return 0;
    }
    memcpy(ptr, fdesc->progbyte, size * nmemb);
    fdesc->progbyte += size * nmemb;
    return nmemb;
 }
+
+//-------------------------------------------------------------------
+uint8_t* obj_file_ptr(file_desc_t* fdesc, uint32_t addr)
+{
+  if (addr > fdesc->progsize)
+    return NULL;
+  return fdesc->progbuf + addr;
+}
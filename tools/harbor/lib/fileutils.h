@@ -19,20 +19,31 @@ typedef enum _enum_file_type {
   BIN_FILE = 1, //!< Binary File
 } file_type_t;
 
+/**
+ * \brief Call or jump with a relocation record, see check_calljmp_has_reloc_rec()
+ */
+typedef struct _calljmp_reloc_str {
+  uint32_t addr;    //!< Address of the instruction
+  uint32_t target;  //!< Symbol value plus addend of the relocation record
+  int ndx;          //!< Index of the record in .rela.text
+} calljmp_reloc_t;
+
 /**
  * \brief Object File Type Descriptor
+ *
+ * The program is kept in memory: the .text section of an ELF file, or the
+ * whole file mmap'ed for a binary file.
  */
 typedef struct _file_desc_str {
   char* name;       //!< File Name
   file_type_t type; //!< File Type
-  union {
-    FILE* fd;               //!< File Descriptor for raw binary file
-    struct {
-      Elf* elf;             //!< ELF Descriptor for ELF file
-      Elf_Data* progdata;   //!< ELF_Data structure for the binary data
-      uint8_t* progbyte;    //!< Pointer to current program byte
-    };
-  };
+  FILE* fd;         //!< File Descriptor for raw binary file
+  Elf* elf;         //!< ELF Descriptor for ELF file
+  uint8_t* progbuf;         //!< Program bytes
+  uint32_t progsize;        //!< Size of the program in bytes
+  uint8_t* progbyte;        //!< Pointer to current program byte
+  calljmp_reloc_t* reloc;   //!< Relocation records sorted by address, built on first use
+  int numreloc;             //!< Number of entries in reloc
 } file_desc_t;
 
 
@@ -59,4 +70,9 @@ int obj_file_seek(file_desc_t* fdesc, uint32_t addr, int whence);
  */
 int obj_file_read(file_desc_t* fdesc, void* ptr, size_t size, size_t nmemb);
 
+/**
+ * \brief Pointer to the program bytes at an address, NULL if out of range
+ */
+uint8_t* obj_file_ptr(file_desc_t* fdesc, uint32_t addr);
+
 #endif//_FILEUTILS_H_
@@ -220,8 +220,18 @@ static uint32_t elf_find_module_start_addr(file_desc_t* fdesc)
   return 0;
 }
 
-// Returns 0 if the call/jmp/rcall/rjmp has relocation record
-int8_t check_calljmp_has_reloc_rec(file_desc_t* fdesc, uint32_t callInstrAddr, uint32_t* calltargetaddr)
+static int cmp_calljmp_reloc(const void* lhop, const void* rhop)
+{
+  const calljmp_reloc_t *lh, *rh;
+  lh = (const calljmp_reloc_t*)lhop;
+  rh = (const calljmp_reloc_t*)rhop;
+  if (lh->addr != rh->addr)
+    return (lh->addr < rh->addr) ? -1 : 1;
+  return lh->ndx - rh->ndx;
+}
+
+// Read .rela.text once and sort it by address
+static void build_calljmp_reloc_index(file_desc_t* fdesc)
 {
   Elf_Scn *scn;
   Elf32_Shdr *shdr;
@@ -229,8 +239,6 @@ int8_t check_calljmp_has_reloc_rec(file_desc_t* fdesc, uint32_t callInstrAddr, u
   Elf32_Rela *erela;
   int numRecs;
 
-  if (BIN_FILE == fdesc->type) return 0;
-  
   scn = getELFSectionByName(fdesc->elf, ".rela.text");
   if (NULL == scn){
     fprintf(stderr, "check_calljmp_has_reloc_rec: Cannot find relocation section in ELF file.\n");
@@ -242,36 +250,73 @@ int8_t check_calljmp_has_reloc_rec(file_desc_t* fdesc, uint32_t callInstrAddr, u
       edata = NULL;
       while ((edata = elf_getdata(scn, edata)) != NULL){
 	if (ELF_T_RELA == edata->d_type){
+	  Elf_Scn* symscn;
+	  Elf32_Shdr* symshdr;
+	  Elf_Data *symdata;
+	  Elf32_Sym* sym;
+	  int numSyms, symNdx, i;
+
 	  erela = (Elf32_Rela*)edata->d_buf;
 	  numRecs = edata->d_size/shdr->sh_entsize;
-	  int i;
+	  symscn = getELFSymbolTableScn(fdesc->elf);
+	  symshdr = elf32_getshdr(symscn);
+	  symdata = NULL;
+	  symdata = elf_getdata(symscn, symdata);
+	  numSyms = symdata->d_size/symshdr->sh_entsize;
+
+	  if ((fdesc->reloc = malloc((numRecs + 1) * sizeof(calljmp_reloc_t))) == NULL){
+	    fprintf(stderr, "check_calljmp_has_reloc_rec: Out of memory.\n");
+	    exit(EXIT_FAILURE);
+	  }
 	  for (i = 0; i < numRecs; i++){
-	    if (callInstrAddr == erela[i].r_offset){ 
-	      Elf_Scn* symscn;
-	      Elf32_Shdr* symshdr;
-	      Elf_Data *symdata;
-	      Elf32_Sym* sym;
-	      int numSyms, symNdx;
-	      symscn = getELFSymbolTableScn(fdesc->elf);
-	      symshdr = elf32_getshdr(symscn);
-	      symdata = NULL;
-	      symdata = elf_getdata(symscn, symdata);
-	      numSyms = symdata->d_size/symshdr->sh_entsize;
-	      symNdx = ELF32_R_SYM(erela[i].r_info);
-	      if (symNdx >= numSyms){
-		fprintf(stderr, "check_calljmp_has_reloc_rec: Invalid symbol table index in relocation entry\n");
-		exit(EXIT_FAILURE);
-	      }
-	      sym = (Elf32_Sym*)((Elf32_Sym*)symdata->d_buf + symNdx);
-	      *calltargetaddr = sym->st_value + erela[i].r_addend;
-	      return 0;
+	    symNdx = ELF32_R_SYM(erela[i].r_info);
+	    if (symNdx >= numSyms){
+	      fprintf(stderr, "check_calljmp_has_reloc_rec: Invalid symbol table index in relocation entry\n");
+	      exit(EXIT_FAILURE);
 	    }
+	    sym = (Elf32_Sym*)((Elf32_Sym*)symdata->d_buf + symNdx);
+	    fdesc->reloc[i].addr = erela[i].r_offset;
+	    fdesc->reloc[i].target = sym->st_value + erela[i].r_addend;
+	    fdesc->reloc[i].ndx = i;
 	  }
+	  qsort(fdesc->reloc, numRecs, sizeof(calljmp_reloc_t), cmp_calljmp_reloc);
+	  fdesc->numreloc = numRecs;
+	  return;
 	}
       }
     }
   }
-  return -1;
+  // No records, remember that we looked
+  if ((fdesc->reloc = malloc(sizeof(calljmp_reloc_t))) == NULL){
+    fprintf(stderr, "check_calljmp_has_reloc_rec: Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  fdesc->numreloc = 0;
 }
 
+// Returns 0 if the call/jmp/rcall/rjmp has relocation record
+int8_t check_calljmp_has_reloc_rec(file_desc_t* fdesc, uint32_t callInstrAddr, uint32_t* calltargetaddr)
+{
+  int lo, hi;
+
+  if (BIN_FILE == fdesc->type) return 0;
+
+  if (NULL == fdesc->reloc)
+    build_calljmp_reloc_index(fdesc);
 
+  // First record at or after callInstrAddr
+  lo = 0;
+  hi = fdesc->numreloc;
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (fdesc->reloc[mid].addr < callInstrAddr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ((lo < fdesc->numreloc) && (fdesc->reloc[lo].addr == callInstrAddr)){
+    *calltargetaddr = fdesc->reloc[lo].target;
+    return 0;
+  }
+  return -1;
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+# Write a synthetic SOS module binary for timing avrsandbox.
+#
+# usage: gen_module.py <instructions> <output> [seed [be]]
+#
+# The module is a 16 byte header whose last word is the entry point,
+# followed by a random mix of ALU ops, loads, stores, short and relative
+# branches, calls and returns.  Only the shape matters for the timing,
+# the code is not meant to run.  Words are little endian, as on the
+# mote, unless "be" is given.
+import random, struct, sys
+
+n = int(sys.argv[1])
+out = sys.argv[2]
+random.seed(int(sys.argv[3]) if len(sys.argv) > 3 else 1)
+fmt = '>H' if len(sys.argv) > 4 and sys.argv[4] == 'be' else '<H'
+
+START = 16
+hdr = bytearray(16)
+hdr[14:16] = struct.pack('<H', START // 2)
+
+words = []
+for i in range(n):
+    r = random.random()
+    if i == n - 1:
+        w = 0x9508                                   # RET
+    elif r < 0.35:
+        w = 0x0C00 | random.randrange(0x400)         # ADD
+    elif r < 0.55:
+        w = 0xE000 | random.randrange(0x1000)        # LDI
+    elif r < 0.62:
+        # RCALL or RJMP within 2k words
+        tgt = random.randrange(max(0, i - 2000), min(n, i + 2000))
+        k = tgt - i - 1
+        w = 0xD000 | (k & 0xfff) if random.random() < 0.7 else 0xC000
+    elif r < 0.72:
+        # BRNE within 60 words
+        tgt = random.randrange(max(0, i - 60), min(n, i + 60))
+        k = tgt - i - 1
+        w = 0xF401 | ((k & 0x7f) << 3)
+    elif r < 0.78:
+        w = 0x9508                                   # RET
+    elif r < 0.9:
+        w = 0x920C | (random.randrange(32) << 4)     # ST X
+    else:
+        w = 0x0C00 | random.randrange(0x400)         # ADD
+    words.append(w)
+
+with open(out, 'wb') as f:
+    f.write(hdr)
+    for w in words:
+        f.write(struct.pack(fmt, w))
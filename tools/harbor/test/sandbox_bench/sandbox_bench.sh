@@ -0,0 +1,54 @@
+#!/bin/sh
+# Time avrsandbox on synthetic modules of growing size.
+#
+# usage: sandbox_bench.sh [-b] [avrsandbox.exe] [baseline avrsandbox.exe]
+#
+# Each size is sandboxed RUNS times and the mean wall time is printed.
+# With a baseline the outputs of both are compared byte for byte.  -b
+# writes big endian modules, for comparing against builds made with
+# -DBBIG_ENDIAN.
+ORDER=le
+if [ "$1" = "-b" ]; then
+	ORDER=be
+	shift
+fi
+SBX=${1:-../../app/avrsandbox/avrsandbox.exe}
+BASE=$2
+RUNS=${RUNS:-10}
+SIZES=${SIZES:-"2000 4000 8000 16000"}
+GEN="python `dirname $0`/gen_module.py"
+DIR=${TMPDIR:-/tmp}/sandbox_bench.$$
+
+command -v python > /dev/null || GEN="python3 `dirname $0`/gen_module.py"
+mkdir -p $DIR || exit 1
+trap "rm -rf $DIR" 0
+
+# mean seconds for RUNS runs of <sandbox> on <in>, writing <out>
+run() {
+	t0=`date +%s%N`
+	i=0
+	while [ $i -lt $RUNS ]; do
+		$1 -s 16 -f $2 -o $3 > /dev/null ||
+			echo "$1 failed on $2" 1>&2
+		i=`expr $i + 1`
+	done
+	t1=`date +%s%N`
+	echo "$t0 $t1 $RUNS" | awk '{ printf "%.4f", ($2 - $1) / $3 / 1e9 }'
+}
+
+printf "%8s %10s" instrs "time (s)"
+[ -n "$BASE" ] && printf " %10s %8s" "base (s)" output
+printf "\n"
+for n in $SIZES; do
+	$GEN $n $DIR/m$n.sos 1 $ORDER || exit 1
+	printf "%8d %10s" $n `run $SBX $DIR/m$n.sos $DIR/m$n.sbx`
+	if [ -n "$BASE" ]; then
+		printf " %10s" `run $BASE $DIR/m$n.sos $DIR/m$n.base.sbx`
+		if cmp -s $DIR/m$n.sbx $DIR/m$n.base.sbx; then
+			printf " %8s" same
+		else
+			printf " %8s" DIFFERS
+		fi
+	fi
+	printf "\n"
+done
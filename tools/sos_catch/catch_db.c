@@ -0,0 +1,266 @@
+/**
+ * @file catch_db.c
+ * @brief batched SQLite ingest for sos_catch programs
+ *
+ * See catch_db.h. All database work happens under one mutex, because
+ * rows arrive on the sossrv client thread while the time based commit
+ * runs on the main thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "catch_db.h"
+
+#define SQLITE_PROBLEM 2
+
+#define MAX_MOTES 65536
+
+// What we remember about a mote between batches:
+typedef struct {
+  int last_time;
+  char known;   // has a row in the motes table
+  char dirty;   // last_time changed in the open batch
+} mote_entry_t;
+
+static sqlite3 *connection;
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const catch_decoder_t *decoders;
+static sqlite3_stmt **inserts; // one per decoder
+static int num_decoders;
+
+static sqlite3_stmt *begin_stmt;
+static sqlite3_stmt *commit_stmt;
+static sqlite3_stmt *mote_insert;
+static sqlite3_stmt *mote_update;
+
+static int batch_rows;
+static int batch_ms;
+static int rows;                     // rows in the open batch, 0 if none
+static unsigned long long batch_start;
+
+static mote_entry_t motes[MAX_MOTES];
+static unsigned short dirty_motes[MAX_MOTES];
+static int num_dirty;
+
+static unsigned long total_rows;
+static unsigned long total_batches;
+
+static unsigned long long now_ms()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * Any unexpected SQLite result ends the program, like the rest of
+ * sos_catch does.
+ */
+static void db_check(int ret, const char *what)
+{
+  if (ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW) {
+    printf("SQLite database error (%s): %s\n", what, sqlite3_errmsg(connection));
+    sqlite3_close(connection);
+    exit(SQLITE_PROBLEM);
+  }
+}
+
+static void db_exec(const char *sql)
+{
+  char *err = NULL;
+  int ret = sqlite3_exec(connection, sql, NULL, NULL, &err);
+
+  if (err != NULL) {
+    printf("SQLite database error: %s\n", err);
+    sqlite3_close(connection);
+    exit(SQLITE_PROBLEM);
+  }
+  db_check(ret, sql);
+}
+
+static sqlite3_stmt *db_prepare(const char *sql)
+{
+  sqlite3_stmt *stmt = NULL;
+
+  db_check(sqlite3_prepare_v2(connection, sql, -1, &stmt, NULL), sql);
+  return stmt;
+}
+
+// Run a statement that returns no rows and get it ready for the next use.
+static void db_step(sqlite3_stmt *stmt)
+{
+  int ret = sqlite3_step(stmt);
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  db_check(ret, sqlite3_sql(stmt));
+}
+
+static void load_motes()
+{
+  sqlite3_stmt *stmt = db_prepare("SELECT address, last_time FROM motes");
+  int ret;
+
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    int address = sqlite3_column_int(stmt, 0);
+    if (address >= 0 && address < MAX_MOTES) {
+      motes[address].known = 1;
+      motes[address].last_time = sqlite3_column_int(stmt, 1);
+    }
+  }
+  sqlite3_finalize(stmt);
+  db_check(ret, "SELECT address, last_time FROM motes");
+}
+
+/*
+ * A new mote gets its row right away, in the open batch. Known motes only
+ * get their last_time written once per batch.
+ */
+static void mote_seen(int address, int tm)
+{
+  mote_entry_t *m = &motes[address];
+
+  if (!m->known) {
+    sqlite3_bind_int(mote_insert, 1, address);
+    sqlite3_bind_int(mote_insert, 2, tm);
+    sqlite3_bind_int(mote_insert, 3, tm);
+    db_step(mote_insert);
+    m->known = 1;
+    m->last_time = tm;
+    return;
+  }
+  if (m->last_time != tm) {
+    m->last_time = tm;
+    if (!m->dirty) {
+      m->dirty = 1;
+      dirty_motes[num_dirty++] = address;
+    }
+  }
+}
+
+static void db_commit()
+{
+  int i;
+
+  if (rows == 0) {
+    return;
+  }
+  for (i = 0; i < num_dirty; i++) {
+    mote_entry_t *m = &motes[dirty_motes[i]];
+    sqlite3_bind_int(mote_update, 1, m->last_time);
+    sqlite3_bind_int(mote_update, 2, dirty_motes[i]);
+    db_step(mote_update);
+    m->dirty = 0;
+  }
+  num_dirty = 0;
+  db_step(commit_stmt);
+  total_rows += rows;
+  total_batches++;
+  rows = 0;
+}
+
+void catch_db_open(const char *filename, const catch_decoder_t *table,
+                   int num_table, int rows_per_batch, int ms_per_batch)
+{
+  int i;
+
+  if (sqlite3_open(filename, &connection) != SQLITE_OK) {
+    printf("%s\n", sqlite3_errmsg(connection));
+    sqlite3_close(connection);
+    exit(SQLITE_PROBLEM);
+  }
+  // Readers (sqlite3, plotting scripts) must not stall the writer:
+  sqlite3_busy_timeout(connection, 5000);
+  db_exec("PRAGMA journal_mode=WAL");
+  db_exec("PRAGMA synchronous=NORMAL");
+  db_exec("CREATE TABLE IF NOT EXISTS motes (address INTEGER, start_time INTEGER, last_time INTEGER)");
+
+  decoders = table;
+  num_decoders = num_table;
+  batch_rows = (rows_per_batch > 0) ? rows_per_batch : 1;
+  batch_ms = ms_per_batch;
+  inserts = (sqlite3_stmt**)malloc(num_decoders * sizeof(sqlite3_stmt*));
+  if (inserts == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < num_decoders; i++) {
+    if (decoders[i].create != NULL) {
+      db_exec(decoders[i].create);
+    }
+    inserts[i] = db_prepare(decoders[i].insert);
+  }
+
+  begin_stmt = db_prepare("BEGIN");
+  commit_stmt = db_prepare("COMMIT");
+  mote_insert = db_prepare("INSERT INTO motes VALUES(?, ?, ?)");
+  mote_update = db_prepare("UPDATE motes SET last_time=? WHERE address=?");
+
+  load_motes();
+}
+
+void catch_db_insert(Message *msg)
+{
+  int i;
+  int row;
+  int mote;
+
+  pthread_mutex_lock(&db_lock);
+  for (i = 0; connection != NULL && i < num_decoders; i++) {
+    if (decoders[i].type != CATCH_DB_ANY_TYPE && decoders[i].type != msg->type) {
+      continue;
+    }
+    mote = CATCH_DB_NO_MOTE;
+    for (row = 0; decoders[i].decode(msg, row, inserts[i], &mote); row++) {
+      if (rows == 0) {
+        db_step(begin_stmt);
+        batch_start = now_ms();
+      }
+      db_step(inserts[i]);
+      if (row == 0 && mote >= 0 && mote < MAX_MOTES) {
+        mote_seen(mote, time(NULL));
+      }
+      if (++rows >= batch_rows) {
+        db_commit();
+      }
+    }
+    sqlite3_clear_bindings(inserts[i]);
+    if (row > 0) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&db_lock);
+}
+
+void catch_db_tick()
+{
+  pthread_mutex_lock(&db_lock);
+  if (rows > 0 && now_ms() - batch_start >= batch_ms) {
+    db_commit();
+  }
+  pthread_mutex_unlock(&db_lock);
+}
+
+void catch_db_close()
+{
+  int i;
+
+  pthread_mutex_lock(&db_lock);
+  db_commit();
+  for (i = 0; i < num_decoders; i++) {
+    sqlite3_finalize(inserts[i]);
+  }
+  sqlite3_finalize(begin_stmt);
+  sqlite3_finalize(commit_stmt);
+  sqlite3_finalize(mote_insert);
+  sqlite3_finalize(mote_update);
+  sqlite3_close(connection);
+  connection = NULL;
+  printf("%lu rows in %lu batches\n", total_rows, total_batches);
+  pthread_mutex_unlock(&db_lock);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file catch_db.h
+ * @brief batched SQLite ingest for sos_catch programs
+ *
+ * A catch function hands every received message to catch_db_insert().
+ * The message is matched against a table of decoders. Each decoder turns
+ * one kind of message into rows through a prepared INSERT statement.
+ * Rows are written inside a transaction that is committed every
+ * batch_rows rows or batch_ms milliseconds, whichever comes first, on a
+ * single connection that stays open in WAL mode.
+ *
+ * Decoders that know the originating mote report it, and catch_db keeps
+ * the motes table (address, start_time, last_time) up to date from an
+ * in-memory cache instead of a SELECT and an UPDATE per message.
+ */
+
+#ifndef CATCH_DB_HEADER
+#define CATCH_DB_HEADER
+
+#include <sqlite3.h>
+#include <message_types.h>
+
+//! decoder type that matches every message
+#define CATCH_DB_ANY_TYPE  -1
+
+//! decode() leaves the mote alone
+#define CATCH_DB_NO_MOTE   -1
+
+#define CATCH_DB_BATCH_ROWS  256
+#define CATCH_DB_BATCH_MS    500
+
+typedef struct catch_decoder {
+  int type;             // message type, or CATCH_DB_ANY_TYPE
+  const char *create;   // CREATE TABLE IF NOT EXISTS for the rows, may be NULL
+  const char *insert;   // INSERT with ? parameters
+  /*
+   * Bind the values of row number row of msg to stmt. Returns 1 if the
+   * row should be written and 0 if msg has no such row. It is called for
+   * rows 0, 1, ... until it returns 0, so one message can give several
+   * rows; 0 for row 0 passes the message on to the next decoder. *mote
+   * is set to the originating mote address, or left at CATCH_DB_NO_MOTE.
+   */
+  int (*decode)(Message *msg, int row, sqlite3_stmt *stmt, int *mote);
+} catch_decoder_t;
+
+/*
+ * Open (or create) the database and prepare the statements of the
+ * decoders. The decoder table must stay valid until catch_db_close().
+ * Exits the program if the database cannot be used.
+ */
+void catch_db_open(const char *filename, const catch_decoder_t *decoders,
+                   int num_decoders, int batch_rows, int batch_ms);
+
+/*
+ * Decode msg and queue its row. Safe to call from the sossrv client
+ * thread while the main thread calls catch_db_tick().
+ */
+void catch_db_insert(Message *msg);
+
+// Commit the open batch if it is older than batch_ms.
+void catch_db_tick();
+
+// Commit the open batch and close the database.
+void catch_db_close();
+
+#endif // #ifndef CATCH_DB_HEADER
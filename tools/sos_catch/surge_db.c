@@ -1,22 +1,35 @@
 /**
  * @file surge_db.c
- * @breif dumps surge messages into an sqlite3 database.
+ * @breif dumps surge messages and sos_db query results into an sqlite3
+ * database.
  * @author Peter Mawhorter (pmawhorter@cs.hmc.edu)
  */
 
 #include <stdio.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "sos_catch.h"
-
-#include <sqlite3.h>
+#include "catch_db.h"
 
 #include <message_types.h>
 #include <tree_routing.h>
 #include <surge.h>
 
 #define BAD_ORIGIN_ADDRESSES 1
-#define SQLITE_PROBLEM 2
-#define OVERFLOW_ERROR 3
+
+/*
+ * sos_db query results, from modules/db_app/mote_interpreter/interpreter.h
+ * (which needs the module headers). The base station forwards the whole
+ * tree routing packet: tr_hdr_t, then query_result_t {qid, num_remaining,
+ * num_results, node_id} and num_results sensor_msg_t {sensor, value}, all
+ * packed.
+ */
+#define MSG_QUERY_REPLY (MOD_MSG_START + 2)
+#define MOTE_INTERPRETER_PID DFLT_APP_ID0
+#define QUERY_RESULT_SIZE 6
+#define SENSOR_MSG_SIZE 3
 
 const char* FILENAME = "messages.sql";
 
@@ -24,231 +37,182 @@ const char* FILENAME = "messages.sql";
 const char *ADDRESS="127.0.0.1";
 const char *PORT="7915";
 
-/*
- * An sqlite3 callback function that sets the given variable to 1 when executed.
- * This is for use as a field existence detector: use it as the callback for
- * a select execution and pass it a variable set to 0. Afterwards, if(that
- * variable) corresponds to the existence of one or more fields matching the
- * select statement.
- */
-int field_found(void* out, int cols, char** values, char** titles) {
-  *(int*)out = 1;
-  return 0;
-}
+// How often the main loop commits a batch that stopped growing:
+#define TICK_US 50000
+
+static volatile int done = 0;
 
 /*
- * Uses the given connection to check for the existence of a mote with the
- * given id. The mote is assumed to exist if it has an entry in the motes
- * table. If there is no entry in the motes table, then it is assumed that
- * the mote does not exist and returns 0.
+ * Surge readings travel in tree routing data packets. One row per reading
+ * goes into the messages table. The surge origin address is dropped
+ * because it's the same as the tree routing origin address.
  */
-int mote_exists(int mote_id, sqlite3* connection) {
-  int ret; // SQLite3 return value.
-  int exists = 0; // Whether the mote exists or not.
-  int check=0; // Buffer overflow?
-  const int QUERY_SIZE = 50; // How many characters could the querry be?
-  char query[QUERY_SIZE]; // SQL querry for the database.
-  char *err = NULL; // SQLite3 error message.
+static int decode_surge(Message* msg, int row, sqlite3_stmt* stmt, int* mote) {
+  tr_hdr_t tr_hdr;
+  SurgeMsg sg_msg;
 
-  check = sprintf(query, "SELECT * FROM motes WHERE address=%d", mote_id);
-  if (check >= QUERY_SIZE) {
-    printf("Query string overflow: %d characters written to buffer of size %d.",
-           check, QUERY_SIZE);
-    sqlite3_close(connection);
-    exit(OVERFLOW_ERROR);
+  if (row > 0 || msg->len < sizeof(tr_hdr_t) + sizeof(SurgeMsg)) {
+    return 0;
   }
+  // Split off the tree routing header:
+  memcpy(&tr_hdr, msg->data, sizeof(tr_hdr_t));
 
-  ret = sqlite3_exec(connection, query, &field_found, &exists, &err);
-
-  if (err != NULL) {
-    printf("SQLite database error: %s\n", err);
-    sqlite3_close(connection);
-    exit(SQLITE_PROBLEM);
-  } else if (ret != 0) {
-    printf(sqlite3_errmsg(connection));
-    sqlite3_close(connection);
-    exit(SQLITE_PROBLEM);
+  // We only care about messages for the Surge module:
+  if (tr_hdr.dst_pid != SURGE_MOD_PID) {
+    return 0;
   }
+  // Get the surge message:
+  memcpy(&sg_msg, msg->data + sizeof(tr_hdr_t), sizeof(SurgeMsg));
+
+  // Flip the endiannesses of the relevant fields:
+  tr_hdr.originaddr = entohs(tr_hdr.originaddr);
+  tr_hdr.seqno = entohs(tr_hdr.seqno);
+  tr_hdr.parentaddr = entohs(tr_hdr.parentaddr);
+  sg_msg.originaddr = entohs(sg_msg.originaddr);
+  sg_msg.reading = entohs(sg_msg.reading);
+  sg_msg.seq_no = entohl(sg_msg.seq_no);
+
+  // Sanity checking:
+  if (tr_hdr.originaddr != sg_msg.originaddr) {
+    printf("Tragic loss of coherence: origin addresses don't agree:\n");
+    printf("Tree Routing: %d\nSurge: %d\n", tr_hdr.originaddr,
+           sg_msg.originaddr);
+    exit(BAD_ORIGIN_ADDRESSES);
+  }
+
+  sqlite3_bind_int(stmt, 1, tr_hdr.originaddr);
+  sqlite3_bind_int(stmt, 2, tr_hdr.seqno);
+  sqlite3_bind_int(stmt, 3, tr_hdr.hopcount);
+  sqlite3_bind_int(stmt, 4, tr_hdr.originhopcount);
+  sqlite3_bind_int(stmt, 5, tr_hdr.parentaddr);
+  sqlite3_bind_int(stmt, 6, sg_msg.type);
+  sqlite3_bind_int64(stmt, 7, sg_msg.seq_no);
+  sqlite3_bind_int(stmt, 8, sg_msg.reading);
+  *mote = tr_hdr.originaddr;
+  return 1;
+}
 
-  return exists;
+// Little endian 16 bit field of a packed payload:
+static int get_u16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
 }
 
 /*
- * Catches surge messages and dumps them into messages.sql:
+ * sos_db query results. Each reply carries one value per sensor in the
+ * query, and each value becomes a row of query_results.
  */
-int catch(Message* msg) {
-  int i; // Loop variable.
-  int ret; // Sqlite 3 return value.
-  int check; // Check on the size of the sprintf into command.
-  int tm = time(NULL); // Timestamp.
-  const int COMMAND_SIZE=150; // Size of sqlite command.
-  char tree_routing_header[sizeof(tr_hdr_t)];
-  char surge_message[sizeof(SurgeMsg)];
-  char command[COMMAND_SIZE]; // The sqlite 3 command we'll be using.
-  char *err; // Place for sqlite error messages.
-  sqlite3* connection; // The sqlite 3 database object.
-
-  // We only care about tree routing messages:
-  if (msg->type == MSG_TR_DATA_PKT) {
-    // Split off the tree routing header:
-    for(i=0; i < sizeof(tr_hdr_t); ++i) {
-      tree_routing_header[i] = msg->data[i];
-    }
-    tr_hdr_t* tr_hdr = (tr_hdr_t*)(tree_routing_header);
-
-    // We only care about messages for the Surge module:
-    if (tr_hdr->dst_pid == SURGE_MOD_PID) {
-      // Get the surge message:
-      for(i=0; i < sizeof(SurgeMsg); ++i) {
-        surge_message[i] = msg->data[sizeof(tr_hdr_t)+i];
-      }
-      SurgeMsg* sg_msg = (SurgeMsg*)(surge_message);
-
-      // Flip the endiannesses of the relevant fields:
-      tr_hdr->originaddr = entohs(tr_hdr->originaddr);
-      tr_hdr->seqno = entohs(tr_hdr->seqno);
-      tr_hdr->parentaddr = entohs(tr_hdr->parentaddr);
-      sg_msg->originaddr = entohs(sg_msg->originaddr);
-      sg_msg->reading = entohs(sg_msg->reading);
-      sg_msg->seq_no = entohl(sg_msg->seq_no);
-
-      // Sanity checking:
-      if (tr_hdr->originaddr != sg_msg->originaddr) {
-        printf("Tragic loss of coherence: origin addresses don't agree:\n");
-        printf("Tree Routing: %d\nSurge: %d\n", tr_hdr->originaddr,
-               sg_msg->originaddr);
-        exit(BAD_ORIGIN_ADDRESSES);
-      }
-
-      // Open the database:
-      ret = sqlite3_open(FILENAME, &connection);
-
-      if (ret != 0) {
-        printf(sqlite3_errmsg(connection));
-        sqlite3_close(connection);
-        exit(SQLITE_PROBLEM);
-      }
-
-      /*
-       * Check that the mote we're adding data for is already listed in the
-       * motes table. If it isn't we need to add it, along with a start time
-       * and last time.
-       */
-      if (!mote_exists(tr_hdr->originaddr, connection)) {
-        check = sprintf(command, "INSERT INTO motes VALUES(%d, %d, %d)",
-                        tr_hdr->originaddr, tm, tm);
-
-        if (check >= COMMAND_SIZE) {
-          printf(
-           "Query string overflow: %d characters written to buffer of size %d.",
-           check, COMMAND_SIZE);
-          sqlite3_close(connection);
-          exit(OVERFLOW_ERROR);
-        }
-
-        ret = sqlite3_exec(connection, command, NULL, NULL, &err);
-   
-        if (err != NULL) {
-          printf("SQLite database error: %s\n", err);
-          sqlite3_close(connection);
-          exit(SQLITE_PROBLEM);
-        } else if (ret != 0) {
-          printf(sqlite3_errmsg(connection));
-          sqlite3_close(connection);
-          exit(SQLITE_PROBLEM);
-        }
-
-      }
-
-      /*
-       * Construct a command for inserting the message into the database.
-       * The surge origin address is dropped because it's the same as the
-       * tree routing origin address.
-       */
-      check = sprintf(command,
-            "INSERT INTO messages VALUES(NULL, %d, %d, %d, %d, %d, %d, %d, %d)",
-            tr_hdr->originaddr,
-            tr_hdr->seqno,
-            tr_hdr->hopcount,
-            tr_hdr->originhopcount,
-            tr_hdr->parentaddr,
-            sg_msg->type,
-            sg_msg->seq_no,
-            sg_msg->reading);
-
-      if (check >= COMMAND_SIZE) {
-        printf(
-          "Query string overflow: %d characters written to buffer of size %d.",
-          check, COMMAND_SIZE);
-        sqlite3_close(connection);
-        exit(OVERFLOW_ERROR);
-      }
-
-      err = NULL;
-      ret = sqlite3_exec(connection, command, NULL, NULL, &err);
+static int decode_query_reply(Message* msg, int row, sqlite3_stmt* stmt, int* mote) {
+  const uint8_t* reply = msg->data + sizeof(tr_hdr_t);
+  const uint8_t* result;
+  int num_results;
+  int origin;
+
+  if (msg->did != MOTE_INTERPRETER_PID ||
+      msg->len < sizeof(tr_hdr_t) + QUERY_RESULT_SIZE) {
+    return 0;
+  }
+  num_results = reply[4];
+  if (row >= num_results ||
+      msg->len < sizeof(tr_hdr_t) + QUERY_RESULT_SIZE + num_results * SENSOR_MSG_SIZE) {
+    return 0;
+  }
+  result = reply + QUERY_RESULT_SIZE + row * SENSOR_MSG_SIZE;
+  // node_id in the reply is only the low byte of the address:
+  origin = get_u16(msg->data + offsetof(tr_hdr_t, originaddr));
+
+  sqlite3_bind_int(stmt, 1, time(NULL));
+  sqlite3_bind_int(stmt, 2, origin);
+  sqlite3_bind_int(stmt, 3, get_u16(reply));
+  sqlite3_bind_int(stmt, 4, get_u16(reply + 2));
+  sqlite3_bind_int(stmt, 5, result[0]);
+  sqlite3_bind_int(stmt, 6, get_u16(result + 1));
+  *mote = origin;
+  return 1;
+}
 
-      if (err != NULL) {
-        printf("SQLite database error: %s\n", err);
-        sqlite3_close(connection);
-        exit(SQLITE_PROBLEM);
-      } else if (ret != 0) {
-        printf(sqlite3_errmsg(connection));
-        sqlite3_close(connection);
-        exit(SQLITE_PROBLEM);
-      }
+/*
+ * With -r, every message that no other decoder wanted is kept as it
+ * arrived, so new message types can be looked at before they get a
+ * decoder of their own.
+ */
+static int decode_raw(Message* msg, int row, sqlite3_stmt* stmt, int* mote) {
+  if (row > 0) {
+    return 0;
+  }
+  sqlite3_bind_int(stmt, 1, time(NULL));
+  sqlite3_bind_int(stmt, 2, msg->did);
+  sqlite3_bind_int(stmt, 3, msg->sid);
+  sqlite3_bind_int(stmt, 4, msg->daddr);
+  sqlite3_bind_int(stmt, 5, msg->saddr);
+  sqlite3_bind_int(stmt, 6, msg->type);
+  sqlite3_bind_blob(stmt, 7, msg->data, msg->len, SQLITE_TRANSIENT);
+  return 1;
+}
 
-      /*
-       * We also need to update the last_time field for this mote:
-       */
-      check = sprintf(command, "UPDATE motes SET last_time=%d WHERE address=%d",
-                      tm, tr_hdr->originaddr);
+static const catch_decoder_t decoders[] = {
+  {
+    MSG_TR_DATA_PKT,
+    "CREATE TABLE IF NOT EXISTS messages (id INTEGER PRIMARY KEY, origin_address INTEGER, routing_sequence_number INTEGER, hop_count INTEGER, origin_hop_count INTEGER, parent_address INTEGER, surge_message_type INTEGER, surge_sequence_number INTEGER, reading INTEGER)",
+    "INSERT INTO messages VALUES(NULL, ?, ?, ?, ?, ?, ?, ?, ?)",
+    decode_surge,
+  },
+  {
+    MSG_QUERY_REPLY,
+    "CREATE TABLE IF NOT EXISTS query_results (id INTEGER PRIMARY KEY, time INTEGER, node_id INTEGER, query_id INTEGER, num_remaining INTEGER, sensor INTEGER, value INTEGER)",
+    "INSERT INTO query_results VALUES(NULL, ?, ?, ?, ?, ?, ?)",
+    decode_query_reply,
+  },
+  // must stay last, -r adds it
+  {
+    CATCH_DB_ANY_TYPE,
+    "CREATE TABLE IF NOT EXISTS raw_messages (id INTEGER PRIMARY KEY, time INTEGER, did INTEGER, sid INTEGER, daddr INTEGER, saddr INTEGER, type INTEGER, data BLOB)",
+    "INSERT INTO raw_messages VALUES(NULL, ?, ?, ?, ?, ?, ?, ?)",
+    decode_raw,
+  },
+};
 
-      if (check >= COMMAND_SIZE) {
-        printf(
-         "Query string overflow: %d characters written to buffer of size %d.",
-         check, COMMAND_SIZE);
-        sqlite3_close(connection);
-        exit(OVERFLOW_ERROR);
-      }
+/*
+ * Catches surge messages and query results and queues them for
+ * messages.sql:
+ */
+int catch(Message* msg) {
+  catch_db_insert(msg);
+  return 0;
+}
 
-      ret = sqlite3_exec(connection, command, NULL, NULL, &err);
-   
-      if (err != NULL) {
-        printf("SQLite database error: %s\n", err);
-        sqlite3_close(connection);
-        exit(SQLITE_PROBLEM);
-      } else if (ret != 0) {
-        printf(sqlite3_errmsg(connection));
-        sqlite3_close(connection);
-        exit(SQLITE_PROBLEM);
-      }
+static void stop(int sig) {
+  done = 1;
+}
 
-      sqlite3_close(connection);
-    }
-  }
-  /*
-   * There are no else cases: messages which aren't Surge messages just go
-   * right on by without being touched. If you want to be able to see what
-   * else is going on, uncomment the following lines and comment out the
-   * closing brace on the line above this comment.
-   */
-/*
-    else {
-      printf("Message destination (%d) is not the Surge module (%d).\n",
-             tr_hdr->dst_pid, SURGE_MOD_PID);
-    }
-  }
-  else {
-    printf("Message (type %d) is not a tree routing message (type %d)\n",
-           msg->type, MSG_TR_DATA_PKT);
-  }
-*/
+static void usage() {
+  printf("usage: surge_db [-f database] [-b rows per commit] [-t ms per commit] [-r]\n");
+  printf("  -r  also keep messages that are not Surge readings or query results in raw_messages\n");
+  exit(EXIT_FAILURE);
 }
 
 // Subscribe the catch function and let it do it's thing.
 int main(int argc, char **argv)
 {
   int ret; // Did subscription succeed?
+  int ch;
+  const char *filename = FILENAME;
+  int batch_rows = CATCH_DB_BATCH_ROWS;
+  int batch_ms = CATCH_DB_BATCH_MS;
+  int num_decoders = sizeof(decoders) / sizeof(decoders[0]) - 1; // no raw_messages unless -r
+
+  while ((ch = getopt(argc, argv, "hf:b:t:r")) != -1) {
+    switch (ch) {
+    case 'f': filename = optarg; break;
+    case 'b': batch_rows = atoi(optarg); break;
+    case 't': batch_ms = atoi(optarg); break;
+    case 'r': num_decoders = sizeof(decoders) / sizeof(decoders[0]); break;
+    default: usage();
+    }
+  }
+
+  catch_db_open(filename, decoders, num_decoders, batch_rows, batch_ms);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
 
   ret = sos_subscribe(ADDRESS, PORT, (recv_msg_func_t)catch);
 
@@ -256,10 +220,12 @@ int main(int argc, char **argv)
     return ret;
   }
 
-  // Let things run:
-  while (1){
-    sleep(1);
+  // Let things run, committing batches that are old enough:
+  while (!done) {
+    usleep(TICK_US);
+    catch_db_tick();
   }
 
+  catch_db_close();
   return 0;
 }
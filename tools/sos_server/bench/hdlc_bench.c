@@ -0,0 +1,231 @@
+/* -*- Mode: C; tab-width:2 -*- */
+/* ex: set ts=2 shiftwidth=2 softtabstop=2 cindent: */
+
+/**
+ * \file hdlc_bench.c
+ * \brief Throughput of the serial receive path of sossrv
+ *
+ * Builds a stream of escaped SOS frames like the ones a mote sends and
+ * times, in MB/s of stream:
+ *   - the bit serial crc, the table crcByte() and the slice-by-4 crcBytes()
+ *   - a per byte HDLC state machine and the bulk hdlc_deframe()
+ * Results of the fast versions are checked against the slow ones.
+ *
+ *   hdlc_bench [-f frames] [-r rounds] [-b read size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sossrv.h>
+#include <sock_utils.h>
+#include <hdlc.h>
+#include <hdlc_deframe.h>
+#include <crc.h>
+
+#define DEFAULT_FRAMES   20000
+#define DEFAULT_ROUNDS   20
+#define DEFAULT_READ     1024
+#define MAX_FRAME        (1 + SOS_MSG_HEADER_SIZE + 256 + 2)
+
+static unsigned char *stream;
+static int stream_len;
+static int num_frames = DEFAULT_FRAMES;
+static int rounds = DEFAULT_ROUNDS;
+static int read_size = DEFAULT_READ;
+
+//! frames seen and a sum over their bytes, to compare the deframers
+static unsigned long frames_seen;
+static unsigned long frames_sum;
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned short crc_bitwise(unsigned short crc, unsigned char b)
+{
+	unsigned char i;
+	crc = crc ^ b << 8;
+	i = 8;
+	do
+		if (crc & 0x8000)
+			crc = crc << 1 ^ 0x1021;
+		else
+			crc = crc << 1;
+	while (--i);
+	return crc;
+}
+
+static void build_stream()
+{
+	SOS_Message_t msg;
+	unsigned short crc;
+	unsigned char crcbytes[2];
+	int i, k;
+
+	stream = malloc((size_t)num_frames * (4 + 2 * MAX_FRAME));
+	srand(1);
+	for (i = 0; i < num_frames; i++) {
+		msg.did = rand(); msg.sid = rand();
+		msg.daddr = rand(); msg.saddr = rand();
+		msg.type = rand();
+		msg.len = 8 + rand() % 120;
+		for (k = 0; k < msg.len; k++) {
+			msg.data[k] = rand();
+		}
+		crc = crcBytes(crcByte(0, HDLC_SOS_MSG), (unsigned char*)&msg, SOS_MSG_HEADER_SIZE + msg.len);
+		crcbytes[0] = (unsigned char)crc;
+		crcbytes[1] = (unsigned char)(crc >> 8);
+		stream[stream_len++] = HDLC_FLAG;
+		stream[stream_len++] = HDLC_SOS_MSG;
+		stream_len += hdlc_escape(stream + stream_len, &msg, SOS_MSG_HEADER_SIZE + msg.len);
+		stream_len += hdlc_escape(stream + stream_len, crcbytes, 2);
+		stream[stream_len++] = HDLC_FLAG;
+	}
+}
+
+static void report(char *name, unsigned long long ns, unsigned long long bytes)
+{
+	printf("%-24s %8.1f MB/s\n", name, (double)bytes * 1000.0 / ns);
+}
+
+//------------------------------------------------------------------
+// CRC
+//------------------------------------------------------------------
+static void bench_crc()
+{
+	unsigned long long t;
+	unsigned short c1 = 0, c2 = 0, c3 = 0;
+	int r, i;
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < stream_len; i++)
+			c1 = crc_bitwise(c1, stream[i]);
+	report("crc bitwise", now_ns() - t, (unsigned long long)rounds * stream_len);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < stream_len; i++)
+			c2 = crcByte(c2, stream[i]);
+	report("crc crcByte", now_ns() - t, (unsigned long long)rounds * stream_len);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < stream_len; i += 0xfffc)
+			c3 = crcBytes(c3, stream + i, (stream_len - i < 0xfffc) ? stream_len - i : 0xfffc);
+	report("crc crcBytes", now_ns() - t, (unsigned long long)rounds * stream_len);
+
+	if ((c1 != c2) || (c1 != c3)) {
+		printf("CRC MISMATCH: 0x%04X 0x%04X 0x%04X\n", c1, c2, c3);
+		exit(1);
+	}
+}
+
+//------------------------------------------------------------------
+// DEFRAMING
+//------------------------------------------------------------------
+static void frame_seen(void *arg, uint8_t *frame, uint16_t len)
+{
+	unsigned short crc = crcBytes(0, frame, len - 2);
+
+	if (crc == (frame[len - 2] | (frame[len - 1] << 8))) {
+		frames_seen++;
+	}
+	frames_sum += crc + len;
+}
+
+//! the old sossrv receive loop: one state machine step per byte
+static void deframe_bytewise(const unsigned char *data, int n)
+{
+	static unsigned char frame[MAX_FRAME];
+	static int len;
+	static int escape;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		unsigned char b = data[i];
+
+		if (b == HDLC_FLAG) {
+			if (len > 0) {
+				frame_seen(NULL, frame, len);
+			}
+			len = 0;
+			escape = 0;
+		} else if (b == HDLC_CTR_ESC) {
+			escape = 1;
+		} else {
+			if (escape) {
+				b ^= 0x20;
+				escape = 0;
+			}
+			if (len < MAX_FRAME) {
+				frame[len++] = b;
+			}
+		}
+	}
+}
+
+static void bench_deframe()
+{
+	static unsigned char frame[MAX_FRAME];
+	hdlc_rx_t rx;
+	unsigned long long t;
+	unsigned long seen, sum;
+	int r, i;
+
+	frames_seen = frames_sum = 0;
+	t = now_ns();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < stream_len; i += read_size)
+			deframe_bytewise(stream + i, (stream_len - i < read_size) ? stream_len - i : read_size);
+	report("deframe per byte", now_ns() - t, (unsigned long long)rounds * stream_len);
+	seen = frames_seen;
+	sum = frames_sum;
+
+	frames_seen = frames_sum = 0;
+	hdlc_rx_init(&rx, frame, sizeof(frame));
+	t = now_ns();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < stream_len; i += read_size)
+			hdlc_deframe(&rx, stream + i, (stream_len - i < read_size) ? stream_len - i : read_size,
+									 frame_seen, NULL);
+	report("deframe hdlc_deframe", now_ns() - t, (unsigned long long)rounds * stream_len);
+
+	if ((seen != frames_seen) || (sum != frames_sum) || (seen != (unsigned long)rounds * num_frames)) {
+		printf("DEFRAME MISMATCH: %lu/%lu frames\n", seen, frames_seen);
+		exit(1);
+	}
+}
+
+static void usage()
+{
+	printf("usage: hdlc_bench [-f frames] [-r rounds] [-b read size]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hf:r:b:")) != -1) {
+		switch (ch) {
+		case 'f': num_frames = atoi(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		case 'b': read_size = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if ((num_frames <= 0) || (rounds <= 0) || (read_size <= 0)) usage();
+
+	build_stream();
+	printf("%d frames, %d bytes, %d rounds, %d byte reads\n", num_frames, stream_len, rounds, read_size);
+	bench_crc();
+	bench_deframe();
+	return 0;
+}
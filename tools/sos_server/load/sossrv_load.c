@@ -0,0 +1,316 @@
+/* -*- Mode: C; tab-width:2 -*- */
+/* ex: set ts=2 shiftwidth=2 softtabstop=2 cindent: */
+
+/**
+ * \file sossrv_load.c
+ * \brief Load generator for sossrv
+ *
+ * sossrv_load plays the SOS NIC: it listens for sossrv on a TCP port,
+ * connects N clients to sossrv and sends M messages through it as fast
+ * as possible (or at -r messages per second).  Every message carries
+ * the time it was sent, so the clients measure the forwarding latency.
+ *
+ *   sossrv_load -c 16 -m 100000 &
+ *   sossrv -Q -n 127.0.0.1:7916
+ *
+ * A client that falls too far behind loses messages in sossrv; these
+ * are reported as lost.  With -s, that many extra clients connect but
+ * never read, to check that they do not hold up the others.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <sossrv.h>
+#include <sock_utils.h>
+#include <hdlc.h>
+#include <crc.h>
+
+//------------------------------------------------------------------
+// CONSTANTS
+//------------------------------------------------------------------
+#define DEFAULT_NIC_PORT     7916
+#define DEFAULT_CLIENTS      8
+#define DEFAULT_MESSAGES     100000
+#define MSG_LOAD_TYPE        32
+//! a run ends when no client made progress for this long
+#define IDLE_TIMEOUT_MS      2000
+#define CLIENT_BUF_SIZE      8192
+
+typedef struct {
+	unsigned int seq;
+	unsigned long long sent_ns;
+} __attribute__ ((packed)) load_payload_t;
+
+typedef struct {
+	int fd;
+	unsigned char buf[CLIENT_BUF_SIZE];
+	int len;
+	unsigned long received;
+} load_client_t;
+
+//------------------------------------------------------------------
+// STATIC DATA
+//------------------------------------------------------------------
+static int nicfd;
+static long num_messages = DEFAULT_MESSAGES;
+static long rate = 0;
+static volatile long num_sent;          //! messages written to sossrv
+static unsigned int *latency_us;       //! one entry per received message
+static unsigned long num_latency;
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! the HDLC frame that the NIC sends to sossrv for one message
+static int build_frame(unsigned char *frame, SOS_Message_t *msg)
+{
+	unsigned char *p = (unsigned char*)msg;
+	unsigned short crc = crcBytes(crcByte(0, HDLC_SOS_MSG), p, SOS_MSG_HEADER_SIZE + msg->len);
+	unsigned char crcbytes[2];
+	int len = 0;
+
+	crcbytes[0] = (unsigned char)crc;
+	crcbytes[1] = (unsigned char)(crc >> 8);
+	frame[len++] = HDLC_FLAG;
+	frame[len++] = HDLC_SOS_MSG;
+	len += hdlc_escape(frame + len, msg, SOS_MSG_HEADER_SIZE + msg->len);
+	len += hdlc_escape(frame + len, crcbytes, 2);
+	frame[len++] = HDLC_FLAG;
+	return len;
+}
+
+static void *sender(void *arg)
+{
+	unsigned char frame[2 * sizeof(SOS_Message_t)];
+	SOS_Message_t msg;
+	load_payload_t *pl = (load_payload_t*)msg.data;
+	unsigned long long start = now_ns();
+	long i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.did = 0x80;
+	msg.sid = 0x80;
+	msg.daddr = 0xffff;
+	msg.saddr = 1;
+	msg.type = MSG_LOAD_TYPE;
+	msg.len = sizeof(load_payload_t);
+	for (i = 0; i < num_messages; i++) {
+		if (rate > 0) {
+			unsigned long long due = start + (unsigned long long)i * 1000000000ULL / rate;
+			unsigned long long now = now_ns();
+			if (due > now) {
+				struct timespec ts;
+				ts.tv_sec = (due - now) / 1000000000ULL;
+				ts.tv_nsec = (due - now) % 1000000000ULL;
+				nanosleep(&ts, NULL);
+			}
+		}
+		pl->seq = i;
+		pl->sent_ns = now_ns();
+		if (writen(nicfd, frame, build_frame(frame, &msg)) < 0) {
+			fprintf(stderr, "sossrv_load: sossrv closed the NIC connection\n");
+			exit(EXIT_FAILURE);
+		}
+		num_sent = i + 1;
+	}
+	return NULL;
+}
+
+static int tcp_listen(int port)
+{
+	struct sockaddr_in addr;
+	int yes = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, 1) < 0)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int tcp_connect(char *host, int port)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_aton(host, &addr.sin_addr);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//! parse the messages a client got, returns -1 when the client is gone
+static int client_read(load_client_t *c)
+{
+	unsigned long long now;
+	int n, used = 0;
+
+	n = read(c->fd, c->buf + c->len, CLIENT_BUF_SIZE - c->len);
+	if (n <= 0) return -1;
+	c->len += n;
+	now = now_ns();
+	while (c->len - used >= SOS_MSG_HEADER_SIZE) {
+		SOS_Message_t *m = (SOS_Message_t*)(c->buf + used);
+		if (c->len - used < SOS_MSG_HEADER_SIZE + m->len) break;
+		if ((m->type == MSG_LOAD_TYPE) && (m->len == sizeof(load_payload_t))) {
+			load_payload_t *pl = (load_payload_t*)m->data;
+			latency_us[num_latency++] = (unsigned int)((now - pl->sent_ns) / 1000);
+			c->received++;
+		}
+		used += SOS_MSG_HEADER_SIZE + m->len;
+	}
+	memmove(c->buf, c->buf + used, c->len - used);
+	c->len -= used;
+	return 0;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+	return (x > y) - (x < y);
+}
+
+static void usage()
+{
+	printf("sossrv_load [-c <clients>] [-s <stalled clients>] [-m <messages>] [-r <msgs/sec>]\n");
+	printf("            [-p <sossrv port>] [-n <NIC port>]\n");
+	printf("Then start sossrv with -Q -n 127.0.0.1:<NIC port>\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int num_clients = DEFAULT_CLIENTS;
+	int num_stalled = 0;
+	int server_port = DEFAULT_SERVER_PORT;
+	int nic_port = DEFAULT_NIC_PORT;
+	load_client_t *clients;
+	struct pollfd *pfds;
+	pthread_t tid;
+	unsigned long long start, last, end;
+	unsigned long total = 0, expected;
+	int listenfd, open_clients, i, ch;
+
+	while ((ch = getopt(argc, argv, "hc:s:m:r:p:n:")) != -1) {
+		switch (ch) {
+		case 'c': num_clients = atoi(optarg); break;
+		case 's': num_stalled = atoi(optarg); break;
+		case 'm': num_messages = atol(optarg); break;
+		case 'r': rate = atol(optarg); break;
+		case 'p': server_port = atoi(optarg); break;
+		case 'n': nic_port = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if ((num_clients <= 0) || (num_messages <= 0)) usage();
+
+	if ((listenfd = tcp_listen(nic_port)) < 0) {
+		perror("sossrv_load: NIC port");
+		return -1;
+	}
+	printf("Waiting for sossrv -n 127.0.0.1:%d\n", nic_port);
+	if ((nicfd = accept(listenfd, NULL, NULL)) < 0) {
+		perror("sossrv_load: accept");
+		return -1;
+	}
+
+	clients = calloc(num_clients, sizeof(load_client_t));
+	pfds = calloc(num_clients, sizeof(struct pollfd));
+	latency_us = malloc(num_clients * num_messages * sizeof(unsigned int));
+	if ((clients == NULL) || (pfds == NULL) || (latency_us == NULL)) {
+		fprintf(stderr, "sossrv_load: out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < num_clients + num_stalled; i++) {
+		int retry, fd;
+		// sossrv opens its listener after connecting to the NIC
+		for (retry = 0; (fd = tcp_connect("127.0.0.1", server_port)) < 0 && retry < 50; retry++) {
+			usleep(100000);
+		}
+		if (fd < 0) {
+			perror("sossrv_load: connect");
+			return -1;
+		}
+		// the stalled clients stay connected until the end
+		if (i >= num_clients) continue;
+		clients[i].fd = fd;
+		pfds[i].fd = fd;
+		pfds[i].events = POLLIN;
+	}
+	// let sossrv accept all the clients before the first message
+	usleep(200000);
+
+	printf("Sending %ld messages to %d clients, %d stalled\n", num_messages, num_clients, num_stalled);
+	start = last = now_ns();
+	pthread_create(&tid, NULL, sender, NULL);
+	expected = (unsigned long)num_clients * num_messages;
+	open_clients = num_clients;
+	while ((total < expected) && (open_clients > 0)) {
+		int n = poll(pfds, num_clients, 100);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("sossrv_load: poll");
+			break;
+		}
+		if (n == 0) {
+			if ((now_ns() - last) / 1000000 > IDLE_TIMEOUT_MS) break;
+			continue;
+		}
+		for (i = 0; i < num_clients; i++) {
+			if (pfds[i].revents == 0) continue;
+			if (client_read(&clients[i]) < 0) {
+				printf("Client %d was closed by sossrv\n", i);
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				open_clients--;
+			}
+		}
+		total = num_latency;
+		last = now_ns();
+	}
+	end = last;
+	// no join: the sender is still blocked if sossrv stopped reading the NIC
+
+	qsort(latency_us, num_latency, sizeof(unsigned int), cmp_uint);
+	printf("clients %d, sent %ld of %ld, received %lu, lost %lu\n",
+				 num_clients, num_sent, num_messages, total, expected - total);
+	printf("%.0f msgs/sec delivered in %.3f s\n",
+				 total / ((end - start) / 1e9), (end - start) / 1e9);
+	if (num_latency > 0) {
+		printf("latency us: p50 %u p99 %u max %u\n",
+					 latency_us[num_latency / 2],
+					 latency_us[(num_latency * 99) / 100],
+					 latency_us[num_latency - 1]);
+	}
+	close(nicfd);
+	return 0;
+}
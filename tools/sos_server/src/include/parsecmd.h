@@ -8,7 +8,8 @@
 #ifndef _PARSECMD_H_
 #define _PARSECMD_H_
 
-int parsecmdline(int argc, char *argv[], int* pServerPort, char** pSerialPort, int* pBaudRate, char** networkPort, int* reducedOutput);
+int parsecmdline(int argc, char *argv[], int* pServerPort, char** pSerialPort, int* pBaudRate, char** networkPort, int* reducedOutput,
+								int* pSendQueueSize, int* pCloseSlow);
 int printuage();
 
 #endif //_PARSECMD_H_
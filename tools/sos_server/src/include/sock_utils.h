@@ -13,5 +13,11 @@ int writen(int fd, void *vptr, int nbytes);
 // This write utility introduces a 1 ms delay between every byte
 // Used in the JTAG mode when the target is slower than normal
 int writeslown(int fd, void *vptr, int nbytes);
+int writeb(int fd, void *symbol, int symbol_len);
+// Writes one byte at a time, with HDLC escape sequences
+int write_string(int fd, void *vptr, int nbytes);
+// Copies nbytes with HDLC escape sequences to dst, which needs room
+// for 2 * nbytes.  Returns the number of bytes in dst
+int hdlc_escape(void *dst, void *src, int nbytes);
 
 #endif //_SOCK_UTILS_H_
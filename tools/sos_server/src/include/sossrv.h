@@ -19,6 +19,7 @@
 #define DEFAULT_SERVER_PORT 7915          //! Server Port
 #define DEFAULT_SERIAL_PORT "/dev/ttyUSB0" //! Serial port of the SOS NIC
 #define DEFAULT_BAUDRATE    57600        //! Baudrate of the SOS NIC
+#define DEFAULT_SENDQ_SIZE  65536        //! Bytes queued for each client
 
 /* enum  */
 /*   { */
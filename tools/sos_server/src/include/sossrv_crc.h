@@ -1,5 +0,0 @@
-
-#ifndef _SOSSRV_CRC_H
-#define _SOSSRV_CRC_H
-unsigned short crcByte(unsigned short oldCrc, unsigned char byte);
-#endif
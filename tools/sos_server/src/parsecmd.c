@@ -13,16 +13,19 @@
 
 //---------------------------------------------------------------------------------
 // COMMAND LINE PARSER
-int parsecmdline(int argc, char *argv[], int* pServerPort, char** pSerialPort, int* pBaudRate, char** networkPort, int *outputOpts)
+int parsecmdline(int argc, char *argv[], int* pServerPort, char** pSerialPort, int* pBaudRate, char** networkPort, int *outputOpts,
+								int* pSendQueueSize, int* pCloseSlow)
 {
   int ch;
   
-  while((ch = getopt(argc, argv, "hqQdp:s:b:n:")) != -1) {
+  while((ch = getopt(argc, argv, "hqQdxp:s:b:n:w:")) != -1) {
     switch(ch) {
     case 'p': (*pServerPort) = (int)atoi(optarg); break;
     case 's': *pSerialPort = optarg; break;
     case 'b': (*pBaudRate) = (int)atoi(optarg); break;
     case 'n': *networkPort = optarg; break;
+    case 'w': (*pSendQueueSize) = (int)atoi(optarg); break;
+    case 'x': (*pCloseSlow) = 1; break;
     case 'Q': if ((*outputOpts <= OUTPUT_DEFAULT) && (*outputOpts > OUTPUT_SILENT)) { *outputOpts = OUTPUT_SILENT; } break;
     case 'q': if ((*outputOpts <= OUTPUT_DEFAULT) && (*outputOpts > OUTPUT_QUIET)) { *outputOpts = OUTPUT_QUIET; } break;
     case 'd': if (*outputOpts < OUTPUT_DEBUG) { *outputOpts = OUTPUT_DEBUG; } break;
@@ -39,7 +42,7 @@ int parsecmdline(int argc, char *argv[], int* pServerPort, char** pSerialPort, i
 int printusage()
 {
   printf("Sossrv Command Line Usage:\n");
-  printf("sossrv [-p <Port>] [-s <COM Port>] [-n <TCP Port>] [-b <baudrate>] [-h]\n");
+  printf("sossrv [-p <Port>] [-s <COM Port>] [-n <TCP Port>] [-b <baudrate>] [-w <bytes>] [-x] [-h]\n");
   printf(" -q              Reduced output (one line headers)\n");
   printf(" -Q              Really quiet, output only on errors\n");
   printf(" -d              Debug, print raw uart streams\n");
@@ -49,6 +52,9 @@ int printusage()
   printf(" -n <TCP Port>  TCP Port can be <IP Addr:Port Num> e.g. 192.69.10.3:6009\n");
   printf(" -b <baudrate>  SOS NIC Baudrate.\n");
   printf("                Default = %d bps\n", DEFAULT_BAUDRATE);
+  printf(" -w <bytes>     Send queue of each client. Messages to a client with a\n");
+  printf("                full queue are dropped. Default = %d\n", DEFAULT_SENDQ_SIZE);
+  printf(" -x             Close clients with a full send queue instead\n");
   printf(" -h             Print this help message\n");
   exit(EXIT_FAILURE);
   return 0;
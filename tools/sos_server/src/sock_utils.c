@@ -173,3 +173,23 @@ int write_string(int fd, void *vptr, int nbytes)
 	return nbytes;
 }
 
+
+
+//------------------------------------------------------------
+// HDLC ESCAPE N BYTES INTO A BUFFER
+int hdlc_escape(void *dst, void *src, int nbytes)
+{
+	unsigned char *out = (unsigned char *)dst;
+	unsigned char *in = (unsigned char *)src;
+	int i;
+
+	for (i = 0; i < nbytes; i++) {
+		if ((in[i] == HDLC_FLAG) || (in[i] == HDLC_CTR_ESC) || (in[i] == HDLC_EXT)) {
+			*out++ = HDLC_CTR_ESC;
+			*out++ = 0x20 ^ in[i];
+		} else {
+			*out++ = in[i];
+		}
+	}
+	return out - (unsigned char *)dst;
+}
@@ -19,8 +19,16 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#define SOSSRV_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <dev_network.h>     // For the TCP connection setup
@@ -29,6 +37,8 @@
 #include <sossrv.h>          // Default value definitions and data types
 #include <sock_utils.h>      // Simple socket utils
 #include <hdlc.h>
+#include <hdlc_deframe.h>    // Bulk HDLC receive
+#include <crc.h>
 // this needs to be consistant with what is in sos_info.h
 //#define UART_MAX_MSG_LEN 0x80
 
@@ -36,18 +46,43 @@
 // MACROS AND DEFINITIONS
 #define LISTENER_BACKLOG 10
 #define	Flip_int16(type)  (((type >> 8) & 0x00ff) | ((type << 8) & 0xff00))
-#undef MAX
-#define MAX(x,y) ((x) > (y) ? (x) : (y))
+
+//-----------------------------------------
+// CLIENTS
+// Every client has a bounded send queue, so that a slow client only
+// loses its own messages instead of stalling the serial link
+#define CLIENT_RX_SIZE   (4 * (SOS_MSG_HEADER_SIZE + 256))
+#define MAX_EVENTS       64
+//! largest HDLC frame: flag, protocol, escaped message and crc, flag
+#define SERIAL_TX_FRAME_SIZE  (4 + 2 * (SOS_MSG_HEADER_SIZE + 256 + 2))
+//! largest unescaped frame: protocol, message and crc
+#define SERIAL_RX_FRAME_SIZE  (1 + SOS_MSG_HEADER_SIZE + 256 + 2)
+
+typedef struct {
+	int fd;
+	int index;                      //! position in client_list
+	unsigned char *txbuf;           //! send ring of sendq_size bytes
+	int txhead;                     //! first byte of the ring to send
+	int txlen;                      //! number of bytes in the ring
+	unsigned char rxbuf[CLIENT_RX_SIZE];
+	int rxlen;
+	unsigned long drops;            //! messages dropped for a full ring
+} client_t;
+
+static void client_close(client_t *c);
 
 //-----------------------------------------
 // LOCAL FUNCTION PROTOTYPES
 static int printsosmsg(SOS_Message_t* psosmsg, unsigned short crc, char *header);
 static int printrawmsg(unsigned char *buff, int len, char *header);
 static int serial_pkt_handler();
-static int network_pkt_handler();
+static int network_pkt_handler(client_t *c);
 static int dispatch_sos_message(SOS_Message_t* psosmsg);
+static int serial_send_msg(SOS_Message_t* psosmsg);
+static void accept_clients();
+static void client_send(client_t *c, unsigned char *buf, int len);
+static void client_flush(client_t *c);
 static unsigned short computeMsgCRC(unsigned char protocol, SOS_Message_t* psosmsg);
-static unsigned short crcByte(unsigned short crc, unsigned char b);
 
 
 //-----------------------------------------
@@ -62,14 +97,14 @@ int serial_baudrate;            //! Baudrate of the serial device
 
 char* network_port;             //! TCP connection to ethernet if any
 
-fd_set master_fds;              //! Master file descriptor list
-fd_set read_fds;                //! Temp file descriptor list for select()  
-int fdmax;                      //! Maximum file descriptor number
-int curr_sock_fd;               //! The current socket descriptor
-
-int newfd;                      //! Newly accept()ed socket descriptor
-struct sockaddr_in remoteaddr;  //! Client address
-int addrlen;                    //! 
+static client_t **clients;      //! Clients by file descriptor
+static int clients_size;
+static client_t **client_list;  //! Connected clients
+static int num_clients;
+static int sendq_size = DEFAULT_SENDQ_SIZE; //! Bytes in each client send queue
+static int close_slow = 0;      //! Close a client with a full queue instead of dropping
+static unsigned char serial_rx_frame[SERIAL_RX_FRAME_SIZE];
+static hdlc_rx_t serial_rx;     //! Deframer for the serial link
 
 int outputOpts = OUTPUT_DEFAULT;
 
@@ -88,11 +123,138 @@ void sig_handler(int sig)
 }
 
 
+//-----------------------------------------------------------------------------
+// EVENT NOTIFICATION
+// epoll where it exists, poll() everywhere else
+enum {
+	EV_READ  = 0x01,
+	EV_WRITE = 0x02,
+};
+
+typedef struct {
+	int fd;
+	int events;
+} sossrv_event_t;
+
+#ifdef SOSSRV_EPOLL
+static int epollfd;
+
+static int ev_init()
+{
+	epollfd = epoll_create(MAX_EVENTS);
+	return epollfd;
+}
+
+static int ev_ctl(int op, int fd, int events)
+{
+	struct epoll_event e;
+
+	memset(&e, 0, sizeof(e));
+	e.events = ((events & EV_READ) ? EPOLLIN : 0) | ((events & EV_WRITE) ? EPOLLOUT : 0);
+	e.data.fd = fd;
+	return epoll_ctl(epollfd, op, fd, &e);
+}
+
+#define ev_add(fd, events) ev_ctl(EPOLL_CTL_ADD, fd, events)
+#define ev_mod(fd, events) ev_ctl(EPOLL_CTL_MOD, fd, events)
+#define ev_del(fd)         ev_ctl(EPOLL_CTL_DEL, fd, 0)
+
+static int ev_wait(sossrv_event_t *ev, int max)
+{
+	struct epoll_event e[MAX_EVENTS];
+	int i, n;
+
+	n = epoll_wait(epollfd, e, (max < MAX_EVENTS) ? max : MAX_EVENTS, -1);
+	for (i = 0; i < n; i++) {
+		ev[i].fd = e[i].data.fd;
+		// errors and hang ups are found by the next read
+		ev[i].events = ((e[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ? EV_READ : 0) |
+			((e[i].events & EPOLLOUT) ? EV_WRITE : 0);
+	}
+	return n;
+}
+#else
+static struct pollfd *pollfds;
+static int num_pollfds;
+static int pollfds_size;
+
+static int ev_init()
+{
+	return 0;
+}
+
+static int ev_find(int fd)
+{
+	int i;
+	for (i = 0; i < num_pollfds; i++) {
+		if (pollfds[i].fd == fd) return i;
+	}
+	return -1;
+}
+
+static int ev_mod(int fd, int events)
+{
+	int i = ev_find(fd);
+	if (i < 0) return -1;
+	pollfds[i].events = ((events & EV_READ) ? POLLIN : 0) | ((events & EV_WRITE) ? POLLOUT : 0);
+	return 0;
+}
+
+static int ev_add(int fd, int events)
+{
+	if (num_pollfds == pollfds_size) {
+		int size = (pollfds_size == 0) ? 16 : pollfds_size * 2;
+		struct pollfd *p = realloc(pollfds, size * sizeof(struct pollfd));
+		if (p == NULL) return -1;
+		pollfds = p;
+		pollfds_size = size;
+	}
+	pollfds[num_pollfds].fd = fd;
+	pollfds[num_pollfds].revents = 0;
+	num_pollfds++;
+	return ev_mod(fd, events);
+}
+
+static int ev_del(int fd)
+{
+	int i = ev_find(fd);
+	if (i < 0) return -1;
+	pollfds[i] = pollfds[--num_pollfds];
+	return 0;
+}
+
+static int ev_wait(sossrv_event_t *ev, int max)
+{
+	int i, n = 0;
+
+	if (poll(pollfds, num_pollfds, -1) < 0) return -1;
+	for (i = 0; i < num_pollfds && n < max; i++) {
+		if (pollfds[i].revents == 0) continue;
+		ev[n].fd = pollfds[i].fd;
+		ev[n].events = ((pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)) ? EV_READ : 0) |
+			((pollfds[i].revents & POLLOUT) ? EV_WRITE : 0);
+		n++;
+	}
+	return n;
+}
+#endif
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
 //-----------------------------------------------------------------------------
 // MAIN
 int main(int argc, char *argv[])
 {
   int yes = 1;                      //! For setsockopt() SO_REUSEADDR
+	sossrv_event_t events[MAX_EVENTS];
+	int numevents;
+	int i;
 
 	if(signal(SIGTERM, sig_handler) == SIG_ERR){
 		fprintf(stderr, "ignore SIGTERM failed\n");
@@ -104,14 +266,24 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	// A client that goes away is found by the failing write
+	if(signal(SIGPIPE, SIG_IGN) == SIG_ERR){
+		fprintf(stderr, "ignore SIGPIPE failed\n");
+		exit(1);
+	}
+
   //--------------------------------------------------------------------------
   // INITIALIZE THE VARIABLES
   server_port = DEFAULT_SERVER_PORT;
   serial_device = DEFAULT_SERIAL_PORT;
   serial_baudrate = DEFAULT_BAUDRATE;
   network_port = NULL;
-  parsecmdline(argc, argv, &server_port, &serial_device, &serial_baudrate, &network_port, &outputOpts);
+  parsecmdline(argc, argv, &server_port, &serial_device, &serial_baudrate, &network_port, &outputOpts,
+							 &sendq_size, &close_slow);
   printf("SOSSRV PARAMETERS:\n");
+	if (sendq_size < SERIAL_TX_FRAME_SIZE) {
+		sendq_size = SERIAL_TX_FRAME_SIZE;
+	}
     
   //--------------------------------------------------------------------------
   // SETUP SERIAL CONNECTION
@@ -120,6 +292,7 @@ int main(int argc, char *argv[])
   } else {
     open_serial_device(serial_device, serial_baudrate, &serialfd);
   }
+  hdlc_rx_init(&serial_rx, serial_rx_frame, sizeof(serial_rx_frame));
   //DEBUG("Connection to sensor network established\n");
   
   //--------------------------------------------------------------------------
@@ -157,306 +330,278 @@ int main(int argc, char *argv[])
     perror("open_listener_sock: listen");
     exit(EXIT_FAILURE);
   }
+	set_nonblocking(listenerfd);
   
   //--------------------------------------------------------------------------
   // MAIN EVENT LOOP
-  FD_ZERO(&master_fds);             //! Clear the Master file descriptor list
-  FD_ZERO(&read_fds);               //! Clear the Temp file descriptor list
-  FD_SET(listenerfd, &master_fds);  //! Set the server listener fd
-  FD_SET(serialfd, &master_fds);    //! Set the serial listener fd
-  
-  //! Track the largest file descriptor in the set
-  fdmax = MAX(serialfd, listenerfd);
+	if ((ev_init() < 0) || (ev_add(listenerfd, EV_READ) < 0) || (ev_add(serialfd, EV_READ) < 0)) {
+		perror("Sossrv: event setup");
+		exit(EXIT_FAILURE);
+	}
   
   // Main Dispatcher Loop
   printf("Starting sossrv on port %d\n", server_port);  
   printf("Server started ...\n");
   for(;;) {
-    read_fds = master_fds; //! Copy the master file descriptor
-    if (select(fdmax+1, &read_fds, NULL, NULL, NULL) == -1) {
-      perror("select");
-      exit(EXIT_FAILURE);
-    }
-    
-    // run through the existing connections looking for data to read
-    for(curr_sock_fd = 0; curr_sock_fd <= fdmax; curr_sock_fd++) {
-      if (FD_ISSET(curr_sock_fd, &read_fds)){
-	//DEBUG("Event on fd %d\n", curr_sock_fd);
-	// Event on listener port
-	if (curr_sock_fd == listenerfd) {
-	  // Handle new connections
-	  addrlen = sizeof(remoteaddr);
-	  if ((newfd = accept(listenerfd, (struct sockaddr *)&remoteaddr, (socklen_t *)&addrlen)) == -1)
-	    perror("Sossrv: accept");
-	  else {
-	    FD_SET(newfd, &master_fds); // add to master set
-	    fdmax = MAX(fdmax, newfd);
-	    printf("Sossrv: Established new connection from %s on socket %d\n", inet_ntoa(remoteaddr.sin_addr), newfd);
-	  }
-	}
-	
-	// Event on serial port
-	else if (curr_sock_fd == serialfd)
-	  serial_pkt_handler();
-	
-	// Event on the other port
-	else
-	  network_pkt_handler();
-      }
-    }
+		numevents = ev_wait(events, MAX_EVENTS);
+		if (numevents < 0) {
+			if (errno == EINTR) continue;
+			perror("Sossrv: wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < numevents; i++) {
+			int fd = events[i].fd;
+			client_t *c;
+
+			// Event on listener port
+			if (fd == listenerfd) {
+				accept_clients();
+				continue;
+			}
+			// Event on serial port
+			if (fd == serialfd) {
+				serial_pkt_handler();
+				continue;
+			}
+			// Event on a client, which may have been closed by an earlier event
+			c = (fd < clients_size) ? clients[fd] : NULL;
+			if (c == NULL) continue;
+			if (events[i].events & EV_READ) {
+				if (network_pkt_handler(c) < 0) continue;
+			}
+			if (events[i].events & EV_WRITE) {
+				client_flush(c);
+			}
+		}
   }
   return 0;
 }
 
 
 //---------------------------------------------------------------------------------
-// SERIAL PACKET HANDLER
-enum {
-	SERIAL_RX_HDLC_START=0,	//! Starting a new connection
-	SERIAL_RX_HDLC_RESTART,	//! Allow for repeated start symbols
-	SERIAL_RX_HEADER,		//! Receive the SOS Message Header
-	SERIAL_RX_DATA,		//! Receive the SOS Message Data
-	SERIAL_RX_ESCAPE, //! Recieved HDLC Escape sequence
-	SERIAL_RX_WAIT,		//! Waiting for data or start symbol
-};
+// CLIENT CONNECTIONS
+static void accept_clients()
+{
+	struct sockaddr_in remoteaddr;  //! Client address
+	socklen_t addrlen;
+	client_t *c;
+	int newfd;
+
+	for (;;) {
+		addrlen = sizeof(remoteaddr);
+		if ((newfd = accept(listenerfd, (struct sockaddr *)&remoteaddr, &addrlen)) == -1) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+				perror("Sossrv: accept");
+			}
+			return;
+		}
+		if (newfd >= clients_size) {
+			int size = (newfd + 1) * 2;
+			client_t **new_clients = realloc(clients, size * sizeof(client_t*));
+			client_t **new_list;
+
+			// the old arrays stay valid until both grew
+			if (new_clients != NULL) {
+				clients = new_clients;
+				memset(clients + clients_size, 0, (size - clients_size) * sizeof(client_t*));
+			}
+			new_list = realloc(client_list, size * sizeof(client_t*));
+			if (new_list != NULL) {
+				client_list = new_list;
+			}
+			if ((new_clients == NULL) || (new_list == NULL)) {
+				fprintf(stderr, "Sossrv: out of memory, refusing socket %d\n", newfd);
+				close(newfd);
+				continue;
+			}
+			clients_size = size;
+		}
+		c = calloc(1, sizeof(client_t));
+		if (c != NULL) {
+			c->txbuf = malloc(sendq_size);
+		}
+		if ((c == NULL) || (c->txbuf == NULL)) {
+			fprintf(stderr, "Sossrv: out of memory, refusing socket %d\n", newfd);
+			free(c);
+			close(newfd);
+			continue;
+		}
+		set_nonblocking(newfd);
+		c->fd = newfd;
+		c->index = num_clients;
+		clients[newfd] = c;
+		client_list[num_clients++] = c;
+		ev_add(newfd, EV_READ);
+		printf("Sossrv: Established new connection from %s on socket %d\n", inet_ntoa(remoteaddr.sin_addr), newfd);
+	}
+}
+
+static void client_close(client_t *c)
+{
+	if (c->drops > 0) {
+		printf("Sossrv: Socket %d dropped %lu messages\n", c->fd, c->drops);
+	}
+	ev_del(c->fd);
+	close(c->fd);
+	clients[c->fd] = NULL;
+	client_list[c->index] = client_list[--num_clients];
+	client_list[c->index]->index = c->index;
+	free(c->txbuf);
+	free(c);
+}
 
-void serial_byte_handler(unsigned char byte);
+/**
+ * Queue bytes to a client and send what the socket takes right away.
+ * A message that does not fit in the queue is dropped, or the client is
+ * closed with -x.  Messages are never cut, because the first bytes of a
+ * message are only written directly when the queue is empty.
+ */
+static void client_send(client_t *c, unsigned char *buf, int len)
+{
+	int sent = 0;
+	int tail, chunk;
+
+	if (c->txlen == 0) {
+		sent = write(c->fd, buf, len);
+		if (sent < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+				perror("Sossrv: Send");
+				client_close(c);
+				return;
+			}
+			sent = 0;
+		}
+		if (sent == len) return;
+	}
+	if (c->txlen + len - sent > sendq_size) {
+		if (close_slow) {
+			printf("Sossrv: Socket %d is too slow, closing it\n", c->fd);
+			client_close(c);
+			return;
+		}
+		if ((c->drops++ % 1000) == 0 && (outputOpts >= OUTPUT_QUIET)) {
+			printf("Sossrv: Socket %d is too slow, dropping messages\n", c->fd);
+		}
+		return;
+	}
+	if (c->txlen == 0) {
+		ev_mod(c->fd, EV_READ | EV_WRITE);
+	}
+	buf += sent;
+	len -= sent;
+	tail = (c->txhead + c->txlen) % sendq_size;
+	chunk = (len < sendq_size - tail) ? len : sendq_size - tail;
+	memcpy(c->txbuf + tail, buf, chunk);
+	memcpy(c->txbuf, buf + chunk, len - chunk);
+	c->txlen += len;
+}
 
-int serial_pkt_handler()
+//! send the queue of a client until the socket is full
+static void client_flush(client_t *c)
 {
-	//unsigned char data[255];
-	//int n = read(serialfd, data, 255);
-	unsigned char data[1024];
-	int i = 0;
-	int n = read(serialfd, data, 1024);
-
-	while (i<n) {
-		if (outputOpts >= OUTPUT_DEBUG) {
-			DEBUG("RX 0x%02X : ", data[i]);
+	int n, chunk;
+
+	while (c->txlen > 0) {
+		chunk = (c->txlen < sendq_size - c->txhead) ? c->txlen : sendq_size - c->txhead;
+		n = write(c->fd, c->txbuf + c->txhead, chunk);
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return;
+			perror("Sossrv: Send");
+			client_close(c);
+			return;
 		}
-		serial_byte_handler(data[i]);
-		i++;
+		c->txhead = (c->txhead + n) % sendq_size;
+		c->txlen -= n;
+		if (n < chunk) return;
 	}
+	c->txhead = 0;
+	ev_mod(c->fd, EV_READ);
 }
 
-void serial_byte_handler(unsigned char rxbyte)
+
+//---------------------------------------------------------------------------------
+// SERIAL PACKET HANDLER
+// The whole read() goes through the bulk deframer, which hands back one
+// unescaped frame at a time: protocol byte, message, crc low, crc high
+
+static void serial_frame_handler(void *arg, uint8_t *frame, uint16_t len)
 {
-	int numrecv;
-	static unsigned char serial_rx_state = SERIAL_RX_WAIT;
-	static unsigned char serial_hdlc_state = HDLC_IDLE;
-	static unsigned char saved_state = HDLC_IDLE;
-	static unsigned char protocol = HDLC_SOS_MSG;
-	
 	static SOS_Message_t serialrxsosmsg;
-	static unsigned char* pserialrx;
-	static unsigned char* rx_buff = serialrxsosmsg.data;
-	static unsigned char rx_len = 0;
-	static int numserialrxbytes;
-	static unsigned short rxCRCval;
-
+	unsigned short rxCRCval;
 	unsigned short computeCRCval;
+	int msglen;
 
-
-	switch (serial_rx_state) {
-		case SERIAL_RX_HDLC_START:
+	switch (frame[0]) {
+		case HDLC_SOS_MSG:
 			{
-				if (rxbyte != HDLC_FLAG) {
+				if (len < 1 + SOS_MSG_HEADER_SIZE + 2) {
 					if (outputOpts >= OUTPUT_DEBUG) {
-						DEBUG("HCLC FLAG byte\n");
+						DEBUG("short frame of %d bytes\n", len);
 					}
 					break;
 				}
-			}
-			
-		case SERIAL_RX_WAIT:
-		case SERIAL_RX_HDLC_RESTART:
-			{
-				if (rxbyte == HDLC_FLAG) {
-					if (outputOpts >= OUTPUT_DEBUG) {
-						DEBUG("HCLC FLAG byte\n");
-					}
-					serial_rx_state = SERIAL_RX_HDLC_RESTART;
-					break;
+				msglen = len - 1 - 2;
+				if (msglen > SOS_MSG_HEADER_SIZE + 255) {
+					msglen = SOS_MSG_HEADER_SIZE + 255;
 				}
-
-				numserialrxbytes = 0;
-				serial_hdlc_state = HDLC_DATA;
-				protocol = rxbyte;
-
-				switch (protocol) {
-					case HDLC_SOS_MSG:
-						{
-							pserialrx = (unsigned char*)(&serialrxsosmsg);
-							serial_rx_state = SERIAL_RX_HEADER;
-							if (outputOpts >= OUTPUT_DEBUG) {
-								DEBUG("protocol HDLC_SOS_MSG\n");
-							}
-							rx_len = 0;
-							break;
-						}
-					case HDLC_RAW:
-						{
-							pserialrx = rx_buff;
-							if (pserialrx == NULL) {
-								printf("No free space to store incomming message.  Dropping!\n");
-								serial_rx_state = SERIAL_RX_WAIT;
-							} else {
-								if (outputOpts >= OUTPUT_DEBUG) {
-									DEBUG("protocol HDLC_RAW\n");
-								}
-								serial_rx_state = SERIAL_RX_DATA;
-								rx_len = UART_MAX_MSG_LEN;
-							}
-							break;
-						}
-					default:
-						{
-							serial_rx_state = SERIAL_RX_WAIT;
-							break;
+				memcpy(&serialrxsosmsg, frame + 1, msglen);
+				rxCRCval = frame[len - 2] | (frame[len - 1] << 8);
+				computeCRCval = crcBytes(0, frame, len - 2);
+				if ((msglen == SOS_MSG_HEADER_SIZE + serialrxsosmsg.len) && (computeCRCval == rxCRCval)) {
+					if (outputOpts >= OUTPUT_QUIET) {
+						printsosmsg(&serialrxsosmsg, rxCRCval, "Received from Serial, CRC OK!");
+					}
+					dispatch_sos_message(&serialrxsosmsg);
+				} else {
+					if (outputOpts >= OUTPUT_QUIET) {
+						printsosmsg(&serialrxsosmsg, rxCRCval, "Received from Serial, CRC FAIL!");
+						if (outputOpts >= OUTPUT_DEBUG) {
+							DEBUG("CRC: recieved = 0x%04X, packet computed = 0x%04X\n", rxCRCval, computeCRCval);
 						}
-				}
-				break;
-			}
-		case SERIAL_RX_HEADER:
-			{
-				if (rxbyte == HDLC_CTR_ESC) {
-					saved_state = serial_hdlc_state;
-					serial_hdlc_state = HDLC_ESCAPE;
-					if (outputOpts >= OUTPUT_DEBUG) {
-						DEBUG("ESC byte\n");
 					}
-					return;
-				}
-
-				if (serial_hdlc_state == HDLC_ESCAPE) {
-					rxbyte ^= 0x20;
-					serial_hdlc_state = saved_state;
-				}
-
-				if (outputOpts >= OUTPUT_DEBUG) {
-					DEBUG("data byte 0x%02X\n", rxbyte);
-				}
-
-				pserialrx[numserialrxbytes++] = rxbyte;
-
-				if (numserialrxbytes == SOS_MSG_HEADER_SIZE) {
-					numserialrxbytes = 0;
-					serial_rx_state = SERIAL_RX_DATA;
-					pserialrx = rx_buff;
-					rx_len = serialrxsosmsg.len;
-					//DEBUG("recv header of length %d: expecting message of len = %d\n", SOS_MSG_HEADER_SIZE, serialrxsosmsg.len);
 				}
 				break;
 			}
-		case SERIAL_RX_DATA:
+		case HDLC_RAW:
 			{
-				switch (rxbyte) {
-					case HDLC_FLAG:
-						{
-							if (outputOpts >= OUTPUT_DEBUG) {
-								DEBUG("HCLC FLAG byte\n");
-							}
-							if (protocol == HDLC_SOS_MSG) {
-								computeCRCval = computeMsgCRC(protocol, &serialrxsosmsg);
-								if ((serial_hdlc_state == HDLC_PADDING) && (computeCRCval == rxCRCval)) {
-									if (outputOpts >= OUTPUT_QUIET) {
-										printsosmsg(&serialrxsosmsg, rxCRCval, "Received from Serial, CRC OK!");
-									}
-									dispatch_sos_message(&serialrxsosmsg);
-								} else {
-									if (outputOpts >= OUTPUT_QUIET) {
-										printsosmsg(&serialrxsosmsg, rxCRCval, "Received from Serial, CRC FAIL!");
-										if (outputOpts >= OUTPUT_DEBUG) {
-											DEBUG("CRC: recieved = 0x%04X, packet computed = 0x%04X\n", rxCRCval, computeCRCval);
-										}
-									}
-								}
-							} else {
-								// dispatch to raw handler
-								if (outputOpts >= OUTPUT_QUIET) {
-									printrawmsg(serialrxsosmsg.data, numserialrxbytes, "Recieved from Serial, RAW Mode!");
-								}
-							}
-							serial_rx_state = SERIAL_RX_WAIT;
-							serial_hdlc_state = HDLC_IDLE;
-							break;
-						}
-					case HDLC_CTR_ESC:
-						{
-							saved_state = serial_hdlc_state;  //! may need to escape a crc byte
-							serial_hdlc_state = HDLC_ESCAPE;
-							if (outputOpts >= OUTPUT_DEBUG) {
-								DEBUG("ESC byte\n");
-							}
-							break;
-						}
-						/* not a Flag Sequence or Escape Sequence handle based on HDLC state */
-					default:
-						{
-							if (serial_hdlc_state == HDLC_ESCAPE) {
-								rxbyte ^= 0x20;
-								serial_hdlc_state = saved_state;
-							}
-
-							switch (serial_hdlc_state) {
-								case HDLC_DATA:
-									{
-										if (numserialrxbytes < rx_len) {
-											if (outputOpts >= OUTPUT_DEBUG) {
-												DEBUG("data byte 0x%02X\n", rxbyte);
-											}
-											pserialrx[numserialrxbytes++] = rxbyte;
-										} else {
-											if (outputOpts >= OUTPUT_DEBUG) {
-												DEBUG("crc low 0x%02X\n", rxbyte);
-											}
-											rxCRCval = (unsigned short)(rxbyte);
-											serial_hdlc_state = HDLC_CRC;
-										}
-										break;
-									}
-								case HDLC_CRC:
-									{
-										if (outputOpts >= OUTPUT_DEBUG) {
-											DEBUG("crc high 0x%02X\n", rxbyte);
-										}
-										rxCRCval = (0xff00&(((unsigned short)(rxbyte))<<8)) + rxCRCval;
-										serial_hdlc_state = HDLC_PADDING;
-										break;
-									}
-								default: // what are we doing here??
-									{ // start looking for the next start symbol
-										serial_rx_state = SERIAL_RX_HDLC_START;
-										serial_hdlc_state = HDLC_IDLE;
-									}
-							}
-						}
+				// dispatch to raw handler
+				if (outputOpts >= OUTPUT_QUIET) {
+					printrawmsg(frame + 1, (len - 1 < UART_MAX_MSG_LEN) ? len - 1 : UART_MAX_MSG_LEN,
+							"Recieved from Serial, RAW Mode!");
 				}
+				break;
 			}
+		default:
+			break;
 	}
 }
 
+int serial_pkt_handler()
+{
+	unsigned char data[4096];
+	int n = read(serialfd, data, sizeof(data));
+
+	if (n <= 0) {
+		return n;
+	}
+	if (outputOpts >= OUTPUT_DEBUG) {
+		printrawmsg(data, n, "RX");
+	}
+	hdlc_deframe(&serial_rx, data, n, serial_frame_handler, NULL);
+	return n;
+}
+
 
 //---------------------------------------------------------------------------------
 // SERIAL RX PACKET DISPATCHER
 int dispatch_sos_message(SOS_Message_t* psosmsg)
 {
 	int i;
-	int netwrbytes;
-	for (i = 0; i <= fdmax; i++){
-		if (FD_ISSET(i, &master_fds) && (i != serialfd) && (i != listenerfd)){
-			netwrbytes = writen(i, psosmsg, psosmsg->len + SOS_MSG_HEADER_SIZE);
-			if ((netwrbytes < 0) || (netwrbytes < (psosmsg->len + SOS_MSG_HEADER_SIZE))){
-				if (netwrbytes < 0){
-					perror("Sossrv: Send");
-				}
-				else{
-					printf("Sossrv: Socket %d hung up\n", i);
-				}
-				close(i);
-				FD_CLR(i, &master_fds);
-			}
-		}
+
+	// client_send() may close a client, which moves the last one to its place
+	for (i = num_clients - 1; i >= 0; i--) {
+		client_send(client_list[i], (unsigned char*)psosmsg, psosmsg->len + SOS_MSG_HEADER_SIZE);
 	}
 	return 0;
 }
@@ -464,91 +609,80 @@ int dispatch_sos_message(SOS_Message_t* psosmsg)
 
 //---------------------------------------------------------------------------------
 // NETWORK PACKET HANDLER
-int network_pkt_handler()
+// Returns -1 if the client was closed
+int network_pkt_handler(client_t *c)
 {
-  //unsigned char netrxbuf[256];    //! Buffer for data received over the network
-  unsigned char netrxbuf[1024];    //! Buffer for data received over the network
   int netrxbytes;                 //! Number of bytes received over the network
   SOS_Message_t* psosmsg;         //! SOS SOS_Message_t Pointer
-	static unsigned char frameByte = HDLC_FLAG;
-	static unsigned char protocolByte = HDLC_SOS_MSG;
-  unsigned short txbuffCRC;       //! CRC of the outgoing message
-  unsigned char txCRC[2];        //! CRC Bytes (To take care of endianness)
-	
-  // We first read the message header
-  netrxbytes = readn(curr_sock_fd, netrxbuf, SOS_MSG_HEADER_SIZE);
-	if ((netrxbytes < 0) || (netrxbytes < SOS_MSG_HEADER_SIZE)) {
+	int used = 0;
+
+	netrxbytes = read(c->fd, c->rxbuf + c->rxlen, CLIENT_RX_SIZE - c->rxlen);
+	if (netrxbytes <= 0) {
+		if ((netrxbytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+			return 0;
 		// Connection closed by client
 		if (netrxbytes < 0)
 			perror("Sossrv: Receive");
 		else
-			printf("Sossrv: Socket %d hung up\n", curr_sock_fd);
-		close(curr_sock_fd);
-		FD_CLR(curr_sock_fd, &master_fds);
+			printf("Sossrv: Socket %d hung up\n", c->fd);
+		client_close(c);
 		return -1;
-	} else {
-		psosmsg = (SOS_Message_t*)netrxbuf;
-		if (psosmsg->len > 0){
-			netrxbytes = readn(curr_sock_fd, &psosmsg->data[0], psosmsg->len);
-			if ((netrxbytes < 0) || (netrxbytes < psosmsg->len)){
-				if (netrxbytes < 0)
-					perror("Sossrv: Receive");
-				else
-					printf("Sossrv: Socket %d hung up\n", curr_sock_fd);
-				close(curr_sock_fd);
-				FD_CLR(curr_sock_fd, &master_fds);
-				return -1;
-			}
-		}
-		//DEBUG("Received a send message packet\n");
-		txbuffCRC = computeMsgCRC(protocolByte, psosmsg);
-		txCRC[0] = (unsigned char) txbuffCRC;
-		txCRC[1] = (unsigned char)(txbuffCRC >> 8);
-
-		printsosmsg(psosmsg, txbuffCRC, "Received from Desktop");
-
-		// Can block -- Its a slow serial link
-		writeb(serialfd, &frameByte, 1);
-		// for now we will only support transmiting of sos_msgs
-		writeb(serialfd, &protocolByte, 1);
-		write_string(serialfd, psosmsg, SOS_MSG_HEADER_SIZE + psosmsg->len);
-		write_string(serialfd, &txCRC, 2);
-		writeb(serialfd, &frameByte, 1);
+	}
+	c->rxlen += netrxbytes;
 
+	// Send every complete message, keep the rest for the next read
+	while (c->rxlen - used >= SOS_MSG_HEADER_SIZE) {
+		psosmsg = (SOS_Message_t*)(c->rxbuf + used);
+		if (c->rxlen - used < SOS_MSG_HEADER_SIZE + psosmsg->len) break;
+		//DEBUG("Received a send message packet\n");
+		serial_send_msg(psosmsg);
+		used += SOS_MSG_HEADER_SIZE + psosmsg->len;
+	}
+	if (used > 0) {
+		memmove(c->rxbuf, c->rxbuf + used, c->rxlen - used);
+		c->rxlen -= used;
 	}
+	return 0;
 }
 
 
-unsigned short computeMsgCRC(unsigned char protocol, SOS_Message_t* psosmsg)
+//---------------------------------------------------------------------------------
+// SERIAL TX
+// The whole HDLC frame is built first and written at once
+int serial_send_msg(SOS_Message_t* psosmsg)
 {
-  unsigned char i;
-  unsigned char* txbuffptr;
+	unsigned char frame[SERIAL_TX_FRAME_SIZE];
+  unsigned short txbuffCRC;       //! CRC of the outgoing message
+  unsigned char txCRC[2];        //! CRC Bytes (To take care of endianness)
+	int len = 0;
 
-  unsigned short runningCRC = crcByte(0, protocol);
+	txbuffCRC = computeMsgCRC(HDLC_SOS_MSG, psosmsg);
+	txCRC[0] = (unsigned char) txbuffCRC;
+	txCRC[1] = (unsigned char)(txbuffCRC >> 8);
 
-  txbuffptr = (unsigned char*) psosmsg;
-  for (i = 0; i < SOS_MSG_HEADER_SIZE; i++)
-    runningCRC = crcByte(runningCRC, txbuffptr[i]);
-  
-  for (i = 0; i < psosmsg->len; i++)
-    runningCRC = crcByte(runningCRC, psosmsg->data[i]);
-  
-  return runningCRC;
+	printsosmsg(psosmsg, txbuffCRC, "Received from Desktop");
+
+	frame[len++] = HDLC_FLAG;
+	// for now we will only support transmiting of sos_msgs
+	frame[len++] = HDLC_SOS_MSG;
+	len += hdlc_escape(frame + len, psosmsg, SOS_MSG_HEADER_SIZE + psosmsg->len);
+	len += hdlc_escape(frame + len, txCRC, 2);
+	frame[len++] = HDLC_FLAG;
+
+	// Can block -- Its a slow serial link
+	if (writen(serialfd, frame, len) < 0) {
+		perror("Sossrv: Serial send");
+		return -1;
+	}
+	return 0;
 }
 
 
-unsigned short crcByte(unsigned short crc, unsigned char b)
+unsigned short computeMsgCRC(unsigned char protocol, SOS_Message_t* psosmsg)
 {
-  unsigned char i;
-  crc = crc ^ b << 8;
-  i = 8;
-  do
-    if (crc & 0x8000)
-      crc = crc << 1 ^ 0x1021;
-    else
-      crc = crc << 1;
-  while (--i);
-  return crc;
+  // the header and the payload are contiguous in SOS_Message_t
+  return crcBytes(crcByte(0, protocol), (unsigned char*)psosmsg,
+                  SOS_MSG_HEADER_SIZE + psosmsg->len);
 }
 
 
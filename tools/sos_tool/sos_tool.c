@@ -20,9 +20,10 @@ static void tool_help(void);
 static void tool_ldmod(char *optarg);
 static void tool_lddata(char *optarg);
 static void tool_send_message(char *optarg);
+static void tool_update(char *optarg);
 
 enum {INSMOD_OPT=1,RMMOD_OPT,LSMOD_OPT,SEND_MESSAGE_OPT,
-      HELP_OPT,LDDATA_OPT,RMDATA_OPT,LSDATA_OPT,LDMOD_OPT};
+      HELP_OPT,LDDATA_OPT,RMDATA_OPT,LSDATA_OPT,LDMOD_OPT,UPDATE_OPT};
 static struct option long_options[] = {
     {"insmod", required_argument, NULL, INSMOD_OPT},
     {"rmmod", required_argument, NULL, RMMOD_OPT},
@@ -33,6 +34,7 @@ static struct option long_options[] = {
     {"rmdata", required_argument, NULL, RMDATA_OPT},
     {"lsdata", no_argument, NULL, LSDATA_OPT},
     {"ldmod",required_argument, NULL, LDMOD_OPT},
+    {"update",required_argument, NULL, UPDATE_OPT},
     {NULL, 0, NULL, 0},
 };
 
@@ -61,6 +63,15 @@ static void tool_ldmod(char *optarg)
     }
 }
 
+static void tool_update(char *optarg)
+{
+    int ret;
+    ret = post_long(KER_DFT_LOADER_PID, NULL_PID, MSG_LOADER_UPDATE, strlen(optarg), optarg, 0);
+    if(ret < 0){
+        tool_error("tool_update(%s) failed\n",optarg);
+    }
+}
+
 static void tool_lddata(char *optarg)
 {
     int ret;
@@ -119,6 +130,8 @@ static void tool_help(void)
     printf("[%s] are the sos_emu_short_opts.  sos_tool -h for more info.\n",sos_emu_short_opts);
     printf("sos_tool long options:\n");
     printf("\tinsmod=<module.mlf>: Install a module with the filename <module.mlf>\n");
+    printf("\tupdate=<module.mlf>[,<old.mlf>]: Replace the installed module with the same code_id,\n");
+    printf("\t  sending only the changes against <old.mlf> when built with LOADER_IMAGE=packed\n");
     printf("\tsend_message=<message>: Send a network message <message>\n");
     printf("\t  <message> format: did sid daddr saddr type argc 0xbe 0xef ...\n");
     printf("\trmmod=<code_id>: Remove a module image with <code_id>, note code_id = 0 removes all modules on network\n");
@@ -150,6 +163,9 @@ void sos_start(void)
         case LDMOD_OPT:
             tool_ldmod(optarg);
             return;
+        case UPDATE_OPT:
+            tool_update(optarg);
+            return;
         case SEND_MESSAGE_OPT:
             tool_send_message(optarg);
             sleep(1);